@@ -0,0 +1,645 @@
+/**
+ * \file
+ *
+ * \brief Benchmark of the decoding stages
+ *
+ * Reads raw captchas (IMG_WIDTH * IMG_HEIGHT 8-bit pixels per image, one
+ * image after the other) and measures each stage, image by image and
+ * in batch mode. Batch results are checked against image by image ones.
+ *
+ * With -t, spans of each stage and image are written as a Chrome trace
+ * (open it in Perfetto) to look at slow images rather than averages.
+ * With -c, hardware counters (cycles, instructions, cache and branch
+ * misses) are measured around each stage and reported per image.
+ * With -g, features and classification are measured again with a glyph
+ * cache, and answers are compared to the ones without cache.
+ * With -M, classification is also measured with a mapped .cnet model.
+ * With -a, images are decoded again through the asynchronous decoder,
+ * driven by a poll() loop as an event loop would, one image in 16 in the
+ * interactive lane and the others in the bulk lane. With -C, these
+ * decodes are sampled into a capture file, for replay.
+ * With -T, symbols are also classified by template matching, with
+ * templates built from the training samples of a labeled corpus. When
+ * the images are labeled archive members, the accuracy of each
+ * classifier is reported.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include <poll.h>
+#include "fann.h"
+#include "captcha_async.h"
+#include "captcha_capture.h"
+#include "captcha_common.h"
+#include "captcha_features.h"
+#include "captcha_batch.h"
+#include "captcha_decode.h"
+#include "captcha_glyph_cache.h"
+#include "captcha_model.h"
+#include "captcha_model_file.h"
+#include "captcha_tar.h"
+#include "captcha_template.h"
+#include "captcha_trace.h"
+#include "captcha_perf.h"
+
+#define IMG_SIZE (IMG_WIDTH * IMG_HEIGHT) //!< Bytes per image
+
+/**
+ * Returns a monotonic time in seconds.
+ */
+double get_time (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Read images which are raw or PGM members of a tar archive.
+ *
+ * \param sets only members of these sets (SAMPLE_TRAIN...), 0 for all
+ * \param labels receives the answer of each image from its name, "" if
+ *        it has none, to be free'd by the caller
+ */
+uint8_t *read_tar_images (char *filename, int sets, int *nbImages, char (**labels)[ANSWER_SIZE])
+{
+    tar_reader *tar = tar_open(filename);
+    if (tar == NULL) {
+        fprintf(stderr, "Error opening input file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = 1024;
+    size_t count = 0;
+    uint8_t *images = malloc(capacity * IMG_SIZE);
+    char (*answers)[ANSWER_SIZE] = malloc(capacity * ANSWER_SIZE);
+    tar_member member;
+    while (images != NULL && answers != NULL && tar_next(tar, &member)) {
+        if (sets != 0 && (sample_sets(member.name) & sets) == 0) continue;
+        if (!tar_member_gray(&member, images + count * IMG_SIZE)) continue;
+        if (sample_answer(member.name, answers[count]) < 0) answers[count][0] = '\0';
+        if (++count == capacity) {
+            capacity *= 2;
+            images = realloc(images, capacity * IMG_SIZE);
+            answers = realloc(answers, capacity * ANSWER_SIZE);
+        }
+    }
+    if (tar_error(tar)) {
+        fprintf(stderr, "Corrupt archive %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    tar_close(tar);
+
+    if (images == NULL || answers == NULL) {
+        fprintf(stderr, "Not enough memory for images.\n");
+        exit(EXIT_FAILURE);
+    }
+    *nbImages = count;
+    *labels = answers;
+    return images;
+} // end read_tar_images()
+
+/**
+ * Read all images from a file ("-" for standard input), or from a tar
+ * archive.
+ *
+ * \param filename raw images file, or .tar/.tar.gz of images
+ * \param sets only members of these sets, for archives
+ * \param nbImages receives the number of images
+ * \param labels receives the answers of archive members (see
+ *        read_tar_images()), NULL for raw images
+ * \return images, to be free'd by the caller
+ */
+uint8_t *read_images (char *filename, int sets, int *nbImages, char (**labels)[ANSWER_SIZE])
+{
+    *labels = NULL;
+    if (is_tar_file(filename)) return read_tar_images(filename, sets, nbImages, labels);
+
+    FILE *f = strcmp("-", filename) == 0 ? stdin : fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error opening input file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    size_t capacity = 1024;
+    size_t count = 0;
+    uint8_t *images = malloc(capacity * IMG_SIZE);
+    while (images != NULL && fread(images + count * IMG_SIZE, IMG_SIZE, 1, f) == 1) {
+        if (++count == capacity) {
+            capacity *= 2;
+            images = realloc(images, capacity * IMG_SIZE);
+        }
+    }
+    if (f != stdin) fclose(f);
+
+    if (images == NULL) {
+        fprintf(stderr, "Not enough memory for images.\n");
+        exit(EXIT_FAILURE);
+    }
+    *nbImages = count;
+    return images;
+} // end read_images()
+
+/**
+ * Start measuring a stage.
+ *
+ * \param counters hardware counters, NULL if not measured
+ * \return start time
+ */
+double start_stage (perf_counters *counters)
+{
+    if (counters != NULL) perf_start(counters);
+    return get_time();
+}
+
+/**
+ * Print time spent in a stage, and hardware counts per image.
+ *
+ * \param start time returned by start_stage()
+ * \param counters hardware counters, NULL if not measured
+ */
+void report (const char *stage, double start, int nbImages, perf_counters *counters)
+{
+    double seconds = get_time() - start;
+    if (counters != NULL) perf_stop(counters);
+
+    printf("%-26s %10.2f us/image %12.0f images/s\n",
+           stage, seconds / nbImages * 1e6, nbImages / seconds);
+    if (counters != NULL) perf_report(stdout, counters, nbImages);
+}
+
+/**
+ * Print the share of labeled images whose answer is right. Images with
+ * too many groups count as wrong.
+ *
+ * \param labels expected answers, "" for images without label
+ */
+void report_accuracy (const char *stage, const char (*answers)[ANSWER_SIZE],
+                      const char (*labels)[ANSWER_SIZE], const int *nbGroups, int nbImages)
+{
+    int labeled = 0, right = 0;
+    for (int i=0; i < nbImages; i++) {
+        if (labels[i][0] == '\0') continue;
+        labeled++;
+        if (nbGroups[i] >= 0 && strcmp(answers[i], labels[i]) == 0) right++;
+    }
+    if (labeled > 0) {
+        printf("%-26s %10.2f %% right (%d/%d labeled images)\n",
+               stage, 100.0 * right / labeled, right, labeled);
+    }
+}
+
+/**
+ * Decode images repeat times with an asynchronous decoder: submit until
+ * its queue is full, wait for its descriptor with poll(), harvest. Every
+ * 16th image goes to the interactive lane.
+ *
+ * \param answers answers of classify_symbols() to compare with
+ * \return number of results which differ
+ */
+int decode_async (captcha_async *ctx, const uint8_t *images, int nbImages, int repeat,
+                  const int *nbGroups, char (*answers)[ANSWER_SIZE])
+{
+    async_result results[64];
+    struct pollfd pfd = { .fd = captcha_async_fd(ctx), .events = POLLIN };
+    int total = nbImages * repeat;
+    int submitted = 0, harvested = 0, differences = 0;
+
+    while (harvested < total) {
+        // Raw images are always valid: submitting fails once a lane is full
+        while (submitted < total &&
+               captcha_async_submit(ctx, submitted % 16 == 0 ? ASYNC_INTERACTIVE : ASYNC_BULK,
+                                    images + (size_t) (submitted % nbImages) * IMG_SIZE,
+                                    IMG_SIZE, submitted) == 0) {
+            submitted++;
+        }
+        if (poll(&pfd, 1, -1) < 0) continue; // EINTR
+
+        int n = captcha_async_harvest(ctx, results, 64);
+        for (int k=0; k < n; k++) {
+            int i = results[k].tag % nbImages;
+            bool same = nbGroups[i] < 0 ? results[k].status == ASYNC_NOT_A_CAPTCHA :
+                        results[k].status == ASYNC_OK && strcmp(results[k].answer, answers[i]) == 0;
+            if (!same) differences++;
+        }
+        harvested += n;
+    } // end while
+
+    return differences;
+} // end decode_async()
+
+int main (int argc, char** argv)
+{
+    char usage_str[] = "Usage: %s [-m model.net] [-r repeat] [-t trace.json] [-c] [-g glyphs] [-M model.cnet]\n"
+                       "       [-a threads [-N]] [-C capture_file] [-F fraction] [-T corpus.tar.gz] [-s train|test]\n"
+                       "       raw_images_file\n";
+
+    char *model_filename = NULL;
+    char *trace_filename = NULL;
+    bool with_counters = false;
+    int cache_capacity = 0;
+    char *mapped_filename = NULL;
+    char *corpus_filename = NULL;
+    char *capture_filename = NULL;
+    double capture_fraction = 1;
+    int sets = 0;
+    int async_threads = 0;
+    bool numa_scaling = false;
+    int repeat = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:C:cF:g:hm:M:Nr:s:t:T:")) != -1) {
+        switch (opt) {
+            case 'm': model_filename = optarg; break;
+            case 'r': repeat = atoi(optarg); break;
+            case 't': trace_filename = optarg; break;
+            case 'c': with_counters = true; break;
+            case 'g': cache_capacity = atoi(optarg); break;
+            case 'M': mapped_filename = optarg; break;
+            case 'a': async_threads = atoi(optarg); break;
+            case 'N': numa_scaling = true; break;
+            case 'T': corpus_filename = optarg; break;
+            case 'C': capture_filename = optarg; break;
+            case 'F': capture_fraction = atof(optarg); break;
+            case 's':
+                sets = strcmp(optarg, "train") == 0 ? SAMPLE_TRAIN :
+                       strcmp(optarg, "test") == 0 ? SAMPLE_TEST : -1;
+                break;
+            case 'h':
+                printf(usage_str, argv[0]);
+                printf("\n"
+                  "Measure decoding stages on raw %dx%d 8-bit images (\"-\" reads\n"
+                  "standard input), or on raw and PGM members of a .tar or .tar.gz\n"
+                  "file, read without extracting it. -s keeps training (_1 to _3) or\n"
+                  "test (_4 to _9) members only.\n"
+                  "Classification is measured if a network is given.\n"
+                  "-t writes spans of each stage and image as a Chrome trace.\n"
+                  "-c measures hardware counters of each stage (Linux perf events),\n"
+                  "per image. * marks counts estimated because counters were shared.\n"
+                  "-g also measures features and classification with a cache of that\n"
+                  "many glyphs (requires -m).\n"
+                  "-M also measures classification with a mapped model file.\n"
+                  "-a also decodes through the asynchronous decoder with that many\n"
+                  "threads (requires -m).\n"
+                  "-N then decodes on 1 to all the NUMA nodes, with that many threads\n"
+                  "pinned to each node, to show how throughput scales.\n"
+                  "-C appends the images decoded with -a and their answers to a\n"
+                  "capture file (see replay), -F sets the share of them to capture\n"
+                  "(default 1).\n"
+                  "-T also classifies by template matching, with %d templates per\n"
+                  "character built from the training members of a labeled archive.\n"
+                  "Members named after their answer (K3xb7_2.pgm) give the accuracy\n"
+                  "of each classifier.\n",
+                  IMG_WIDTH, IMG_HEIGHT, TEMPLATES_PER_CLASS);
+                exit(EXIT_SUCCESS);
+            default:
+                printf(usage_str, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind >= argc || repeat < 1 || sets < 0 || async_threads < 0) {
+        printf(usage_str, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *trace_file = NULL;
+    if (trace_filename != NULL) {
+#ifndef CAPTCHA_TRACE
+        fprintf(stderr, "Warning: built without CAPTCHA_TRACE, the trace will be empty.\n");
+#endif
+        trace_file = fopen(trace_filename, "w");
+        if (trace_file == NULL) {
+            fprintf(stderr, "Error opening trace file %s.\n", trace_filename);
+            exit(EXIT_FAILURE);
+        }
+        trace_start();
+    }
+
+    int nbImages;
+    char (*labels)[ANSWER_SIZE];
+    TRACE_BEGIN("load");
+    uint8_t *images = read_images(argv[optind], sets, &nbImages, &labels);
+    TRACE_END("load");
+    if (nbImages == 0) {
+        fprintf(stderr, "No image in %s.\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    struct fann *ann = NULL;
+    label_map classes;
+    if (model_filename != NULL) {
+        ann = fann_create_from_file(model_filename);
+        if (ann == NULL) {
+            fprintf(stderr, "Cannot create network from %s.\n", model_filename);
+            exit(EXIT_FAILURE);
+        }
+        if (!label_map_for_network(model_filename, fann_get_num_output(ann), &classes)) {
+            fprintf(stderr, "Label map of %s is invalid or does not match its %u outputs.\n",
+                    model_filename, fann_get_num_output(ann));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint8_t *pixels = malloc((size_t) nbImages * IMG_SIZE);
+    uint8_t *batch_pixels = malloc((size_t) nbImages * IMG_SIZE);
+    int *nbGroups = malloc(nbImages * sizeof(int));
+    int *batch_nbGroups = malloc(nbImages * sizeof(int));
+    symbols_struct *symbols = malloc(nbImages * sizeof(symbols_struct));
+    if (pixels == NULL || batch_pixels == NULL || nbGroups == NULL ||
+        batch_nbGroups == NULL || symbols == NULL) {
+        fprintf(stderr, "Not enough memory for %d images.\n", nbImages);
+        exit(EXIT_FAILURE);
+    }
+    int total = nbImages * repeat;
+
+    printf("%d images, %d repeats\n", nbImages, repeat);
+
+    perf_counters perf;
+    perf_counters *counters = NULL;
+    if (with_counters) {
+        if (perf_open(&perf) > 0) {
+            counters = &perf;
+        } else {
+            // Usual in containers: no PMU, or perf_event_paranoid too high
+            fprintf(stderr, "Hardware counters unavailable, measuring time only.\n");
+        }
+    }
+
+    // Grouping, image by image
+    double start = start_stage(counters);
+    for (int r=0; r < repeat; r++) {
+        for (int i=0; i < nbImages; i++) {
+            TRACE_IMAGE(i);
+            nbGroups[i] = label_pixels(images + i * IMG_SIZE, pixels + i * IMG_SIZE);
+        }
+    }
+    report("label", start, total, counters);
+
+    // Grouping, BATCH_LANES images at a time
+    TRACE_IMAGE(-1);
+    start = start_stage(counters);
+    for (int r=0; r < repeat; r++) {
+        if (!label_pixels_batch(images, nbImages, batch_pixels, batch_nbGroups)) {
+            fprintf(stderr, "Not enough memory for batch.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    report("label (batch)", start, total, counters);
+
+    int mismatches = 0;
+    for (int i=0; i < nbImages; i++) {
+        if (nbGroups[i] != batch_nbGroups[i] ||
+            (nbGroups[i] >= 0 &&
+             memcmp(pixels + i * IMG_SIZE, batch_pixels + i * IMG_SIZE, IMG_SIZE) != 0)) {
+            mismatches++;
+        }
+    }
+    if (mismatches) printf("label (batch) differs for %d images!\n", mismatches);
+
+    // Features. Dots are merged in place, so work on a copy of the groups.
+    start = start_stage(counters);
+    for (int r=0; r < repeat; r++) {
+        memcpy(batch_pixels, pixels, (size_t) nbImages * IMG_SIZE);
+        for (int i=0; i < nbImages; i++) {
+            if (nbGroups[i] < 0) continue;
+            TRACE_IMAGE(i);
+            extract_features(batch_pixels + i * IMG_SIZE, nbGroups[i], &symbols[i]);
+        }
+    }
+    report("features", start, total, counters);
+
+    // Classification by template matching, on the groups renumbered by the features
+    char (*template_answers)[ANSWER_SIZE] = NULL;
+    if (corpus_filename != NULL) {
+        double build_start = get_time();
+        template_set *templates = template_build_from_corpus(corpus_filename, TEMPLATES_PER_CLASS);
+        if (templates == NULL) {
+            fprintf(stderr, "Cannot build templates from %s.\n", corpus_filename);
+            exit(EXIT_FAILURE);
+        }
+        printf("%-26s %10.2f ms, %d templates\n", "build (template)",
+               (get_time() - build_start) * 1e3, template_count(templates));
+
+        template_answers = malloc(nbImages * ANSWER_SIZE);
+        if (template_answers == NULL) {
+            fprintf(stderr, "Not enough memory for %d answers.\n", nbImages);
+            exit(EXIT_FAILURE);
+        }
+
+        start = start_stage(counters);
+        for (int r=0; r < repeat; r++) {
+            for (int i=0; i < nbImages; i++) {
+                if (nbGroups[i] < 0) continue;
+                TRACE_IMAGE(i);
+                classify_symbols_template(templates, batch_pixels + i * IMG_SIZE, &symbols[i],
+                                          template_answers[i]);
+            }
+        }
+        report("classify (template)", start, total, counters);
+        if (labels != NULL) {
+            report_accuracy("classify (template)", template_answers, labels, nbGroups, nbImages);
+        }
+        template_free(templates);
+    }
+
+    // Classification
+    if (ann != NULL) {
+        char (*answers)[ANSWER_SIZE] = malloc(nbImages * ANSWER_SIZE);
+        if (answers == NULL) {
+            fprintf(stderr, "Not enough memory for %d answers.\n", nbImages);
+            exit(EXIT_FAILURE);
+        }
+
+        start = start_stage(counters);
+        for (int r=0; r < repeat; r++) {
+            for (int i=0; i < nbImages; i++) {
+                if (nbGroups[i] < 0) continue;
+                TRACE_IMAGE(i);
+                classify_symbols(ann, &classes, &symbols[i], answers[i]);
+            }
+        }
+        report("classify", start, total, counters);
+        if (labels != NULL) report_accuracy("classify", answers, labels, nbGroups, nbImages);
+
+        if (template_answers != NULL) {
+            int differences = 0;
+            for (int i=0; i < nbImages; i++) {
+                if (nbGroups[i] >= 0 && strcmp(template_answers[i], answers[i]) != 0) differences++;
+            }
+            printf("classify (template) differs from classify for %d images\n", differences);
+        }
+
+        // Features and classification of symbols not in the glyph cache
+        if (cache_capacity > 0) {
+            glyph_cache *cache = glyph_cache_create(cache_capacity);
+            if (cache == NULL) {
+                fprintf(stderr, "Not enough memory for glyph cache.\n");
+                exit(EXIT_FAILURE);
+            }
+
+            symbols_struct cached_symbols;
+            char answer[ANSWER_SIZE];
+            int differences = 0;
+            start = start_stage(counters);
+            for (int r=0; r < repeat; r++) {
+                memcpy(batch_pixels, pixels, (size_t) nbImages * IMG_SIZE);
+                for (int i=0; i < nbImages; i++) {
+                    if (nbGroups[i] < 0) continue;
+                    TRACE_IMAGE(i);
+                    segment_symbols(batch_pixels + i * IMG_SIZE, nbGroups[i], &cached_symbols);
+                    classify_symbols_cached(ann, &classes, cache, 0, batch_pixels + i * IMG_SIZE,
+                                            &cached_symbols, answer);
+                    if (r == 0 && strcmp(answer, answers[i]) != 0) differences++;
+                }
+            }
+            report("features+classify (cache)", start, total, counters);
+
+            glyph_cache_stats stats;
+            glyph_cache_get_stats(cache, &stats);
+            printf("glyph cache: %.1f%% hits (%llu/%llu), %zu/%zu glyphs, %llu evictions, "
+                   "%d answers differ\n",
+                   stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0,
+                   (unsigned long long) stats.hits, (unsigned long long) stats.lookups,
+                   stats.entries, stats.capacity, (unsigned long long) stats.evictions,
+                   differences);
+            glyph_cache_destroy(cache);
+        } // end if cache
+
+        // Labeling, features and classification on threads, polled
+        if (async_threads > 0) {
+            model_holder *holder = model_holder_create(model_filename);
+            captcha_async *ctx = holder != NULL ?
+                captcha_async_create(holder, NULL, async_threads, NULL) : NULL;
+            if (ctx == NULL) {
+                fprintf(stderr, "Cannot start asynchronous decoder.\n");
+                exit(EXIT_FAILURE);
+            }
+            capture_writer *capture = NULL;
+            if (capture_filename != NULL) {
+                capture = capture_open(capture_filename, capture_fraction, 1024);
+                if (capture == NULL) {
+                    fprintf(stderr, "Cannot open capture file %s.\n", capture_filename);
+                    exit(EXIT_FAILURE);
+                }
+                captcha_async_set_capture(ctx, capture);
+            }
+
+            start = start_stage(counters);
+            int differences = decode_async(ctx, images, nbImages, repeat, nbGroups, answers);
+            report("decode (async)", start, total, counters);
+            if (differences) printf("decode (async) differs for %d images!\n", differences);
+
+            const char *lane_names[ASYNC_NB_LANES] = { "interactive", "bulk" };
+            for (int l=0; l < ASYNC_NB_LANES; l++) {
+                async_lane_stats stats;
+                captcha_async_get_stats(ctx, l, &stats);
+                printf("async %-11s %8llu images, latency mean %.0f p50 %.0f p99 %.0f "
+                       "max %.0f us, wait mean %.0f us, max depth %d, %llu rejected\n",
+                       lane_names[l], (unsigned long long) stats.decoded,
+                       stats.decoded ? stats.latency / stats.decoded * 1e6 : 0.0,
+                       async_latency_percentile(&stats, 0.5) * 1e6,
+                       async_latency_percentile(&stats, 0.99) * 1e6, stats.maxLatency * 1e6,
+                       stats.decoded ? stats.waitTime / stats.decoded * 1e6 : 0.0,
+                       stats.maxDepth, (unsigned long long) stats.rejected);
+            }
+
+            captcha_async_destroy(ctx);
+
+            // Same on more and more nodes, with async_threads threads each
+            if (numa_scaling) {
+                numa_topology topology;
+                int nbNodes = numa_detect(&topology);
+                printf("numa: %d node%s:", nbNodes, nbNodes > 1 ? "s" : "");
+                for (int n=0; n < nbNodes; n++) {
+                    printf(" node%d (%d cpus)", topology.ids[n], topology.nbCpus[n]);
+                }
+                printf("\n");
+
+                for (int n=1; n <= nbNodes; n++) {
+                    topology.nbNodes = n;
+                    captcha_async *numa_ctx =
+                        captcha_async_create_numa(holder, NULL, async_threads * n, NULL, &topology);
+                    if (numa_ctx == NULL) {
+                        fprintf(stderr, "Cannot start asynchronous decoder on %d nodes.\n", n);
+                        exit(EXIT_FAILURE);
+                    }
+                    char stage[32];
+                    snprintf(stage, sizeof(stage), "decode (async, %d node%s)", n, n > 1 ? "s" : "");
+                    start = start_stage(counters);
+                    int differences = decode_async(numa_ctx, images, nbImages, repeat, nbGroups, answers);
+                    report(stage, start, total, counters);
+                    if (differences) printf("%s differs for %d images!\n", stage, differences);
+                    captcha_async_destroy(numa_ctx);
+                }
+            }
+            model_holder_destroy(holder);
+            if (capture != NULL) {
+                capture_stats stats;
+                capture_get_stats(capture, &stats);
+                capture_close(capture);
+                printf("capture: %llu/%llu images sampled, %llu dropped, %llu write errors\n",
+                       (unsigned long long) stats.sampled, (unsigned long long) stats.offered,
+                       (unsigned long long) stats.dropped, (unsigned long long) stats.errors);
+            }
+        }
+
+        free(answers);
+        fann_destroy(ann);
+    }
+
+    // Classification with a mapped model file
+    if (mapped_filename != NULL) {
+        double open_start = get_time();
+        mapped_model *model = mapped_model_open(mapped_filename);
+        double open_time = get_time() - open_start;
+        if (model == NULL || model->header->nbInputs != NB_FEATURES) {
+            fprintf(stderr, "Cannot map model file %s.\n", mapped_filename);
+            exit(EXIT_FAILURE);
+        }
+        printf("%-26s %10.2f us\n", "open (mapped)", open_time * 1e6);
+
+        char answer[ANSWER_SIZE];
+        start = start_stage(counters);
+        for (int r=0; r < repeat; r++) {
+            for (int i=0; i < nbImages; i++) {
+                if (nbGroups[i] < 0) continue;
+                TRACE_IMAGE(i);
+                classify_symbols_mapped(model, &symbols[i], answer);
+            }
+        }
+        report("classify (mapped)", start, total, counters);
+        mapped_model_close(model);
+    }
+
+    int failed = 0;
+    for (int i=0; i < nbImages; i++) {
+        if (nbGroups[i] < 0) failed++;
+    }
+    printf("%d images with too many groups\n", failed);
+
+    if (counters != NULL) perf_close(counters);
+
+    if (trace_file != NULL) {
+        trace_stop();
+        if (!trace_write(trace_file)) {
+            fprintf(stderr, "Error writing trace file %s.\n", trace_filename);
+        }
+        fclose(trace_file);
+    }
+
+    free(images);
+    free(labels);
+    free(template_answers);
+    free(pixels);
+    free(batch_pixels);
+    free(nbGroups);
+    free(batch_nbGroups);
+    free(symbols);
+
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+} // end main()
@@ -0,0 +1,628 @@
+/**
+ * \file
+ *
+ * \brief Decoding without blocking the caller
+ *
+ * Jobs live in a fixed array of slots, each holding the image and then
+ * its result, so that submitting allocates nothing. Each lane owns
+ * queueSize slots. A slot moves from the free list of its lane to the
+ * pending queue of its lane (captcha_async_submit()), is decoded by a
+ * thread, then waits in the done queue until harvested, and goes back
+ * to its free list. The lists are linked through the slots and guarded
+ * by one mutex, held only to link and unlink.
+ *
+ * On NUMA machines, the decoder is split into one pool per node: its
+ * slots, queues, mutex and threads, the threads pinned to the CPUs of
+ * the node. A pool and its slots are allocated and filled by the
+ * creating thread while pinned to the node, and each thread copies the
+ * network after being started there, so that the first-touch policy puts
+ * all of them in the memory of the node. Pools after the first get their
+ * own glyph cache. Submitting goes round robin over the pools, skipping
+ * those whose lane is full; only the eventfd is shared. Without
+ * topology, the decoder is a single pool.
+ *
+ * A thread takes a batch from the highest lane with images waiting,
+ * unless a lower one has been passed over maxSkips times in a row.
+ *
+ * The eventfd is written when a done queue stops being empty, and read
+ * (reset) by captcha_async_harvest() before it goes through the pools,
+ * which writes it again if it leaves results behind: no queue is ever
+ * non-empty with the descriptor unreadable.
+ *
+ * With a capture, a thread copies each sampled image and its result
+ * into a record of the capture ring once decoded, before linking it to
+ * the done queue.
+ */
+
+#define _GNU_SOURCE // eventfd flags
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "fann.h"
+#include "captcha_async.h"
+#include "captcha_capture.h"
+#include "captcha_common.h"
+#include "captcha_features.h"
+#include "captcha_glyph_cache.h"
+#include "captcha_model.h"
+#include "captcha_numa.h"
+
+#define IMG_SIZE (IMG_WIDTH * IMG_HEIGHT) //!< Bytes per image
+#define NO_SLOT -1
+
+static const async_lane_config default_lanes[ASYNC_NB_LANES] = {
+    [ASYNC_INTERACTIVE] = { .queueSize = 64, .batchSize = 1, .maxSkips = 0 },
+    [ASYNC_BULK] = { .queueSize = 1024, .batchSize = 16, .maxSkips = 8 },
+};
+
+typedef struct {
+    uint8_t gray[IMG_SIZE];
+    async_result result;
+    double submitted;       //!< time of captcha_async_submit()
+    double started;         //!< time a thread took it
+    double finished;        //!< time its result was ready
+    int next;               //!< next slot in its list
+} async_job;
+
+/**
+ * List of slots, in the order they were added.
+ */
+typedef struct {
+    int head, tail;
+} job_list;
+
+typedef struct {
+    async_lane_config config;
+    job_list free, pending;
+    int skips;              //!< times passed over since last taken
+    async_lane_stats stats;
+} async_lane;
+
+/**
+ * Slots and threads of a NUMA node.
+ */
+typedef struct {
+    captcha_async *ctx;
+    glyph_cache *cache;     //!< NULL for none
+    bool ownCache;          //!< cache is a replica to free
+    capture_writer *capture; //!< NULL for none
+    async_job *jobs;
+    async_lane lanes[ASYNC_NB_LANES];
+    job_list done;
+    bool stop;
+    pthread_mutex_t mutex;  //!< guards the lists, lanes, capture and stop
+    pthread_cond_t work;    //!< signaled when a pending queue gets a slot, or on stop
+    pthread_t *threads;
+    int nbThreads;
+} async_pool;
+
+struct captcha_async {
+    model_holder *holder;
+    async_pool **pools;
+    int nbPools;
+    unsigned int nextPool;  //!< atomic, pool tried first by the next submit
+    unsigned int nextHarvest; //!< atomic, pool harvested first next time
+    int fd;                 //!< eventfd, readable while a done queue is not empty
+};
+
+/**
+ * Returns a monotonic time in seconds.
+ */
+static double get_time (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void push_job (async_job *jobs, job_list *list, int slot)
+{
+    jobs[slot].next = NO_SLOT;
+    if (list->tail == NO_SLOT) list->head = slot;
+    else jobs[list->tail].next = slot;
+    list->tail = slot;
+}
+
+static int pop_job (async_job *jobs, job_list *list)
+{
+    int slot = list->head;
+    if (slot != NO_SLOT) {
+        list->head = jobs[slot].next;
+        if (list->head == NO_SLOT) list->tail = NO_SLOT;
+    }
+    return slot;
+}
+
+/**
+ * Make the completion queue descriptor readable.
+ */
+static void signal_done (captcha_async *ctx)
+{
+    uint64_t one = 1;
+    while (write(ctx->fd, &one, sizeof(one)) < 0 && errno == EINTR) { }
+}
+
+/**
+ * Choose the lane to take images from, with the mutex held.
+ *
+ * \return lane, -1 if no image is waiting
+ */
+static int pick_lane (async_pool *pool)
+{
+    int lane = -1;
+    for (int l=0; l < ASYNC_NB_LANES; l++) {
+        async_lane *candidate = &pool->lanes[l];
+        if (candidate->pending.head == NO_SLOT) continue;
+        if (lane < 0) {
+            lane = l;
+        } else if (candidate->config.maxSkips > 0 &&
+                   candidate->skips >= candidate->config.maxSkips) {
+            lane = l; // starving
+            break;
+        }
+    }
+    if (lane < 0) return -1;
+
+    for (int l=0; l < ASYNC_NB_LANES; l++) {
+        if (l == lane) pool->lanes[l].skips = 0;
+        else if (pool->lanes[l].pending.head != NO_SLOT) pool->lanes[l].skips++;
+    }
+    return lane;
+} // end pick_lane()
+
+/**
+ * Count a decoded job in the stats of its lane, with the mutex held.
+ */
+static void count_job (async_lane_stats *stats, const async_job *job)
+{
+    double wait = job->started - job->submitted;
+    double latency = job->finished - job->submitted;
+    stats->decoded++;
+    stats->waitTime += wait;
+    if (wait > stats->maxWait) stats->maxWait = wait;
+    stats->latency += latency;
+    if (latency > stats->maxLatency) stats->maxLatency = latency;
+
+    int bucket = 0;
+    for (double limit = 1e-6; latency >= limit && bucket < ASYNC_LATENCY_BUCKETS - 1;
+         limit *= 2) {
+        bucket++;
+    }
+    stats->histogram[bucket]++;
+}
+
+/**
+ * Copy a decoded job into the capture, if it is sampled.
+ */
+static void capture_job (capture_writer *capture, const async_job *job)
+{
+    capture_record *record = capture_claim(capture);
+    if (record == NULL) return;
+
+    // Submission time on the wall clock, from the monotonic one
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    double age = get_time() - job->submitted;
+    record->time = (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000 - (uint64_t) (age * 1e6);
+    record->tag = job->result.tag;
+    record->latency = (uint32_t) ((job->finished - job->submitted) * 1e6);
+    record->model = job->result.model;
+    record->lane = job->result.lane;
+    record->status = job->result.status;
+    memcpy(record->answer, job->result.answer, ANSWER_SIZE);
+    record->reserved[0] = 0;
+    memcpy(record->gray, job->gray, IMG_SIZE);
+    capture_commit(capture, record);
+} // end capture_job()
+
+/**
+ * Copy the current network and its label map if ann is missing or
+ * outdated. The previous copy is kept if the current one cannot be
+ * copied.
+ */
+static void update_network (model_holder *holder, struct fann **ann, label_map *labels,
+                            uint32_t *version)
+{
+    if (*ann != NULL && model_version(holder) == *version) return;
+
+    captcha_model *model = model_acquire(holder);
+    struct fann *copy = fann_copy(model->ann);
+    if (copy != NULL) {
+        if (*ann != NULL) fann_destroy(*ann);
+        *ann = copy;
+        *labels = model->labels;
+        *version = model->version;
+    }
+    model_release(model);
+}
+
+/**
+ * Decode the image of a job into its result.
+ */
+static void decode_job (async_pool *pool, async_job *job, struct fann **ann, label_map *labels,
+                        uint32_t *version)
+{
+    async_result *result = &job->result;
+    result->answer[0] = '\0';
+    result->model = 0;
+
+    update_network(pool->ctx->holder, ann, labels, version);
+    if (*ann == NULL) {
+        result->status = ASYNC_NO_MEMORY;
+        return;
+    }
+    result->model = *version;
+
+    uint8_t pixels[IMG_SIZE];
+    component_table components;
+    symbols_struct symbols;
+    int nbGroups = label_components(job->gray, pixels, &components);
+    if (nbGroups < 0) {
+        result->status = ASYNC_NOT_A_CAPTCHA;
+        return;
+    }
+    if (pool->cache != NULL) {
+        segment_components(pixels, &components, &symbols);
+        classify_symbols_cached(*ann, labels, pool->cache, *version, pixels, &symbols,
+                                result->answer);
+    } else {
+        extract_components_features(pixels, &components, &symbols);
+        classify_symbols(*ann, labels, &symbols, result->answer);
+    }
+    result->status = ASYNC_OK;
+} // end decode_job()
+
+static void *decode_thread (void *arg)
+{
+    async_pool *pool = arg;
+    struct fann *ann = NULL; // copy of the network for this thread, on its node
+    label_map labels;
+    uint32_t version = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for (;;) {
+        int l;
+        while ((l = pick_lane(pool)) < 0 && !pool->stop) {
+            pthread_cond_wait(&pool->work, &pool->mutex);
+        }
+        if (pool->stop) break;
+
+        // Take a batch, linked through the slots as the queues are
+        async_lane *lane = &pool->lanes[l];
+        job_list batch = { NO_SLOT, NO_SLOT };
+        double started = get_time();
+        for (int i=0; i < lane->config.batchSize && lane->pending.head != NO_SLOT; i++) {
+            int slot = pop_job(pool->jobs, &lane->pending);
+            pool->jobs[slot].started = started;
+            push_job(pool->jobs, &batch, slot);
+            lane->stats.depth--;
+        }
+        capture_writer *capture = pool->capture;
+        pthread_mutex_unlock(&pool->mutex);
+
+        for (int slot = batch.head; slot != NO_SLOT; slot = pool->jobs[slot].next) {
+            decode_job(pool, &pool->jobs[slot], &ann, &labels, &version);
+            pool->jobs[slot].finished = get_time();
+            if (capture != NULL) capture_job(capture, &pool->jobs[slot]);
+        }
+
+        pthread_mutex_lock(&pool->mutex);
+        bool wasEmpty = pool->done.head == NO_SLOT;
+        for (int slot = batch.head; slot != NO_SLOT; ) {
+            int next = pool->jobs[slot].next;
+            count_job(&lane->stats, &pool->jobs[slot]);
+            push_job(pool->jobs, &pool->done, slot);
+            slot = next;
+        }
+        if (wasEmpty) {
+            pthread_mutex_unlock(&pool->mutex);
+            signal_done(pool->ctx);
+            pthread_mutex_lock(&pool->mutex);
+        }
+    } // end for each batch
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (ann != NULL) fann_destroy(ann);
+    return NULL;
+} // end decode_thread()
+
+/**
+ * Stop and join the threads of a pool, then free it.
+ */
+static void destroy_pool (async_pool *pool)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->mutex);
+    for (int i=0; i < pool->nbThreads; i++) pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->mutex);
+    if (pool->ownCache) glyph_cache_destroy(pool->cache);
+    free(pool->threads);
+    free(pool->jobs);
+    free(pool);
+}
+
+/**
+ * Allocate a pool, fill its slots and start its threads, which inherit
+ * the affinity of the calling thread.
+ *
+ * \param cache glyph cache of the pool, NULL for none
+ * \param nbSlots sum of the queue sizes of lanes
+ * \return pool, NULL on error (errno is set)
+ */
+static async_pool *create_pool (captcha_async *ctx, glyph_cache *cache, int nbThreads,
+                                const async_lane_config *lanes, int nbSlots)
+{
+    async_pool *pool = calloc(1, sizeof(async_pool));
+    if (pool == NULL) return NULL;
+    // Touched here, on the node: calloc() would leave fresh pages to be
+    // placed by the first submitter
+    pool->jobs = malloc(nbSlots * sizeof(async_job));
+    pool->threads = malloc(nbThreads * sizeof(pthread_t));
+    if (pool->jobs == NULL || pool->threads == NULL) {
+        free(pool->threads);
+        free(pool->jobs);
+        free(pool);
+        errno = ENOMEM;
+        return NULL;
+    }
+    memset(pool->jobs, 0, nbSlots * sizeof(async_job));
+
+    pool->ctx = ctx;
+    pool->cache = cache;
+    pool->done = (job_list) { NO_SLOT, NO_SLOT };
+    int slot = 0;
+    for (int l=0; l < ASYNC_NB_LANES; l++) {
+        async_lane *lane = &pool->lanes[l];
+        lane->config = lanes[l];
+        lane->free = lane->pending = (job_list) { NO_SLOT, NO_SLOT };
+        for (int i=0; i < lanes[l].queueSize; i++) {
+            pool->jobs[slot].result.lane = l;
+            push_job(pool->jobs, &lane->free, slot++);
+        }
+    }
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->work, NULL);
+
+    for (pool->nbThreads=0; pool->nbThreads < nbThreads; pool->nbThreads++) {
+        int error = pthread_create(&pool->threads[pool->nbThreads], NULL, decode_thread, pool);
+        if (error != 0) {
+            destroy_pool(pool);
+            errno = error;
+            return NULL;
+        }
+    }
+    return pool;
+} // end create_pool()
+
+captcha_async *captcha_async_create (model_holder *holder, glyph_cache *cache,
+                                     int nbThreads, const async_lane_config *lanes)
+{
+    return captcha_async_create_numa(holder, cache, nbThreads, lanes, NULL);
+}
+
+captcha_async *captcha_async_create_numa (model_holder *holder, glyph_cache *cache,
+                                          int nbThreads, const async_lane_config *lanes,
+                                          const numa_topology *topology)
+{
+    if (lanes == NULL) lanes = default_lanes;
+    int nbSlots = 0;
+    for (int l=0; l < ASYNC_NB_LANES; l++) {
+        if (lanes[l].queueSize < 1 || lanes[l].batchSize < 1 || lanes[l].maxSkips < 0) {
+            errno = EINVAL;
+            return NULL;
+        }
+        nbSlots += lanes[l].queueSize;
+    }
+    if (holder == NULL || nbThreads < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    int nbPools = topology != NULL ? topology->nbNodes : 1;
+    if (nbPools > nbThreads) nbPools = nbThreads;
+
+    captcha_async *ctx = calloc(1, sizeof(captcha_async));
+    if (ctx == NULL) return NULL;
+    ctx->pools = calloc(nbPools, sizeof(async_pool *));
+    ctx->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->pools == NULL || ctx->fd < 0) {
+        int error = errno;
+        if (ctx->fd >= 0) close(ctx->fd);
+        free(ctx->pools);
+        free(ctx);
+        errno = error;
+        return NULL;
+    }
+    ctx->holder = holder;
+
+    size_t cacheCapacity = 0;
+    if (cache != NULL) {
+        glyph_cache_stats stats;
+        glyph_cache_get_stats(cache, &stats);
+        cacheCapacity = stats.capacity;
+    }
+
+    for (int p=0; p < nbPools; p++) {
+        if (topology != NULL) {
+            int error = numa_pin_thread(topology, p);
+            if (error != 0) {
+                captcha_async_destroy(ctx);
+                errno = error;
+                return NULL;
+            }
+        }
+
+        // The first pool shares the cache of the caller, others get a replica
+        glyph_cache *poolCache = cache;
+        if (cache != NULL && p > 0) poolCache = glyph_cache_create(cacheCapacity);
+        int threads = nbThreads / nbPools + (p < nbThreads % nbPools);
+        async_pool *pool = NULL;
+        if (cache == NULL || poolCache != NULL) {
+            pool = create_pool(ctx, poolCache, threads, lanes, nbSlots);
+        } else {
+            errno = ENOMEM;
+        }
+        int error = errno;
+        if (topology != NULL) numa_unpin_thread(topology);
+        if (pool == NULL) {
+            if (poolCache != cache) glyph_cache_destroy(poolCache);
+            captcha_async_destroy(ctx);
+            errno = error;
+            return NULL;
+        }
+        pool->ownCache = poolCache != cache;
+        ctx->pools[ctx->nbPools++] = pool;
+    } // end for each node
+    return ctx;
+} // end captcha_async_create_numa()
+
+void captcha_async_destroy (captcha_async *ctx)
+{
+    if (ctx == NULL) return;
+    for (int p=0; p < ctx->nbPools; p++) destroy_pool(ctx->pools[p]);
+    close(ctx->fd);
+    free(ctx->pools);
+    free(ctx);
+}
+
+int captcha_async_nb_pools (const captcha_async *ctx)
+{
+    return ctx->nbPools;
+}
+
+void captcha_async_set_capture (captcha_async *ctx, capture_writer *capture)
+{
+    for (int p=0; p < ctx->nbPools; p++) {
+        async_pool *pool = ctx->pools[p];
+        pthread_mutex_lock(&pool->mutex);
+        pool->capture = capture;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+int captcha_async_submit (captcha_async *ctx, int lane, const void *image, size_t size,
+                          uint64_t tag)
+{
+    if (lane < 0 || lane >= ASYNC_NB_LANES) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // The next pool with room in the lane
+    unsigned int first = __atomic_fetch_add(&ctx->nextPool, 1, __ATOMIC_RELAXED);
+    async_pool *pool = NULL;
+    int slot = NO_SLOT;
+    for (int i=0; i < ctx->nbPools && slot == NO_SLOT; i++) {
+        pool = ctx->pools[(first + i) % ctx->nbPools];
+        pthread_mutex_lock(&pool->mutex);
+        slot = pop_job(pool->jobs, &pool->lanes[lane].free);
+        if (slot == NO_SLOT && i == ctx->nbPools - 1) pool->lanes[lane].stats.rejected++;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+    if (slot == NO_SLOT) {
+        errno = EAGAIN;
+        return -1;
+    }
+    async_lane *queue = &pool->lanes[lane];
+
+    // The slot belongs to nobody else until queued
+    async_job *job = &pool->jobs[slot];
+    bool valid = read_gray_image(image, size, job->gray);
+    job->result.tag = tag;
+    job->submitted = get_time();
+
+    pthread_mutex_lock(&pool->mutex);
+    if (valid) {
+        push_job(pool->jobs, &queue->pending, slot);
+        queue->stats.submitted++;
+        if (++queue->stats.depth > queue->stats.maxDepth) {
+            queue->stats.maxDepth = queue->stats.depth;
+        }
+        pthread_cond_signal(&pool->work);
+    } else {
+        push_job(pool->jobs, &queue->free, slot);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+
+    if (!valid) {
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+} // end captcha_async_submit()
+
+int captcha_async_fd (const captcha_async *ctx)
+{
+    return ctx->fd;
+}
+
+int captcha_async_harvest (captcha_async *ctx, async_result *results, int max)
+{
+    int nbResults = 0;
+
+    // Reset the descriptor, EAGAIN if it was not readable. Results done
+    // from now on write it again.
+    uint64_t count;
+    while (read(ctx->fd, &count, sizeof(count)) < 0 && errno == EINTR) { }
+
+    bool left = false;
+    unsigned int first = __atomic_fetch_add(&ctx->nextHarvest, 1, __ATOMIC_RELAXED);
+    for (int i=0; i < ctx->nbPools; i++) {
+        async_pool *pool = ctx->pools[(first + i) % ctx->nbPools];
+        pthread_mutex_lock(&pool->mutex);
+        while (nbResults < max && pool->done.head != NO_SLOT) {
+            int slot = pop_job(pool->jobs, &pool->done);
+            async_result *result = &pool->jobs[slot].result;
+            results[nbResults++] = *result;
+            push_job(pool->jobs, &pool->lanes[result->lane].free, slot);
+        }
+        if (pool->done.head != NO_SLOT) left = true;
+        pthread_mutex_unlock(&pool->mutex);
+    }
+
+    if (left) signal_done(ctx);
+    return nbResults;
+} // end captcha_async_harvest()
+
+void captcha_async_get_stats (captcha_async *ctx, int lane, async_lane_stats *stats)
+{
+    memset(stats, 0, sizeof(async_lane_stats));
+    for (int p=0; p < ctx->nbPools; p++) {
+        async_pool *pool = ctx->pools[p];
+        pthread_mutex_lock(&pool->mutex);
+        const async_lane_stats *s = &pool->lanes[lane].stats;
+        stats->submitted += s->submitted;
+        stats->rejected += s->rejected;
+        stats->decoded += s->decoded;
+        stats->depth += s->depth;
+        if (s->maxDepth > stats->maxDepth) stats->maxDepth = s->maxDepth;
+        stats->waitTime += s->waitTime;
+        if (s->maxWait > stats->maxWait) stats->maxWait = s->maxWait;
+        stats->latency += s->latency;
+        if (s->maxLatency > stats->maxLatency) stats->maxLatency = s->maxLatency;
+        for (int i=0; i < ASYNC_LATENCY_BUCKETS; i++) stats->histogram[i] += s->histogram[i];
+        pthread_mutex_unlock(&pool->mutex);
+    }
+} // end captcha_async_get_stats()
+
+double async_latency_percentile (const async_lane_stats *stats, double fraction)
+{
+    if (stats->decoded == 0) return 0;
+
+    uint64_t below = 0;
+    double limit = 1e-6;
+    for (int i=0; i < ASYNC_LATENCY_BUCKETS - 1; i++, limit *= 2) {
+        below += stats->histogram[i];
+        if (below >= fraction * stats->decoded) {
+            return limit < stats->maxLatency ? limit : stats->maxLatency;
+        }
+    }
+    return stats->maxLatency;
+}
@@ -0,0 +1,187 @@
+#pragma once
+#ifndef CAPTCHA_ASYNC_H
+#define CAPTCHA_ASYNC_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "captcha_decode.h"
+#include "captcha_numa.h"
+
+struct model_holder;
+struct glyph_cache;
+struct capture_writer;
+
+/**
+ * Status of a decode.
+ */
+#define ASYNC_OK 0              //!< answer is set
+#define ASYNC_NOT_A_CAPTCHA 1   //!< too many groups of pixels
+#define ASYNC_NO_MEMORY 2       //!< the network could not be copied
+
+/**
+ * Lanes of a decoder, by priority: threads take images from the
+ * interactive lane first.
+ */
+#define ASYNC_INTERACTIVE 0
+#define ASYNC_BULK 1
+#define ASYNC_NB_LANES 2
+
+/**
+ * Buckets of the latency histogram of a lane: bucket i counts latencies
+ * below 2^i microseconds (and above the previous one), the last one all
+ * longer latencies.
+ */
+#define ASYNC_LATENCY_BUCKETS 24
+
+/**
+ * Queue of a lane.
+ */
+typedef struct {
+    int queueSize;  //!< images submitted to the lane and not harvested yet, at most,
+                    //!< per pool (NUMA node)
+    int batchSize;  //!< images a thread takes from the lane at once, at most
+    int maxSkips;   //!< times the lane can be passed over for a higher one while
+                    //!< images wait in it, 0 for no limit
+} async_lane_config;
+
+/**
+ * Counters of a lane since the decoder was created.
+ */
+typedef struct {
+    uint64_t submitted;    //!< images accepted by captcha_async_submit()
+    uint64_t rejected;     //!< images refused because the lane was full
+    uint64_t decoded;      //!< images decoded
+    int depth;             //!< images waiting for a thread now
+    int maxDepth;          //!< most images ever waiting for the threads of a pool
+    double waitTime;       //!< seconds waited for a thread, all images
+    double maxWait;        //!< longest wait for a thread, seconds
+    double latency;        //!< seconds from submission to result, all images
+    double maxLatency;     //!< longest latency, seconds
+    uint64_t histogram[ASYNC_LATENCY_BUCKETS]; //!< latencies, see ASYNC_LATENCY_BUCKETS
+} async_lane_stats;
+
+/**
+ * Completion of a submitted image.
+ */
+typedef struct {
+    uint64_t tag;               //!< tag given to captcha_async_submit()
+    int lane;                   //!< lane it was submitted to
+    int status;                 //!< ASYNC_OK...
+    uint32_t model;             //!< version of the network which decoded it
+    char answer[ANSWER_SIZE];   //!< decoded captcha, "" unless ASYNC_OK
+} async_result;
+
+/**
+ * Decoder for event loops: images are decoded by a pool of threads, and
+ * results are harvested from a completion queue whose file descriptor
+ * becomes readable when results are waiting, so that it can be polled
+ * with sockets.
+ *
+ * Each lane has its own queue, so that bulk images never take the slots
+ * of interactive ones, and a thread takes at most batchSize images of a
+ * lane at a time, so that an interactive image waits for at most one
+ * bulk batch per thread.
+ */
+typedef struct captcha_async captcha_async;
+
+/**
+ * Start the threads of a decoder.
+ *
+ * \param holder network, reloads are picked up between two images
+ * \param cache glyph cache shared by the threads, NULL for none
+ * \param nbThreads decoding threads
+ * \param lanes ASYNC_NB_LANES queues, NULL for the defaults: 64
+ *              interactive images taken one at a time, 1024 bulk images
+ *              taken 16 at a time, a bulk batch at least every 8
+ *              interactive images
+ * \return decoder, NULL on error (errno is set)
+ */
+captcha_async *captcha_async_create (struct model_holder *holder, struct glyph_cache *cache,
+                                     int nbThreads, const async_lane_config *lanes);
+
+/**
+ * Start a decoder with one pool of threads per NUMA node, each thread
+ * pinned to the CPUs of its node and decoding the images queued to its
+ * pool, from a copy of the network, slots and glyph cache in the memory
+ * of its node. Images go to the pools in turn, skipping pools whose lane
+ * is full.
+ *
+ * \param cache glyph cache of the first pool, NULL for none. The other
+ *              pools get an empty cache of the same capacity.
+ * \param nbThreads decoding threads, spread evenly over the nodes. Nodes
+ *                  beyond the nbThreads first ones get none.
+ * \param topology nodes to use (numa_detect()), NULL for one pool with
+ *                 threads not pinned, as captcha_async_create()
+ * \return decoder, NULL on error (errno is set)
+ */
+captcha_async *captcha_async_create_numa (struct model_holder *holder, struct glyph_cache *cache,
+                                          int nbThreads, const async_lane_config *lanes,
+                                          const numa_topology *topology);
+
+/**
+ * Number of pools of threads (NUMA nodes) of a decoder.
+ */
+int captcha_async_nb_pools (const captcha_async *ctx);
+
+/**
+ * Stop the threads. Images not decoded yet are dropped, results not
+ * harvested are lost. holder and cache are not free'd.
+ */
+void captcha_async_destroy (captcha_async *ctx);
+
+/**
+ * Sample decoded images into a capture file (see captcha_capture.h),
+ * with their submission time, lane, tag and result. Threads copy the
+ * sampled images in the ring of the capture; its own thread writes
+ * them.
+ *
+ * \param capture NULL to stop capturing. Batches taken before the call
+ *                may still be captured: close the capture after
+ *                captcha_async_destroy().
+ */
+void captcha_async_set_capture (captcha_async *ctx, struct capture_writer *capture);
+
+/**
+ * Queue an image to decode, without waiting. The image is copied.
+ *
+ * \param lane ASYNC_INTERACTIVE or ASYNC_BULK
+ * \param image raw (IMG_WIDTH * IMG_HEIGHT bytes) or binary PGM image
+ * \param size bytes of image
+ * \param tag returned with the result
+ * \return 0, -1 with errno EINVAL if image is not such an image, EAGAIN
+ *         if queueSize images are in the lane of every pool already
+ */
+int captcha_async_submit (captcha_async *ctx, int lane, const void *image, size_t size,
+                          uint64_t tag);
+
+/**
+ * File descriptor (an eventfd) readable while results are waiting. Do
+ * not read it: captcha_async_harvest() does. It can be readable with no
+ * result left, harvesting then returns 0.
+ */
+int captcha_async_fd (const captcha_async *ctx);
+
+/**
+ * Take results in completion order (pool by pool), without waiting.
+ *
+ * \param results receives at most max results
+ * \return number of results
+ */
+int captcha_async_harvest (captcha_async *ctx, async_result *results, int max);
+
+/**
+ * Copy the counters of a lane.
+ */
+void captcha_async_get_stats (captcha_async *ctx, int lane, async_lane_stats *stats);
+
+/**
+ * Latency below which a fraction of the images of a lane were decoded,
+ * from its histogram (rounded up to a power of two microseconds, at
+ * most the longest latency).
+ *
+ * \param fraction 0.99 for the 99th percentile
+ * \return seconds, 0 if no image was decoded
+ */
+double async_latency_percentile (const async_lane_stats *stats, double fraction);
+
+#endif
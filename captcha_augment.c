@@ -0,0 +1,467 @@
+/**
+ * \file
+ *
+ * \brief Variants of the training glyphs, made while the network trains
+ *
+ * A variant is drawn from the pixels of one glyph, alone on a blank
+ * image at its place in the captcha: rotated and sheared around its
+ * middle, maybe dilated or eroded, with noise on the edge of its
+ * strokes. The image then goes through label_pixels() and
+ * extract_features() like any captcha, so that variants have the
+ * features the decoder would compute for such a glyph.
+ *
+ * Threads take chunks of glyphs of the batch being made, and the random
+ * numbers of a row only depend on the seed, the epoch and the row.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include "captcha_augment.h"
+#include "captcha_common.h"
+#include "captcha_tar.h"
+
+#define IMG_SIZE (IMG_WIDTH * IMG_HEIGHT) //!< Bytes per image
+#define AUGMENT_TRIES 4     //!< variants drawn before using the glyph as it is
+#define CHUNK_GLYPHS 16     //!< glyphs a thread takes at once
+#define NB_BATCHES 2
+
+#define max(a,b) ((a > b) ? (a) : (b))
+
+typedef struct {
+    int sample;         //!< index of the pixels of its captcha
+    uint8_t groupId;    //!< group of its pixels, after segment_symbols()
+    char character;
+    uint8_t classId;    //!< class of character in the label map of the corpus
+    uint16_t xMin, xMax, yMin, yMax;
+    float features[NB_FEATURES]; //!< features of the glyph as it is
+} corpus_glyph;
+
+struct augment_corpus {
+    uint8_t *pixels;        //!< nbSamples * IMG_SIZE groups
+    int nbSamples;
+    corpus_glyph *glyphs;
+    int nbGlyphs;
+    label_map labels;       //!< classes of the outputs
+};
+
+typedef struct {
+    augment_batch batch;
+    float *inputs;
+    float *outputs;
+    int nextGlyph;      //!< first glyph no thread took yet
+    int pendingGlyphs;  //!< glyphs whose rows are not written yet
+} batch_slot;
+
+struct augment_pipeline {
+    const augment_corpus *corpus;
+    augment_params params;
+    int variants;
+    uint64_t seed;
+    batch_slot batches[NB_BATCHES];
+    uint64_t nextEpoch;     //!< epoch of the batch augment_wait() returns
+    bool stop;
+    pthread_mutex_t mutex;  //!< guards the batch counters, nextEpoch and stop
+    pthread_cond_t work;    //!< signaled when a batch is released, or on stop
+    pthread_cond_t ready;   //!< signaled when a batch is complete
+    pthread_t *threads;
+    int nbThreads;
+};
+
+/**
+ * Seed a xorshift64* generator for a row of an epoch (splitmix64), as
+ * generator does for an image.
+ */
+static uint64_t rng_for_row (uint64_t seed, uint64_t epoch, uint64_t row)
+{
+    uint64_t z = seed + ((epoch << 32) + row + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return z ? z : 1;
+}
+
+static uint64_t rng_next (uint64_t *rng)
+{
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return *rng * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Random float in [0, 1)
+ */
+static float rng_float (uint64_t *rng)
+{
+    return (rng_next(rng) >> 40) / (float) (1 << 24);
+}
+
+static bool is_on (const uint8_t *on, int x, int y)
+{
+    return !is_out_coord((Coord) {x, y}) && on[get_index(x, y)];
+}
+
+/**
+ * Dilate or erode the pixels of a box, with the 4 nearest neighbours.
+ */
+static void morph (uint8_t *on, int xMin, int xMax, int yMin, int yMax, bool dilate)
+{
+    uint8_t result[IMG_SIZE];
+    for (int y = yMin; y <= yMax; y++) {
+        for (int x = xMin; x <= xMax; x++) {
+            int around = is_on(on, x-1, y) + is_on(on, x+1, y) +
+                         is_on(on, x, y-1) + is_on(on, x, y+1);
+            bool self = on[get_index(x, y)];
+            result[get_index(x, y)] = dilate ? self || around > 0 : self && around == 4;
+        }
+    }
+    for (int y = yMin; y <= yMax; y++) {
+        memcpy(on + get_index(xMin, y), result + get_index(xMin, y), xMax - xMin + 1);
+    }
+} // end morph()
+
+/**
+ * Flip pixels which differ from one of their 4 nearest neighbours.
+ */
+static void edge_noise (uint8_t *on, int xMin, int xMax, int yMin, int yMax, float noise,
+                        uint64_t *rng)
+{
+    uint8_t result[IMG_SIZE];
+    for (int y = yMin; y <= yMax; y++) {
+        for (int x = xMin; x <= xMax; x++) {
+            bool self = on[get_index(x, y)];
+            bool edge = is_on(on, x-1, y) != self || is_on(on, x+1, y) != self ||
+                        is_on(on, x, y-1) != self || is_on(on, x, y+1) != self;
+            result[get_index(x, y)] = edge && rng_float(rng) < noise ? !self : self;
+        }
+    }
+    for (int y = yMin; y <= yMax; y++) {
+        memcpy(on + get_index(xMin, y), result + get_index(xMin, y), xMax - xMin + 1);
+    }
+} // end edge_noise()
+
+/**
+ * Draw a variant of a glyph alone on a blank image.
+ *
+ * \param gray receives IMG_WIDTH * IMG_HEIGHT pixels
+ */
+static void draw_variant (const corpus_glyph *glyph, const uint8_t *pixels,
+                          const augment_params *params, uint64_t *rng, uint8_t *gray)
+{
+    float angle = params->rotation * (2 * rng_float(rng) - 1);
+    float shear = params->shear * (2 * rng_float(rng) - 1);
+    float c = cosf(angle), s = sinf(angle);
+    float xMiddle = (glyph->xMin + glyph->xMax) / 2.0f;
+    float yMiddle = (glyph->yMin + glyph->yMax) / 2.0f;
+
+    // Room for what rotation, shear and dilation move out of the bounds
+    int width = glyph->xMax - glyph->xMin + 1, height = glyph->yMax - glyph->yMin + 1;
+    int margin = (int) ceilf(fabsf(shear) * height / 2 + fabsf(s) * max(width, height) / 2) + 2;
+    int xMin = max(glyph->xMin - margin, 0), xMax = glyph->xMax + margin;
+    int yMin = max(glyph->yMin - margin, 0), yMax = glyph->yMax + margin;
+    if (xMax >= IMG_WIDTH) xMax = IMG_WIDTH - 1;
+    if (yMax >= IMG_HEIGHT) yMax = IMG_HEIGHT - 1;
+
+    // Each pixel of the box takes the pixel of the glyph it comes from
+    uint8_t on[IMG_SIZE];
+    memset(on, 0, IMG_SIZE);
+    for (int y = yMin; y <= yMax; y++) {
+        for (int x = xMin; x <= xMax; x++) {
+            float dx = x - xMiddle, dy = y - yMiddle;
+            float u = c * dx + s * dy, v = c * dy - s * dx;
+            int srcX = (int) lroundf(xMiddle + u - shear * v);
+            int srcY = (int) lroundf(yMiddle + v);
+            on[get_index(x, y)] = srcX >= glyph->xMin && srcX <= glyph->xMax &&
+                                  srcY >= glyph->yMin && srcY <= glyph->yMax &&
+                                  pixels[get_index(srcX, srcY)] == glyph->groupId;
+        }
+    }
+
+    float thickness = rng_float(rng);
+    if (thickness < params->thickness) {
+        morph(on, xMin, xMax, yMin, yMax, true);
+    } else if (thickness < 2 * params->thickness) {
+        morph(on, xMin, xMax, yMin, yMax, false);
+    }
+    if (params->noise > 0) edge_noise(on, xMin, xMax, yMin, yMax, params->noise, rng);
+
+    for (int i=0; i < IMG_SIZE; i++) gray[i] = on[i] ? 255 : 0;
+} // end draw_variant()
+
+char augment_glyph (const augment_corpus *corpus, int glyph, const augment_params *params,
+                    uint64_t *rng, float *features)
+{
+    const corpus_glyph *g = &corpus->glyphs[glyph];
+    const uint8_t *pixels = corpus->pixels + (size_t) g->sample * IMG_SIZE;
+    uint8_t gray[IMG_SIZE];
+    uint8_t labels[IMG_SIZE];
+    symbols_struct symbols;
+
+    for (int t=0; t < AUGMENT_TRIES; t++) {
+        draw_variant(g, pixels, params, rng, gray);
+        int nbGroups = label_pixels(gray, labels);
+        if (nbGroups < 1) continue;
+        // A dot apart from its letter is merged back, like in a captcha
+        extract_features(labels, nbGroups, &symbols);
+        if (symbols.nbSymbols != 1) continue;
+
+        // Strokes thinned to one pixel give 0 / 0 in some features
+        bool finite = true;
+        for (int f=0; f < NB_FEATURES; f++) finite = finite && isfinite(symbols.features[0][f]);
+        if (!finite) continue;
+
+        for (int f=0; f < NB_FEATURES; f++) features[f] = symbols.features[0][f];
+        return g->character;
+    }
+    memcpy(features, g->features, sizeof(g->features));
+    return g->character;
+} // end augment_glyph()
+
+/**
+ * Keep the glyphs of a segmented captcha.
+ *
+ * \return false if out of memory
+ */
+static bool add_sample (augment_corpus *corpus, const uint8_t *pixels,
+                        const symbols_struct *symbols, const char *answer)
+{
+    uint8_t *newPixels = realloc(corpus->pixels, (size_t) (corpus->nbSamples + 1) * IMG_SIZE);
+    if (newPixels == NULL) return false;
+    corpus->pixels = newPixels;
+    corpus_glyph *newGlyphs = realloc(corpus->glyphs,
+        (corpus->nbGlyphs + symbols->nbSymbols) * sizeof(corpus_glyph));
+    if (newGlyphs == NULL) return false;
+    corpus->glyphs = newGlyphs;
+
+    memcpy(corpus->pixels + (size_t) corpus->nbSamples * IMG_SIZE, pixels, IMG_SIZE);
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        int symbol = symbols->order[i];
+        corpus_glyph *glyph = &corpus->glyphs[corpus->nbGlyphs++];
+        glyph->sample = corpus->nbSamples;
+        glyph->groupId = symbols->groupIds[symbol];
+        glyph->character = answer[i];
+        glyph->classId = label_class(&corpus->labels, answer[i]);
+        glyph->xMin = symbols->xMins[symbol];
+        glyph->xMax = symbols->xMaxs[symbol];
+        glyph->yMin = symbols->yMins[symbol];
+        glyph->yMax = symbols->yMaxs[symbol];
+        for (int f=0; f < NB_FEATURES; f++) glyph->features[f] = symbols->features[symbol][f];
+    }
+    corpus->nbSamples++;
+    return true;
+} // end add_sample()
+
+augment_corpus *augment_load (const char *filename, const label_map *labels)
+{
+    tar_reader *tar = tar_open(filename);
+    if (tar == NULL) return NULL;
+    augment_corpus *corpus = calloc(1, sizeof(augment_corpus));
+    if (corpus == NULL) {
+        tar_close(tar);
+        return NULL;
+    }
+    if (labels != NULL) {
+        corpus->labels = *labels;
+    } else {
+        label_map_legacy(&corpus->labels);
+    }
+
+    uint8_t pixels[IMG_SIZE];
+    symbols_struct symbols;
+    char answer[CAPTCHA_ARR_SIZE + 1];
+    bool error = false;
+    tar_member member;
+    while (!error && tar_next(tar, &member)) {
+        if ((sample_sets(member.name) & SAMPLE_TRAIN) == 0) continue;
+
+        int nbGroups = tar_member_pixels(&member, pixels);
+        int length = sample_answer(member.name, answer);
+        if (nbGroups < 0 || length < 0) continue;
+        extract_features(pixels, nbGroups, &symbols);
+        if (symbols.nbSymbols != length) continue;
+        bool known = true;
+        for (int i=0; i < length; i++) {
+            known = known && label_class(&corpus->labels, answer[i]) >= 0;
+        }
+        if (!known) continue;
+
+        error = !add_sample(corpus, pixels, &symbols, answer);
+    } // end while
+
+    error = error || tar_error(tar);
+    tar_close(tar);
+    if (error) {
+        augment_free(corpus);
+        return NULL;
+    }
+    return corpus;
+} // end augment_load()
+
+int augment_nb_glyphs (const augment_corpus *corpus)
+{
+    return corpus->nbGlyphs;
+}
+
+void augment_free (augment_corpus *corpus)
+{
+    if (corpus == NULL) return;
+    free(corpus->pixels);
+    free(corpus->glyphs);
+    free(corpus);
+}
+
+/**
+ * Write the rows of a chunk of glyphs.
+ */
+static void make_rows (augment_pipeline *pipeline, batch_slot *slot, int first, int last)
+{
+    for (int glyph = first; glyph < last; glyph++) {
+        for (int v=0; v < pipeline->variants; v++) {
+            int row = glyph * pipeline->variants + v;
+            uint64_t rng = rng_for_row(pipeline->seed, slot->batch.epoch, row);
+            augment_glyph(pipeline->corpus, glyph, &pipeline->params, &rng,
+                          slot->inputs + (size_t) row * NB_FEATURES);
+        }
+    }
+}
+
+static void *augment_thread (void *arg)
+{
+    augment_pipeline *pipeline = arg;
+    int nbGlyphs = pipeline->corpus->nbGlyphs;
+
+    pthread_mutex_lock(&pipeline->mutex);
+    while (!pipeline->stop) {
+        // The batch the trainer waits for first
+        batch_slot *slot = NULL;
+        for (int b=0; b < NB_BATCHES && slot == NULL; b++) {
+            batch_slot *candidate = &pipeline->batches[(pipeline->nextEpoch + b) % NB_BATCHES];
+            if (candidate->nextGlyph < nbGlyphs) slot = candidate;
+        }
+        if (slot == NULL) {
+            pthread_cond_wait(&pipeline->work, &pipeline->mutex);
+            continue;
+        }
+
+        int first = slot->nextGlyph;
+        int last = first + CHUNK_GLYPHS < nbGlyphs ? first + CHUNK_GLYPHS : nbGlyphs;
+        slot->nextGlyph = last;
+        pthread_mutex_unlock(&pipeline->mutex);
+
+        make_rows(pipeline, slot, first, last);
+
+        pthread_mutex_lock(&pipeline->mutex);
+        slot->pendingGlyphs -= last - first;
+        if (slot->pendingGlyphs == 0) pthread_cond_broadcast(&pipeline->ready);
+    } // end while
+    pthread_mutex_unlock(&pipeline->mutex);
+    return NULL;
+} // end augment_thread()
+
+/**
+ * Stop the threads started so far and free the pipeline.
+ */
+static void stop_threads (augment_pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    pipeline->stop = true;
+    pthread_cond_broadcast(&pipeline->work);
+    pthread_mutex_unlock(&pipeline->mutex);
+    for (int i=0; i < pipeline->nbThreads; i++) pthread_join(pipeline->threads[i], NULL);
+
+    pthread_cond_destroy(&pipeline->work);
+    pthread_cond_destroy(&pipeline->ready);
+    pthread_mutex_destroy(&pipeline->mutex);
+    for (int b=0; b < NB_BATCHES; b++) {
+        free(pipeline->batches[b].inputs);
+        free(pipeline->batches[b].outputs);
+    }
+    free(pipeline->threads);
+    free(pipeline);
+}
+
+augment_pipeline *augment_start (const augment_corpus *corpus, const augment_params *params,
+                                 int variants, int nbThreads, uint64_t seed)
+{
+    if (variants < 1 || nbThreads < 1) {
+        errno = EINVAL;
+        return NULL;
+    }
+    augment_pipeline *pipeline = calloc(1, sizeof(augment_pipeline));
+    if (pipeline == NULL) return NULL;
+    pipeline->corpus = corpus;
+    pipeline->params = *params;
+    pipeline->variants = variants;
+    pipeline->seed = seed;
+    pthread_mutex_init(&pipeline->mutex, NULL);
+    pthread_cond_init(&pipeline->work, NULL);
+    pthread_cond_init(&pipeline->ready, NULL);
+
+    // Outputs only depend on the glyph: written once
+    size_t nbRows = (size_t) corpus->nbGlyphs * variants;
+    int nbOutputs = corpus->labels.nbClasses;
+    pipeline->threads = malloc(nbThreads * sizeof(pthread_t));
+    bool allocated = pipeline->threads != NULL;
+    for (int b=0; b < NB_BATCHES; b++) {
+        batch_slot *slot = &pipeline->batches[b];
+        slot->inputs = malloc((nbRows * NB_FEATURES + 1) * sizeof(float));
+        slot->outputs = malloc((nbRows * nbOutputs + 1) * sizeof(float));
+        allocated = allocated && slot->inputs != NULL && slot->outputs != NULL;
+        if (!allocated) continue;
+
+        for (size_t row = 0; row < nbRows; row++) {
+            float *outputs = slot->outputs + row * nbOutputs;
+            for (int o=0; o < nbOutputs; o++) outputs[o] = -1;
+            outputs[corpus->glyphs[row / variants].classId] = 1;
+        }
+        slot->batch = (augment_batch) { b, (int) nbRows, nbOutputs, slot->inputs, slot->outputs };
+        slot->pendingGlyphs = corpus->nbGlyphs;
+    } // end for b
+    if (!allocated) {
+        stop_threads(pipeline);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    for (; pipeline->nbThreads < nbThreads; pipeline->nbThreads++) {
+        int error = pthread_create(&pipeline->threads[pipeline->nbThreads], NULL,
+                                   augment_thread, pipeline);
+        if (error != 0) {
+            stop_threads(pipeline);
+            errno = error;
+            return NULL;
+        }
+    }
+    return pipeline;
+} // end augment_start()
+
+const augment_batch *augment_wait (augment_pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    batch_slot *slot = &pipeline->batches[pipeline->nextEpoch % NB_BATCHES];
+    while (slot->pendingGlyphs > 0) pthread_cond_wait(&pipeline->ready, &pipeline->mutex);
+    pthread_mutex_unlock(&pipeline->mutex);
+    return &slot->batch;
+}
+
+void augment_release (augment_pipeline *pipeline)
+{
+    pthread_mutex_lock(&pipeline->mutex);
+    batch_slot *slot = &pipeline->batches[pipeline->nextEpoch % NB_BATCHES];
+    slot->batch.epoch += NB_BATCHES;
+    slot->nextGlyph = 0;
+    slot->pendingGlyphs = pipeline->corpus->nbGlyphs;
+    pipeline->nextEpoch++;
+    pthread_cond_broadcast(&pipeline->work);
+    pthread_mutex_unlock(&pipeline->mutex);
+}
+
+void augment_stop (augment_pipeline *pipeline)
+{
+    if (pipeline == NULL) return;
+    stop_threads(pipeline);
+}
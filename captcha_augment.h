@@ -0,0 +1,99 @@
+#pragma once
+#ifndef CAPTCHA_AUGMENT_H
+#define CAPTCHA_AUGMENT_H
+
+#include <stdint.h>
+#include "captcha_features.h"
+#include "captcha_labels.h"
+
+/**
+ * Perturbations of a glyph. Each variant draws its own amounts.
+ */
+typedef struct {
+    float rotation;   //!< largest rotation around the middle of the glyph, radians
+    float shear;      //!< largest horizontal shift per row, pixels, around the middle row
+    float thickness;  //!< probability to dilate the strokes by one pixel, same to erode them
+    float noise;      //!< probability to flip each pixel on the edge of the strokes
+} augment_params;
+
+/**
+ * Glyphs of labeled captchas, with the pixels they are made of.
+ */
+typedef struct augment_corpus augment_corpus;
+
+/**
+ * Rows of training data, one per variant, in glyph order.
+ */
+typedef struct {
+    uint64_t epoch;         //!< 0 for the first batch, then 1...
+    int nbRows;             //!< glyphs * variants
+    int nbOutputs;          //!< classes of the label map of the corpus
+    const float *inputs;    //!< nbRows * NB_FEATURES features
+    const float *outputs;   //!< nbRows * nbOutputs, 1 for the class of the character,
+                            //!< -1 elsewhere
+} augment_batch;
+
+/**
+ * Threads making a batch of variants ahead of the trainer.
+ */
+typedef struct augment_pipeline augment_pipeline;
+
+/**
+ * Read the training samples (see SAMPLE_TRAIN) of an archive, as
+ * sample_features does, and keep their glyphs. Samples whose number of
+ * symbols differs from the length of their answer, or whose answer has
+ * characters not in the label map, are skipped.
+ *
+ * \param filename .tar or .tar.gz corpus, "-" for standard input
+ * \param labels classes of the outputs, copied. NULL for the legacy map.
+ * \return corpus, NULL if the archive cannot be read
+ */
+augment_corpus *augment_load (const char *filename, const label_map *labels);
+
+int augment_nb_glyphs (const augment_corpus *corpus);
+
+void augment_free (augment_corpus *corpus);
+
+/**
+ * Compute the features of one variant of a glyph. Variants which do
+ * not segment into one symbol are drawn again a few times, then the
+ * glyph is used as it is.
+ *
+ * \param rng state of a xorshift64* generator, not 0
+ * \param features receives NB_FEATURES values
+ * \return character of the glyph
+ */
+char augment_glyph (const augment_corpus *corpus, int glyph, const augment_params *params,
+                    uint64_t *rng, float *features);
+
+/**
+ * Start threads making batches of variants: every glyph of the corpus
+ * gives variants rows to each batch. Two batches are kept, so that the
+ * threads make the next one while the caller uses the current one.
+ * Batch e is the same whatever the number of threads for the same seed.
+ *
+ * \param corpus kept until augment_stop()
+ * \param params copied
+ * \param variants rows per glyph and batch
+ * \return pipeline, NULL on error (errno is set)
+ */
+augment_pipeline *augment_start (const augment_corpus *corpus, const augment_params *params,
+                                 int variants, int nbThreads, uint64_t seed);
+
+/**
+ * Wait for the next batch. It stays valid until augment_release().
+ */
+const augment_batch *augment_wait (augment_pipeline *pipeline);
+
+/**
+ * Give the batch returned by augment_wait() back to the threads, which
+ * start making a new one in it.
+ */
+void augment_release (augment_pipeline *pipeline);
+
+/**
+ * Stop the threads and free the batches.
+ */
+void augment_stop (augment_pipeline *pipeline);
+
+#endif
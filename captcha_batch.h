@@ -0,0 +1,32 @@
+#pragma once
+#ifndef CAPTCHA_BATCH_H
+#define CAPTCHA_BATCH_H
+
+#include <stdint.h>
+#include "captcha_common.h"
+
+/**
+ * Number of captchas processed in lockstep. Labels are 16 bits, so 16
+ * lanes fill a 256-bit vector register.
+ */
+#define BATCH_LANES 16
+
+/**
+ * Same as label_pixels() for several images at once.
+ *
+ * Images are interleaved BATCH_LANES by BATCH_LANES so that each vector
+ * lane works on a different captcha: binarization and labeling run the
+ * same loops for all of them. Results are identical to label_pixels().
+ *
+ * \param gray nbImages images of IMG_WIDTH * IMG_HEIGHT 8-bit pixels,
+ *             one after the other
+ * \param nbImages number of images
+ * \param pixels nbImages arrays of IMG_WIDTH * IMG_HEIGHT group IDs,
+ *               one after the other
+ * \param nbGroups receives the number of groups of each image,
+ *                 -1 if there are more than CAPTCHA_ARR_SIZE.
+ * \return false if memory could not be allocated.
+ */
+bool label_pixels_batch (const uint8_t *gray, int nbImages, uint8_t *pixels, int *nbGroups);
+
+#endif
@@ -0,0 +1,228 @@
+/**
+ * \file
+ *
+ * \brief Sampling of decoded images into a capture file
+ *
+ * Records go through a bounded queue of slots with sequence numbers,
+ * as in captcha_ring.c: slot i is free for the claim of position p when
+ * its sequence is p, committed when it is p + 1, and free again for
+ * p + capacity once written. Decoding threads take positions with a
+ * compare and swap on the head and give up when the slot is not free,
+ * so they never wait. The writing thread goes through positions in
+ * order, and sleeps a little when the next one is not committed yet.
+ *
+ * Sampling keeps a count of offered images: image n is taken when
+ * floor((n + 1) * fraction) > floor(n * fraction).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "captcha_capture.h"
+
+#define CAPTURE_MAX_CAPACITY (1 << 16)
+#define CAPTURE_IDLE_NS 5000000 //!< Sleep of the writing thread when nothing is committed
+
+typedef struct {
+    capture_record record;  //!< first, so that a record is its slot
+    uint64_t seq;           //!< atomic, see file comment
+} capture_slot;
+
+struct capture_writer {
+    FILE *file;
+    double fraction;
+    capture_slot *slots;
+    uint64_t mask;          //!< capacity - 1
+    uint64_t head __attribute__((aligned(64))); //!< atomic, next position to claim
+    uint64_t offered;       //!< atomic
+    uint64_t dropped;       //!< atomic
+    uint64_t sampled;       //!< atomic
+    uint64_t written __attribute__((aligned(64))); //!< atomic, only the thread writes it
+    uint64_t errors;        //!< atomic, only the thread writes it
+    bool stop;              //!< atomic
+    pthread_t thread;
+};
+
+static void *write_thread (void *arg)
+{
+    capture_writer *capture = arg;
+    uint64_t tail = 0;
+
+    for (;;) {
+        capture_slot *slot = &capture->slots[tail & capture->mask];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == tail + 1) {
+            if (fwrite(&slot->record, sizeof(capture_record), 1, capture->file) == 1) {
+                __atomic_add_fetch(&capture->written, 1, __ATOMIC_RELAXED);
+            } else {
+                __atomic_add_fetch(&capture->errors, 1, __ATOMIC_RELAXED);
+            }
+            __atomic_store_n(&slot->seq, tail + capture->mask + 1, __ATOMIC_RELEASE);
+            tail++;
+            continue;
+        }
+
+        // Nothing committed: records written so far reach the file
+        fflush(capture->file);
+        if (__atomic_load_n(&capture->stop, __ATOMIC_ACQUIRE)) {
+            // Committed before stop was set, unless claimed and never committed
+            if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == tail + 1) continue;
+            break;
+        }
+        struct timespec idle = { 0, CAPTURE_IDLE_NS };
+        nanosleep(&idle, NULL);
+    } // end for
+
+    return NULL;
+} // end write_thread()
+
+/**
+ * Check the header of a capture file, or write it if the file is empty.
+ * A record cut by a crash at the end of the file is removed, so that
+ * appended records stay aligned.
+ *
+ * \param file opened for reading and appending
+ * \return false if the file is not a capture file (errno is set)
+ */
+static bool prepare_file (FILE *file)
+{
+    capture_file_header header;
+    if (fseek(file, 0, SEEK_END) != 0) return false;
+    long size = ftell(file);
+    if (size < 0) return false;
+
+    if (size == 0) {
+        memset(&header, 0, sizeof(header));
+        header.magic = CAPTURE_FILE_MAGIC;
+        header.version = CAPTURE_FILE_VERSION;
+        header.width = IMG_WIDTH;
+        header.height = IMG_HEIGHT;
+        header.recordSize = sizeof(capture_record);
+        return fwrite(&header, sizeof(header), 1, file) == 1 && fflush(file) == 0;
+    }
+
+    rewind(file);
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != CAPTURE_FILE_MAGIC || header.version != CAPTURE_FILE_VERSION ||
+        header.width != IMG_WIDTH || header.height != IMG_HEIGHT ||
+        header.recordSize != sizeof(capture_record)) {
+        errno = EINVAL;
+        return false;
+    }
+    long extra = (size - (long) sizeof(header)) % (long) sizeof(capture_record);
+    if (extra != 0 && ftruncate(fileno(file), size - extra) != 0) return false;
+    return true;
+} // end prepare_file()
+
+capture_writer *capture_open (const char *filename, double fraction, int capacity)
+{
+    if (!(fraction >= 0 && fraction <= 1) || capacity < 1 || capacity > CAPTURE_MAX_CAPACITY) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uint64_t nbSlots = 1;
+    while (nbSlots < (uint64_t) capacity) nbSlots *= 2;
+
+    capture_writer *capture = calloc(1, sizeof(capture_writer));
+    if (capture == NULL) return NULL;
+    capture->slots = calloc(nbSlots, sizeof(capture_slot));
+    capture->file = fopen(filename, "a+b");
+    if (capture->slots == NULL || capture->file == NULL || !prepare_file(capture->file)) {
+        int error = errno;
+        if (capture->file != NULL) fclose(capture->file);
+        free(capture->slots);
+        free(capture);
+        errno = error;
+        return NULL;
+    }
+
+    capture->fraction = fraction;
+    capture->mask = nbSlots - 1;
+    for (uint64_t i=0; i < nbSlots; i++) capture->slots[i].seq = i;
+
+    int error = pthread_create(&capture->thread, NULL, write_thread, capture);
+    if (error != 0) {
+        fclose(capture->file);
+        free(capture->slots);
+        free(capture);
+        errno = error;
+        return NULL;
+    }
+    return capture;
+} // end capture_open()
+
+void capture_close (capture_writer *capture)
+{
+    if (capture == NULL) return;
+    __atomic_store_n(&capture->stop, true, __ATOMIC_RELEASE);
+    pthread_join(capture->thread, NULL);
+    fclose(capture->file);
+    free(capture->slots);
+    free(capture);
+}
+
+capture_record *capture_claim (capture_writer *capture)
+{
+    uint64_t n = __atomic_fetch_add(&capture->offered, 1, __ATOMIC_RELAXED);
+    if ((uint64_t) ((n + 1) * capture->fraction) == (uint64_t) (n * capture->fraction)) {
+        return NULL;
+    }
+    __atomic_add_fetch(&capture->sampled, 1, __ATOMIC_RELAXED);
+
+    uint64_t pos = __atomic_load_n(&capture->head, __ATOMIC_RELAXED);
+    for (;;) {
+        capture_slot *slot = &capture->slots[pos & capture->mask];
+        int64_t diff = (int64_t) (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - pos);
+        if (diff == 0) {
+            if (__atomic_compare_exchange_n(&capture->head, &pos, pos + 1, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                return &slot->record;
+            }
+            // pos was reloaded by the failed exchange
+        } else if (diff < 0) {
+            // Not written yet since the last lap: the writer is behind
+            __atomic_add_fetch(&capture->dropped, 1, __ATOMIC_RELAXED);
+            return NULL;
+        } else {
+            pos = __atomic_load_n(&capture->head, __ATOMIC_RELAXED);
+        }
+    } // end for
+} // end capture_claim()
+
+void capture_commit (capture_writer *capture, capture_record *record)
+{
+    capture_slot *slot = (capture_slot *) record;
+    uint64_t pos = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    (void) capture;
+}
+
+void capture_get_stats (capture_writer *capture, capture_stats *stats)
+{
+    stats->offered = __atomic_load_n(&capture->offered, __ATOMIC_RELAXED);
+    stats->sampled = __atomic_load_n(&capture->sampled, __ATOMIC_RELAXED);
+    stats->dropped = __atomic_load_n(&capture->dropped, __ATOMIC_RELAXED);
+    stats->written = __atomic_load_n(&capture->written, __ATOMIC_RELAXED);
+    stats->errors = __atomic_load_n(&capture->errors, __ATOMIC_RELAXED);
+}
+
+FILE *capture_read_open (const char *filename)
+{
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) return NULL;
+
+    capture_file_header header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        header.magic != CAPTURE_FILE_MAGIC || header.version != CAPTURE_FILE_VERSION ||
+        header.width != IMG_WIDTH || header.height != IMG_HEIGHT ||
+        header.recordSize != sizeof(capture_record)) {
+        fclose(file);
+        errno = EINVAL;
+        return NULL;
+    }
+    return file;
+} // end capture_read_open()
@@ -0,0 +1,104 @@
+#pragma once
+#ifndef CAPTCHA_CAPTURE_H
+#define CAPTCHA_CAPTURE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "captcha_decode.h"
+
+/**
+ * Capture file: a header, then fixed size records appended one after
+ * the other, in native byte order. Runs append to the same file as long
+ * as the header matches.
+ */
+#define CAPTURE_FILE_MAGIC 0x50414343u  //!< "CCAP"
+#define CAPTURE_FILE_VERSION 1
+
+typedef struct {
+    uint32_t magic;         //!< CAPTURE_FILE_MAGIC
+    uint32_t version;       //!< CAPTURE_FILE_VERSION
+    uint32_t width;         //!< IMG_WIDTH
+    uint32_t height;        //!< IMG_HEIGHT
+    uint32_t recordSize;    //!< sizeof(capture_record)
+    uint32_t reserved[3];   //!< 0
+} capture_file_header;
+
+/**
+ * An image as it was submitted, and what it was decoded to.
+ */
+typedef struct {
+    uint64_t time;                  //!< submission, microseconds since the Epoch
+    uint64_t tag;                   //!< tag given with the image
+    uint32_t latency;               //!< microseconds from submission to result
+    uint32_t model;                 //!< version of the network which decoded it
+    uint8_t  lane;                  //!< ASYNC_INTERACTIVE or ASYNC_BULK
+    uint8_t  status;                //!< ASYNC_OK...
+    char     answer[ANSWER_SIZE];   //!< decoded captcha, "" unless ASYNC_OK
+    uint8_t  reserved[1];           //!< 0, aligns gray
+    uint8_t  gray[IMG_WIDTH * IMG_HEIGHT];
+} capture_record;
+
+/**
+ * Counters of a capture since it was opened.
+ */
+typedef struct {
+    uint64_t offered;   //!< images seen by capture_claim()
+    uint64_t sampled;   //!< images chosen, written or dropped
+    uint64_t dropped;   //!< images chosen while the writer was behind
+    uint64_t written;   //!< records written to the file
+    uint64_t errors;    //!< records the file refused (disk full...)
+} capture_stats;
+
+/**
+ * Writer of a capture file. Decoding threads claim a record in a ring
+ * without locking nor waiting, fill it, and commit it; a thread of the
+ * writer appends committed records to the file. When the ring is full,
+ * images are dropped rather than slowing decoding down.
+ */
+typedef struct capture_writer capture_writer;
+
+/**
+ * Open a capture file for appending, creating it if needed, and start
+ * its writing thread.
+ *
+ * \param fraction share of the images to capture, from 0 to 1. One image
+ *                 in 1/fraction is taken, evenly spread.
+ * \param capacity records the ring holds, rounded up to a power of two
+ * \return writer, NULL on error (errno is set, EINVAL if the file is not
+ *         a capture file of this version and image size)
+ */
+capture_writer *capture_open (const char *filename, double fraction, int capacity);
+
+/**
+ * Write the records committed so far, stop the thread and close the
+ * file. No record may be claimed any more.
+ */
+void capture_close (capture_writer *capture);
+
+/**
+ * Count an image, and claim a record for it if it is sampled.
+ *
+ * \return record to fill then commit, NULL if the image is not sampled
+ *         or the ring is full
+ */
+capture_record *capture_claim (capture_writer *capture);
+
+/**
+ * Hand a filled record to the writing thread.
+ *
+ * \param record returned by capture_claim()
+ */
+void capture_commit (capture_writer *capture, capture_record *record);
+
+void capture_get_stats (capture_writer *capture, capture_stats *stats);
+
+/**
+ * Open a capture file for reading, and check its header.
+ *
+ * \return file positioned on the first record, NULL on error (errno is
+ *         set, EINVAL if it is not a capture file)
+ */
+FILE *capture_read_open (const char *filename);
+
+#endif
@@ -0,0 +1,504 @@
+/*
+Usage:
+	captcha_cari_compress [-r magnitude|sensitivity] [-s sizes] [-d epochs]
+	                      [-w fraction] [-t test_file] [-b accuracy] [-o output.net]
+	                      teacher.net train_file
+
+	Shrink the hidden layer of a network made by captcha_cari_train, and
+	print accuracy against inference cost for each hidden size of sizes
+	(comma separated, default 64,48,32,24,16):
+
+	pruned     The hidden units ranked lowest are removed, and their mean
+	           activation on train_file is moved into the biases of the
+	           outputs. -r sets how units are ranked: by sensitivity (the
+	           default), how much the outputs move on train_file when the
+	           unit is replaced by its mean, or by the magnitude of their
+	           output weights.
+	distilled  With -d, the pruned network then trained for that many
+	           epochs to reproduce the outputs of the teacher on
+	           train_file.
+
+	-w zeroes that fraction of the smallest weights of each network, as a
+	sparse decoder would skip them. Accuracy is measured on test_file
+	(default train_file). With -o, the network with the fewest
+	multiply-adds whose accuracy is at least -b (default: the accuracy of
+	the teacher) is written, with the label map of the teacher (see
+	captcha_labels.h). train_file and test_file must have the outputs of
+	the teacher.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "fann.h"
+#include "captcha_labels.h"
+
+#define MAX_SIZES 32
+
+/*
+Weights of a network with one hidden layer. Each row ends with the weight
+of the bias.
+*/
+struct layers {
+	unsigned int num_input, num_hidden, num_output;
+	enum fann_activationfunc_enum hidden_function, output_function;
+	fann_type hidden_steepness, output_steepness;
+	fann_type *hidden;	/* num_hidden rows of num_input + 1 weights */
+	fann_type *output;	/* num_output rows of num_hidden + 1 weights */
+};
+
+/*
+Network shrunk and measured.
+*/
+struct candidate {
+	struct fann *ann;
+	unsigned int hidden;
+	unsigned int macs;
+	float accuracy;
+};
+
+static struct layers *alloc_layers(unsigned int num_input, unsigned int num_hidden,
+	unsigned int num_output)
+{
+	struct layers *l = calloc(1, sizeof(struct layers));
+	l->num_input = num_input;
+	l->num_hidden = num_hidden;
+	l->num_output = num_output;
+	l->hidden = calloc(num_hidden * (num_input + 1), sizeof(fann_type));
+	l->output = calloc(num_output * (num_hidden + 1), sizeof(fann_type));
+	if (l->hidden == NULL || l->output == NULL) {
+		fprintf(stderr, "Cannot allocate a network of %u hidden neurons.\n", num_hidden);
+		exit(EXIT_FAILURE);
+	}
+	return l;
+}
+
+static void free_layers(struct layers *l)
+{
+	free(l->hidden);
+	free(l->output);
+	free(l);
+}
+
+/*
+FANN numbers neurons layer after layer, each layer followed by its bias
+neuron: inputs are 0 to num_input - 1, hidden neurons start at
+num_input + 1 and outputs at num_input + num_hidden + 2.
+*/
+static fann_type *weight_of(struct layers *l, struct fann_connection *c)
+{
+	unsigned int first_hidden = l->num_input + 1;
+	unsigned int first_output = first_hidden + l->num_hidden + 1;
+	if (c->to_neuron >= first_output)
+		return &l->output[(c->to_neuron - first_output) * (l->num_hidden + 1)
+			+ c->from_neuron - first_hidden];
+	return &l->hidden[(c->to_neuron - first_hidden) * (l->num_input + 1) + c->from_neuron];
+}
+
+static bool supported(enum fann_activationfunc_enum function)
+{
+	return function == FANN_LINEAR || function == FANN_SIGMOID ||
+		function == FANN_SIGMOID_SYMMETRIC;
+}
+
+static struct layers *read_layers(struct fann *ann, const char *filename)
+{
+	unsigned int sizes[3];
+	if (fann_get_num_layers(ann) != 3) {
+		fprintf(stderr, "%s does not have one hidden layer.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	fann_get_layer_array(ann, sizes);
+	struct layers *l = alloc_layers(sizes[0], sizes[1], sizes[2]);
+
+	l->hidden_function = fann_get_activation_function(ann, 1, 0);
+	l->hidden_steepness = fann_get_activation_steepness(ann, 1, 0);
+	l->output_function = fann_get_activation_function(ann, 2, 0);
+	l->output_steepness = fann_get_activation_steepness(ann, 2, 0);
+	if (!supported(l->hidden_function) || !supported(l->output_function)) {
+		fprintf(stderr, "%s: only linear and sigmoid activations are supported.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	unsigned int num_connections = fann_get_total_connections(ann);
+	if (num_connections != l->num_hidden * (l->num_input + 1) +
+		l->num_output * (l->num_hidden + 1)) {
+		fprintf(stderr, "%s is not fully connected.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	struct fann_connection *connections = malloc(num_connections * sizeof(struct fann_connection));
+	fann_get_connection_array(ann, connections);
+	for (unsigned int c = 0; c < num_connections; c++)
+		*weight_of(l, &connections[c]) = connections[c].weight;
+	free(connections);
+	return l;
+}
+
+static struct fann *build_network(struct layers *l)
+{
+	struct fann *ann = fann_create_standard(3, l->num_input, l->num_hidden, l->num_output);
+	fann_set_activation_function_hidden(ann, l->hidden_function);
+	fann_set_activation_steepness_hidden(ann, l->hidden_steepness);
+	fann_set_activation_function_output(ann, l->output_function);
+	fann_set_activation_steepness_output(ann, l->output_steepness);
+
+	unsigned int num_connections = fann_get_total_connections(ann);
+	struct fann_connection *connections = malloc(num_connections * sizeof(struct fann_connection));
+	fann_get_connection_array(ann, connections);
+	for (unsigned int c = 0; c < num_connections; c++)
+		connections[c].weight = *weight_of(l, &connections[c]);
+	fann_set_weight_array(ann, connections, num_connections);
+	free(connections);
+	return ann;
+}
+
+/*
+Same activations as fann_run() for the supported functions.
+*/
+static fann_type activation(enum fann_activationfunc_enum function, fann_type steepness,
+	fann_type sum)
+{
+	switch (function) {
+		case FANN_SIGMOID: return 1 / (1 + expf(-2 * steepness * sum));
+		case FANN_SIGMOID_SYMMETRIC: return tanhf(steepness * sum);
+		default: return steepness * sum;
+	}
+}
+
+static void hidden_values(const struct layers *l, const fann_type *input, fann_type *values)
+{
+	for (unsigned int j = 0; j < l->num_hidden; j++) {
+		const fann_type *w = &l->hidden[j * (l->num_input + 1)];
+		fann_type sum = w[l->num_input];
+		for (unsigned int i = 0; i < l->num_input; i++) sum += w[i] * input[i];
+		values[j] = activation(l->hidden_function, l->hidden_steepness, sum);
+	}
+}
+
+/*
+Rank hidden units, most useful first, and compute their mean activation.
+*/
+static void rank_units(const struct layers *l, struct fann_train_data *data, bool sensitivity,
+	unsigned int *order, fann_type *mean)
+{
+	unsigned int h = l->num_hidden;
+	fann_type *values = malloc(h * sizeof(fann_type));
+	double *sum = calloc(h, sizeof(double));
+	double *deviation = calloc(h, sizeof(double));
+	double *score = malloc(h * sizeof(double));
+
+	for (unsigned int r = 0; r < data->num_data; r++) {
+		hidden_values(l, data->input[r], values);
+		for (unsigned int j = 0; j < h; j++) sum[j] += values[j];
+	}
+	for (unsigned int j = 0; j < h; j++) mean[j] = sum[j] / data->num_data;
+	for (unsigned int r = 0; r < data->num_data; r++) {
+		hidden_values(l, data->input[r], values);
+		for (unsigned int j = 0; j < h; j++) deviation[j] += fabsf(values[j] - mean[j]);
+	}
+
+	// Replacing unit j by its mean moves output o by w[o][j] * |value - mean|
+	for (unsigned int j = 0; j < h; j++) {
+		double magnitude = 0;
+		for (unsigned int o = 0; o < l->num_output; o++)
+			magnitude += fabsf(l->output[o * (h + 1) + j]);
+		score[j] = sensitivity ? magnitude * deviation[j] / data->num_data : magnitude;
+	}
+
+	for (unsigned int j = 0; j < h; j++) {
+		unsigned int k = j;
+		for (; k > 0 && score[order[k - 1]] < score[j]; k--) order[k] = order[k - 1];
+		order[k] = j;
+	}
+
+	free(values);
+	free(sum);
+	free(deviation);
+	free(score);
+}
+
+/*
+Keep the first size units of order, the others become constants added to
+the biases of the outputs.
+*/
+static struct layers *prune_units(const struct layers *l, const unsigned int *order,
+	const fann_type *mean, unsigned int size)
+{
+	struct layers *p = alloc_layers(l->num_input, size, l->num_output);
+	p->hidden_function = l->hidden_function;
+	p->hidden_steepness = l->hidden_steepness;
+	p->output_function = l->output_function;
+	p->output_steepness = l->output_steepness;
+
+	for (unsigned int k = 0; k < size; k++)
+		memcpy(&p->hidden[k * (l->num_input + 1)], &l->hidden[order[k] * (l->num_input + 1)],
+			(l->num_input + 1) * sizeof(fann_type));
+	for (unsigned int o = 0; o < l->num_output; o++) {
+		const fann_type *w = &l->output[o * (l->num_hidden + 1)];
+		fann_type *pw = &p->output[o * (size + 1)];
+		pw[size] = w[l->num_hidden];
+		for (unsigned int k = 0; k < l->num_hidden; k++) {
+			if (k < size) pw[k] = w[order[k]];
+			else pw[size] += w[order[k]] * mean[order[k]];
+		}
+	}
+	return p;
+}
+
+static int compare_magnitude(const void *a, const void *b)
+{
+	fann_type x = fabsf(*(const fann_type *) a), y = fabsf(*(const fann_type *) b);
+	return (x > y) - (x < y);
+}
+
+/*
+Zero a fraction of the weights, smallest first. Returns the weights left.
+*/
+static unsigned int zero_smallest(struct layers *l, float fraction)
+{
+	unsigned int num_hidden = l->num_hidden * (l->num_input + 1);
+	unsigned int total = num_hidden + l->num_output * (l->num_hidden + 1);
+	unsigned int num_zeroed = (unsigned int) (total * fraction);
+	if (num_zeroed > 0) {
+		fann_type *sorted = malloc(total * sizeof(fann_type));
+		memcpy(sorted, l->hidden, num_hidden * sizeof(fann_type));
+		memcpy(sorted + num_hidden, l->output, (total - num_hidden) * sizeof(fann_type));
+		qsort(sorted, total, sizeof(fann_type), compare_magnitude);
+		fann_type threshold = fabsf(sorted[num_zeroed - 1]);
+		free(sorted);
+
+		for (unsigned int i = 0; i < total; i++) {
+			fann_type *w = i < num_hidden ? &l->hidden[i] : &l->output[i - num_hidden];
+			if (fabsf(*w) <= threshold) *w = 0;
+		}
+	}
+
+	unsigned int nonzero = 0;
+	for (unsigned int i = 0; i < num_hidden; i++) nonzero += l->hidden[i] != 0;
+	for (unsigned int i = 0; i < total - num_hidden; i++) nonzero += l->output[i] != 0;
+	return nonzero;
+}
+
+/*
+Fraction of the samples whose highest output is the one expected, and
+time per fann_run().
+*/
+static float accuracy(struct fann *ann, struct fann_train_data *data, double *microseconds)
+{
+	struct timespec start, end;
+	unsigned int correct = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned int i = 0; i < data->num_data; i++) {
+		fann_type *output = fann_run(ann, data->input[i]);
+		unsigned int guess = 0, expected = 0;
+		for (unsigned int o = 1; o < data->num_output; o++) {
+			if (output[o] > output[guess]) guess = o;
+			if (data->output[i][o] > data->output[i][expected]) expected = o;
+		}
+		if (guess == expected) correct++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	*microseconds = ((end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3) /
+		(data->num_data > 0 ? data->num_data : 1);
+	return data->num_data > 0 ? (float) correct / data->num_data : 0;
+}
+
+static struct fann_train_data *read_train_data(const char *filename, struct fann *ann)
+{
+	struct fann_train_data *data = fann_read_train_from_file(filename);
+	if (data == NULL || fann_length_train_data(data) == 0) {
+		fprintf(stderr, "Cannot read training file %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	if (fann_num_input_train_data(data) != fann_get_num_input(ann) ||
+		fann_num_output_train_data(data) != fann_get_num_output(ann)) {
+		fprintf(stderr, "%s does not match the network (%u inputs, %u outputs).\n",
+			filename, fann_get_num_input(ann), fann_get_num_output(ann));
+		exit(EXIT_FAILURE);
+	}
+	return data;
+}
+
+/*
+Training samples whose outputs are those of the teacher.
+*/
+static struct fann_train_data *teacher_outputs(struct fann *teacher, struct fann_train_data *data)
+{
+	struct fann_train_data *targets = fann_duplicate_train_data(data);
+	for (unsigned int i = 0; i < targets->num_data; i++)
+		memcpy(targets->output[i], fann_run(teacher, targets->input[i]),
+			targets->num_output * sizeof(fann_type));
+	return targets;
+}
+
+/*
+Measure a network, print its line and keep it if it is the smallest
+meeting the bar so far. Takes ownership of l.
+*/
+static void measure(const char *method, struct layers *l, float fraction,
+	struct fann_train_data *test, float bar, struct candidate *best)
+{
+	unsigned int nonzero = zero_smallest(l, fraction);
+	unsigned int macs = l->num_hidden * (l->num_input + 1) + l->num_output * (l->num_hidden + 1);
+	struct fann *ann = build_network(l);
+	double microseconds;
+	float acc = accuracy(ann, test, &microseconds);
+	printf("%-10s %6u %8u %8u %10.2f %8.4f%s\n", method, l->num_hidden, nonzero, macs,
+		microseconds, acc, acc >= bar ? "" : "  below bar");
+
+	if (acc >= bar && (best->ann == NULL || macs < best->macs ||
+		(macs == best->macs && acc > best->accuracy))) {
+		if (best->ann != NULL) fann_destroy(best->ann);
+		*best = (struct candidate) { ann, l->num_hidden, macs, acc };
+	} else {
+		fann_destroy(ann);
+	}
+	free_layers(l);
+}
+
+/*
+The label map is saved first, as captcha_cari_train does.
+*/
+static void save_network(struct fann *ann, const label_map *labels, const char *filename)
+{
+	char labels_file[4096];
+	if (!label_map_filename(filename, labels_file, sizeof(labels_file)) ||
+		!label_map_save(labels_file, labels)) {
+		fprintf(stderr, "Cannot write label map of %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	if (fann_save(ann, tmp) != 0 || rename(tmp, filename) != 0) {
+		fprintf(stderr, "Cannot write network %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+static unsigned int parse_sizes(const char *list, unsigned int *sizes)
+{
+	unsigned int num_sizes = 0;
+	for (const char *p = list; *p != '\0' && num_sizes < MAX_SIZES; ) {
+		char *end;
+		long size = strtol(p, &end, 10);
+		if (end == p || size < 1 || (*end != ',' && *end != '\0')) return 0;
+		sizes[num_sizes++] = size;
+		p = *end == ',' ? end + 1 : end;
+	}
+	return num_sizes;
+}
+
+int main(int argc, char** argv)
+{
+	const char *usage = "Usage: %s [-r magnitude|sensitivity] [-s sizes] [-d epochs] "
+		"[-w fraction] [-t test_file] [-b accuracy] [-o output.net] teacher.net train_file\n";
+	bool sensitivity = true;
+	unsigned int sizes[MAX_SIZES] = { 64, 48, 32, 24, 16 };
+	unsigned int num_sizes = 5;
+	unsigned int distill_epochs = 0;
+	float fraction = 0;
+	const char *test_file = NULL, *output_file = NULL;
+	float bar = -1;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "b:d:o:r:s:t:w:")) != -1) {
+		switch (opt) {
+			case 'b': bar = atof(optarg); break;
+			case 'd': distill_epochs = atoi(optarg); break;
+			case 'o': output_file = optarg; break;
+			case 'r':
+				if (strcmp(optarg, "magnitude") != 0 && strcmp(optarg, "sensitivity") != 0) {
+					fprintf(stderr, usage, argv[0]);
+					exit(EXIT_FAILURE);
+				}
+				sensitivity = strcmp(optarg, "sensitivity") == 0;
+				break;
+			case 's': num_sizes = parse_sizes(optarg, sizes); break;
+			case 't': test_file = optarg; break;
+			case 'w': fraction = atof(optarg); break;
+			default:
+				fprintf(stderr, usage, argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+	if (argc - optind != 2 || num_sizes == 0 || fraction < 0 || fraction >= 1) {
+		fprintf(stderr, usage, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	const char *teacher_file = argv[optind], *train_file = argv[optind + 1];
+
+	struct fann *teacher = fann_create_from_file(teacher_file);
+	if (teacher == NULL) {
+		fprintf(stderr, "Cannot load network %s.\n", teacher_file);
+		exit(EXIT_FAILURE);
+	}
+	label_map labels;
+	if (!label_map_for_network(teacher_file, fann_get_num_output(teacher), &labels)) {
+		fprintf(stderr, "Label map of %s is invalid or does not match its %u outputs.\n",
+			teacher_file, fann_get_num_output(teacher));
+		exit(EXIT_FAILURE);
+	}
+	struct layers *layers = read_layers(teacher, teacher_file);
+	struct fann_train_data *train = read_train_data(train_file, teacher);
+	struct fann_train_data *test = test_file != NULL ? read_train_data(test_file, teacher) : train;
+
+	double microseconds;
+	float teacher_accuracy = accuracy(teacher, test, &microseconds);
+	if (bar < 0) bar = teacher_accuracy;
+
+	unsigned int *order = malloc(layers->num_hidden * sizeof(unsigned int));
+	fann_type *mean = malloc(layers->num_hidden * sizeof(fann_type));
+	rank_units(layers, train, sensitivity, order, mean);
+	struct fann_train_data *targets = distill_epochs > 0 ? teacher_outputs(teacher, train) : NULL;
+
+	printf("%-10s %6s %8s %8s %10s %8s\n", "method", "hidden", "weights", "mult-add",
+		"us/symbol", "accuracy");
+	struct candidate best = { NULL, 0, 0, 0 };
+	struct layers *copy = prune_units(layers, order, mean, layers->num_hidden);
+	measure("teacher", copy, 0, test, bar, &best);
+
+	for (unsigned int s = 0; s < num_sizes; s++) {
+		if (sizes[s] > layers->num_hidden) {
+			fprintf(stderr, "Skipping %u hidden neurons, the teacher has %u.\n",
+				sizes[s], layers->num_hidden);
+			continue;
+		}
+		struct layers *pruned = prune_units(layers, order, mean, sizes[s]);
+		struct fann *student = distill_epochs > 0 ? build_network(pruned) : NULL;
+		measure("pruned", pruned, fraction, test, bar, &best);
+		if (student != NULL) {
+			for (unsigned int epoch = 0; epoch < distill_epochs; epoch++)
+				fann_train_epoch(student, targets);
+			measure("distilled", read_layers(student, "student"), fraction, test, bar, &best);
+			fann_destroy(student);
+		}
+	}
+
+	int status = EXIT_SUCCESS;
+	if (output_file != NULL) {
+		if (best.ann == NULL) {
+			printf("No network reaches accuracy %.4f, %s not written\n", bar, output_file);
+			status = EXIT_FAILURE;
+		} else {
+			printf("Saving %u hidden neurons, %u multiply-adds, accuracy %.4f, to %s\n",
+				best.hidden, best.macs, best.accuracy, output_file);
+			save_network(best.ann, &labels, output_file);
+		}
+	}
+
+	if (best.ann != NULL) fann_destroy(best.ann);
+	if (targets != NULL) fann_destroy_train(targets);
+	if (test != train) fann_destroy_train(test);
+	fann_destroy_train(train);
+	free(order);
+	free(mean);
+	free_layers(layers);
+	fann_destroy(teacher);
+	return status;
+}
@@ -0,0 +1,580 @@
+/**
+ * \file
+ *
+ * \brief Python extension module (captcha_cari)
+ *
+ * Decode captchas and extract features from Python without going through
+ * remove_noise, segmenter and decoder_cari.pl for each image.
+ *
+ * Images are passed through the buffer protocol and are not copied:
+ * bytes, bytearray, or a (N, 60, 150) uint8 NumPy array (a single
+ * (60, 150) image works too). Pixel values are the blue channel, a pixel
+ * is black above BLACK_THR. The GIL is released while images are
+ * processed, so several Python threads can work at the same time.
+ * With lockstep=True, pixels of BATCH_LANES images are grouped in lockstep
+ * (captcha_batch.c), which only beats grouping them one image at a time
+ * when captcha_batch.c is vectorized for AVX2 or wider: setup.py builds
+ * for the baseline instruction set, so it is off by default.
+ *
+ *     import captcha_cari
+ *     features, counts = captcha_cari.extract_features(images)
+ *     decoder = captcha_cari.Decoder("knn_multiple.net")
+ *     answers, features = decoder.decode(images)
+ *
+ * features is a (M, 31) float32 array, one row per symbol, symbols of
+ * each image in reading order. counts gives the number of symbols of
+ * each image, -1 if the image has too many groups of pixels to be a
+ * captcha. answers is a list of str, None for such images.
+ *
+ * Decoder(model, cache_size=n) keeps a cache of n glyphs -> class shared
+ * by all threads: symbols found in it skip features and network, and
+ * their features are NaN. decoder.cache_stats() gives its hit rate.
+ *
+ * decoder.reload() loads the network again (or another one), while other
+ * threads keep decoding: calls in flight finish with the old network.
+ * decoder.watch() reloads it when the file changes or on a command on a
+ * Unix socket (captcha_model.h).
+ *
+ * start_trace(), stop_trace() and write_trace(filename) record spans of
+ * each stage and image, from all threads, as a Chrome trace.
+ */
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#define NPY_NO_DEPRECATED_API NPY_1_7_API_VERSION
+#include <numpy/arrayobject.h>
+#include <string.h>
+#include "fann.h"
+#include "captcha_batch.h"
+#include "captcha_decode.h"
+#include "captcha_glyph_cache.h"
+#include "captcha_model.h"
+#include "captcha_trace.h"
+
+#define IMG_SIZE (IMG_WIDTH * IMG_HEIGHT) //!< Bytes per image
+#define CHUNK_IMAGES (16 * BATCH_LANES)   //!< Images grouped before their symbols
+
+/**
+ * Work on a batch of images, done without the GIL.
+ */
+typedef struct {
+    const uint8_t *images;           //!< nbImages images, one after the other
+    Py_ssize_t nbImages;
+    bool lockstep;                   //!< group pixels with label_pixels_batch()
+    struct fann *ann;                //!< NULL to only extract features
+    glyph_cache *cache;              //!< NULL for no glyph cache (needs ann)
+    uint32_t model;                  //!< version of ann, for the glyph cache
+    label_map labels;                //!< characters of the outputs of ann
+    float *features;                 //!< room for CAPTCHA_ARR_SIZE rows per image
+    int32_t *counts;                 //!< number of symbols per image
+    char (*answers)[ANSWER_SIZE];    //!< one answer per image if ann is set
+    uint8_t *pixels;                 //!< group IDs of CHUNK_IMAGES images
+    Py_ssize_t nbRows;               //!< number of rows written in features
+    bool failed;                     //!< out of memory
+} batch_job;
+
+static void run_batch (batch_job *job)
+{
+    symbols_struct symbols;
+    int nbGroups[CHUNK_IMAGES];
+    float *row = job->features;
+
+    job->nbRows = 0;
+    for (Py_ssize_t first=0; first < job->nbImages; first += CHUNK_IMAGES) {
+        int nb = job->nbImages - first < CHUNK_IMAGES ? job->nbImages - first : CHUNK_IMAGES;
+
+        // Group pixels of BATCH_LANES images at a time, or one by one
+        TRACE_IMAGE(-1);
+        if (job->lockstep) {
+            if (!label_pixels_batch(job->images + first * IMG_SIZE, nb, job->pixels, nbGroups)) {
+                job->failed = true;
+                return;
+            }
+        } else {
+            for (int i=0; i < nb; i++) {
+                nbGroups[i] = label_pixels(job->images + (first + i) * IMG_SIZE,
+                                           job->pixels + i * IMG_SIZE);
+            }
+        }
+
+        for (int i=0; i < nb; i++) {
+            int n = nbGroups[i];
+            TRACE_IMAGE(first + i);
+            if (n >= 0 && job->cache != NULL) {
+                segment_symbols(job->pixels + i * IMG_SIZE, n, &symbols);
+                n = symbols.nbSymbols;
+                classify_symbols_cached(job->ann, &job->labels, job->cache, job->model,
+                                        job->pixels + i * IMG_SIZE,
+                                        &symbols, job->answers[first + i]);
+            } else if (n >= 0) {
+                extract_features(job->pixels + i * IMG_SIZE, n, &symbols);
+                n = symbols.nbSymbols;
+                if (job->ann != NULL) {
+                    classify_symbols(job->ann, &job->labels, &symbols, job->answers[first + i]);
+                }
+            }
+
+            job->counts[first + i] = n;
+            if (n < 0) continue;
+
+            for (int s=0; s < n; s++) {
+                const double *features = symbols.features[symbols.order[s]];
+                for (int k=0; k < NB_FEATURES; k++) {
+                    *row++ = (float) features[k];
+                }
+            }
+            job->nbRows += n;
+        } // end for each image
+    } // end for each chunk
+} // end run_batch()
+
+/**
+ * Get a view on images. Raises an exception and returns false if the
+ * object cannot be seen as a list of IMG_HEIGHT x IMG_WIDTH bytes.
+ */
+static bool get_images (PyObject *obj, Py_buffer *view, Py_ssize_t *nbImages)
+{
+    if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS) < 0) return false;
+
+    if (view->itemsize != 1) {
+        PyErr_SetString(PyExc_TypeError, "images must be 8-bit pixels (uint8)");
+        goto error;
+    }
+    if (view->ndim >= 2 &&
+        (view->ndim > 3 ||
+         view->shape[view->ndim - 2] != IMG_HEIGHT ||
+         view->shape[view->ndim - 1] != IMG_WIDTH)) {
+        PyErr_Format(PyExc_ValueError, "images must have shape (N, %d, %d)",
+                     IMG_HEIGHT, IMG_WIDTH);
+        goto error;
+    }
+    if (view->len % IMG_SIZE != 0) {
+        PyErr_Format(PyExc_ValueError, "buffer length is not a multiple of %d",
+                     IMG_SIZE);
+        goto error;
+    }
+
+    *nbImages = view->len / IMG_SIZE;
+    return true;
+
+error:
+    PyBuffer_Release(view);
+    return false;
+} // end get_images()
+
+static void free_job (batch_job *job)
+{
+    PyMem_RawFree(job->features);
+    PyMem_RawFree(job->counts);
+    PyMem_RawFree(job->pixels);
+    PyMem_RawFree(job->answers);
+}
+
+/**
+ * Prepare a job on the images of view. Raises an exception and returns
+ * false if memory is missing.
+ */
+static bool init_job (batch_job *job, Py_buffer *view, Py_ssize_t nbImages, bool with_answers,
+                      bool lockstep)
+{
+    memset(job, 0, sizeof(batch_job));
+    job->images = view->buf;
+    job->nbImages = nbImages;
+    job->lockstep = lockstep;
+    job->features = PyMem_RawMalloc((nbImages * CAPTCHA_ARR_SIZE * NB_FEATURES + 1) * sizeof(float));
+    job->counts = PyMem_RawMalloc((nbImages + 1) * sizeof(int32_t));
+    job->pixels = PyMem_RawMalloc(CHUNK_IMAGES * IMG_SIZE);
+    if (with_answers) job->answers = PyMem_RawMalloc((nbImages + 1) * ANSWER_SIZE);
+
+    if (job->features == NULL || job->counts == NULL || job->pixels == NULL ||
+        (with_answers && job->answers == NULL)) {
+        free_job(job);
+        PyErr_NoMemory();
+        return false;
+    }
+    return true;
+} // end init_job()
+
+/**
+ * Copy features of a finished job into a new (M, NB_FEATURES) float32 array.
+ */
+static PyObject *features_array (batch_job *job)
+{
+    npy_intp dims[2] = { job->nbRows, NB_FEATURES };
+    PyObject *array = PyArray_SimpleNew(2, dims, NPY_FLOAT32);
+    if (array == NULL) return NULL;
+
+    memcpy(PyArray_DATA((PyArrayObject *) array), job->features,
+           job->nbRows * NB_FEATURES * sizeof(float));
+    return array;
+}
+
+static PyObject *captcha_extract_features (PyObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "images", "lockstep", NULL };
+    PyObject *images;
+    int lockstep = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p:extract_features", kwlist,
+                                     &images, &lockstep)) {
+        return NULL;
+    }
+
+    Py_buffer view;
+    Py_ssize_t nbImages;
+    if (!get_images(images, &view, &nbImages)) return NULL;
+
+    batch_job job;
+    if (!init_job(&job, &view, nbImages, false, lockstep)) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    run_batch(&job);
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&view);
+
+    if (job.failed) {
+        free_job(&job);
+        return PyErr_NoMemory();
+    }
+
+    PyObject *features = features_array(&job);
+    npy_intp dims[1] = { nbImages };
+    PyObject *counts = PyArray_SimpleNew(1, dims, NPY_INT32);
+    if (counts != NULL) {
+        memcpy(PyArray_DATA((PyArrayObject *) counts), job.counts, nbImages * sizeof(int32_t));
+    }
+    free_job(&job);
+
+    if (features == NULL || counts == NULL) {
+        Py_XDECREF(features);
+        Py_XDECREF(counts);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", features, counts);
+} // end captcha_extract_features()
+
+
+static PyObject *captcha_start_trace (PyObject *self, PyObject *args)
+{
+    trace_start();
+    Py_RETURN_NONE;
+}
+
+static PyObject *captcha_stop_trace (PyObject *self, PyObject *args)
+{
+    trace_stop();
+    Py_RETURN_NONE;
+}
+
+static PyObject *captcha_write_trace (PyObject *self, PyObject *args)
+{
+    const char *filename;
+    if (!PyArg_ParseTuple(args, "s:write_trace", &filename)) return NULL;
+
+    FILE *f = fopen(filename, "w");
+    if (f == NULL) return PyErr_SetFromErrnoWithFilename(PyExc_OSError, filename);
+
+    // Other threads may still be decoding: stop recording first
+    trace_stop();
+    bool ok;
+    Py_BEGIN_ALLOW_THREADS
+    ok = trace_write(f);
+    Py_END_ALLOW_THREADS
+    fclose(f);
+
+    if (!ok) {
+        PyErr_Format(PyExc_OSError, "Error writing trace file %s", filename);
+        return NULL;
+    }
+    Py_RETURN_NONE;
+} // end captcha_write_trace()
+
+
+/*****************************************************************************/
+/*                               Decoder type                                */
+/*****************************************************************************/
+
+typedef struct {
+    PyObject_HEAD
+    model_holder *models;   //!< current network
+    glyph_cache *cache;     //!< NULL if cache_size is 0
+    model_watcher *watcher; //!< NULL if not watching
+} DecoderObject;
+
+static int Decoder_init (DecoderObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "model", "cache_size", NULL };
+    const char *model;
+    Py_ssize_t cache_size = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|n:Decoder", kwlist,
+                                     &model, &cache_size)) return -1;
+    if (cache_size < 0) {
+        PyErr_SetString(PyExc_ValueError, "cache_size must be >= 0");
+        return -1;
+    }
+
+    glyph_cache_destroy(self->cache);
+    self->cache = NULL;
+    if (cache_size > 0) {
+        self->cache = glyph_cache_create(cache_size);
+        if (self->cache == NULL) {
+            PyErr_NoMemory();
+            return -1;
+        }
+    }
+
+    model_watcher_stop(self->watcher);
+    self->watcher = NULL;
+    model_holder_destroy(self->models);
+    self->models = model_holder_create(model);
+    if (self->models == NULL) {
+        PyErr_Format(PyExc_IOError, "cannot create network with %d inputs from %s",
+                     NB_FEATURES, model);
+        return -1;
+    }
+    return 0;
+} // end Decoder_init()
+
+static void Decoder_dealloc (DecoderObject *self)
+{
+    model_watcher_stop(self->watcher);
+    model_holder_destroy(self->models);
+    glyph_cache_destroy(self->cache);
+    Py_TYPE(self)->tp_free((PyObject *) self);
+}
+
+static PyObject *Decoder_decode (DecoderObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "images", "lockstep", NULL };
+    PyObject *images;
+    int lockstep = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p:decode", kwlist, &images, &lockstep)) {
+        return NULL;
+    }
+
+    if (self->models == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder is not initialized");
+        return NULL;
+    }
+
+    Py_buffer view;
+    Py_ssize_t nbImages;
+    if (!get_images(images, &view, &nbImages)) return NULL;
+
+    batch_job job;
+    if (!init_job(&job, &view, nbImages, true, lockstep)) {
+        PyBuffer_Release(&view);
+        return NULL;
+    }
+
+    // fann_run() writes into the network: each call works on its own copy
+    // so that threads can decode with the same Decoder. A reload during
+    // the call does not affect the copy.
+    job.cache = self->cache;
+    Py_BEGIN_ALLOW_THREADS
+    captcha_model *model = model_acquire(self->models);
+    job.ann = fann_copy(model->ann);
+    job.model = model->version;
+    job.labels = model->labels;
+    model_release(model);
+    if (job.ann != NULL) {
+        run_batch(&job);
+        fann_destroy(job.ann);
+    } else {
+        job.failed = true;
+    }
+    Py_END_ALLOW_THREADS
+
+    PyBuffer_Release(&view);
+
+    if (job.failed) {
+        free_job(&job);
+        return PyErr_NoMemory();
+    }
+
+    PyObject *answers = PyList_New(nbImages);
+    for (Py_ssize_t i=0; answers != NULL && i < nbImages; i++) {
+        PyObject *answer;
+        if (job.counts[i] < 0) {
+            Py_INCREF(Py_None);
+            answer = Py_None;
+        } else {
+            answer = PyUnicode_FromString(job.answers[i]);
+            if (answer == NULL) Py_CLEAR(answers);
+        }
+        if (answers != NULL) PyList_SET_ITEM(answers, i, answer);
+    }
+    PyObject *features = features_array(&job);
+    free_job(&job);
+
+    if (answers == NULL || features == NULL) {
+        Py_XDECREF(answers);
+        Py_XDECREF(features);
+        return NULL;
+    }
+    return Py_BuildValue("(NN)", answers, features);
+} // end Decoder_decode()
+
+static PyObject *Decoder_cache_stats (DecoderObject *self, PyObject *args)
+{
+    if (self->cache == NULL) Py_RETURN_NONE;
+
+    glyph_cache_stats stats;
+    glyph_cache_get_stats(self->cache, &stats);
+    return Py_BuildValue("{sKsKsKsKsnsnsd}",
+                         "lookups", (unsigned long long) stats.lookups,
+                         "hits", (unsigned long long) stats.hits,
+                         "insertions", (unsigned long long) stats.insertions,
+                         "evictions", (unsigned long long) stats.evictions,
+                         "entries", (Py_ssize_t) stats.entries,
+                         "capacity", (Py_ssize_t) stats.capacity,
+                         "hit_rate", stats.lookups ? (double) stats.hits / stats.lookups : 0.0);
+} // end Decoder_cache_stats()
+
+static PyObject *Decoder_reload (DecoderObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "model", NULL };
+    const char *model = NULL;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|z:reload", kwlist, &model)) return NULL;
+    if (self->models == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder is not initialized");
+        return NULL;
+    }
+
+    uint32_t version;
+    Py_BEGIN_ALLOW_THREADS
+    version = model_reload(self->models, model);
+    Py_END_ALLOW_THREADS
+
+    if (version == 0) {
+        PyErr_Format(PyExc_IOError, "cannot create network with %d inputs from %s",
+                     NB_FEATURES, model != NULL ? model : "the current file");
+        return NULL;
+    }
+    return PyLong_FromUnsignedLong(version);
+} // end Decoder_reload()
+
+static PyObject *Decoder_watch (DecoderObject *self, PyObject *args, PyObject *kwds)
+{
+    static char *kwlist[] = { "interval", "socket", "sighup", NULL };
+    double interval = 1.0;
+    const char *socket_path = NULL;
+    int sighup = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwds, "|dzp:watch", kwlist,
+                                     &interval, &socket_path, &sighup)) return NULL;
+    if (self->models == NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder is not initialized");
+        return NULL;
+    }
+    if (self->watcher != NULL) {
+        PyErr_SetString(PyExc_RuntimeError, "Decoder is already watching");
+        return NULL;
+    }
+
+    self->watcher = model_watcher_start(self->models, (int) (interval * 1000), sighup, socket_path);
+    if (self->watcher == NULL) return PyErr_SetFromErrno(PyExc_OSError);
+    Py_RETURN_NONE;
+} // end Decoder_watch()
+
+static PyObject *Decoder_get_version (DecoderObject *self, void *closure)
+{
+    if (self->models == NULL) Py_RETURN_NONE;
+    return PyLong_FromUnsignedLong(model_version(self->models));
+}
+
+static PyGetSetDef Decoder_getset[] = {
+    { "version", (getter) Decoder_get_version, NULL,
+      "Version of the network, 1 when created, +1 per reload.", NULL },
+    { NULL, NULL, NULL, NULL, NULL }
+};
+
+static PyMethodDef Decoder_methods[] = {
+    { "decode", (PyCFunction) Decoder_decode, METH_VARARGS | METH_KEYWORDS,
+      "decode(images, lockstep=False) -> (answers, features)\n\n"
+      "Decode captchas. answers is a list of str (None if an image has too\n"
+      "many groups of pixels), features a (M, 31) float32 array. lockstep\n"
+      "groups the pixels of several images at once (faster with AVX2 builds)." },
+    { "cache_stats", (PyCFunction) Decoder_cache_stats, METH_NOARGS,
+      "cache_stats() -> dict\n\n"
+      "Counters of the glyph cache (hits, lookups, evictions...), None\n"
+      "without cache." },
+    { "reload", (PyCFunction) Decoder_reload, METH_VARARGS | METH_KEYWORDS,
+      "reload(model=None) -> version\n\n"
+      "Load the network again, or another one, without stopping decodes in\n"
+      "other threads. Raises IOError and keeps the current one on failure." },
+    { "watch", (PyCFunction) Decoder_watch, METH_VARARGS | METH_KEYWORDS,
+      "watch(interval=1.0, socket=None, sighup=False)\n\n"
+      "Reload the network in the background when its file changes (checked\n"
+      "every interval seconds), on a \"reload [model]\" line sent to the Unix\n"
+      "socket path, and on SIGHUP if sighup is true." },
+    { NULL, NULL, 0, NULL }
+};
+
+static PyTypeObject DecoderType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    .tp_name = "captcha_cari.Decoder",
+    .tp_doc = "Decoder(model, cache_size=0)\n\nCaptcha decoder using a network saved by captcha_cari_train,\n"
+              "with a cache of cache_size glyphs if not 0.",
+    .tp_basicsize = sizeof(DecoderObject),
+    .tp_itemsize = 0,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_new = PyType_GenericNew,
+    .tp_init = (initproc) Decoder_init,
+    .tp_dealloc = (destructor) Decoder_dealloc,
+    .tp_methods = Decoder_methods,
+    .tp_getset = Decoder_getset,
+};
+
+
+/*****************************************************************************/
+/*                                  Module                                   */
+/*****************************************************************************/
+
+static PyMethodDef captcha_methods[] = {
+    { "extract_features", (PyCFunction) captcha_extract_features, METH_VARARGS | METH_KEYWORDS,
+      "extract_features(images, lockstep=False) -> (features, counts)\n\n"
+      "Features of each symbol, in reading order, as a (M, 31) float32 array,\n"
+      "and number of symbols of each image (-1 if too many groups of pixels).\n"
+      "lockstep as in Decoder.decode()." },
+    { "start_trace", captcha_start_trace, METH_NOARGS,
+      "start_trace()\n\nStart recording spans of each stage and image, in all threads." },
+    { "stop_trace", captcha_stop_trace, METH_NOARGS,
+      "stop_trace()\n\nStop recording spans." },
+    { "write_trace", captcha_write_trace, METH_VARARGS,
+      "write_trace(filename)\n\nStop recording and write spans as Chrome trace-event JSON\n"
+      "(open in Perfetto). Decoding must be finished in other threads." },
+    { NULL, NULL, 0, NULL }
+};
+
+static struct PyModuleDef captcha_module = {
+    PyModuleDef_HEAD_INIT,
+    .m_name = "captcha_cari",
+    .m_doc = "Captcha decoding and feature extraction.",
+    .m_size = -1,
+    .m_methods = captcha_methods,
+};
+
+PyMODINIT_FUNC PyInit_captcha_cari (void)
+{
+    import_array();
+
+    if (PyType_Ready(&DecoderType) < 0) return NULL;
+
+    PyObject *module = PyModule_Create(&captcha_module);
+    if (module == NULL) return NULL;
+
+    Py_INCREF(&DecoderType);
+    if (PyModule_AddObject(module, "Decoder", (PyObject *) &DecoderType) < 0) {
+        Py_DECREF(&DecoderType);
+        Py_DECREF(module);
+        return NULL;
+    }
+    PyModule_AddIntConstant(module, "IMG_WIDTH", IMG_WIDTH);
+    PyModule_AddIntConstant(module, "IMG_HEIGHT", IMG_HEIGHT);
+    PyModule_AddIntConstant(module, "NB_FEATURES", NB_FEATURES);
+
+    return module;
+} // end PyInit_captcha_cari()
@@ -12,6 +12,23 @@ $ann = fann_create_from_file($train_file);
 if (!$ann)
     die("ANN could not be created");
 
+// Character of each output: label map file of the network, or '0' + output
+$labels_file = (dirname(__FILE__) . "/knn_multiple.labels");
+$labels = "";
+if (is_file($labels_file)) {
+    foreach (file($labels_file, FILE_IGNORE_NEW_LINES) as $labels_line) {
+        if ($labels_line !== "" && $labels_line[0] !== '#') {
+            $labels = $labels_line;
+            break;
+        }
+    }
+} else {
+    for ($i = 0; $i < 74; $i++)
+        $labels .= chr($i + ord('0'));
+}
+if (strlen($labels) != fann_get_num_output($ann))
+    die("The label map does not match knn_multiple.net");
+
 while (($line = fgets(STDIN)) !== false) {
     $inputStrings = explode(' ', $line);
     $inputIntegers = array();
@@ -23,7 +40,7 @@ while (($line = fgets(STDIN)) !== false) {
     if(count($inputIntegers) > 3) {
         $calc_out = fann_run($ann, $inputIntegers);
         $guess = array_keys($calc_out, max($calc_out))[0];
-        print(chr($guess+ord('0')));
+        print($labels[$guess]);
     }
 }
 
@@ -17,12 +17,233 @@ License along with this library; if not, write to the Free Software
 Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+/*
+Usage:
+	captcha_cari_train train_file output.net
+		Train a new network from random weights.
+
+	captcha_cari_train -i current.net [-e epochs] [-t validation_file | -v fraction]
+	                   [-p patience] train_file [new_samples...] output.net
+		Fine-tune current.net on train_file and the new samples (same
+		format). Both networks are scored on samples neither was trained
+		on: validation_file, or else a fraction of the new samples (the
+		same ones for the same new samples), which are then not trained
+		on. Training stops when the accuracy on them no longer improves.
+		The output is written, and the new samples appended to
+		train_file, only if that accuracy is at least the one of
+		current.net, otherwise the program exits with status 2 and leaves
+		both untouched.
+
+	Both take [-l labels]
+		Label map file listing the characters to tell apart (see
+		captcha_labels.h): the network has one output per character of
+		it. By default a new network has the legacy outputs, '0' to 'y',
+		and a fine-tuned one those of current.net. Training files with
+		the legacy outputs are converted to the map when read. The map is
+		saved next to output.net (output.labels).
+
+	Both take [-a corpus.tar[.gz] [-n variants] [-j threads]]
+		Add to the training samples of each epoch variants of the glyphs
+		of the training samples (_1 to _3) of a corpus, as sample_features
+		reads them: slightly rotated and sheared, thicker or thinner, with
+		noisy edges. Threads make the variants of the next epoch while the
+		current one trains, so every epoch sees new ones.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "fann.h"
+#include "captcha_augment.h"
+#include "captcha_labels.h"
 
-int main(int argc, char** argv)
+#define EXIT_REGRESSION 2
+
+/*
+Largest rotation (radians) and shear (pixels per row) of a variant, then
+probabilities to thicken or thin its strokes and to flip an edge pixel.
+*/
+static const augment_params augmentation = { 0.15f, 0.3f, 0.2f, 0.05f };
+
+/*
+Fraction of the samples whose highest output is the one expected.
+*/
+static float accuracy(struct fann *ann, struct fann_train_data *data)
+{
+	unsigned int correct = 0;
+	for (unsigned int i = 0; i < data->num_data; i++) {
+		fann_type *output = fann_run(ann, data->input[i]);
+		unsigned int guess = 0, expected = 0;
+		for (unsigned int o = 1; o < data->num_output; o++) {
+			if (output[o] > output[guess]) guess = o;
+			if (data->output[i][o] > data->output[i][expected]) expected = o;
+		}
+		if (guess == expected) correct++;
+	}
+	return data->num_data > 0 ? (float) correct / data->num_data : 0;
+}
+
+/*
+Rows of legacy training data (outputs '0' to 'y') with the outputs of a
+label map instead.
+*/
+static struct fann_train_data *to_label_map(struct fann_train_data *legacy,
+	const label_map *labels, const char *filename)
+{
+	struct fann_train_data *data = fann_create_train(legacy->num_data, legacy->num_input,
+		labels->nbClasses);
+	if (data == NULL) {
+		fprintf(stderr, "Cannot allocate %u training samples.\n", legacy->num_data);
+		exit(EXIT_FAILURE);
+	}
+	for (unsigned int i = 0; i < legacy->num_data; i++) {
+		unsigned int expected = 0;
+		for (unsigned int o = 1; o < legacy->num_output; o++)
+			if (legacy->output[i][o] > legacy->output[i][expected]) expected = o;
+		int class = label_class(labels, '0' + expected);
+		if (class < 0) {
+			fprintf(stderr, "%s: sample %u is a '%c', which is not in the label map.\n",
+				filename, i + 1, '0' + expected);
+			exit(EXIT_FAILURE);
+		}
+
+		memcpy(data->input[i], legacy->input[i], legacy->num_input * sizeof(fann_type));
+		for (unsigned int o = 0; o < data->num_output; o++)
+			data->output[i][o] = (int) o == class ? 1 : -1;
+	}
+	fann_destroy_train(legacy);
+	return data;
+}
+
+static struct fann_train_data *read_train_data(const char *filename, struct fann *ann,
+	const label_map *labels)
+{
+	struct fann_train_data *data = fann_read_train_from_file(filename);
+	if (data == NULL) {
+		fprintf(stderr, "Cannot read training file %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+	if (fann_num_output_train_data(data) == LABEL_LEGACY_CLASSES &&
+		fann_get_num_output(ann) != LABEL_LEGACY_CLASSES) {
+		data = to_label_map(data, labels, filename);
+	}
+	if (fann_num_input_train_data(data) != fann_get_num_input(ann) ||
+		fann_num_output_train_data(data) != fann_get_num_output(ann)) {
+		fprintf(stderr, "%s does not match the network (%u inputs, %u outputs).\n",
+			filename, fann_get_num_input(ann), fann_get_num_output(ann));
+		exit(EXIT_FAILURE);
+	}
+	return data;
+}
+
+/*
+Files are written to a temporary file then renamed, so that readers (such
+as a decoder watching the network) never see a partial file.
+*/
+static void save_train_data(struct fann_train_data *data, const char *filename)
+{
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	if (fann_save_train(data, tmp) != 0 || rename(tmp, filename) != 0) {
+		fprintf(stderr, "Cannot write training file %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+The label map is saved first: a decoder reloading the network when it
+changes finds the map of the new network.
+*/
+static void save_network(struct fann *ann, const label_map *labels, const char *filename)
+{
+	char labels_file[4096];
+	if (!label_map_filename(filename, labels_file, sizeof(labels_file)) ||
+		!label_map_save(labels_file, labels)) {
+		fprintf(stderr, "Cannot write label map of %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+
+	char tmp[4096];
+	snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+	if (fann_save(ann, tmp) != 0 || rename(tmp, filename) != 0) {
+		fprintf(stderr, "Cannot write network %s.\n", filename);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/*
+Start the threads making variants of the glyphs of a corpus.
+*/
+static augment_pipeline *start_augmentation(const char *corpus_file, augment_corpus **corpus,
+	const label_map *labels, int variants, int threads)
+{
+	*corpus = augment_load(corpus_file, labels);
+	if (*corpus == NULL) {
+		fprintf(stderr, "Cannot read corpus %s.\n", corpus_file);
+		exit(EXIT_FAILURE);
+	}
+	if (augment_nb_glyphs(*corpus) == 0) {
+		fprintf(stderr, "No training sample in corpus %s.\n", corpus_file);
+		exit(EXIT_FAILURE);
+	}
+	augment_pipeline *pipeline = augment_start(*corpus, &augmentation, variants, threads, 1);
+	if (pipeline == NULL) {
+		perror("Cannot start augmentation threads");
+		exit(EXIT_FAILURE);
+	}
+	printf("%d glyphs in %s, %d variants each per epoch, %d threads\n",
+		augment_nb_glyphs(*corpus), corpus_file, variants, threads);
+	return pipeline;
+}
+
+/*
+Training samples followed by room for the variants of an epoch.
+*/
+static struct fann_train_data *with_variants(struct fann_train_data *train,
+	const augment_corpus *corpus, int variants)
+{
+	unsigned int num_variants = augment_nb_glyphs(corpus) * variants;
+	struct fann_train_data *data = fann_create_train(train->num_data + num_variants,
+		train->num_input, train->num_output);
+	if (data == NULL) {
+		fprintf(stderr, "Cannot allocate %u training samples.\n", train->num_data + num_variants);
+		exit(EXIT_FAILURE);
+	}
+	for (unsigned int i = 0; i < train->num_data; i++) {
+		memcpy(data->input[i], train->input[i], train->num_input * sizeof(fann_type));
+		memcpy(data->output[i], train->output[i], train->num_output * sizeof(fann_type));
+	}
+	return data;
+}
+
+/*
+Train one epoch. With a pipeline, data ends with the rows of the variants
+(see with_variants()), which are replaced by the next batch first.
+*/
+static float train_epoch(struct fann *ann, struct fann_train_data *data,
+	augment_pipeline *pipeline)
+{
+	if (pipeline != NULL) {
+		const augment_batch *batch = augment_wait(pipeline);
+		unsigned int first = data->num_data - batch->nbRows;
+		for (int r = 0; r < batch->nbRows; r++) {
+			for (unsigned int i = 0; i < data->num_input; i++)
+				data->input[first + r][i] = batch->inputs[r * NB_FEATURES + i];
+			for (unsigned int o = 0; o < data->num_output; o++)
+				data->output[first + r][o] = batch->outputs[r * batch->nbOutputs + o];
+		}
+		augment_release(pipeline);
+	}
+	return fann_train_epoch(ann, data);
+}
+
+static int train_from_scratch(const char *train_file, const char *output_file,
+	const label_map *labels, const char *corpus_file, int variants, int threads)
 {
 	const unsigned int num_input = 31;
-	const unsigned int num_output = 74;
+	const unsigned int num_output = labels->nbClasses;
 	const unsigned int num_layers = 3;
 	const unsigned int num_neurons_hidden = 100;
 	const float desired_error = (const float) 0.001;
@@ -34,11 +255,247 @@ int main(int argc, char** argv)
 	fann_set_activation_function_hidden(ann, FANN_SIGMOID_SYMMETRIC);
 	fann_set_activation_function_output(ann, FANN_SIGMOID_SYMMETRIC);
 
-	fann_train_on_file(ann, argv[1], max_epochs, epochs_between_reports, desired_error);
+	if (corpus_file == NULL) {
+		struct fann_train_data *data = read_train_data(train_file, ann, labels);
+		fann_train_on_data(ann, data, max_epochs, epochs_between_reports, desired_error);
+		fann_destroy_train(data);
+	} else {
+		augment_corpus *corpus;
+		augment_pipeline *pipeline = start_augmentation(corpus_file, &corpus, labels, variants,
+			threads);
+		struct fann_train_data *train = read_train_data(train_file, ann, labels);
+		struct fann_train_data *data = with_variants(train, corpus, variants);
+		fann_destroy_train(train);
+
+		for (unsigned int epoch = 1; epoch <= max_epochs; epoch++) {
+			float mse = train_epoch(ann, data, pipeline);
+			if (epoch == 1 || epoch % epochs_between_reports == 0 || mse <= desired_error)
+				printf("Epochs     %8u. Current error: %.10f\n", epoch, mse);
+			if (mse <= desired_error) break;
+		}
 
-	fann_save(ann, argv[2]);
+		fann_destroy_train(data);
+		augment_stop(pipeline);
+		augment_free(corpus);
+	}
+
+	save_network(ann, labels, output_file);
 
 	fann_destroy(ann);
 
 	return 0;
 }
+
+/*
+Read the new samples, which follow train_file in train_files, as one set.
+NULL if there are none.
+*/
+static struct fann_train_data *read_new_samples(char **train_files, int nb_train_files,
+	struct fann *ann, const label_map *labels)
+{
+	struct fann_train_data *data = NULL;
+	for (int f = 1; f < nb_train_files; f++) {
+		struct fann_train_data *samples = read_train_data(train_files[f], ann, labels);
+		if (data == NULL) {
+			data = samples;
+			continue;
+		}
+		struct fann_train_data *merged = fann_merge_train_data(data, samples);
+		fann_destroy_train(samples);
+		fann_destroy_train(data);
+		data = merged;
+	}
+	return data;
+}
+
+static int train_incremental(const char *current_file, char **train_files, int nb_train_files,
+	const char *output_file, const label_map *wanted_labels, unsigned int max_epochs,
+	const char *validation_file, float validation_fraction, unsigned int patience,
+	const char *corpus_file, int variants, int threads)
+{
+	const unsigned int epochs_between_checks = 10;
+
+	struct fann *ann = fann_create_from_file(current_file);
+	if (ann == NULL) {
+		fprintf(stderr, "Cannot load network %s.\n", current_file);
+		exit(EXIT_FAILURE);
+	}
+
+	// Outputs cannot change while fine-tuning
+	label_map labels;
+	if (!label_map_for_network(current_file, fann_get_num_output(ann), &labels)) {
+		fprintf(stderr, "Label map of %s is invalid or does not match its %u outputs.\n",
+			current_file, fann_get_num_output(ann));
+		exit(EXIT_FAILURE);
+	}
+	if (wanted_labels != NULL && strcmp(wanted_labels->characters, labels.characters) != 0) {
+		fprintf(stderr, "%s was trained for the characters %s, not %s.\n",
+			current_file, labels.characters, wanted_labels->characters);
+		exit(EXIT_FAILURE);
+	}
+
+	struct fann_train_data *known = read_train_data(train_files[0], ann, &labels);
+	struct fann_train_data *new_samples = read_new_samples(train_files, nb_train_files, ann,
+		&labels);
+
+	// Validate on samples current.net was not trained on: the validation file, or
+	// else new samples held out of training. The split only depends on the new
+	// samples, so that train_file growing does not move it.
+	struct fann_train_data *validation, *fresh = new_samples;
+	if (validation_file != NULL) {
+		validation = read_train_data(validation_file, ann, &labels);
+	} else if (new_samples == NULL) {
+		fprintf(stderr, "No new samples to hold out, give a validation file (-t).\n");
+		exit(EXIT_FAILURE);
+	} else {
+		unsigned int num_new = fann_length_train_data(new_samples);
+		unsigned int num_validation = (unsigned int) (num_new * validation_fraction);
+		if (num_validation < 1 || num_validation >= num_new) {
+			fprintf(stderr, "Cannot hold out %u of %u new samples.\n", num_validation, num_new);
+			exit(EXIT_FAILURE);
+		}
+		struct fann_train_data *shuffled = fann_duplicate_train_data(new_samples);
+		if (shuffled == NULL) {
+			fprintf(stderr, "Cannot allocate %u training samples.\n", num_new);
+			exit(EXIT_FAILURE);
+		}
+		srand(0);
+		fann_shuffle_train_data(shuffled);
+		fresh = fann_subset_train_data(shuffled, 0, num_new - num_validation);
+		validation = fann_subset_train_data(shuffled, num_new - num_validation, num_validation);
+		fann_destroy_train(shuffled);
+	}
+
+	// Train on train_file and the new samples not held out. train_file with all the
+	// new samples appended is only saved with the network.
+	struct fann_train_data *train = known, *appended = NULL;
+	if (new_samples != NULL) {
+		train = fann_merge_train_data(known, fresh);
+		appended = fann_merge_train_data(known, new_samples);
+		if (train == NULL || appended == NULL) {
+			fprintf(stderr, "Cannot allocate %u training samples.\n",
+				fann_length_train_data(known) + fann_length_train_data(new_samples));
+			exit(EXIT_FAILURE);
+		}
+		if (fresh != new_samples) fann_destroy_train(fresh);
+		fann_destroy_train(new_samples);
+		fann_destroy_train(known);
+	}
+
+	float baseline = accuracy(ann, validation);
+	printf("%u training samples, %u validation samples, accuracy of %s: %.4f\n",
+		fann_length_train_data(train), fann_length_train_data(validation), current_file,
+		baseline);
+
+	// Variants are for training only, validation stays on real samples
+	augment_corpus *corpus = NULL;
+	augment_pipeline *pipeline = NULL;
+	if (corpus_file != NULL) {
+		pipeline = start_augmentation(corpus_file, &corpus, &labels, variants, threads);
+		struct fann_train_data *augmented = with_variants(train, corpus, variants);
+		fann_destroy_train(train);
+		train = augmented;
+	}
+
+	// Keep the best fine-tuned network, stop after patience checks without progress
+	struct fann *best = NULL;
+	float best_accuracy = -1;
+	unsigned int best_epoch = 0, checks_without_progress = 0;
+	for (unsigned int epoch = 1; epoch <= max_epochs; epoch++) {
+		float mse = train_epoch(ann, train, pipeline);
+		if (epoch % epochs_between_checks != 0 && epoch != max_epochs) continue;
+
+		float current = accuracy(ann, validation);
+		printf("Epoch %8u. MSE: %.6f. Validation accuracy: %.4f\n", epoch, mse, current);
+		if (current > best_accuracy) {
+			if (best != NULL) fann_destroy(best);
+			best = fann_copy(ann);
+			best_accuracy = current;
+			best_epoch = epoch;
+			checks_without_progress = 0;
+		} else if (++checks_without_progress >= patience) {
+			break;
+		}
+	}
+
+	int status = 0;
+	if (best != NULL && best_accuracy >= baseline) {
+		printf("Best validation accuracy %.4f at epoch %u, saving %s\n",
+			best_accuracy, best_epoch, output_file);
+		save_network(best, &labels, output_file);
+		if (appended != NULL) save_train_data(appended, train_files[0]);
+	} else {
+		printf("Validation accuracy regressed, %s not written\n", output_file);
+		if (appended != NULL) printf("New samples not appended to %s\n", train_files[0]);
+		status = EXIT_REGRESSION;
+	}
+
+	augment_stop(pipeline);
+	augment_free(corpus);
+	if (best != NULL) fann_destroy(best);
+	fann_destroy(ann);
+	fann_destroy_train(train);
+	fann_destroy_train(validation);
+	if (appended != NULL) fann_destroy_train(appended);
+
+	return status;
+}
+
+int main(int argc, char** argv)
+{
+	const char *current_file = NULL;
+	unsigned int max_epochs = 2000;
+	const char *validation_file = NULL;
+	float validation_fraction = 0.1f;
+	unsigned int patience = 20;
+	const char *corpus_file = NULL;
+	int variants = 1;
+	int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	const char *labels_file = NULL;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "a:e:i:j:l:n:p:t:v:")) != -1) {
+		switch (opt) {
+			case 'a': corpus_file = optarg; break;
+			case 'e': max_epochs = atoi(optarg); break;
+			case 'i': current_file = optarg; break;
+			case 'j': threads = atoi(optarg); break;
+			case 'l': labels_file = optarg; break;
+			case 'n': variants = atoi(optarg); break;
+			case 'p': patience = atoi(optarg); break;
+			case 't': validation_file = optarg; break;
+			case 'v': validation_fraction = atof(optarg); break;
+			default:
+				fprintf(stderr, "Usage: %s [-i current.net [-e epochs] [-t validation_file | "
+					"-v fraction] [-p patience]] [-l labels] [-a corpus [-n variants] "
+					"[-j threads]] train_file [new_samples...] output.net\n", argv[0]);
+				exit(EXIT_FAILURE);
+		}
+	}
+
+	int nb_files = argc - optind;
+	if (nb_files < 2 || (current_file == NULL && nb_files != 2) || variants < 1 || threads < 1 ||
+		(int) max_epochs < 1) {
+		fprintf(stderr, "Usage: %s [-i current.net [-e epochs] [-t validation_file | "
+			"-v fraction] [-p patience]] [-l labels] [-a corpus [-n variants] "
+			"[-j threads]] train_file [new_samples...] output.net\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	const char *output_file = argv[argc - 1];
+
+	label_map labels;
+	if (labels_file != NULL && !label_map_load(labels_file, &labels)) {
+		fprintf(stderr, "Cannot read label map %s.\n", labels_file);
+		exit(EXIT_FAILURE);
+	} else if (labels_file == NULL) {
+		label_map_legacy(&labels);
+	}
+
+	if (current_file == NULL) {
+		return train_from_scratch(argv[optind], output_file, &labels, corpus_file, variants,
+			threads);
+	}
+	return train_incremental(current_file, &argv[optind], nb_files - 1, output_file,
+		labels_file != NULL ? &labels : NULL, max_epochs, validation_file, validation_fraction,
+		patience, corpus_file, variants, threads);
+}
@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include "captcha_common.h"
 
 Coord get_north_coord (Coord c)      { return (Coord){ c.x     , c.y - 1     };  }
@@ -174,6 +175,49 @@ median_elem_type median(median_elem_type m[], int n)
     else return mingtguess;
 }
 
+/**
+ * Names of the stages, bit i is stage_names[i].
+ */
+static const char *const stage_names[NB_STAGES] = {
+    "label", "segment", "features", "classify", "debug-image", "drawings"
+};
+
+int stages_needed (int stages)
+{
+    if (stages & STAGE_CLASSIFY) stages |= STAGE_FEATURES;
+    if (stages & (STAGE_FEATURES | STAGE_DRAWINGS)) stages |= STAGE_SEGMENT;
+    if (stages) stages |= STAGE_LABEL;
+    return stages;
+}
+
+int parse_stages (const char *list)
+{
+    int stages = 0;
+    while (*list != '\0') {
+        size_t length = strcspn(list, ",");
+        int s;
+        for (s=0; s < NB_STAGES; s++) {
+            if (strlen(stage_names[s]) == length && strncmp(list, stage_names[s], length) == 0) break;
+        }
+        if (s == NB_STAGES) return -1;
+        stages |= 1 << s;
+        list += length;
+        if (*list == ',') list++;
+    }
+    return stages;
+} // end parse_stages()
+
+void print_stages (FILE *out, int stages)
+{
+    const char *separator = "";
+    for (int s=0; s < NB_STAGES; s++) {
+        if (stages & (1 << s)) {
+            fprintf(out, "%s%s", separator, stage_names[s]);
+            separator = " ";
+        }
+    }
+}
+
 median_elem_type mean(median_elem_type m[], int n)
 {
     median_elem_type total = 0;
@@ -184,3 +228,29 @@ median_elem_type mean(median_elem_type m[], int n)
 
     return total / n;
 }
+
+bool read_gray_image (const uint8_t *data, size_t size, uint8_t *gray)
+{
+    const size_t img_size = IMG_WIDTH * IMG_HEIGHT;
+    if (size == img_size) {
+        memcpy(gray, data, img_size);
+        return true;
+    }
+
+    // Binary PGM with a header as written by the generator. The header is
+    // copied first: data need not be '\0' terminated.
+    if (size <= img_size) return false;
+    char header[32];
+    size_t header_size = size - img_size < sizeof(header) ? size - img_size : sizeof(header) - 1;
+    memcpy(header, data, header_size);
+    header[header_size] = '\0';
+
+    int width, height, maxval, header_length;
+    if (sscanf(header, "P5 %d %d %d%n", &width, &height, &maxval, &header_length) == 3 &&
+        width == IMG_WIDTH && height == IMG_HEIGHT && maxval == 255 &&
+        size - img_size == (size_t) header_length + 1) {
+        memcpy(gray, data + header_length + 1, img_size);
+        return true;
+    }
+    return false;
+} // end read_gray_image()
@@ -122,6 +122,50 @@ int char_to_int(char *char_array, size_t len);
 
 pixels_struct convert_txt_to_1dim_array(FILE* inputf);
 
+/**
+ * Read an image of IMG_WIDTH x IMG_HEIGHT 8-bit pixels from memory: raw
+ * (IMG_WIDTH * IMG_HEIGHT bytes) or binary PGM.
+ *
+ * \param data contents of the image file
+ * \param size bytes of data
+ * \param gray receives IMG_WIDTH * IMG_HEIGHT pixels
+ * \return false if data is not such an image
+ */
+bool read_gray_image (const uint8_t *data, size_t size, uint8_t *gray);
+
+/**
+ * Stages of the pipeline, as bits of a mask. A caller requests the
+ * artifacts it needs, and only their stages run (see stages_needed()).
+ */
+#define STAGE_LABEL       0x01 //!< label plane: group ID of each pixel
+#define STAGE_SEGMENT     0x02 //!< symbols: bounds, merged dots, reading order
+#define STAGE_FEATURES    0x04 //!< features of each symbol
+#define STAGE_CLASSIFY    0x08 //!< answer from the network
+#define STAGE_DEBUG_IMAGE 0x10 //!< image without noise, written by remove_noise
+#define STAGE_DRAWINGS    0x20 //!< text drawings of the captcha and its symbols
+#define NB_STAGES 6
+
+/**
+ * Add the stages the requested ones depend on: classification needs
+ * features, features and drawings need symbols, everything needs labels.
+ *
+ * \param stages requested stages (STAGE_LABEL...)
+ * \return stages to run
+ */
+int stages_needed (int stages);
+
+/**
+ * Parse a comma separated list of stage names ("segment,features").
+ *
+ * \return stages, -1 if a name is unknown
+ */
+int parse_stages (const char *list);
+
+/**
+ * Print the names of stages, separated by spaces.
+ */
+void print_stages (FILE *out, int stages);
+
 typedef float median_elem_type;
 
 median_elem_type median(median_elem_type m[], int n);
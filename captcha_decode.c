@@ -0,0 +1,122 @@
+/**
+ * \file
+ *
+ * \brief Classification of symbols with the network from captcha_cari_train
+ */
+
+#include <math.h>
+#include "fann.h"
+#include "captcha_decode.h"
+#include "captcha_glyph_cache.h"
+#include "captcha_labels.h"
+#include "captcha_trace.h"
+
+/**
+ * Run the network on the features of one symbol.
+ *
+ * \param score receives the output of the winning neuron
+ * \return index of the first output with the highest value
+ */
+static unsigned int run_network (struct fann *ann, const double *features, float *score)
+{
+    unsigned int num_output = fann_get_num_output(ann);
+    fann_type input[NB_FEATURES];
+
+    for (int k=0; k < NB_FEATURES; k++) {
+        input[k] = (fann_type) features[k];
+    }
+
+    fann_type *output = fann_run(ann, input);
+    unsigned int guess = 0;
+    for (unsigned int o=1; o < num_output; o++) {
+        if (output[o] > output[guess]) guess = o;
+    }
+    *score = output[guess];
+    return guess;
+} // end run_network()
+
+/**
+ * Character of an output of the network.
+ */
+static char output_character (const label_map *labels, unsigned int classId)
+{
+    return labels != NULL ? label_character(labels, classId) : (char) ('0' + classId);
+}
+
+void classify_symbols (struct fann *ann, const label_map *labels, const symbols_struct *symbols,
+                       char *answer)
+{
+    float score;
+
+    TRACE_BEGIN("classify");
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        unsigned int classId = run_network(ann, symbols->features[symbols->order[i]], &score);
+        answer[i] = output_character(labels, classId);
+    }
+
+    answer[symbols->nbSymbols] = '\0';
+    TRACE_END("classify");
+} // end classify_symbols()
+
+int classify_symbols_cached (struct fann *ann, const label_map *labels, struct glyph_cache *cache,
+                             uint32_t model, uint8_t *pixels, symbols_struct *symbols,
+                             char *answer)
+{
+    int hits = 0;
+
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        int symbol = symbols->order[i];
+        glyph_key key;
+        uint8_t classId;
+        float score;
+
+        glyph_key_from_symbol(pixels, symbols, symbol, model, &key);
+        if (glyph_cache_lookup(cache, &key, &classId, &score)) {
+            for (int k=0; k < NB_FEATURES; k++) symbols->features[symbol][k] = NAN;
+            hits++;
+        } else {
+            compute_features(pixels, symbols, symbol);
+            TRACE_BEGIN("classify");
+            classId = run_network(ann, symbols->features[symbol], &score);
+            TRACE_END("classify");
+            glyph_cache_insert(cache, &key, classId, score);
+        }
+        answer[i] = output_character(labels, classId);
+    } // end for each symbol
+
+    answer[symbols->nbSymbols] = '\0';
+    return hits;
+} // end classify_symbols_cached()
+
+int decode_captcha (struct fann *ann, const label_map *labels, const uint8_t *gray,
+                    symbols_struct *symbols, char *answer)
+{
+    uint8_t pixels[IMG_WIDTH * IMG_HEIGHT];
+
+    int ran = decode_stages(ann, labels, gray, STAGE_CLASSIFY, pixels, symbols, answer);
+    return ran & STAGE_CLASSIFY ? symbols->nbSymbols : -1;
+} // end decode_captcha()
+
+int decode_stages (struct fann *ann, const label_map *labels, const uint8_t *gray, int stages,
+                   uint8_t *pixels, symbols_struct *symbols, char *answer)
+{
+    stages = stages_needed(stages);
+    answer[0] = '\0';
+    symbols->nbSymbols = 0;
+    if (!(stages & STAGE_LABEL)) return 0;
+
+    component_table components;
+    int nbGroups = label_components(gray, pixels, &components);
+    if (nbGroups < 0 || !(stages & STAGE_SEGMENT)) return STAGE_LABEL;
+
+    segment_components(pixels, &components, symbols);
+    if (!(stages & STAGE_FEATURES)) return STAGE_LABEL | STAGE_SEGMENT;
+
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        compute_features(pixels, symbols, i);
+    }
+    if (!(stages & STAGE_CLASSIFY)) return STAGE_LABEL | STAGE_SEGMENT | STAGE_FEATURES;
+
+    classify_symbols(ann, labels, symbols, answer);
+    return STAGE_LABEL | STAGE_SEGMENT | STAGE_FEATURES | STAGE_CLASSIFY;
+} // end decode_stages()
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef CAPTCHA_DECODE_H
+#define CAPTCHA_DECODE_H
+
+#include <stdint.h>
+#include "captcha_features.h"
+#include "captcha_labels.h"
+
+struct fann;
+struct glyph_cache;
+
+/**
+ * Maximum length of a decoded captcha, including the terminating '\0'.
+ */
+#define ANSWER_SIZE (CAPTCHA_ARR_SIZE + 1)
+
+/**
+ * Classify symbols in reading order, like captcha_cari_test.php does
+ * with the features printed by the segmenter.
+ *
+ * Output neuron i stands for the i-th character of the label map.
+ *
+ * \param ann network trained by captcha_cari_train. fann_run() writes
+ *            into the network, so it must not be shared between threads.
+ * \param labels label map of the network (label_map_for_network()), NULL
+ *               for a legacy network: output i is '0' + i
+ * \param symbols symbols as filled by extract_features()
+ * \param answer receives the decoded captcha, '\0' terminated
+ *               (at least ANSWER_SIZE chars)
+ */
+void classify_symbols (struct fann *ann, const label_map *labels, const symbols_struct *symbols,
+                       char *answer);
+
+/**
+ * Same as classify_symbols() for symbols whose features have not been
+ * computed yet (segment_symbols()). A symbol whose glyph is in the cache
+ * gets the cached class without features nor network; its features are
+ * set to NaN. The others are computed, classified and cached.
+ *
+ * \param ann network, see classify_symbols()
+ * \param labels label map, see classify_symbols()
+ * \param cache glyph cache, can be shared between threads
+ * \param model version of ann, 0 if it is never reloaded (captcha_model.h).
+ *              Classes cached for other versions are ignored and age out.
+ * \param pixels pixels array, as renumbered by segment_symbols()
+ * \param symbols symbols as filled by segment_symbols(), receives features
+ * \param answer receives the decoded captcha (at least ANSWER_SIZE chars)
+ * \return number of symbols found in the cache
+ */
+int classify_symbols_cached (struct fann *ann, const label_map *labels, struct glyph_cache *cache,
+                             uint32_t model, uint8_t *pixels, symbols_struct *symbols,
+                             char *answer);
+
+/**
+ * Group pixels, extract features and classify symbols of one captcha.
+ *
+ * \param ann network, see classify_symbols()
+ * \param labels label map, see classify_symbols()
+ * \param gray IMG_WIDTH * IMG_HEIGHT 8-bit pixels, row by row
+ * \param symbols receives the symbols and their features
+ * \param answer receives the decoded captcha (at least ANSWER_SIZE chars)
+ * \return number of symbols, or -1 if the image contains too many groups
+ *         of pixels to be a captcha.
+ */
+int decode_captcha (struct fann *ann, const label_map *labels, const uint8_t *gray,
+                    symbols_struct *symbols, char *answer);
+
+/**
+ * Run the stages of decoding one captcha that the requested ones need
+ * (see stages_needed()), and no other: a caller wanting the reading
+ * order gets no features computed nor network run.
+ *
+ * \param ann network, see classify_symbols(). May be NULL without STAGE_CLASSIFY.
+ * \param labels label map, see classify_symbols()
+ * \param gray IMG_WIDTH * IMG_HEIGHT 8-bit pixels, row by row
+ * \param stages requested among STAGE_LABEL, STAGE_SEGMENT, STAGE_FEATURES
+ *               and STAGE_CLASSIFY
+ * \param pixels receives the label plane, renumbered if symbols are segmented
+ * \param symbols receives the symbols, with their features if computed
+ * \param answer receives the decoded captcha if classified, "" otherwise
+ * \return stages which ran. Only STAGE_LABEL if the image contains too many
+ *         groups of pixels to be a captcha, symbols then has none.
+ */
+int decode_stages (struct fann *ann, const label_map *labels, const uint8_t *gray, int stages,
+                   uint8_t *pixels, symbols_struct *symbols, char *answer);
+
+#endif
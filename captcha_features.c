@@ -0,0 +1,683 @@
+/**
+ * \file
+ *
+ * \brief Pixel grouping and feature extraction on in-memory buffers
+ *
+ * Same computations as the remove_noise and segmenter programs, without
+ * ImageMagick and without text files in between.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "captcha_features.h"
+#include "captcha_trace.h"
+
+#define min(a,b) ((a < b) ? (a) : (b))
+#define max(a,b) ((a > b) ? (a) : (b))
+
+bool is_black_value (uint8_t value) { return value > BLACK_THR; }
+
+/**
+ * Start the entry of a new group in the table.
+ */
+static void add_component (component_table *components, int groupId)
+{
+    components->nbComponents = groupId;
+    components->areas[groupId] = 0;
+    components->xMins[groupId] = IMG_WIDTH;
+    components->xMaxs[groupId] = 0;
+    components->yMins[groupId] = IMG_HEIGHT;
+    components->yMaxs[groupId] = 0;
+    components->firstYs[groupId] = IMG_HEIGHT;
+    components->xSums[groupId] = 0;
+    components->ySums[groupId] = 0;
+    components->mergedInto[groupId] = 0;
+}
+
+/**
+ * Account for a pixel of a group in the table.
+ */
+static inline void add_component_pixel (component_table *components, int groupId, int x, int y)
+{
+    components->areas[groupId]++;
+    components->xSums[groupId] += x;
+    components->ySums[groupId] += y;
+    if (x < components->xMins[groupId] ||
+        (x == components->xMins[groupId] && y < components->firstYs[groupId])) {
+        components->xMins[groupId] = x;
+        components->firstYs[groupId] = y;
+    }
+    if (x > components->xMaxs[groupId]) components->xMaxs[groupId] = x;
+    if (y < components->yMins[groupId]) components->yMins[groupId] = y;
+    if (y > components->yMaxs[groupId]) components->yMaxs[groupId] = y;
+}
+
+int label_pixels (const uint8_t *gray, uint8_t *pixels)
+{
+    component_table components;
+    return label_components(gray, pixels, &components);
+}
+
+int label_components (const uint8_t *gray, uint8_t *pixels, component_table *components)
+{
+    TRACE_BEGIN("label");
+    memset(pixels, 0, IMG_WIDTH * IMG_HEIGHT);
+
+    // Pixels still to visit. A pixel is labeled when pushed, so it is
+    // pushed at most once.
+    uint16_t stack[IMG_WIDTH * IMG_HEIGHT];
+    int nbGroups = 0;
+    components->nbComponents = 0;
+
+    for (int index = 0; index < IMG_WIDTH * IMG_HEIGHT; index++) {
+        if (pixels[index] || !is_black_value(gray[index])) continue;
+
+        if (nbGroups == CAPTCHA_ARR_SIZE) {
+            TRACE_END("label");
+            return -1;
+        }
+        nbGroups++;
+        add_component(components, nbGroups);
+
+        int top = 0;
+        stack[top++] = index;
+        pixels[index] = nbGroups;
+
+        while (top > 0) {
+            int current = stack[--top];
+            int x = current % IMG_WIDTH;
+            int y = current / IMG_WIDTH;
+            add_component_pixel(components, nbGroups, x, y);
+
+            for (int varY = y-1; varY <= y+1; varY++) {
+                for (int varX = x-1; varX <= x+1; varX++) {
+                    if (is_out_coord((Coord) {varX, varY})) continue;
+                    int neighbour = get_index(varX, varY);
+                    if (!pixels[neighbour] && is_black_value(gray[neighbour])) {
+                        pixels[neighbour] = nbGroups;
+                        stack[top++] = neighbour;
+                    }
+                } // end for varX
+            } // end for varY
+        } // end while
+    } // end for index
+
+    TRACE_END("label");
+    return nbGroups;
+} // end label_components()
+
+void component_table_from_pixels (const uint8_t *pixels, uint16_t nbGroups,
+                                  component_table *components)
+{
+    for (int groupId = 1; groupId <= nbGroups; groupId++) add_component(components, groupId);
+    components->nbComponents = nbGroups;
+
+    for (int y = 0; y < IMG_HEIGHT; y++) {
+        for (int x = 0; x < IMG_WIDTH; x++) {
+            int groupId = pixels[get_index(x, y)];
+            if (groupId != 0) add_component_pixel(components, groupId, x, y);
+        }
+    }
+} // end component_table_from_pixels()
+
+// In hole = !hasExit
+static bool has_exit(int x, int y, int firstX, int firstY, int lastX, int lastY,
+                     uint8_t *pixels, int groupId, uint8_t *visited, uint8_t *exit_array)
+{
+    int index = get_index(x,y);
+    if (visited[index]) return exit_array[index];
+    visited[index] = true;
+
+    // On a pixel from the group = wall.
+    int p = pixels[index];
+    bool is_wall = p == groupId;
+    if (is_wall) {
+        exit_array[index] = false;
+        return false;
+    }
+
+    bool has_exit_somewhere = false;
+    for (int varX = x-1; varX <= x+1 && !has_exit_somewhere; varX++) {
+        for (int varY = y-1; varY <= y+1 && !has_exit_somewhere; varY++) {
+            if (varX == x && varY == y) continue; // Ignore pixel corresponding to x,y params.
+
+            has_exit_somewhere = (varX < firstX||varX > lastX||varY < firstY||varY > lastY) ||
+                has_exit(varX, varY, firstX, firstY, lastX, lastY,
+                         pixels, groupId, visited, exit_array);
+        }
+    }
+    exit_array[index] = has_exit_somewhere;
+    return has_exit_somewhere;
+}
+
+// Returns true if pixel (x,y) is in a hole of the symbol (letters O, D, B, etc.)
+// x: absolute x
+// y: absolute y
+// firstX: first existent x
+// firstY: first existent y
+// lastX: last existent x
+// lastY: last existent y
+// groupId: id of symbol as found in pixels array
+static bool in_hole(int x, int y, int firstX, int firstY, int lastX, int lastY, uint8_t *pixels,
+                    size_t pixels_len, int groupId)
+{
+    if (pixels[get_index(x,y)] == groupId) return false;
+
+    uint8_t *visited = calloc(pixels_len, 1);
+    uint8_t *exit_array = calloc(pixels_len, 1);
+    bool r = has_exit(x, y, firstX, firstY, lastX, lastY, pixels, groupId, visited, exit_array);
+
+    free(visited);
+    free(exit_array);
+
+    return !r;
+}
+
+// Returns true if pixel at index is part of group. Some light matches
+// go past the bounds of the symbol, and even past the end of the image.
+static bool is_group_pixel(uint8_t *pixels, int index, int groupId)
+{
+    return index < IMG_WIDTH * IMG_HEIGHT && pixels[index] == groupId;
+}
+
+/**
+ * Compute the features of one symbol.
+ *
+ * \param pixels pixels array, dots already merged
+ * \param groupId id of symbol as found in pixels array
+ * \param xMin left bound
+ * \param xMax right bound
+ * \param yMin top bound
+ * \param yMax bottom bound
+ * \param has_dot true if a dot was merged into the symbol
+ * \param features receives NB_FEATURES values
+ */
+static void symbol_features(uint8_t *pixels, int groupId,
+                            int xMin, int xMax, int yMin, int yMax,
+                            bool has_dot, double *features)
+{
+    int width = xMax - xMin;
+    int height = yMax - yMin;
+
+    // Temporary work variables
+    bool last_pixel_on = false; // horizontal
+    int distance_from_center_horiz_total = 0;
+    int distance_from_center_horiz_measurements = 0;
+    int distance_from_center_vert_total = 0;
+    int distance_from_center_vert_measurements = 0;
+
+    /**
+     * FEATURES
+     */
+    int length = 0; // number of pixels in symbol
+    int broadest_segment = 0; // longest horizontal line of continuous pixels
+    bool has_hole = false; // 1 if letter has a hole, exhaustive list: B, D, G, O, P, Q, R
+    int max_horiz_transitions = 0; // max number of transitions in all rows
+    int max_vert_transitions = 0; // max number of transitions in all columns
+    int some_horiz_transitions[] = { 0, 0, 0, 0, 0 }; // other transitions (1/3, 1/2, 2/3, 1/4, 3/4)
+    int some_vert_transitions[] =  { 0, 0, 0, 0, 0 }; // other transitions (1/3, 1/2, 2/3, 1/4, 3/4)
+    // Taken from document "Optical character recognition system using
+    // support vecto machines" by "Eugen-Dumitru Tautu and Florin Leon"
+    float mean_distance_from_center_horiz = 0;
+    float mean_distance_from_center_vert = 0;
+
+    // Visit pixels of symbol zone
+    for (int y = yMin; y < yMax + 1; y++) {
+        int firstX = -1;
+        last_pixel_on = false;
+        int relY = y - yMin; // relative Y (0, 1, 2, 3...)
+        int theseTransitions = 0;
+
+        for (int x = xMin; x < xMax + 1; x++) {
+            int relX = x - xMin; // relative X (0, 1, 2, 3...)
+
+            int val = pixels[get_index(x,y)];
+            if (val == groupId) { // pixel part of the symbol
+                distance_from_center_horiz_total += abs(width / 2 - relX);
+                distance_from_center_horiz_measurements++;
+                distance_from_center_vert_total += abs(height / 2 - relY);
+                distance_from_center_vert_measurements++;
+
+                if (!last_pixel_on) {
+                    firstX = x; // used for broadest segment
+                    theseTransitions++;
+
+                    if (height/3 == relY) some_horiz_transitions[0]++;
+                    else if (height/2 == relY) some_horiz_transitions[1]++;
+                    else if (2*height/3 == relY) some_horiz_transitions[2]++;
+                    else if (height/4 == relY) some_horiz_transitions[3]++;
+                    else if (3*height/4 == relY) some_horiz_transitions[4]++;
+                }
+
+                // update broadest segment
+                if (x == xMax) {
+                    if ((x - firstX) > broadest_segment) {
+                        broadest_segment = (x - firstX);
+                    }
+                }
+
+                last_pixel_on = true;
+                length++;
+            }
+            else { // background pixel or from another symbol
+                // update broadest segment
+                if (last_pixel_on) {
+                    theseTransitions++;
+
+                    if ((x - firstX) > broadest_segment) {
+                        broadest_segment = x - firstX;
+                    }
+                } // end if last pixel on
+
+                last_pixel_on = false;
+            } // end if part of symbol
+        } // end for x
+
+        if (theseTransitions > max_horiz_transitions) {
+            max_horiz_transitions = theseTransitions;
+        }
+    } // end for y
+
+    for (int x = xMin; x < xMax + 1; x++) {
+        last_pixel_on = false;
+        int theseTransitions = 0;
+
+        for (int y = yMin; y < yMax + 1; y++) {
+            int relY = y - yMin; // relative Y (0, 1, 2, 3...)
+
+            int val = pixels[get_index(x,y)];
+            if (val == groupId) { // pixel part of the symbol
+                if (!last_pixel_on) {
+                    if (width/3 == relY) some_vert_transitions[0]++;
+                    else if (width/2 == relY) some_vert_transitions[1]++;
+                    else if (2*width/3 == relY) some_vert_transitions[2]++;
+                    else if (width/4 == relY) some_vert_transitions[3]++;
+                    else if (3*width/4 == relY) some_vert_transitions[4]++;
+
+                    theseTransitions++;
+                } // end if last pixel not on
+                last_pixel_on = true;
+            } else {
+                if (last_pixel_on) {
+                    theseTransitions++;
+                } // end if last pixel on
+                last_pixel_on = false;
+            } // end if part of symbol
+        } // end for y (2)
+        if (theseTransitions > max_vert_transitions) {
+            max_vert_transitions = theseTransitions;
+        }
+    } // end for x (2)
+
+
+    // Detect holes
+    // The idea is to find our way to an "exit". If this is not possible,
+    // we are trapped within the symbol, and so, there is a "hole" in it.
+    // TODO: Choose random pixels instead with a bias in the center.
+    TRACE_BEGIN("hole");
+    for (int y = yMin; y < yMax + 1; y++) {
+        if (has_hole) break;
+
+        for (int x = xMin; x < xMax + 1; x++) {
+
+            if (in_hole(x, y, xMin, yMin, xMax, yMax,
+                        pixels, IMG_WIDTH * IMG_HEIGHT, groupId)) {
+                has_hole = true;
+                break;
+            }
+        } // end for x (hole)
+    } // end for y (hole)
+    TRACE_END("hole");
+
+    /**
+     * Zoning
+     */
+    #define H_ZONES 3
+    #define V_ZONES 3
+    int zone_width = width/H_ZONES;
+    int zone_height = height/V_ZONES;
+    int zone_counts[H_ZONES * V_ZONES];
+    float zone_scaled[H_ZONES * V_ZONES];
+    for (int i=0; i < H_ZONES * V_ZONES; i++) {
+        zone_counts[i] = 0;
+    }
+
+    for (int h = 0; h < H_ZONES; h++) {
+        for (int v = 0; v < V_ZONES; v++) {
+            for (int y = yMin + v * zone_height; y < yMin + (v+1) * zone_height; y++) {
+                for (int x = xMin + h * zone_width; x < xMin + (h+1) * zone_width; x++) {
+                    if (pixels[get_index(x, y)] == groupId) {
+                        zone_counts[h * V_ZONES + v]++;
+                    }
+                } // end for x (x coordinate)
+            } // end for y (y coordinate)
+        } // end for v (vertical zones)
+    } // end for h (horizontal zones)
+
+    for (int i=0; i < H_ZONES * V_ZONES; i++) {
+        zone_scaled[i] = 2.0 * ((float) zone_counts[i] / (zone_height * zone_width)) - 1;
+        if (isnan(zone_scaled[i])) zone_scaled[i] = 0;
+    }
+
+
+    /**
+     * Light matches
+     * Draw a line somewhere in the character and look if any on pixel is on it.
+     */
+    float light_matches[7];
+    int n, o;
+    // The following code is for...
+    // -----------
+    // |         |
+    // |         |
+    // |         |
+    // |    |    | <== that line in the middle, at 8/10 of height
+    // -----------
+    n = 0;
+    o = 0;
+    int xMiddle = xMin + 1.0 * (xMax - xMin + 1) / 2.0;
+    for ( int y = yMin + 0.8 * (yMax - yMin + 1);
+              y <= yMax; y++) {
+        if (is_group_pixel(pixels, get_index(xMiddle,y), groupId)) {
+            n++;
+        }
+        o++;
+    }
+    #define Update_light_matches(lm) do { light_matches[lm] = 2.0 * ((float) n / o) - 1;if (isnan(light_matches[lm])) fprintf(stderr, "Light match %d is Nan.\n", lm); } while (0)
+    Update_light_matches(0);
+
+    // -----------
+    // |         |
+    // |-- < here|
+    // |         |
+    // |         |
+    // |         |
+    // -----------
+    n = 0;
+    o = 0;
+    int y14 = yMin + 0.25 * (yMax - yMin + 1);
+    for ( int x = xMin;
+              x <= xMin + 0.33 * (xMax - xMin + 1);
+              x++) {
+        if (is_group_pixel(pixels, get_index(x,y14), groupId)) {
+            n++;
+        }
+        o++;
+    }
+    Update_light_matches(1);
+
+    // -----------
+    // |         |
+    // |         |
+    // |         |
+    // |-- < here|
+    // |         |
+    // -----------
+    n = 0;
+    o = 0;
+    int y34 = yMin + 0.75 * (yMax - yMin + 1);
+    for ( int x = xMin;
+              x <= xMin + 0.33 * (xMax - xMin + 1);
+              x++) {
+        if (is_group_pixel(pixels, get_index(x,y34), groupId)) {
+            n++;
+        }
+        o++;
+    }
+    Update_light_matches(2);
+
+    // -----------
+    // |         |
+    // |here > --|
+    // |         |
+    // |         |
+    // |         |
+    // -----------
+    n = 0;
+    o = 0;
+    int y14r = yMin + 0.33 * (yMax - yMin + 1);
+    for ( int x = xMin + 0.66 * (xMax - xMin + 1);
+              x <= xMax;
+              x++) {
+        if (is_group_pixel(pixels, get_index(x,y14r), groupId)) {
+            n++;
+        }
+        o++;
+    }
+    Update_light_matches(3);
+
+    // -----------
+    // |         |
+    // |         |
+    // |         |
+    // |here > --|
+    // |         |
+    // -----------
+    n = 0;
+    o = 0;
+    int y34r = yMin + 0.66 * (yMax - yMin + 1);
+    for ( int x = xMin + 0.66 * (xMax - xMin + 1);
+              x <= xMax;
+              x++) {
+        if (is_group_pixel(pixels, get_index(x,y34r), groupId)) {
+            n++;
+        }
+        o++;
+    }
+    Update_light_matches(4);
+
+
+    // -----------
+    // |         |
+    // |         |
+    // |here > --|
+    // |         |
+    // |         |
+    // -----------
+    n = 0;
+    o = 0;
+    int y12r = yMin + 0.50 * (yMax - yMin + 1);
+    for ( int x = xMin + 0.66 * (xMax - xMin + 1);
+              x <= xMax;
+              x++) {
+        if (is_group_pixel(pixels, get_index(x,y12r), groupId)) {
+            n++;
+        }
+        o++;
+    }
+    Update_light_matches(5);
+
+
+    // -----------
+    // |         |
+    // |         |
+    // |-- < here|
+    // |         |
+    // |         |
+    // -----------
+    n = 0;
+    o = 0;
+    int y12 = yMin + 0.50 * (yMax - yMin + 1);
+    for ( int x = xMin;
+              x <= xMax + 0.33 * (xMax - xMin + 1);
+              x++) {
+        if (is_group_pixel(pixels, get_index(x,y12), groupId)) {
+            n++;
+        }
+        o++;
+    }
+    Update_light_matches(6);
+
+    /**
+     * Scale features
+     */
+    float aan_relative_length = (2.0 * length / (width*height)) - 1;
+    float aan_relative_broadest_segment = (2.0 * broadest_segment / width) - 1;
+    mean_distance_from_center_horiz = (float) distance_from_center_horiz_total /
+                                      distance_from_center_horiz_measurements;
+    mean_distance_from_center_vert = (float) distance_from_center_vert_total /
+                                      distance_from_center_vert_measurements;
+
+    double *f = features;
+    *f++ = (2.0 * (height > 22 ? 22 : height)) / 22 - 1; // symbol height (on 22)
+    *f++ = aan_relative_length;
+    *f++ = aan_relative_broadest_segment;
+    *f++ = (2.0 * (max_horiz_transitions > 14 ? 14 : max_horiz_transitions)) / 14 - 1;
+    *f++ = (2.0 * (max_vert_transitions  > 14 ? 14 : max_vert_transitions )) / 14 - 1;
+    *f++ = (2.0 * (mean_distance_from_center_horiz / width/2)) - 1;
+    *f++ = (2.0 * (mean_distance_from_center_vert / height/2)) - 1;
+    for (int i=0; i < 5; i++) {
+        *f++ = some_horiz_transitions[i];
+    }
+    for (int i=0; i < 7; i++) {
+        *f++ = light_matches[i];
+    }
+    *f++ = has_dot ? 1 : -1;
+    *f++ = (yMax > DESCENDER_Y) ? 1 : -1;
+    *f++ = has_hole ? 1 : -1;
+    for (int i=0; i < H_ZONES * V_ZONES; i++) {
+        *f++ = zone_scaled[i];
+    }
+} // end symbol_features()
+
+/**
+ * Compare reading order keys (see segment_components()).
+ */
+static int compare_keys (const void *a, const void *b)
+{
+    uint32_t keyA = *(const uint32_t *) a, keyB = *(const uint32_t *) b;
+    return (keyA > keyB) - (keyA < keyB);
+}
+
+void segment_symbols (uint8_t *pixels, uint16_t nbGroups, symbols_struct *symbols)
+{
+    component_table components;
+    component_table_from_pixels(pixels, nbGroups, &components);
+    segment_components(pixels, &components, symbols);
+}
+
+void segment_components (uint8_t *pixels, component_table *components, symbols_struct *symbols)
+{
+    TRACE_BEGIN("group");
+    int nbGroups = components->nbComponents;
+    uint16_t *xMins = components->xMins;
+    uint16_t *xMaxs = components->xMaxs;
+    uint16_t *yMins = components->yMins;
+    uint16_t *yMaxs = components->yMaxs;
+    uint8_t *mergedInto = components->mergedInto;
+
+    // Associate dot of letters i and j with the bottom of the letter: the
+    // first group, by ID, whose columns span the ones of the dot. Bounds
+    // grow as dots are merged, so groups are taken in order.
+    for (int groupId = 1; groupId < nbGroups + 1; groupId++) {
+        // detect if symbol within bounds
+        int nearGroupId = -1;
+        for (int otherGroupId = 1; otherGroupId < nbGroups + 1; otherGroupId++) {
+            if (groupId == otherGroupId) continue;
+
+            // 3 is to give some flexibility when the symbol is rotated / skewed
+            if (xMins[groupId] >= xMins[otherGroupId] - 3 &&
+                xMaxs[groupId] <= xMaxs[otherGroupId] + 3) {
+                nearGroupId = otherGroupId;
+                break;
+            }
+        }
+        if (nearGroupId == -1 || mergedInto[nearGroupId]) continue;
+
+        // Only the bounds of the dot are visited
+        for (int y = yMins[groupId]; y <= yMaxs[groupId]; y++) {
+            uint8_t *row = pixels + get_index(0, y);
+            for (int x = xMins[groupId]; x <= xMaxs[groupId]; x++) {
+                if (row[x] == groupId) row[x] = nearGroupId;
+            }
+        }
+        if (xMins[groupId] < xMins[nearGroupId] ||
+            (xMins[groupId] == xMins[nearGroupId] &&
+             components->firstYs[groupId] < components->firstYs[nearGroupId])) {
+            components->firstYs[nearGroupId] = components->firstYs[groupId];
+        }
+        yMins[nearGroupId] = min(yMins[groupId], yMins[nearGroupId]);
+        xMins[nearGroupId] = min(xMins[groupId], xMins[nearGroupId]);
+        yMaxs[nearGroupId] = max(yMaxs[groupId], yMaxs[nearGroupId]);
+        xMaxs[nearGroupId] = max(xMaxs[groupId], xMaxs[nearGroupId]);
+        components->areas[nearGroupId] += components->areas[groupId];
+        components->xSums[nearGroupId] += components->xSums[groupId];
+        components->ySums[nearGroupId] += components->ySums[groupId];
+
+        mergedInto[groupId] = nearGroupId;
+    }
+    TRACE_END("group");
+
+    // A group is a symbol unless it was merged, and has a dot if a group was merged into it
+    bool has_dot[nbGroups+1];
+    memset(has_dot, 0, sizeof(has_dot));
+    for (int groupId = 1; groupId < nbGroups+1; groupId++) {
+        if (mergedInto[groupId]) has_dot[mergedInto[groupId]] = true;
+    }
+
+    // Reading order is the order a column by column scan meets the symbols:
+    // by left column, then by top pixel in that column. The key of a symbol
+    // is its first pixel met, followed by its index.
+    uint32_t keys[CAPTCHA_ARR_SIZE];
+    uint16_t nbSymbols = 0;
+    for (int groupId = 1; groupId < nbGroups+1; groupId++) { // for each group
+        if (mergedInto[groupId]) continue;
+
+        symbols->groupIds[nbSymbols] = groupId;
+        symbols->xMins[nbSymbols] = xMins[groupId];
+        symbols->xMaxs[nbSymbols] = xMaxs[groupId];
+        symbols->yMins[nbSymbols] = yMins[groupId];
+        symbols->yMaxs[nbSymbols] = yMaxs[groupId];
+        symbols->hasDot[nbSymbols] = has_dot[groupId];
+        uint32_t firstPixel = xMins[groupId] * IMG_HEIGHT + components->firstYs[groupId];
+        keys[nbSymbols] = firstPixel << 8 | nbSymbols;
+        nbSymbols++;
+    } // end for each group
+    symbols->nbSymbols = nbSymbols;
+
+    TRACE_BEGIN("sort");
+    qsort(keys, nbSymbols, sizeof(uint32_t), compare_keys);
+    for (int i = 0; i < nbSymbols; i++) symbols->order[i] = keys[i] & 0xFF;
+    TRACE_END("sort");
+} // end segment_components()
+
+void compute_features (uint8_t *pixels, symbols_struct *symbols, int symbol)
+{
+    TRACE_BEGIN("features");
+    symbol_features(pixels, symbols->groupIds[symbol],
+                    symbols->xMins[symbol], symbols->xMaxs[symbol],
+                    symbols->yMins[symbol], symbols->yMaxs[symbol],
+                    symbols->hasDot[symbol], symbols->features[symbol]);
+    TRACE_END("features");
+}
+
+void extract_features (uint8_t *pixels, uint16_t nbGroups, symbols_struct *symbols)
+{
+    segment_symbols(pixels, nbGroups, symbols);
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        compute_features(pixels, symbols, i);
+    }
+}
+
+void extract_components_features (uint8_t *pixels, component_table *components,
+                                  symbols_struct *symbols)
+{
+    segment_components(pixels, components, symbols);
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        compute_features(pixels, symbols, i);
+    }
+}
+
+void print_features (FILE *f, const double *features)
+{
+    for (int i=0; i < NB_FEATURES; i++) {
+        if (i == 1) { // relative length
+            fprintf(f, "%.4f ", features[i]);
+        } else if ((i >= 7 && i <= 11) || (i >= 19 && i <= 21)) { // counts and flags
+            fprintf(f, "%d ", (int) features[i]);
+        } else {
+            fprintf(f, "%.3f ", features[i]);
+        }
+    }
+} // end print_features()
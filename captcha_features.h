@@ -0,0 +1,161 @@
+#pragma once
+#ifndef CAPTCHA_FEATURES_H
+#define CAPTCHA_FEATURES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "captcha_common.h"
+
+#define NB_FEATURES 31 //!< Number of values on a "CODED FEATURES" line
+
+/**
+ * An 8-bit pixel is black if its value is above this threshold.
+ * Same test as is_black() in remove_noise.c (blue > 60000 on 16 bits).
+ */
+#define BLACK_THR 233
+
+/**
+ * A symbol whose bottom is below this row has a descender (g, j, p, q,
+ * y): the one feature which depends on where the symbol is in the image.
+ */
+#define DESCENDER_Y 42
+
+/**
+ * Groups of adjacent black pixels (components), indexed by group ID from
+ * 1, as labeling finds them. Carried from labeling to segment_components()
+ * so that grouping, dot merging and reading order need no pass over the
+ * image. The centroid of a component is (xSums / areas, ySums / areas).
+ */
+typedef struct {
+    uint16_t nbComponents;                    //!< number of groups
+    uint16_t areas[CAPTCHA_ARR_SIZE + 1];     //!< number of pixels
+    uint16_t xMins[CAPTCHA_ARR_SIZE + 1];     //!< left bound
+    uint16_t xMaxs[CAPTCHA_ARR_SIZE + 1];     //!< right bound
+    uint16_t yMins[CAPTCHA_ARR_SIZE + 1];     //!< top bound
+    uint16_t yMaxs[CAPTCHA_ARR_SIZE + 1];     //!< bottom bound
+    uint16_t firstYs[CAPTCHA_ARR_SIZE + 1];   //!< top pixel of the left column, the first
+                                              //!< one met column by column
+    uint32_t xSums[CAPTCHA_ARR_SIZE + 1];     //!< sum of the columns of the pixels
+    uint32_t ySums[CAPTCHA_ARR_SIZE + 1];     //!< sum of the rows of the pixels
+    uint8_t  mergedInto[CAPTCHA_ARR_SIZE + 1]; //!< group a dot (i, j) was merged into, 0 if none
+} component_table;
+
+/**
+ * Symbols of a captcha, once the dots of i and j have been merged
+ * with the bottom of the letter.
+ *
+ * Symbols are stored in the order the segmenter prints them
+ * ("Group 1", "Group 2"...), which is not the reading order.
+ */
+typedef struct {
+    uint16_t nbSymbols;                   //!< number of symbols
+    uint8_t  groupIds[CAPTCHA_ARR_SIZE];  //!< group ID of symbol in pixels array
+    uint16_t xMins[CAPTCHA_ARR_SIZE];     //!< left bound of symbol
+    uint16_t xMaxs[CAPTCHA_ARR_SIZE];     //!< right bound of symbol
+    uint16_t yMins[CAPTCHA_ARR_SIZE];     //!< top bound of symbol
+    uint16_t yMaxs[CAPTCHA_ARR_SIZE];     //!< bottom bound of symbol
+    bool     hasDot[CAPTCHA_ARR_SIZE];    //!< a dot (i, j) was merged into symbol
+    uint8_t  order[CAPTCHA_ARR_SIZE];     //!< reading order, as symbol indices
+    double   features[CAPTCHA_ARR_SIZE][NB_FEATURES]; //!< "CODED FEATURES"
+} symbols_struct;
+
+/**
+ * Returns true if 8-bit pixel value is black.
+ *
+ * \param value pixel value (blue channel)
+ * \return true if pixel value is black.
+ */
+bool is_black_value (uint8_t value);
+
+/**
+ * Find groups of adjacent black pixels (including diagonal).
+ *
+ * Groups are numbered from 1, in the order their first pixel is met
+ * row by row, which is how remove_noise and convert_txt_to_1dim_array()
+ * number them.
+ *
+ * \param gray IMG_WIDTH * IMG_HEIGHT 8-bit pixels, row by row
+ * \param pixels IMG_WIDTH * IMG_HEIGHT array receiving the group ID
+ *               of each pixel, 0 for background.
+ * \return number of groups, or -1 if there are more than CAPTCHA_ARR_SIZE.
+ */
+int label_pixels (const uint8_t *gray, uint8_t *pixels);
+
+/**
+ * Same as label_pixels(), and fill the table of the groups on the way.
+ *
+ * \param components receives the groups, unless there are too many
+ */
+int label_components (const uint8_t *gray, uint8_t *pixels, component_table *components);
+
+/**
+ * Fill the table of the groups of a pixels array which was not labeled
+ * by label_components(), in one pass over the image.
+ *
+ * \param pixels pixels array as returned by label_pixels() or
+ *               convert_txt_to_1dim_array()
+ * \param nbGroups number of groups in pixels array (at most CAPTCHA_ARR_SIZE)
+ */
+void component_table_from_pixels (const uint8_t *pixels, uint16_t nbGroups,
+                                  component_table *components);
+
+/**
+ * Same as segment_symbols() with the table of the groups: only the
+ * pixels of merged dots are visited.
+ *
+ * \param pixels pixels array as labeled by label_components(). Merged
+ *               groups are renumbered in place.
+ * \param components groups of pixels, merged dots are recorded in it
+ */
+void segment_components (uint8_t *pixels, component_table *components, symbols_struct *symbols);
+
+/**
+ * Same as extract_features() with the table of the groups.
+ */
+void extract_components_features (uint8_t *pixels, component_table *components,
+                                  symbols_struct *symbols);
+
+/**
+ * Merge dots with their letter, compute bounds and reading order of
+ * each symbol, but not their features.
+ *
+ * \param pixels pixels array as returned by label_pixels() or
+ *               convert_txt_to_1dim_array(). Merged groups are
+ *               renumbered in place.
+ * \param nbGroups number of groups in pixels array (at most CAPTCHA_ARR_SIZE)
+ * \param symbols receives the symbols, features are left untouched
+ */
+void segment_symbols (uint8_t *pixels, uint16_t nbGroups, symbols_struct *symbols);
+
+/**
+ * Compute the features of one symbol.
+ *
+ * \param pixels pixels array, as renumbered by segment_symbols()
+ * \param symbols symbols as filled by segment_symbols()
+ * \param symbol index of the symbol in symbols (not in reading order)
+ */
+void compute_features (uint8_t *pixels, symbols_struct *symbols, int symbol);
+
+/**
+ * Merge dots with their letter, compute bounds, features and reading
+ * order of each symbol. This is the work of the segmenter program.
+ *
+ * \param pixels pixels array as returned by label_pixels() or
+ *               convert_txt_to_1dim_array(). Merged groups are
+ *               renumbered in place.
+ * \param nbGroups number of groups in pixels array (at most CAPTCHA_ARR_SIZE)
+ * \param symbols receives the symbols
+ */
+void extract_features (uint8_t *pixels, uint16_t nbGroups, symbols_struct *symbols);
+
+/**
+ * Print features the way they appear on a "CODED FEATURES" line,
+ * each value followed by a space.
+ *
+ * \param f output stream
+ * \param features NB_FEATURES values
+ */
+void print_features (FILE *f, const double *features);
+
+#endif
@@ -0,0 +1,201 @@
+/**
+ * \file
+ *
+ * \brief Cache of symbol classes keyed by normalized glyph
+ *
+ * Captchas never repeat, but their symbols come from a small font and
+ * the same glyphs come back all the time. A symbol found in the cache
+ * skips feature extraction and the network.
+ *
+ * The table is set-associative: a glyph can only be in the set given by
+ * its hash, so the size is bounded and eviction is local to the set
+ * (least recently used). Counters are kept per set, under the lock of
+ * the set, and summed by glyph_cache_get_stats().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "captcha_glyph_cache.h"
+
+typedef struct {
+    glyph_key key;
+    uint64_t  hash;
+    uint64_t  lastUse;  //!< tick of the set at last lookup or insertion
+    float     score;
+    uint8_t   classId;
+    bool      used;
+} cache_entry;
+
+typedef struct {
+    pthread_mutex_t mutex;
+    uint64_t tick;      //!< incremented at each access
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t insertions;
+    uint64_t evictions;
+    size_t   entries;
+    cache_entry ways[CACHE_WAYS];
+} cache_set;
+
+struct glyph_cache {
+    size_t nbSets;      //!< power of two
+    cache_set *sets;
+};
+
+/**
+ * Mix the words of a key (splitmix64 finalizer on each word).
+ */
+static uint64_t hash_key (const glyph_key *key)
+{
+    uint64_t words[(sizeof(glyph_key) + 7) / 8] = { 0 };
+    memcpy(words, key, sizeof(glyph_key));
+
+    uint64_t h = 0x9E3779B97F4A7C15u;
+    for (size_t i=0; i < sizeof(words) / sizeof(words[0]); i++) {
+        uint64_t z = h ^ words[i];
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9u;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBu;
+        h = z ^ (z >> 31);
+    }
+    return h;
+} // end hash_key()
+
+glyph_cache *glyph_cache_create (size_t capacity)
+{
+    size_t nbSets = 1;
+    while (nbSets * CACHE_WAYS < capacity) nbSets *= 2;
+
+    glyph_cache *cache = malloc(sizeof(glyph_cache));
+    if (cache == NULL) return NULL;
+    cache->nbSets = nbSets;
+    cache->sets = calloc(nbSets, sizeof(cache_set));
+    if (cache->sets == NULL) {
+        free(cache);
+        return NULL;
+    }
+
+    for (size_t s=0; s < nbSets; s++) {
+        pthread_mutex_init(&cache->sets[s].mutex, NULL);
+    }
+    return cache;
+} // end glyph_cache_create()
+
+void glyph_cache_destroy (glyph_cache *cache)
+{
+    if (cache == NULL) return;
+    for (size_t s=0; s < cache->nbSets; s++) {
+        pthread_mutex_destroy(&cache->sets[s].mutex);
+    }
+    free(cache->sets);
+    free(cache);
+}
+
+void glyph_key_from_symbol (const uint8_t *pixels, const symbols_struct *symbols,
+                            int symbol, uint32_t model, glyph_key *key)
+{
+    int xMin = symbols->xMins[symbol];
+    int yMin = symbols->yMins[symbol];
+    int width = symbols->xMaxs[symbol] - xMin + 1;
+    int height = symbols->yMaxs[symbol] - yMin + 1;
+    uint8_t groupId = symbols->groupIds[symbol];
+
+    memset(key, 0, sizeof(glyph_key));
+    key->width = width;
+    key->height = height;
+    key->hasDot = symbols->hasDot[symbol];
+    key->descender = symbols->yMaxs[symbol] > DESCENDER_Y;
+    key->model = model;
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = pixels + get_index(xMin, yMin + y);
+        uint16_t *cells = &key->rows[y * GLYPH_SIZE / height];
+        for (int x = 0; x < width; x++) {
+            if (row[x] == groupId) *cells |= 1u << (x * GLYPH_SIZE / width);
+        }
+    }
+} // end glyph_key_from_symbol()
+
+bool glyph_cache_lookup (glyph_cache *cache, const glyph_key *key,
+                         uint8_t *classId, float *score)
+{
+    uint64_t hash = hash_key(key);
+    cache_set *set = &cache->sets[hash & (cache->nbSets - 1)];
+    bool found = false;
+
+    pthread_mutex_lock(&set->mutex);
+    set->lookups++;
+    for (int w=0; w < CACHE_WAYS; w++) {
+        cache_entry *entry = &set->ways[w];
+        if (entry->used && entry->hash == hash &&
+            memcmp(&entry->key, key, sizeof(glyph_key)) == 0) {
+            entry->lastUse = ++set->tick;
+            *classId = entry->classId;
+            *score = entry->score;
+            set->hits++;
+            found = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&set->mutex);
+
+    return found;
+} // end glyph_cache_lookup()
+
+void glyph_cache_insert (glyph_cache *cache, const glyph_key *key,
+                         uint8_t classId, float score)
+{
+    uint64_t hash = hash_key(key);
+    cache_set *set = &cache->sets[hash & (cache->nbSets - 1)];
+
+    pthread_mutex_lock(&set->mutex);
+
+    // Same glyph (inserted by another thread meanwhile), else a free
+    // entry, else the least recently used one
+    cache_entry *victim = NULL;
+    for (int w=0; w < CACHE_WAYS; w++) {
+        cache_entry *entry = &set->ways[w];
+        if (entry->used && entry->hash == hash &&
+            memcmp(&entry->key, key, sizeof(glyph_key)) == 0) {
+            victim = entry;
+            break;
+        }
+        if (victim == NULL || (victim->used &&
+                               (!entry->used || entry->lastUse < victim->lastUse))) {
+            victim = entry;
+        }
+    } // end for each way
+
+    if (!victim->used) {
+        set->entries++;
+    } else if (victim->hash != hash || memcmp(&victim->key, key, sizeof(glyph_key)) != 0) {
+        set->evictions++;
+    }
+
+    victim->key = *key;
+    victim->hash = hash;
+    victim->lastUse = ++set->tick;
+    victim->classId = classId;
+    victim->score = score;
+    victim->used = true;
+    set->insertions++;
+
+    pthread_mutex_unlock(&set->mutex);
+} // end glyph_cache_insert()
+
+void glyph_cache_get_stats (glyph_cache *cache, glyph_cache_stats *stats)
+{
+    memset(stats, 0, sizeof(glyph_cache_stats));
+    stats->capacity = cache->nbSets * CACHE_WAYS;
+
+    for (size_t s=0; s < cache->nbSets; s++) {
+        cache_set *set = &cache->sets[s];
+        pthread_mutex_lock(&set->mutex);
+        stats->lookups += set->lookups;
+        stats->hits += set->hits;
+        stats->insertions += set->insertions;
+        stats->evictions += set->evictions;
+        stats->entries += set->entries;
+        pthread_mutex_unlock(&set->mutex);
+    }
+} // end glyph_cache_get_stats()
@@ -0,0 +1,87 @@
+#pragma once
+#ifndef CAPTCHA_GLYPH_CACHE_H
+#define CAPTCHA_GLYPH_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "captcha_features.h"
+
+#define GLYPH_SIZE 16 //!< Glyphs are normalized to GLYPH_SIZE x GLYPH_SIZE bits
+#define CACHE_WAYS 8  //!< Entries per set, the least recently used one is evicted
+
+/**
+ * Normalized glyph of a symbol: its bounding box scaled to
+ * GLYPH_SIZE x GLYPH_SIZE cells, a cell is on if a pixel of the symbol
+ * falls in it. Size and dot are part of the key, so that shapes which
+ * only differ by their proportions are not confused, and so is the
+ * descender flag, the only feature which depends on the position of the
+ * symbol, so that a shape seen higher or lower is not confused either.
+ */
+typedef struct {
+    uint16_t rows[GLYPH_SIZE]; //!< bit x of rows[y] is cell (x, y)
+    uint8_t  width;            //!< bounding box width in pixels
+    uint8_t  height;           //!< bounding box height in pixels
+    uint8_t  hasDot;           //!< a dot (i, j) was merged into symbol
+    uint8_t  descender;        //!< bottom below DESCENDER_Y (a feature of the network)
+    uint32_t model;            //!< version of the network which gave the class
+} glyph_key;
+
+/**
+ * Counters of a cache since its creation.
+ */
+typedef struct {
+    uint64_t lookups;   //!< calls to glyph_cache_lookup()
+    uint64_t hits;      //!< lookups which found the glyph
+    uint64_t insertions;
+    uint64_t evictions; //!< insertions which replaced another glyph
+    size_t   entries;   //!< glyphs currently cached
+    size_t   capacity;  //!< maximum number of glyphs
+} glyph_cache_stats;
+
+typedef struct glyph_cache glyph_cache;
+
+/**
+ * Create a cache of glyph -> class. It can be used by several threads
+ * at the same time: each set of CACHE_WAYS entries has its own lock.
+ *
+ * \param capacity maximum number of glyphs, rounded up to a power of two
+ *                 multiple of CACHE_WAYS
+ * \return cache, NULL if memory could not be allocated
+ */
+glyph_cache *glyph_cache_create (size_t capacity);
+
+void glyph_cache_destroy (glyph_cache *cache);
+
+/**
+ * Normalize a symbol.
+ *
+ * \param pixels pixels array, as renumbered by segment_symbols()
+ * \param symbols symbols as filled by segment_symbols()
+ * \param symbol index of the symbol in symbols
+ * \param model version of the network (see captcha_model.h), so that
+ *              classes given by a previous network are not used
+ * \param key receives the glyph
+ */
+void glyph_key_from_symbol (const uint8_t *pixels, const symbols_struct *symbols,
+                            int symbol, uint32_t model, glyph_key *key);
+
+/**
+ * Look a glyph up.
+ *
+ * \param classId receives the class (output neuron) if found
+ * \param score receives the output of that neuron if found
+ * \return true if the glyph is cached
+ */
+bool glyph_cache_lookup (glyph_cache *cache, const glyph_key *key,
+                         uint8_t *classId, float *score);
+
+/**
+ * Add a glyph, or update it if it is already cached.
+ */
+void glyph_cache_insert (glyph_cache *cache, const glyph_key *key,
+                         uint8_t classId, float score);
+
+void glyph_cache_get_stats (glyph_cache *cache, glyph_cache_stats *stats);
+
+#endif
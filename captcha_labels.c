@@ -0,0 +1,88 @@
+/**
+ * \file
+ *
+ * \brief Label map: characters of the outputs of the network
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "captcha_labels.h"
+
+#define LINE_SIZE 256 //!< Longest line of a label map file
+
+void label_map_legacy (label_map *map)
+{
+    char alphabet[LABEL_LEGACY_CLASSES + 1];
+    for (int i=0; i < LABEL_LEGACY_CLASSES; i++) alphabet[i] = '0' + i;
+    alphabet[LABEL_LEGACY_CLASSES] = '\0';
+    label_map_parse(alphabet, map);
+}
+
+bool label_map_parse (const char *alphabet, label_map *map)
+{
+    memset(map->classes, -1, sizeof(map->classes));
+    map->nbClasses = 0;
+    for (const char *c = alphabet; *c != '\0'; c++) {
+        // Printable, not a space, not twice
+        if (*c <= ' ' || *c > '~' || map->classes[(int) *c] >= 0 ||
+            map->nbClasses == LABEL_MAX_CLASSES) {
+            return false;
+        }
+        map->classes[(int) *c] = map->nbClasses;
+        map->characters[map->nbClasses++] = *c;
+    }
+    map->characters[map->nbClasses] = '\0';
+    return map->nbClasses > 0;
+} // end label_map_parse()
+
+bool label_map_load (const char *filename, label_map *map)
+{
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) return false;
+
+    char line[LINE_SIZE];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        found = line[0] != '#' && line[0] != '\0';
+    }
+    fclose(file);
+    return found && label_map_parse(line, map);
+} // end label_map_load()
+
+bool label_map_save (const char *filename, const label_map *map)
+{
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    FILE *file = fopen(tmp, "w");
+    if (file == NULL) return false;
+    fprintf(file, "# Characters of the outputs of the network, in order\n%s\n", map->characters);
+    if (fclose(file) != 0 || rename(tmp, filename) != 0) {
+        unlink(tmp);
+        return false;
+    }
+    return true;
+} // end label_map_save()
+
+bool label_map_filename (const char *net_filename, char *filename, size_t size)
+{
+    size_t length = strlen(net_filename);
+    if (length >= 4 && strcmp(net_filename + length - 4, ".net") == 0) length -= 4;
+    int n = snprintf(filename, size, "%.*s%s", (int) length, net_filename, LABEL_FILE_EXTENSION);
+    return n >= 0 && (size_t) n < size;
+}
+
+bool label_map_for_network (const char *net_filename, unsigned int nbOutputs, label_map *map)
+{
+    char filename[4096];
+    if (!label_map_filename(net_filename, filename, sizeof(filename))) return false;
+
+    if (access(filename, F_OK) == 0) {
+        if (!label_map_load(filename, map)) return false;
+    } else {
+        label_map_legacy(map);
+    }
+    return (unsigned int) map->nbClasses == nbOutputs;
+} // end label_map_for_network()
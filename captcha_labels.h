@@ -0,0 +1,94 @@
+#pragma once
+#ifndef CAPTCHA_LABELS_H
+#define CAPTCHA_LABELS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Label map file: the characters the network tells apart, output i of
+ * the network standing for the i-th one. Lines starting with '#' are
+ * comments, the first other non-empty line is the alphabet, e.g.
+ *
+ *     # Characters of the captchas, in class order
+ *     123456789ABCDEFGHJKLMPQRSTUVWXYabcdefhjkmnpqrstuvwxy
+ *
+ * A network x.net is decoded with the map in x.labels, saved next to it
+ * by captcha_cari_train. Networks without one are legacy networks, with
+ * one output per character from '0' to 'y' (LABEL_LEGACY_CLASSES).
+ */
+#define LABEL_MAX_CLASSES 94        //!< printable ASCII characters, space excluded
+#define LABEL_LEGACY_CLASSES 74     //!< '0' + i for output i
+#define LABEL_FILE_EXTENSION ".labels"
+
+typedef struct {
+    int nbClasses;
+    char characters[LABEL_MAX_CLASSES + 1]; //!< character of each class, '\0' terminated
+    int8_t classes[128];                    //!< class of each character, -1 if none
+} label_map;
+
+/**
+ * Map of legacy networks: class i is '0' + i, for LABEL_LEGACY_CLASSES
+ * classes.
+ */
+void label_map_legacy (label_map *map);
+
+/**
+ * Make a map from an alphabet.
+ *
+ * \param alphabet distinct printable characters, without spaces
+ * \return false if alphabet is not such a string
+ */
+bool label_map_parse (const char *alphabet, label_map *map);
+
+/**
+ * Read a label map file.
+ *
+ * \return false if the file cannot be read or holds no valid alphabet
+ */
+bool label_map_load (const char *filename, label_map *map);
+
+/**
+ * Write a label map file, replacing it in one step.
+ */
+bool label_map_save (const char *filename, const label_map *map);
+
+/**
+ * Name of the label map file of a network: its name with .net replaced
+ * by LABEL_FILE_EXTENSION (or appended to it).
+ *
+ * \return false if filename does not fit in size chars
+ */
+bool label_map_filename (const char *net_filename, char *filename, size_t size);
+
+/**
+ * Map of a network: its label map file if there is one, the legacy map
+ * otherwise.
+ *
+ * \param nbOutputs outputs of the network, which must be the number of
+ *                  classes of the map
+ * \return false if the file is invalid or does not match the network
+ */
+bool label_map_for_network (const char *net_filename, unsigned int nbOutputs, label_map *map);
+
+/**
+ * Class of a character.
+ *
+ * \return class, -1 if the character is not in the map
+ */
+static inline int label_class (const label_map *map, char character)
+{
+    unsigned char c = (unsigned char) character;
+    return c < 128 ? map->classes[c] : -1;
+}
+
+/**
+ * Character of a class, as returned by the argmax of the outputs.
+ */
+static inline char label_character (const label_map *map, unsigned int classId)
+{
+    return classId < (unsigned int) map->nbClasses ? map->characters[classId] : '?';
+}
+
+#endif
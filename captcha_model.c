@@ -0,0 +1,401 @@
+/**
+ * \file
+ *
+ * \brief Hot reload of the network
+ *
+ * The current model is a pointer swapped atomically. Decoders acquire it
+ * with an increment of its reference count and no lock, a reload
+ * publishes a new model and drops the reference of the holder on the old
+ * one, which is free'd when the last decode using it releases it.
+ *
+ * Between reading the pointer and incrementing the count, a reader could
+ * see a model which a reload is about to free. Readers announce
+ * themselves in holder->acquiring during these two instructions, and a
+ * reload waits for it to be 0 before dropping the old model. Only
+ * reloads ever wait.
+ */
+
+#define _POSIX_C_SOURCE 200809L // sigaction(), strdup()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "fann.h"
+#include "captcha_features.h"
+#include "captcha_model.h"
+
+struct model_holder {
+    captcha_model *current;   //!< atomic
+    uint32_t version;         //!< atomic, version of current
+    int acquiring;            //!< atomic, readers in model_acquire()
+    char *filename;           //!< file of current model, under mutex
+    pthread_mutex_t mutex;    //!< serializes reloads
+};
+
+/**
+ * Load a network as a model with one reference.
+ */
+static captcha_model *load_model (const char *filename, uint32_t version)
+{
+    struct fann *ann = fann_create_from_file(filename);
+    if (ann == NULL) return NULL;
+    label_map labels;
+    if (fann_get_num_input(ann) != NB_FEATURES ||
+        !label_map_for_network(filename, fann_get_num_output(ann), &labels)) {
+        fann_destroy(ann);
+        return NULL;
+    }
+
+    captcha_model *model = malloc(sizeof(captcha_model));
+    if (model == NULL) {
+        fann_destroy(ann);
+        return NULL;
+    }
+    model->ann = ann;
+    model->labels = labels;
+    model->version = version;
+    model->refs = 1;
+    return model;
+} // end load_model()
+
+model_holder *model_holder_create (const char *filename)
+{
+    model_holder *holder = malloc(sizeof(model_holder));
+    if (holder == NULL) return NULL;
+
+    holder->filename = strdup(filename);
+    holder->current = load_model(filename, 1);
+    if (holder->filename == NULL || holder->current == NULL) {
+        if (holder->current != NULL) model_release(holder->current);
+        free(holder->filename);
+        free(holder);
+        return NULL;
+    }
+    holder->version = 1;
+    holder->acquiring = 0;
+    pthread_mutex_init(&holder->mutex, NULL);
+    return holder;
+} // end model_holder_create()
+
+void model_holder_destroy (model_holder *holder)
+{
+    if (holder == NULL) return;
+    model_release(holder->current);
+    pthread_mutex_destroy(&holder->mutex);
+    free(holder->filename);
+    free(holder);
+}
+
+captcha_model *model_acquire (model_holder *holder)
+{
+    __atomic_add_fetch(&holder->acquiring, 1, __ATOMIC_SEQ_CST);
+    captcha_model *model = __atomic_load_n(&holder->current, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&model->refs, 1, __ATOMIC_SEQ_CST);
+    __atomic_sub_fetch(&holder->acquiring, 1, __ATOMIC_RELEASE);
+    return model;
+}
+
+void model_release (captcha_model *model)
+{
+    if (__atomic_sub_fetch(&model->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        fann_destroy(model->ann);
+        free(model);
+    }
+}
+
+uint32_t model_version (model_holder *holder)
+{
+    return __atomic_load_n(&holder->version, __ATOMIC_ACQUIRE);
+}
+
+uint32_t model_reload (model_holder *holder, const char *filename)
+{
+    pthread_mutex_lock(&holder->mutex);
+
+    char *name = strdup(filename != NULL ? filename : holder->filename);
+    uint32_t version = holder->version + 1;
+    captcha_model *model = name != NULL ? load_model(name, version) : NULL;
+    if (model == NULL) {
+        free(name);
+        pthread_mutex_unlock(&holder->mutex);
+        return 0;
+    }
+
+    captcha_model *old = __atomic_exchange_n(&holder->current, model, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&holder->version, version, __ATOMIC_RELEASE);
+
+    // Readers which may have read the old pointer have incremented its
+    // count once this is 0
+    while (__atomic_load_n(&holder->acquiring, __ATOMIC_SEQ_CST) != 0) sched_yield();
+    model_release(old);
+
+    free(holder->filename);
+    holder->filename = name;
+    pthread_mutex_unlock(&holder->mutex);
+
+    return version;
+} // end model_reload()
+
+
+/*****************************************************************************/
+/*                                  Watcher                                  */
+/*****************************************************************************/
+
+#define COMMAND_SIZE 4096 //!< Maximum length of a socket command
+
+struct model_watcher {
+    model_holder *holder;
+    pthread_t thread;
+    int poll_ms;
+    int wakeup[2];             //!< pipe: 'r' reload, 's' stop
+    int listenFd;              //!< -1 without socket
+    char *socket_path;
+    bool signals;
+    struct sigaction old_action; //!< SIGHUP handler before start
+};
+
+/** Write end of the pipe of the watcher handling signals, -1 if none */
+static volatile sig_atomic_t signal_fd = -1;
+
+static void on_sighup (int signum)
+{
+    (void) signum;
+    int saved_errno = errno;
+    if (signal_fd >= 0 && write(signal_fd, "r", 1) < 0) {
+        // Pipe full: a reload is already pending
+    }
+    errno = saved_errno;
+}
+
+/**
+ * Returns true if the file has changed since *last, and updates *last.
+ */
+static bool file_changed (const char *filename, struct stat *last)
+{
+    struct stat st;
+    if (stat(filename, &st) != 0) return false; // being replaced
+
+    bool changed = st.st_mtim.tv_sec != last->st_mtim.tv_sec ||
+                   st.st_mtim.tv_nsec != last->st_mtim.tv_nsec ||
+                   st.st_size != last->st_size || st.st_ino != last->st_ino;
+    *last = st;
+    return changed;
+}
+
+/**
+ * Copy of the file name of the current model.
+ */
+static char *current_filename (model_holder *holder)
+{
+    pthread_mutex_lock(&holder->mutex);
+    char *name = strdup(holder->filename);
+    pthread_mutex_unlock(&holder->mutex);
+    return name;
+}
+
+/**
+ * Read one command from a client, reload and reply.
+ */
+static void serve_client (model_watcher *watcher, int client)
+{
+    char command[COMMAND_SIZE];
+    size_t length = 0;
+
+    // Commands are short: do not let a slow client block the watcher
+    struct timeval timeout = { 1, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (length < sizeof(command) - 1) {
+        ssize_t n = read(client, command + length, sizeof(command) - 1 - length);
+        if (n <= 0) break;
+        length += n;
+        if (memchr(command, '\n', length) != NULL) break;
+    }
+    command[length] = '\0';
+    command[strcspn(command, "\r\n")] = '\0';
+
+    char reply[32];
+    uint32_t version = 0;
+    if (strcmp(command, "reload") == 0) {
+        version = model_reload(watcher->holder, NULL);
+    } else if (strncmp(command, "reload ", 7) == 0) {
+        version = model_reload(watcher->holder, command + 7);
+    }
+    if (version != 0) {
+        snprintf(reply, sizeof(reply), "ok %u\n", (unsigned int) version);
+    } else {
+        snprintf(reply, sizeof(reply), "error\n");
+    }
+    if (write(client, reply, strlen(reply)) < 0) {
+        // Client is gone, nothing to do
+    }
+} // end serve_client()
+
+static void *watch (void *arg)
+{
+    model_watcher *watcher = arg;
+    char *filename = current_filename(watcher->holder);
+    struct stat last;
+    memset(&last, 0, sizeof(last));
+    if (filename != NULL) file_changed(filename, &last);
+
+    for (;;) {
+        struct pollfd fds[2] = {
+            { .fd = watcher->wakeup[0], .events = POLLIN },
+            { .fd = watcher->listenFd, .events = POLLIN },
+        };
+        int n = poll(fds, watcher->listenFd >= 0 ? 2 : 1, watcher->poll_ms);
+
+        bool reload = false;
+        if (n > 0 && (fds[0].revents & POLLIN)) {
+            char buffer[64];
+            ssize_t nb = read(watcher->wakeup[0], buffer, sizeof(buffer));
+            if (nb > 0 && memchr(buffer, 's', nb) != NULL) break;
+            reload = nb > 0;
+        }
+        if (n > 0 && watcher->listenFd >= 0 && (fds[1].revents & POLLIN)) {
+            int client = accept(watcher->listenFd, NULL, NULL);
+            if (client >= 0) {
+                serve_client(watcher, client);
+                close(client);
+            }
+        }
+        if (reload) model_reload(watcher->holder, NULL);
+
+        // The file may have been changed by a socket command
+        char *name = current_filename(watcher->holder);
+        if (name != NULL && (filename == NULL || strcmp(name, filename) != 0)) {
+            free(filename);
+            filename = name;
+            file_changed(filename, &last);
+        } else {
+            free(name);
+            // A file still being written fails to load. It changes again
+            // when complete.
+            if (filename != NULL && file_changed(filename, &last)) {
+                model_reload(watcher->holder, NULL);
+            }
+        }
+    } // end for ever
+
+    free(filename);
+    return NULL;
+} // end watch()
+
+/**
+ * Listen on a Unix socket, replacing a stale one.
+ */
+static int open_socket (const char *path)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    unlink(path);
+    if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(fd, 4) != 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+} // end open_socket()
+
+model_watcher *model_watcher_start (model_holder *holder, int poll_ms,
+                                    bool signals, const char *socket_path)
+{
+    if (signals && signal_fd >= 0) {
+        errno = EBUSY;
+        return NULL;
+    }
+
+    model_watcher *watcher = calloc(1, sizeof(model_watcher));
+    if (watcher == NULL) return NULL;
+    watcher->holder = holder;
+    watcher->poll_ms = poll_ms;
+    watcher->listenFd = -1;
+    watcher->signals = signals;
+
+    if (pipe(watcher->wakeup) != 0) {
+        free(watcher);
+        return NULL;
+    }
+    for (int i=0; i < 2; i++) fcntl(watcher->wakeup[i], F_SETFD, FD_CLOEXEC);
+    fcntl(watcher->wakeup[1], F_SETFL, O_NONBLOCK); // written by the signal handler
+
+    if (socket_path != NULL) {
+        watcher->socket_path = strdup(socket_path);
+        watcher->listenFd = watcher->socket_path != NULL ? open_socket(socket_path) : -1;
+        if (watcher->listenFd < 0) goto error;
+    }
+
+    if (pthread_create(&watcher->thread, NULL, watch, watcher) != 0) goto error;
+
+    if (signals) {
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = on_sighup;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        signal_fd = watcher->wakeup[1];
+        sigaction(SIGHUP, &action, &watcher->old_action);
+    }
+    return watcher;
+
+error:
+    {
+        int saved_errno = errno;
+        if (watcher->listenFd >= 0) {
+            close(watcher->listenFd);
+            unlink(socket_path);
+        }
+        close(watcher->wakeup[0]);
+        close(watcher->wakeup[1]);
+        free(watcher->socket_path);
+        free(watcher);
+        errno = saved_errno;
+    }
+    return NULL;
+} // end model_watcher_start()
+
+void model_watcher_stop (model_watcher *watcher)
+{
+    if (watcher == NULL) return;
+
+    if (watcher->signals) {
+        sigaction(SIGHUP, &watcher->old_action, NULL);
+        signal_fd = -1;
+    }
+
+    // Blocking write: the stop request must not be lost
+    int flags = fcntl(watcher->wakeup[1], F_GETFL);
+    fcntl(watcher->wakeup[1], F_SETFL, flags & ~O_NONBLOCK);
+    if (write(watcher->wakeup[1], "s", 1) == 1) pthread_join(watcher->thread, NULL);
+
+    if (watcher->listenFd >= 0) {
+        close(watcher->listenFd);
+        unlink(watcher->socket_path);
+    }
+    close(watcher->wakeup[0]);
+    close(watcher->wakeup[1]);
+    free(watcher->socket_path);
+    free(watcher);
+} // end model_watcher_stop()
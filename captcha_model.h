@@ -0,0 +1,97 @@
+#pragma once
+#ifndef CAPTCHA_MODEL_H
+#define CAPTCHA_MODEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "captcha_labels.h"
+
+struct fann;
+
+/**
+ * A loaded network. Never changes once published: a reload publishes
+ * a new one, and the old one is free'd when its last user releases it.
+ */
+typedef struct {
+    struct fann *ann;  //!< network, shared: decode with a fann_copy()
+    label_map labels;  //!< characters of its outputs, from its label map file
+    uint32_t version;  //!< 1 for the first model of a holder, then +1 per reload
+    int refs;          //!< users, plus one while it is the current model
+} captcha_model;
+
+/**
+ * Current model of a decoder, swapped atomically by reloads.
+ */
+typedef struct model_holder model_holder;
+
+/**
+ * Load a network and make it the current model.
+ *
+ * \param filename network saved by captcha_cari_train
+ * \return holder, NULL if the network cannot be loaded, does not take
+ *         NB_FEATURES inputs, or does not match its label map file
+ *         (label_map_for_network())
+ */
+model_holder *model_holder_create (const char *filename);
+
+/**
+ * Free the holder and its current model. Models still acquired are
+ * free'd when released.
+ */
+void model_holder_destroy (model_holder *holder);
+
+/**
+ * Get the current model, without lock. It stays valid, even if a
+ * reload happens meanwhile, until model_release().
+ */
+captcha_model *model_acquire (model_holder *holder);
+
+/**
+ * Release a model returned by model_acquire().
+ */
+void model_release (captcha_model *model);
+
+/**
+ * Version of the current model, to check whether a copy made from it
+ * is outdated without acquiring it.
+ */
+uint32_t model_version (model_holder *holder);
+
+/**
+ * Load a network and make it the current model. Decodes in flight
+ * finish with the model they acquired. The current model is kept if
+ * the new one cannot be loaded.
+ *
+ * \param holder holder
+ * \param filename network to load, NULL to load the file of the current
+ *                 model again
+ * \return version of the new model, 0 if it could not be loaded
+ */
+uint32_t model_reload (model_holder *holder, const char *filename);
+
+/**
+ * Thread reloading the model of a holder when asked.
+ */
+typedef struct model_watcher model_watcher;
+
+/**
+ * Start a thread which reloads the model:
+ * - when the model file changes (modification time, size or inode,
+ *   checked every poll_ms; a file replaced with rename() is seen too),
+ * - on SIGHUP, if signals is true (the handler only wakes the thread up),
+ * - on a "reload [filename]" line on a Unix socket, if socket_path is
+ *   not NULL. The reply is "ok <version>" or "error".
+ *
+ * Only one watcher at a time can handle signals.
+ *
+ * \return watcher, NULL on error (errno is set)
+ */
+model_watcher *model_watcher_start (model_holder *holder, int poll_ms,
+                                    bool signals, const char *socket_path);
+
+/**
+ * Stop the thread, remove the socket and restore the SIGHUP handler.
+ */
+void model_watcher_stop (model_watcher *watcher);
+
+#endif
@@ -0,0 +1,212 @@
+/**
+ * \file
+ *
+ * \brief Networks in binary files mapped in memory
+ *
+ * fann_create_from_file() parses a text file number by number in every
+ * process. A .cnet file is mapped as is: the weights are used where they
+ * lie in the page cache, shared by all processes using the same file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "captcha_model_file.h"
+
+#define ALIGNED __attribute__ ((aligned (MODEL_FILE_ALIGN)))
+
+/**
+ * Returns true if a block of size bytes at offset is aligned and inside
+ * the file.
+ */
+static bool valid_block (uint64_t offset, uint64_t size, size_t fileSize)
+{
+    return offset % MODEL_FILE_ALIGN == 0 && offset <= fileSize && size <= fileSize - offset;
+}
+
+/**
+ * Returns true if the header describes a network this code can run,
+ * whose blocks are inside the file.
+ */
+static bool valid_header (const model_file_header *header, size_t size)
+{
+    if (header->magic != MODEL_FILE_MAGIC ||
+        header->version < 1 || header->version > MODEL_FILE_VERSION ||
+        header->weightType != MODEL_FLOAT32 ||
+        header->nbLayers < 1 || header->nbLayers > MODEL_FILE_MAX_LAYERS ||
+        header->nbInputs < 1 || header->nbInputs > MODEL_FILE_MAX_NEURONS) {
+        return false;
+    }
+
+    uint32_t nbInputs = header->nbInputs;
+    for (uint32_t l=0; l < header->nbLayers; l++) {
+        const model_file_layer *layer = &header->layers[l];
+        if (layer->nbNeurons < 1 || layer->nbNeurons > MODEL_FILE_MAX_NEURONS ||
+            layer->stride < layer->nbNeurons || layer->stride % 16 != 0 ||
+            layer->stride > MODEL_FILE_MAX_NEURONS ||
+            (layer->activation != MODEL_LINEAR && layer->activation != MODEL_SIGMOID &&
+             layer->activation != MODEL_SIGMOID_SYMMETRIC) ||
+            !(layer->steepness > 0) ||
+            !valid_block(layer->weightsOffset, (uint64_t) nbInputs * layer->stride * sizeof(float), size) ||
+            !valid_block(layer->biasesOffset, (uint64_t) layer->stride * sizeof(float), size)) {
+            return false;
+        }
+        nbInputs = layer->nbNeurons;
+    } // end for each layer
+
+    return true;
+} // end valid_header()
+
+/**
+ * Read the characters of the outputs of a valid file.
+ *
+ * \return false if its labels block is invalid or does not match the
+ *         outputs
+ */
+static bool read_labels (const model_file_header *header, const uint8_t *base, size_t size,
+                         label_map *labels)
+{
+    if (header->version < 2 || header->nbLabels == 0) {
+        label_map_legacy(labels);
+        return true;
+    }
+
+    uint32_t nbOutputs = header->layers[header->nbLayers - 1].nbNeurons;
+    if (header->nbLabels != nbOutputs || header->nbLabels > LABEL_MAX_CLASSES ||
+        !valid_block(header->labelsOffset, header->nbLabels, size)) {
+        return false;
+    }
+    char alphabet[LABEL_MAX_CLASSES + 1];
+    memcpy(alphabet, base + header->labelsOffset, header->nbLabels);
+    alphabet[header->nbLabels] = '\0';
+    return label_map_parse(alphabet, labels) && labels->nbClasses == (int) nbOutputs;
+} // end read_labels()
+
+mapped_model *mapped_model_open (const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+    if ((size_t) st.st_size < sizeof(model_file_header)) {
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd); // the mapping stays
+    if (base == MAP_FAILED) return NULL;
+
+    mapped_model *model = malloc(sizeof(mapped_model));
+    if (model == NULL) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    if (!valid_header(base, st.st_size) || !read_labels(base, base, st.st_size, &model->labels)) {
+        free(model);
+        munmap(base, st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+    model->base = base;
+    model->size = st.st_size;
+    model->header = base;
+    return model;
+} // end mapped_model_open()
+
+void mapped_model_close (mapped_model *model)
+{
+    if (model == NULL) return;
+    munmap((void *) model->base, model->size);
+    free(model);
+}
+
+uint32_t mapped_model_num_output (const mapped_model *model)
+{
+    return model->header->layers[model->header->nbLayers - 1].nbNeurons;
+}
+
+/**
+ * Compute one layer, like fann_run() does.
+ *
+ * \param out receives layer->stride values, padding included
+ */
+static void run_layer (const mapped_model *model, const model_file_layer *layer,
+                       uint32_t nbInputs, const float *restrict in, float *restrict out)
+{
+    const float *weights = (const float *) (model->base + layer->weightsOffset);
+    const float *biases = (const float *) (model->base + layer->biasesOffset);
+    uint32_t stride = layer->stride;
+
+    // Stride is a multiple of 16: the inner loop works on whole vectors
+    memcpy(out, biases, stride * sizeof(float));
+    for (uint32_t i=0; i < nbInputs; i++) {
+        const float *row = weights + (size_t) i * stride;
+        float value = in[i];
+        for (uint32_t j=0; j < stride; j++) out[j] += value * row[j];
+    }
+
+    float max_sum = 150 / layer->steepness;
+    for (uint32_t j=0; j < layer->nbNeurons; j++) {
+        float s = layer->steepness * out[j];
+        if (s > max_sum) s = max_sum; else if (s < -max_sum) s = -max_sum;
+
+        switch (layer->activation) {
+            case MODEL_SIGMOID_SYMMETRIC: out[j] = 2.0f / (1.0f + expf(-2.0f * s)) - 1.0f; break;
+            case MODEL_SIGMOID:           out[j] = 1.0f / (1.0f + expf(-2.0f * s)); break;
+            default:                      out[j] = s; break;
+        }
+    }
+} // end run_layer()
+
+void mapped_model_run (const mapped_model *model, const float *input, float *output)
+{
+    const model_file_header *header = model->header;
+    float buffers[2][MODEL_FILE_MAX_NEURONS] ALIGNED;
+
+    const float *in = input;
+    uint32_t nbInputs = header->nbInputs;
+    for (uint32_t l=0; l < header->nbLayers; l++) {
+        float *out = buffers[l % 2];
+        run_layer(model, &header->layers[l], nbInputs, in, out);
+        in = out;
+        nbInputs = header->layers[l].nbNeurons;
+    }
+    memcpy(output, in, nbInputs * sizeof(float));
+} // end mapped_model_run()
+
+void classify_symbols_mapped (const mapped_model *model, const symbols_struct *symbols,
+                              char *answer)
+{
+    uint32_t num_output = mapped_model_num_output(model);
+    float input[MODEL_FILE_MAX_NEURONS];
+    float output[MODEL_FILE_MAX_NEURONS];
+
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        const double *features = symbols->features[symbols->order[i]];
+        for (int k=0; k < NB_FEATURES; k++) {
+            input[k] = (float) features[k];
+        }
+
+        // First output with the highest value wins
+        mapped_model_run(model, input, output);
+        uint32_t guess = 0;
+        for (uint32_t o=1; o < num_output; o++) {
+            if (output[o] > output[guess]) guess = o;
+        }
+        answer[i] = label_character(&model->labels, guess);
+    } // end for each symbol
+
+    answer[symbols->nbSymbols] = '\0';
+} // end classify_symbols_mapped()
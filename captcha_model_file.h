@@ -0,0 +1,107 @@
+#pragma once
+#ifndef CAPTCHA_MODEL_FILE_H
+#define CAPTCHA_MODEL_FILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "captcha_features.h"
+#include "captcha_labels.h"
+
+/**
+ * Binary network file (.cnet), written by net_to_model.py.
+ *
+ * A header followed by blocks of little-endian floats, each starting at
+ * a multiple of MODEL_FILE_ALIGN bytes from the beginning of the file.
+ * Layer l has a weights block of [inputs of l][stride] floats (weights
+ * of all neurons for input 0, then input 1...) and a biases block of
+ * [stride] floats. stride is the number of neurons rounded up to a
+ * multiple of 16, padding is 0.
+ *
+ * Version 2 adds the characters of the outputs (label map of the
+ * network), one byte each, in a block of nbLabels bytes. Version 1 files
+ * and files with nbLabels 0 have the legacy map ('0' + i).
+ */
+#define MODEL_FILE_MAGIC 0x54454E43u  //!< "CNET"
+#define MODEL_FILE_VERSION 2
+#define MODEL_FILE_ALIGN 64           //!< Alignment of blocks, in bytes
+#define MODEL_FILE_MAX_LAYERS 8       //!< Layers with weights, inputs excluded
+#define MODEL_FILE_MAX_NEURONS 1024   //!< Neurons per layer
+
+/** Activation functions, same ids as FANN */
+#define MODEL_LINEAR 0
+#define MODEL_SIGMOID 3
+#define MODEL_SIGMOID_SYMMETRIC 5
+
+/** Weight types */
+#define MODEL_FLOAT32 0
+
+typedef struct {
+    uint32_t nbNeurons;     //!< neurons, bias excluded
+    uint32_t stride;        //!< floats per row of weights
+    uint32_t activation;    //!< MODEL_LINEAR...
+    float    steepness;     //!< activation steepness
+    uint64_t weightsOffset; //!< bytes from beginning of file
+    uint64_t biasesOffset;  //!< bytes from beginning of file
+} model_file_layer;
+
+typedef struct {
+    uint32_t magic;         //!< MODEL_FILE_MAGIC
+    uint32_t version;       //!< MODEL_FILE_VERSION
+    uint32_t nbInputs;
+    uint32_t nbLayers;      //!< layers with weights
+    uint32_t weightType;    //!< MODEL_FLOAT32
+    uint32_t nbLabels;      //!< characters of the outputs, 0 for the legacy map
+    uint64_t labelsOffset;  //!< bytes from beginning of file, 0 if nbLabels is 0
+    model_file_layer layers[MODEL_FILE_MAX_LAYERS];
+} model_file_header;
+
+/**
+ * A model file mapped read-only: processes using the same file share
+ * its pages in the page cache, and opening it costs no parsing.
+ */
+typedef struct {
+    const uint8_t *base;               //!< mapping of the whole file
+    size_t size;                       //!< file size
+    const model_file_header *header;   //!< = base
+    label_map labels;                  //!< characters of the outputs
+} mapped_model;
+
+/**
+ * Map and check a model file.
+ *
+ * \param filename .cnet file
+ * \return model, NULL if the file cannot be mapped or is not a valid
+ *         model file of version 1 or 2 (errno is set, EINVAL if invalid)
+ */
+mapped_model *mapped_model_open (const char *filename);
+
+/**
+ * Unmap a model file.
+ */
+void mapped_model_close (mapped_model *model);
+
+/**
+ * Number of outputs (neurons of the last layer).
+ */
+uint32_t mapped_model_num_output (const mapped_model *model);
+
+/**
+ * Same as fann_run(). Can be called by several threads at the same time.
+ *
+ * \param input nbInputs values
+ * \param output receives mapped_model_num_output() values
+ */
+void mapped_model_run (const mapped_model *model, const float *input, float *output);
+
+/**
+ * Same as classify_symbols() with a mapped model, which must take
+ * NB_FEATURES inputs. Outputs are mapped to characters with the labels
+ * of the file.
+ *
+ * \param answer receives the decoded captcha, '\0' terminated
+ *               (at least CAPTCHA_ARR_SIZE + 1 chars)
+ */
+void classify_symbols_mapped (const mapped_model *model, const symbols_struct *symbols,
+                              char *answer);
+
+#endif
@@ -0,0 +1,123 @@
+/**
+ * \file
+ *
+ * \brief NUMA topology from sysfs, and thread pinning
+ *
+ * /sys/devices/system/node/online lists the nodes, and nodeN/cpulist
+ * the CPUs of node N, both as ranges ("0-7,16-23"). Memory placement is
+ * left to the first-touch policy of the kernel: a page goes to the node
+ * of the thread which first writes it, so a thread pinned to a node
+ * which allocates and fills its buffers gets them locally, without
+ * libnuma.
+ */
+
+#define _GNU_SOURCE // CPU_SET(), pthread_setaffinity_np()
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include "captcha_numa.h"
+
+#define NUMA_SYSFS "/sys/devices/system/node"
+#define LIST_SIZE 4096 //!< Longest list read from sysfs
+
+/**
+ * Read a list of ranges ("0-3,8,10-11") from a sysfs file into a bitmap
+ * of NUMA_MAX_CPUS bits. Numbers beyond are ignored.
+ *
+ * \return false if the file cannot be read
+ */
+static bool read_list (const char *filename, uint64_t *bits)
+{
+    memset(bits, 0, NUMA_MAX_CPUS / 8);
+    FILE *file = fopen(filename, "r");
+    if (file == NULL) return false;
+    char list[LIST_SIZE];
+    bool read = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+    if (!read) return false;
+
+    char *cursor = list;
+    while (*cursor != '\0' && *cursor != '\n') {
+        char *end;
+        long first = strtol(cursor, &end, 10);
+        if (end == cursor) return false;
+        long last = first;
+        if (*end == '-') {
+            cursor = end + 1;
+            last = strtol(cursor, &end, 10);
+            if (end == cursor) return false;
+        }
+        for (long i = first; i <= last && i < NUMA_MAX_CPUS; i++) {
+            if (i >= 0) bits[i / 64] |= (uint64_t) 1 << (i % 64);
+        }
+        cursor = *end == ',' ? end + 1 : end;
+    } // end while
+    return true;
+} // end read_list()
+
+static void to_cpu_set (const uint64_t *bits, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    for (int cpu=0; cpu < NUMA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if ((bits[cpu / 64] >> (cpu % 64)) & 1) CPU_SET(cpu, set);
+    }
+}
+
+int numa_detect (numa_topology *topology)
+{
+    memset(topology, 0, sizeof(numa_topology));
+
+    cpu_set_t affinity;
+    if (pthread_getaffinity_np(pthread_self(), sizeof(affinity), &affinity) != 0) {
+        CPU_ZERO(&affinity);
+        for (int cpu=0; cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &affinity);
+    }
+    for (int cpu=0; cpu < NUMA_MAX_CPUS && cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &affinity)) topology->allowed[cpu / 64] |= (uint64_t) 1 << (cpu % 64);
+    }
+
+    uint64_t nodes[NUMA_MAX_CPUS / 64];
+    if (read_list(NUMA_SYSFS "/online", nodes)) {
+        for (int id=0; id < NUMA_MAX_CPUS && topology->nbNodes < NUMA_MAX_NODES; id++) {
+            if (!((nodes[id / 64] >> (id % 64)) & 1)) continue;
+
+            char filename[64];
+            snprintf(filename, sizeof(filename), NUMA_SYSFS "/node%d/cpulist", id);
+            int n = topology->nbNodes;
+            if (!read_list(filename, topology->cpus[n])) continue;
+            topology->nbCpus[n] = 0;
+            for (int w=0; w < NUMA_MAX_CPUS / 64; w++) {
+                topology->cpus[n][w] &= topology->allowed[w];
+                topology->nbCpus[n] += __builtin_popcountll(topology->cpus[n][w]);
+            }
+            if (topology->nbCpus[n] == 0) continue; // memory only, or excluded
+            topology->ids[n] = id;
+            topology->nbNodes++;
+        } // end for each node
+    }
+
+    if (topology->nbNodes == 0) {
+        memcpy(topology->cpus[0], topology->allowed, sizeof(topology->allowed));
+        topology->nbCpus[0] = CPU_COUNT(&affinity);
+        topology->ids[0] = 0;
+        topology->nbNodes = 1;
+    }
+    return topology->nbNodes;
+} // end numa_detect()
+
+int numa_pin_thread (const numa_topology *topology, int node)
+{
+    cpu_set_t set;
+    to_cpu_set(topology->cpus[node], &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+int numa_unpin_thread (const numa_topology *topology)
+{
+    cpu_set_t set;
+    to_cpu_set(topology->allowed, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
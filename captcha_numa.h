@@ -0,0 +1,49 @@
+#pragma once
+#ifndef CAPTCHA_NUMA_H
+#define CAPTCHA_NUMA_H
+
+#include <stdint.h>
+
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024 //!< as CPU_SETSIZE
+
+/**
+ * NUMA nodes with CPUs the process may run on, in sysfs order.
+ */
+typedef struct {
+    int nbNodes;                                    //!< at least 1, lower it to use
+                                                    //!< the first nodes only
+    int ids[NUMA_MAX_NODES];                        //!< node numbers in sysfs
+    int nbCpus[NUMA_MAX_NODES];                     //!< allowed CPUs of each node
+    uint64_t cpus[NUMA_MAX_NODES][NUMA_MAX_CPUS / 64]; //!< bitmaps of allowed CPUs
+    uint64_t allowed[NUMA_MAX_CPUS / 64];           //!< all allowed CPUs
+} numa_topology;
+
+/**
+ * Read the nodes and their CPUs from /sys/devices/system/node, keeping
+ * the CPUs of the affinity of the calling thread (taskset, cpusets).
+ * Nodes without such CPUs (memory only, or excluded) are left out.
+ * Without sysfs, all allowed CPUs make one node, numbered 0.
+ *
+ * \return number of nodes
+ */
+int numa_detect (numa_topology *topology);
+
+/**
+ * Restrict the calling thread to the CPUs of a node. Threads it creates
+ * inherit this affinity, and the pages it touches first are allocated
+ * on the node.
+ *
+ * \param node index in the topology, from 0 to nbNodes - 1
+ * \return 0, or an errno value
+ */
+int numa_pin_thread (const numa_topology *topology, int node);
+
+/**
+ * Let the calling thread run on all the CPUs allowed at numa_detect().
+ *
+ * \return 0, or an errno value
+ */
+int numa_unpin_thread (const numa_topology *topology);
+
+#endif
@@ -0,0 +1,132 @@
+/**
+ * \file
+ *
+ * \brief Hardware performance counters (Linux perf_event_open)
+ *
+ * Each counter is opened on its own rather than as a group, so that
+ * one the CPU or the kernel does not support does not prevent the
+ * others from being measured. If there are more counters than the PMU
+ * has registers, the kernel multiplexes them and counts are scaled by
+ * the time each counter actually ran.
+ *
+ * Counters are inherited by the threads started after they are opened,
+ * and a read sums the thread which opened them and those threads, ended
+ * or not. Resetting a counter does not clear the counts of ended threads,
+ * so a measure is the difference between reads at start and stop.
+ */
+
+#define _GNU_SOURCE // syscall()
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "captcha_perf.h"
+
+/**
+ * Type and config of each counter, in perf_counter order.
+ */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} events[PERF_NB_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instr" },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+                          (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), "L1d-miss" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "LLC-miss" },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "br-miss" },
+};
+
+int perf_open (perf_counters *counters)
+{
+    int available = 0;
+
+    for (int c=0; c < PERF_NB_COUNTERS; c++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[c].type;
+        attr.config = events[c].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1; // allowed with perf_event_paranoid <= 2
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+        // Calling thread and its new threads, any CPU
+        counters->fds[c] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        counters->values[c] = 0;
+        counters->scaled[c] = false;
+        if (counters->fds[c] >= 0) available++;
+    }
+
+    return available;
+} // end perf_open()
+
+void perf_start (perf_counters *counters)
+{
+    for (int c=0; c < PERF_NB_COUNTERS; c++) {
+        if (counters->fds[c] < 0) continue;
+        if (read(counters->fds[c], counters->base[c], sizeof(counters->base[c])) !=
+            sizeof(counters->base[c])) {
+            memset(counters->base[c], 0, sizeof(counters->base[c]));
+        }
+        ioctl(counters->fds[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+void perf_stop (perf_counters *counters)
+{
+    for (int c=0; c < PERF_NB_COUNTERS; c++) {
+        if (counters->fds[c] < 0) continue;
+        ioctl(counters->fds[c], PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    for (int c=0; c < PERF_NB_COUNTERS; c++) {
+        if (counters->fds[c] < 0) continue;
+
+        uint64_t data[3]; // value, time enabled, time running
+        bool ok = read(counters->fds[c], data, sizeof(data)) == sizeof(data);
+        for (int i=0; ok && i < 3; i++) data[i] -= counters->base[c][i];
+        if (!ok || data[2] == 0) {
+            counters->values[c] = 0;
+            counters->scaled[c] = false;
+            continue;
+        }
+
+        counters->scaled[c] = data[2] < data[1];
+        counters->values[c] = counters->scaled[c] ?
+                              (uint64_t) ((double) data[0] * data[1] / data[2]) : data[0];
+    } // end for each counter
+} // end perf_stop()
+
+void perf_report (FILE *f, const perf_counters *counters, int nbImages)
+{
+    fprintf(f, "%26s", "");
+    for (int c=0; c < PERF_NB_COUNTERS; c++) {
+        if (counters->fds[c] < 0) {
+            fprintf(f, " %s n/a", events[c].name);
+        } else {
+            fprintf(f, " %s %.0f%s", events[c].name, (double) counters->values[c] / nbImages,
+                    counters->scaled[c] ? "*" : "");
+        }
+    }
+
+    if (counters->fds[PERF_CYCLES] >= 0 && counters->fds[PERF_INSTRUCTIONS] >= 0 &&
+        counters->values[PERF_CYCLES] > 0) {
+        fprintf(f, " IPC %.2f", (double) counters->values[PERF_INSTRUCTIONS] /
+                                counters->values[PERF_CYCLES]);
+    }
+    fprintf(f, "\n");
+} // end perf_report()
+
+void perf_close (perf_counters *counters)
+{
+    for (int c=0; c < PERF_NB_COUNTERS; c++) {
+        if (counters->fds[c] >= 0) close(counters->fds[c]);
+        counters->fds[c] = -1;
+    }
+}
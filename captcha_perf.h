@@ -0,0 +1,69 @@
+#pragma once
+#ifndef CAPTCHA_PERF_H
+#define CAPTCHA_PERF_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Hardware counters measured around benchmark stages.
+ */
+typedef enum {
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_L1D_MISSES,
+    PERF_LLC_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_NB_COUNTERS
+} perf_counter;
+
+/**
+ * Counters of the calling thread and of the threads it starts after
+ * perf_open() (such as the workers of the asynchronous decoder), user
+ * space only. A counter the kernel refuses (container,
+ * perf_event_paranoid, virtual machine without PMU) stays closed and is
+ * reported as unavailable.
+ */
+typedef struct {
+    int      fds[PERF_NB_COUNTERS];       //!< -1 if unavailable
+    uint64_t base[PERF_NB_COUNTERS][3];   //!< value, time enabled and running at perf_start()
+    uint64_t values[PERF_NB_COUNTERS];    //!< counts of last measure
+    bool     scaled[PERF_NB_COUNTERS];    //!< counter was multiplexed, value is estimated
+} perf_counters;
+
+/**
+ * Open counters, disabled. Threads must be started afterwards to be
+ * counted.
+ *
+ * \param counters counters to open
+ * \return number of counters available, 0 if none
+ */
+int perf_open (perf_counters *counters);
+
+/**
+ * Enable available counters.
+ */
+void perf_start (perf_counters *counters);
+
+/**
+ * Disable counters and read their values.
+ */
+void perf_stop (perf_counters *counters);
+
+/**
+ * Print counts of last measure divided by nbImages, "n/a" for
+ * unavailable counters, then IPC.
+ *
+ * \param f output stream
+ * \param counters measured counters
+ * \param nbImages number of images of the measure
+ */
+void perf_report (FILE *f, const perf_counters *counters, int nbImages);
+
+/**
+ * Close counters.
+ */
+void perf_close (perf_counters *counters);
+
+#endif
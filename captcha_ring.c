@@ -0,0 +1,253 @@
+/**
+ * \file
+ *
+ * \brief Records of remove_noise handed to segmenter in shared memory
+ *
+ * A bounded queue of slots, each with a sequence number: slot i is free
+ * for the writer of position p when its sequence is p, holds the record
+ * of position p when it is p + 1, and is free again for p + capacity
+ * once read. Writers take positions by incrementing the head with a
+ * compare and swap, the reader goes through them in order.
+ *
+ * Sequences are also the futex words processes wait on: the reader
+ * waits for the sequence of the next slot to become p + 1, a writer of
+ * a full ring for its slot to be read, and a writer waiting for its
+ * record to be read does the same on the slot it wrote.
+ */
+
+#define _GNU_SOURCE // syscall()
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "captcha_ring.h"
+
+#define RING_MAGIC 0x474E4952 //!< "RING"
+#define RING_VERSION 1
+#define RING_MAX_CAPACITY (1 << 16)
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t capacity;  //!< slots, a power of two
+    uint32_t slotSize;  //!< sizeof(ring_slot), so that builds can't disagree
+    uint32_t head __attribute__((aligned(64))); //!< atomic, next position to write
+} __attribute__((aligned(64))) ring_header;
+
+typedef struct {
+    uint32_t seq;       //!< atomic, futex word
+    ring_record record;
+} __attribute__((aligned(64))) ring_slot;
+
+struct label_ring {
+    ring_header *header;
+    ring_slot *slots;
+    size_t size;        //!< bytes mapped
+    uint32_t mask;      //!< capacity - 1
+    uint32_t tail;      //!< next position to read, reader only
+};
+
+/**
+ * Get the absolute time timeout_ms from now.
+ *
+ * \return deadline, NULL to wait for ever
+ */
+static struct timespec *get_deadline (int timeout_ms, struct timespec *deadline)
+{
+    if (timeout_ms < 0) return NULL;
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += timeout_ms / 1000;
+    deadline->tv_nsec += (timeout_ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+    return deadline;
+}
+
+/**
+ * Wait while *word is value, shared between processes.
+ *
+ * \param deadline CLOCK_MONOTONIC time, NULL for no limit
+ * \return false if the deadline passed
+ */
+static bool futex_wait (uint32_t *word, uint32_t value, const struct timespec *deadline)
+{
+    if (syscall(SYS_futex, word, FUTEX_WAIT_BITSET, value, deadline, NULL,
+                FUTEX_BITSET_MATCH_ANY) == 0) return true;
+    return errno != ETIMEDOUT; // EAGAIN if it changed meanwhile, EINTR
+}
+
+static void futex_wake (uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/**
+ * Map a shared memory object as a ring.
+ */
+static label_ring *map_ring (int fd, size_t size)
+{
+    label_ring *ring = malloc(sizeof(label_ring));
+    if (ring == NULL) return NULL;
+
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (memory == MAP_FAILED) {
+        free(ring);
+        return NULL;
+    }
+    ring->header = memory;
+    ring->slots = (ring_slot *) (ring->header + 1);
+    ring->size = size;
+    ring->tail = 0;
+    return ring;
+}
+
+label_ring *ring_create (const char *name, int capacity)
+{
+    if (capacity < 1 || capacity > RING_MAX_CAPACITY) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uint32_t slots = 1;
+    while (slots < (uint32_t) capacity) slots *= 2;
+    size_t size = sizeof(ring_header) + slots * sizeof(ring_slot);
+
+    // Writers blocked on a previous ring keep it until they time out
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return NULL;
+    label_ring *ring = NULL;
+    if (ftruncate(fd, size) == 0) ring = map_ring(fd, size);
+    int error = errno;
+    close(fd);
+    if (ring == NULL) {
+        shm_unlink(name);
+        errno = error;
+        return NULL;
+    }
+
+    ring->mask = slots - 1;
+    for (uint32_t i=0; i < slots; i++) ring->slots[i].seq = i;
+    ring->header->version = RING_VERSION;
+    ring->header->capacity = slots;
+    ring->header->slotSize = sizeof(ring_slot);
+    ring->header->head = 0;
+    __atomic_store_n(&ring->header->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+} // end ring_create()
+
+label_ring *ring_open (const char *name)
+{
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+
+    struct stat st;
+    label_ring *ring = NULL;
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(ring_header)) {
+        ring = map_ring(fd, st.st_size);
+    } else {
+        errno = EINVAL;
+    }
+    int error = errno;
+    close(fd);
+    if (ring == NULL) {
+        errno = error;
+        return NULL;
+    }
+
+    ring_header *header = ring->header;
+    if (__atomic_load_n(&header->magic, __ATOMIC_ACQUIRE) != RING_MAGIC ||
+        header->version != RING_VERSION || header->slotSize != sizeof(ring_slot) ||
+        header->capacity == 0 || (header->capacity & (header->capacity - 1)) != 0 ||
+        sizeof(ring_header) + header->capacity * sizeof(ring_slot) > ring->size) {
+        ring_close(ring);
+        errno = EINVAL;
+        return NULL;
+    }
+    ring->mask = header->capacity - 1;
+    return ring;
+} // end ring_open()
+
+void ring_close (label_ring *ring)
+{
+    if (ring == NULL) return;
+    munmap(ring->header, ring->size);
+    free(ring);
+}
+
+void ring_unlink (const char *name)
+{
+    shm_unlink(name);
+}
+
+bool ring_put (label_ring *ring, const ring_record *record, int timeout_ms, uint32_t *ticket)
+{
+    struct timespec time;
+    const struct timespec *deadline = get_deadline(timeout_ms, &time);
+
+    uint32_t pos = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+    ring_slot *slot;
+    for (;;) {
+        slot = &ring->slots[pos & ring->mask];
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        int32_t diff = (int32_t) (seq - pos);
+        if (diff == 0) {
+            // Free: take it, or retry with the head another writer moved
+            if (__atomic_compare_exchange_n(&ring->header->head, &pos, pos + 1, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) break;
+        } else if (diff < 0) {
+            // Full: the record of pos - capacity is not read yet
+            if (!futex_wait(&slot->seq, seq, deadline)) return false;
+            pos = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+        } else {
+            pos = __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+        }
+    } // end for
+
+    memcpy(&slot->record, record, sizeof(ring_record));
+    __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+    futex_wake(&slot->seq);
+    *ticket = pos;
+    return true;
+} // end ring_put()
+
+bool ring_wait_read (label_ring *ring, uint32_t ticket, int timeout_ms)
+{
+    struct timespec time;
+    const struct timespec *deadline = get_deadline(timeout_ms, &time);
+
+    ring_slot *slot = &ring->slots[ticket & ring->mask];
+    uint32_t released = ticket + ring->mask + 1;
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        // Later writers may have reused the slot already
+        if ((int32_t) (seq - released) >= 0) return true;
+        if (!futex_wait(&slot->seq, seq, deadline)) return false;
+    }
+}
+
+const ring_record *ring_get (label_ring *ring)
+{
+    ring_slot *slot = &ring->slots[ring->tail & ring->mask];
+    for (;;) {
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq == ring->tail + 1) return &slot->record;
+        futex_wait(&slot->seq, seq, NULL);
+    }
+}
+
+void ring_release (label_ring *ring)
+{
+    ring_slot *slot = &ring->slots[ring->tail & ring->mask];
+    __atomic_store_n(&slot->seq, ring->tail + ring->mask + 1, __ATOMIC_RELEASE);
+    futex_wake(&slot->seq);
+    ring->tail++;
+}
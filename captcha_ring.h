@@ -0,0 +1,88 @@
+#pragma once
+#ifndef CAPTCHA_RING_H
+#define CAPTCHA_RING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "captcha_common.h"
+
+#define RING_PATH_SIZE 256 //!< Longest output path of a record, with '\0'
+
+/**
+ * Groups of pixels of one captcha, as remove_noise writes them in its
+ * text file and convert_txt_to_1dim_array() reads them back.
+ */
+typedef struct {
+    uint16_t nbGroups;                     //!< groups, numbered from 1
+    char output[RING_PATH_SIZE];           //!< where to write the report, "" for stdout
+    uint8_t pixels[IMG_WIDTH * IMG_HEIGHT]; //!< group of each pixel, 0 for background
+} ring_record;
+
+/**
+ * Ring of records in shared memory, written by any number of processes
+ * and read by one. Waiting is done with futexes on the shared pages, so
+ * the processes need nothing else in common than the name of the ring.
+ */
+typedef struct label_ring label_ring;
+
+/**
+ * Create a ring, replacing any ring of the same name, to read it.
+ *
+ * \param name shared memory object, "/name" (see shm_open())
+ * \param capacity records, rounded up to a power of two
+ * \return ring, NULL on error (errno is set)
+ */
+label_ring *ring_create (const char *name, int capacity);
+
+/**
+ * Open a ring created by ring_create(), to write to it.
+ *
+ * \return ring, NULL on error (errno is set)
+ */
+label_ring *ring_open (const char *name);
+
+/**
+ * Unmap a ring. The shared memory object stays until ring_unlink().
+ */
+void ring_close (label_ring *ring);
+
+/**
+ * Remove the shared memory object of a ring. Processes which mapped it
+ * keep using it.
+ */
+void ring_unlink (const char *name);
+
+/**
+ * Take a free record, fill it and hand it to the reader.
+ *
+ * \param record copied into the ring
+ * \param timeout_ms time to wait for a free record, -1 for ever
+ * \param ticket receives the position of the record, for ring_wait_read()
+ * \return false if the ring stayed full
+ */
+bool ring_put (label_ring *ring, const ring_record *record, int timeout_ms, uint32_t *ticket);
+
+/**
+ * Wait until the reader is done with a record.
+ *
+ * \param ticket given by ring_put()
+ * \param timeout_ms time to wait, -1 for ever
+ * \return false on timeout
+ */
+bool ring_wait_read (label_ring *ring, uint32_t ticket, int timeout_ms);
+
+/**
+ * Wait for the next record. Records are read in the order writers took
+ * them: a writer which dies between ring_put() taking the record and
+ * filling it blocks the reader.
+ *
+ * \return record, valid until ring_release()
+ */
+const ring_record *ring_get (label_ring *ring);
+
+/**
+ * Give the record returned by ring_get() back to writers.
+ */
+void ring_release (label_ring *ring);
+
+#endif
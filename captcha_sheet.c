@@ -0,0 +1,556 @@
+/**
+ * \file
+ *
+ * \brief Captchas of large sheets, labeled in parallel strips
+ *
+ * Each strip is labeled with its own union-find forest: a black pixel
+ * starts as its own root and is united with its black neighbours already
+ * scanned (west, north-west, north, north-east). Roots are always the
+ * smallest index of their tree, that is the first pixel of the group in
+ * row order. Strips only touch their own rows, so they need no locking.
+ * Groups crossing a border are then united in one pass over the first
+ * row of each strip, and the roots are numbered strip by strip.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "captcha_sheet.h"
+
+#define NO_PARENT UINT32_MAX //!< Parent of background pixels
+#define NO_CELL UINT32_MAX   //!< Cell of groups in no captcha
+
+/**
+ * Work of one thread on one strip of rows [y0, y1).
+ */
+typedef struct {
+    const uint8_t *gray;
+    int stride;
+    sheet_labels *sheet;
+    uint32_t *parent;      //!< union-find forest, shared by all strips
+    int y0, y1;
+    uint32_t nbRoots;      //!< groups whose first pixel is in the strip
+    uint32_t firstId;      //!< ID of the first of them
+    sheet_box *boxes;      //!< bounds of the parts of all groups in the strip
+} strip_job;
+
+/**
+ * Root of i, halving the path on the way. Only for trees no other
+ * thread is writing.
+ */
+static uint32_t find_root (uint32_t *parent, uint32_t i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+/**
+ * Root of i, without writing: trees can be read by all threads at once.
+ */
+static uint32_t read_root (const uint32_t *parent, uint32_t i)
+{
+    while (parent[i] != i) i = parent[i];
+    return i;
+}
+
+/**
+ * Unite the trees of a and b under the smallest root.
+ */
+static void unite (uint32_t *parent, uint32_t a, uint32_t b)
+{
+    a = find_root(parent, a);
+    b = find_root(parent, b);
+    if (a < b) parent[b] = a;
+    else if (b < a) parent[a] = b;
+}
+
+/**
+ * Run fn on each job, one thread per job.
+ */
+static void run_jobs (void *(*fn) (void *), strip_job *jobs, int nbJobs)
+{
+    pthread_t threads[nbJobs];
+    int started = 0;
+    for (; started < nbJobs; started++) {
+        if (pthread_create(&threads[started], NULL, fn, &jobs[started]) != 0) break;
+    }
+    for (int t=0; t < started; t++) pthread_join(threads[t], NULL);
+
+    // Run what could not be started in this thread
+    for (int t=started; t < nbJobs; t++) fn(&jobs[t]);
+}
+
+static void *label_strip (void *arg)
+{
+    strip_job *job = arg;
+    int width = job->sheet->width;
+    uint32_t *parent = job->parent;
+
+    for (int y = job->y0; y < job->y1; y++) {
+        const uint8_t *row = job->gray + (size_t) y * job->stride;
+        for (int x = 0; x < width; x++) {
+            uint32_t i = (uint32_t) y * width + x;
+            if (!is_black_value(row[x])) {
+                parent[i] = NO_PARENT;
+                continue;
+            }
+            parent[i] = i;
+
+            if (x > 0 && parent[i - 1] != NO_PARENT) unite(parent, i, i - 1);
+            if (y == job->y0) continue; // the row above is another strip's
+            uint32_t above = i - width;
+            for (int dx = -1; dx <= 1; dx++) {
+                if (x + dx < 0 || x + dx >= width) continue;
+                if (parent[above + dx] != NO_PARENT) unite(parent, i, above + dx);
+            }
+        } // end for x
+    } // end for y
+
+    return NULL;
+} // end label_strip()
+
+static void *count_roots (void *arg)
+{
+    strip_job *job = arg;
+    int width = job->sheet->width;
+
+    job->nbRoots = 0;
+    for (uint32_t i = (uint32_t) job->y0 * width; i < (uint32_t) job->y1 * width; i++) {
+        if (job->parent[i] == i) job->nbRoots++;
+    }
+    return NULL;
+}
+
+static void *resolve_labels (void *arg)
+{
+    strip_job *job = arg;
+    uint32_t *labels = job->sheet->labels;
+    int width = job->sheet->width;
+
+    for (uint32_t i = (uint32_t) job->y0 * width; i < (uint32_t) job->y1 * width; i++) {
+        labels[i] = job->parent[i] == NO_PARENT ? 0 : read_root(job->parent, i) + 1;
+    }
+    return NULL;
+}
+
+/**
+ * The parent of roots becomes their group ID: the forest is not read any
+ * more after resolve_labels().
+ */
+static void *number_roots (void *arg)
+{
+    strip_job *job = arg;
+    int width = job->sheet->width;
+
+    uint32_t id = job->firstId;
+    for (uint32_t i = (uint32_t) job->y0 * width; i < (uint32_t) job->y1 * width; i++) {
+        if (job->sheet->labels[i] == i + 1) job->parent[i] = id++;
+    }
+    return NULL;
+}
+
+static void *number_labels (void *arg)
+{
+    strip_job *job = arg;
+    sheet_labels *sheet = job->sheet;
+    int width = sheet->width;
+
+    for (uint32_t g = 0; g < sheet->nbGroups; g++) {
+        job->boxes[g] = (sheet_box) {INT32_MAX, -1, INT32_MAX, -1};
+    }
+    for (int y = job->y0; y < job->y1; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t i = (uint32_t) y * width + x;
+            if (sheet->labels[i] == 0) continue;
+
+            uint32_t id = job->parent[sheet->labels[i] - 1];
+            sheet->labels[i] = id;
+            sheet_box *box = &job->boxes[id - 1];
+            if (x < box->xMin) box->xMin = x;
+            if (x > box->xMax) box->xMax = x;
+            if (y < box->yMin) box->yMin = y;
+            if (y > box->yMax) box->yMax = y;
+        } // end for x
+    } // end for y
+    return NULL;
+} // end number_labels()
+
+bool label_sheet (const uint8_t *gray, int width, int height, int stride, int nbThreads,
+                  sheet_labels *sheet)
+{
+    memset(sheet, 0, sizeof(sheet_labels));
+    sheet->width = width;
+    sheet->height = height;
+    if (nbThreads < 1) nbThreads = 1;
+    if (nbThreads > height) nbThreads = height > 0 ? height : 1;
+
+    size_t size = (size_t) width * height;
+    uint32_t *parent = malloc(size * sizeof(uint32_t));
+    sheet->labels = malloc(size * sizeof(uint32_t));
+    strip_job *jobs = calloc(nbThreads, sizeof(strip_job));
+    if (parent == NULL || sheet->labels == NULL || jobs == NULL) goto error;
+
+    int stripHeight = (height + nbThreads - 1) / nbThreads;
+    for (int t = 0; t < nbThreads; t++) {
+        jobs[t] = (strip_job) {
+            .gray = gray, .stride = stride, .sheet = sheet, .parent = parent,
+            .y0 = t * stripHeight < height ? t * stripHeight : height,
+            .y1 = (t + 1) * stripHeight < height ? (t + 1) * stripHeight : height,
+        };
+    }
+
+    run_jobs(label_strip, jobs, nbThreads);
+
+    // Unite groups crossing strip borders
+    for (int t = 1; t < nbThreads; t++) {
+        int y = jobs[t].y0;
+        if (y == jobs[t].y1) continue;
+        for (int x = 0; x < width; x++) {
+            uint32_t i = (uint32_t) y * width + x;
+            if (parent[i] == NO_PARENT) continue;
+            for (int dx = -1; dx <= 1; dx++) {
+                if (x + dx < 0 || x + dx >= width) continue;
+                uint32_t above = i - width + dx;
+                if (parent[above] != NO_PARENT) unite(parent, i, above);
+            }
+        }
+    } // end for each border
+
+    // Number groups in the order of their root
+    run_jobs(count_roots, jobs, nbThreads);
+    for (int t = 0; t < nbThreads; t++) {
+        jobs[t].firstId = sheet->nbGroups + 1;
+        sheet->nbGroups += jobs[t].nbRoots;
+    }
+    run_jobs(resolve_labels, jobs, nbThreads);
+    run_jobs(number_roots, jobs, nbThreads);
+
+    sheet->boxes = malloc(sheet->nbGroups * sizeof(sheet_box) + 1);
+    sheet->cells = calloc(sheet->nbGroups + 1, sizeof(uint32_t));
+    sheet->cellGroups = calloc(sheet->nbGroups + 1, sizeof(uint32_t));
+    if (sheet->boxes == NULL || sheet->cells == NULL || sheet->cellGroups == NULL) goto error;
+    for (int t = 0; t < nbThreads; t++) {
+        jobs[t].boxes = malloc(sheet->nbGroups * sizeof(sheet_box) + 1);
+        if (jobs[t].boxes == NULL) goto error;
+    }
+    run_jobs(number_labels, jobs, nbThreads);
+
+    // Bounds of whole groups
+    for (uint32_t g = 0; g < sheet->nbGroups; g++) {
+        sheet->boxes[g] = jobs[0].boxes[g];
+        for (int t = 1; t < nbThreads; t++) {
+            sheet_box *part = &jobs[t].boxes[g];
+            sheet_box *box = &sheet->boxes[g];
+            if (part->xMin < box->xMin) box->xMin = part->xMin;
+            if (part->xMax > box->xMax) box->xMax = part->xMax;
+            if (part->yMin < box->yMin) box->yMin = part->yMin;
+            if (part->yMax > box->yMax) box->yMax = part->yMax;
+        }
+    }
+
+    for (int t = 0; t < nbThreads; t++) free(jobs[t].boxes);
+    free(jobs);
+    free(parent);
+    return true;
+
+error:
+    if (jobs != NULL) {
+        for (int t = 0; t < nbThreads; t++) free(jobs[t].boxes);
+    }
+    free(jobs);
+    free(parent);
+    free_sheet_labels(sheet);
+    return false;
+} // end label_sheet()
+
+void free_sheet_labels (sheet_labels *sheet)
+{
+    free(sheet->labels);
+    free(sheet->boxes);
+    free(sheet->cells);
+    free(sheet->cellGroups);
+    memset(sheet, 0, sizeof(sheet_labels));
+}
+
+/**
+ * Bounds of a and b together.
+ */
+static sheet_box box_union (sheet_box a, sheet_box b)
+{
+    return (sheet_box) {
+        a.xMin < b.xMin ? a.xMin : b.xMin, a.xMax > b.xMax ? a.xMax : b.xMax,
+        a.yMin < b.yMin ? a.yMin : b.yMin, a.yMax > b.yMax ? a.yMax : b.yMax,
+    };
+}
+
+static bool fits_in_captcha (sheet_box box)
+{
+    return box.xMax - box.xMin < IMG_WIDTH && box.yMax - box.yMin < IMG_HEIGHT;
+}
+
+/**
+ * Pair of groups close to each other.
+ */
+typedef struct {
+    uint32_t a, b;
+    int32_t  gap;   //!< background pixels between their bounds
+} group_pair;
+
+/**
+ * Background pixels between two boxes, horizontally or vertically,
+ * whichever is larger. 0 if they overlap.
+ */
+static int32_t box_gap (sheet_box a, sheet_box b)
+{
+    int32_t gapX = (a.xMin > b.xMin ? a.xMin : b.xMin) - (a.xMax < b.xMax ? a.xMax : b.xMax) - 1;
+    int32_t gapY = (a.yMin > b.yMin ? a.yMin : b.yMin) - (a.yMax < b.yMax ? a.yMax : b.yMax) - 1;
+    int32_t gap = gapX > gapY ? gapX : gapY;
+    return gap > 0 ? gap : 0;
+}
+
+static int compare_gaps (const void *a, const void *b)
+{
+    const group_pair *pa = a, *pb = b;
+    if (pa->gap != pb->gap) return pa->gap < pb->gap ? -1 : 1;
+    if (pa->a != pb->a) return pa->a < pb->a ? -1 : 1;
+    return pa->b < pb->b ? -1 : (pa->b > pb->b);
+}
+
+/**
+ * Sort keys of groups by xMin: xMin in the high 32 bits, group in the
+ * low ones.
+ */
+static int compare_keys (const void *a, const void *b)
+{
+    uint64_t ka = *(const uint64_t *) a, kb = *(const uint64_t *) b;
+    return ka < kb ? -1 : (ka > kb);
+}
+
+/**
+ * Gather groups at most SHEET_MAX_GAP apart, closest first, as long as
+ * they fit in a captcha.
+ *
+ * \param keys receives the cluster of each group: its first group
+ * \return false if memory could not be allocated
+ */
+static bool cluster_groups (const sheet_labels *sheet, uint32_t *keys)
+{
+    uint32_t nbGroups = sheet->nbGroups;
+    uint64_t *order = malloc(nbGroups * sizeof(uint64_t) + 1);
+    sheet_box *clusters = malloc(nbGroups * sizeof(sheet_box) + 1);
+    size_t nbPairs = 0, capacity = 1024;
+    group_pair *pairs = malloc(capacity * sizeof(group_pair));
+    bool ok = false;
+    if (order == NULL || clusters == NULL || pairs == NULL) goto end;
+
+    // Close pairs, sweeping groups by xMin
+    for (uint32_t g = 0; g < nbGroups; g++) {
+        order[g] = (uint64_t) sheet->boxes[g].xMin << 32 | g; // xMin >= 0
+    }
+    qsort(order, nbGroups, sizeof(uint64_t), compare_keys);
+    for (uint32_t i = 0; i < nbGroups; i++) {
+        uint32_t ga = (uint32_t) order[i];
+        sheet_box a = sheet->boxes[ga];
+        if (!fits_in_captcha(a)) continue;
+        for (uint32_t j = i + 1; j < nbGroups; j++) {
+            uint32_t gb = (uint32_t) order[j];
+            sheet_box b = sheet->boxes[gb];
+            if (b.xMin - a.xMax - 1 > SHEET_MAX_GAP) break;
+            int32_t gap = box_gap(a, b);
+            if (gap > SHEET_MAX_GAP || !fits_in_captcha(box_union(a, b))) continue;
+
+            if (nbPairs == capacity) {
+                capacity *= 2;
+                group_pair *grown = realloc(pairs, capacity * sizeof(group_pair));
+                if (grown == NULL) goto end;
+                pairs = grown;
+            }
+            pairs[nbPairs++] = (group_pair) {ga, gb, gap};
+        }
+    } // end for each group
+
+    // Symbols of a captcha are closer to each other than to other captchas
+    qsort(pairs, nbPairs, sizeof(group_pair), compare_gaps);
+    for (uint32_t g = 0; g < nbGroups; g++) {
+        keys[g] = g;
+        clusters[g] = sheet->boxes[g];
+    }
+    for (size_t p = 0; p < nbPairs; p++) {
+        uint32_t a = find_root(keys, pairs[p].a);
+        uint32_t b = find_root(keys, pairs[p].b);
+        if (a == b) continue;
+        sheet_box box = box_union(clusters[a], clusters[b]);
+        if (!fits_in_captcha(box)) continue;
+        if (b < a) { uint32_t t = a; a = b; b = t; }
+        keys[b] = a;
+        clusters[a] = box;
+    }
+    for (uint32_t g = 0; g < nbGroups; g++) {
+        keys[g] = fits_in_captcha(sheet->boxes[g]) ? find_root(keys, g) : NO_CELL;
+    }
+    ok = true;
+
+end:
+    free(order);
+    free(clusters);
+    free(pairs);
+    return ok;
+} // end cluster_groups()
+
+int find_sheet_cells (sheet_labels *sheet, const sheet_grid *grid, sheet_cell **cells)
+{
+    uint32_t nbGroups = sheet->nbGroups;
+    int nbCells = 0;
+    int capacity = 64;
+    *cells = malloc(capacity * sizeof(sheet_cell));
+
+    // Cluster of each group, then cell of each cluster
+    uint32_t nbKeys = nbGroups;
+    int columns = 0;
+    if (grid != NULL) {
+        columns = (sheet->width - grid->x + grid->pitchX - 1) / grid->pitchX;
+        int rows = (sheet->height - grid->y + grid->pitchY - 1) / grid->pitchY;
+        nbKeys = columns > 0 && rows > 0 ? (uint32_t) columns * rows : 0;
+    }
+    uint32_t *keys = malloc(nbGroups * sizeof(uint32_t) + 1);
+    uint32_t *keyCells = malloc(nbKeys * sizeof(uint32_t) + 1);
+    if (*cells == NULL || keys == NULL || keyCells == NULL) goto error;
+
+    if (grid == NULL) {
+        if (!cluster_groups(sheet, keys)) goto error;
+    } else {
+        // Cell of the grid holding the center of the group
+        for (uint32_t g = 0; g < nbGroups; g++) {
+            sheet_box box = sheet->boxes[g];
+            int column = ((box.xMin + box.xMax) / 2 - grid->x) / grid->pitchX;
+            int row = ((box.yMin + box.yMax) / 2 - grid->y) / grid->pitchY;
+            bool inside = (box.xMin + box.xMax) / 2 >= grid->x && (box.yMin + box.yMax) / 2 >= grid->y &&
+                          column < columns && fits_in_captcha(box);
+            keys[g] = inside ? (uint32_t) row * columns + column : NO_CELL;
+        }
+    }
+    for (uint32_t k = 0; k < nbKeys; k++) keyCells[k] = NO_CELL;
+
+    // Cells in the order of their first group
+    for (uint32_t g = 0; g < nbGroups; g++) {
+        uint32_t key = keys[g];
+        sheet->cells[g] = NO_CELL; // frame or grid line of the sheet
+        if (key == NO_CELL) continue;
+
+        if (keyCells[key] == NO_CELL) {
+            if (nbCells == capacity) {
+                capacity *= 2;
+                sheet_cell *grown = realloc(*cells, capacity * sizeof(sheet_cell));
+                if (grown == NULL) goto error;
+                *cells = grown;
+            }
+            (*cells)[nbCells] = (sheet_cell) {.box = sheet->boxes[g], .nbGroups = 0};
+            if (grid != NULL) {
+                (*cells)[nbCells].x = grid->x + (key % columns) * grid->pitchX;
+                (*cells)[nbCells].y = grid->y + (key / columns) * grid->pitchY;
+            }
+            keyCells[key] = nbCells++;
+        }
+        sheet_cell *cell = &(*cells)[keyCells[key]];
+        cell->box = box_union(cell->box, sheet->boxes[g]);
+        sheet->cells[g] = keyCells[key];
+        sheet->cellGroups[g] = ++cell->nbGroups;
+    } // end for each group
+
+    if (grid == NULL) {
+        // Centered on the groups
+        for (int c = 0; c < nbCells; c++) {
+            sheet_cell *cell = &(*cells)[c];
+            cell->x = cell->box.xMin - (IMG_WIDTH - (cell->box.xMax - cell->box.xMin + 1)) / 2;
+            cell->y = cell->box.yMin - (IMG_HEIGHT - (cell->box.yMax - cell->box.yMin + 1)) / 2;
+        }
+    }
+
+    free(keys);
+    free(keyCells);
+    return nbCells;
+
+error:
+    free(keys);
+    free(keyCells);
+    free(*cells);
+    *cells = NULL;
+    return -1;
+} // end find_sheet_cells()
+
+int sheet_cell_pixels (const sheet_labels *sheet, uint32_t cell, const sheet_cell *cells,
+                       uint8_t *pixels)
+{
+    const sheet_cell *c = &cells[cell];
+    if (c->nbGroups > CAPTCHA_ARR_SIZE) return -1;
+
+    // Only the bounds of the cell groups are read, in place in the sheet
+    memset(pixels, 0, IMG_WIDTH * IMG_HEIGHT);
+    for (int y = c->box.yMin; y <= c->box.yMax; y++) {
+        const uint32_t *row = sheet->labels + (size_t) y * sheet->width;
+        for (int x = c->box.xMin; x <= c->box.xMax; x++) {
+            uint32_t label = row[x];
+            // With a grid, groups can stick out of their cell
+            if (label != 0 && sheet->cells[label - 1] == cell &&
+                !is_out_coord((Coord) {x - c->x, y - c->y})) {
+                pixels[get_index(x - c->x, y - c->y)] = sheet->cellGroups[label - 1];
+            }
+        }
+    }
+    return c->nbGroups;
+} // end sheet_cell_pixels()
+
+/**
+ * Cells shared by the decoding threads.
+ */
+typedef struct {
+    const sheet_labels *sheet;
+    const sheet_cell *cells;
+    int nbCells;
+    int next;              //!< next cell to decode, atomic
+    sheet_classifier classify;
+    void *arg;
+    char *answers;
+} sheet_decoding;
+
+static void *decode_cells (void *arg)
+{
+    sheet_decoding *decoding = arg;
+    uint8_t pixels[IMG_WIDTH * IMG_HEIGHT];
+    symbols_struct symbols;
+
+    int c;
+    while ((c = __atomic_fetch_add(&decoding->next, 1, __ATOMIC_RELAXED)) < decoding->nbCells) {
+        char *answer = decoding->answers + (size_t) c * (CAPTCHA_ARR_SIZE + 1);
+        int nbGroups = sheet_cell_pixels(decoding->sheet, c, decoding->cells, pixels);
+        if (nbGroups < 0) {
+            strcpy(answer, "-");
+            continue;
+        }
+        extract_features(pixels, nbGroups, &symbols);
+        decoding->classify(&symbols, answer, decoding->arg);
+    }
+    return NULL;
+}
+
+bool decode_sheet_cells (const sheet_labels *sheet, const sheet_cell *cells, int nbCells,
+                         int nbThreads, sheet_classifier classify, void *arg, char *answers)
+{
+    sheet_decoding decoding = {
+        .sheet = sheet, .cells = cells, .nbCells = nbCells, .next = 0,
+        .classify = classify, .arg = arg, .answers = answers,
+    };
+    if (nbThreads < 1) nbThreads = 1;
+
+    pthread_t threads[nbThreads];
+    int started = 0;
+    for (; started < nbThreads; started++) {
+        if (pthread_create(&threads[started], NULL, decode_cells, &decoding) != 0) break;
+    }
+    for (int t=0; t < started; t++) pthread_join(threads[t], NULL);
+    return started > 0;
+}
@@ -0,0 +1,125 @@
+#pragma once
+#ifndef CAPTCHA_SHEET_H
+#define CAPTCHA_SHEET_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "captcha_common.h"
+#include "captcha_features.h"
+
+/**
+ * Largest gap between groups of pixels of one captcha, in pixels.
+ */
+#define SHEET_MAX_GAP 30
+
+/**
+ * Bounds of a group of black pixels in a sheet.
+ */
+typedef struct {
+    int32_t xMin, xMax, yMin, yMax;
+} sheet_box;
+
+/**
+ * Groups of black pixels (8-connected) of a large image holding many
+ * captchas, and the captcha each group belongs to.
+ *
+ * Groups are numbered from 1 in the order their first pixel is met row
+ * by row, like label_pixels() does for one captcha.
+ */
+typedef struct {
+    int32_t   width, height;
+    uint32_t *labels;      //!< width * height group IDs, 0 for background
+    uint32_t  nbGroups;
+    sheet_box *boxes;      //!< bounds of group g at boxes[g - 1]
+    uint32_t *cells;       //!< cell of group g at cells[g - 1], set by find_sheet_cells()
+    uint32_t *cellGroups;  //!< group ID of group g in its cell, from 1, set by find_sheet_cells()
+} sheet_labels;
+
+/**
+ * A captcha found in a sheet: IMG_WIDTH x IMG_HEIGHT pixels from (x, y),
+ * which may lie partly outside of the sheet.
+ */
+typedef struct {
+    int32_t  x, y;       //!< top left corner in the sheet
+    sheet_box box;       //!< bounds of its groups
+    uint32_t nbGroups;   //!< groups in the cell
+} sheet_cell;
+
+/**
+ * Group the black pixels of a sheet.
+ *
+ * The sheet is cut in horizontal strips labeled in parallel, each with a
+ * union-find forest of its own. Groups crossing strip borders are then
+ * merged, and the final numbering is computed strip by strip again.
+ *
+ * \param gray width * height 8-bit pixels, rows stride bytes apart
+ * \param nbThreads strips labeled at the same time
+ * \param sheet receives the groups, to be free'd with free_sheet_labels()
+ * \return false if memory or threads could not be allocated
+ */
+bool label_sheet (const uint8_t *gray, int width, int height, int stride, int nbThreads,
+                  sheet_labels *sheet);
+
+/**
+ * Free the arrays of a sheet.
+ */
+void free_sheet_labels (sheet_labels *sheet);
+
+/**
+ * Where captchas are in a sheet, when known: the top left corner of the
+ * first one, and the distance between the corners of neighbours.
+ */
+typedef struct {
+    int32_t x, y;
+    int32_t pitchX, pitchY;
+} sheet_grid;
+
+/**
+ * Gather groups into captchas.
+ *
+ * Without a grid, groups at most SHEET_MAX_GAP pixels apart are merged,
+ * closest first, as long as the bounds of the merged groups fit in
+ * IMG_WIDTH x IMG_HEIGHT, and cells are centered on their groups. Some
+ * features depend on the position of symbols in the captcha (descenders
+ * are told by their bottom row), so pass the grid when it is known.
+ * With a grid, a group belongs to the cell holding its center.
+ *
+ * Groups larger than a captcha (frames, grid lines) are in no cell.
+ * Cells are ordered by their first group.
+ *
+ * \param grid position of captchas, NULL to find them from the groups
+ * \param cells receives the cells, to be free'd by the caller
+ * \return number of cells, -1 if memory could not be allocated
+ */
+int find_sheet_cells (sheet_labels *sheet, const sheet_grid *grid, sheet_cell **cells);
+
+/**
+ * Fill the pixels array of a captcha from the sheet labels, the way
+ * label_pixels() would for the captcha alone: groups of other captchas
+ * overlapping the cell are left out.
+ *
+ * \param pixels IMG_WIDTH * IMG_HEIGHT array receiving group IDs
+ * \return number of groups, -1 if there are more than CAPTCHA_ARR_SIZE
+ */
+int sheet_cell_pixels (const sheet_labels *sheet, uint32_t cell, const sheet_cell *cells,
+                       uint8_t *pixels);
+
+/**
+ * Classifier called for each captcha of a sheet, from several threads.
+ *
+ * \param answer receives the decoded captcha, '\0' terminated
+ */
+typedef void (*sheet_classifier) (const symbols_struct *symbols, char *answer, void *arg);
+
+/**
+ * Extract features and classify the captchas of a sheet, nbThreads cells
+ * at a time.
+ *
+ * \param answers nbCells answers of CAPTCHA_ARR_SIZE + 1 chars, "-" for
+ *                cells with too many groups
+ * \return false if threads could not be created
+ */
+bool decode_sheet_cells (const sheet_labels *sheet, const sheet_cell *cells, int nbCells,
+                         int nbThreads, sheet_classifier classify, void *arg, char *answers);
+
+#endif
@@ -0,0 +1,304 @@
+/**
+ * \file
+ *
+ * \brief Members of tar archives read as a stream
+ *
+ * The corpus ships as a tarball. Reading it sequentially through zlib
+ * (which passes uncompressed data through) gives every sample in memory
+ * without extracting thousands of files first.
+ *
+ * Supported: ustar and old tar headers, GNU long names ('L') and pax
+ * paths ('x'). Sizes in base-256 are accepted. Only files, long names and
+ * pax headers are read in memory, up to TAR_MEMBER_MAX bytes: a corrupt
+ * size cannot make the reader allocate or write past what it holds.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "captcha_common.h"
+#include "captcha_features.h"
+#include "captcha_tar.h"
+
+#define BLOCK_SIZE 512
+
+struct tar_reader {
+    gzFile gz;
+    uint8_t *data;      //!< contents of the current member
+    size_t capacity;    //!< bytes allocated for data
+    bool error;
+    bool end;
+};
+
+/**
+ * Parse a numeric header field: octal digits padded with spaces or
+ * '\0', or base-256 if the high bit of the first byte is set. Negative
+ * and larger than 64-bit base-256 values are rejected.
+ */
+static bool parse_number (const uint8_t *field, size_t length, uint64_t *value)
+{
+    *value = 0;
+    if (field[0] & 0x80) {
+        if (field[0] & 0x40) return false; // negative
+        *value = field[0] & 0x3f;
+        for (size_t i=1; i < length; i++) {
+            if (*value > UINT64_MAX >> 8) return false;
+            *value = (*value << 8) | field[i];
+        }
+        return true;
+    }
+
+    size_t i = 0;
+    while (i < length && field[i] == ' ') i++;
+    for (; i < length && field[i] >= '0' && field[i] <= '7'; i++) {
+        *value = (*value << 3) | (field[i] - '0');
+    }
+    return i == length || field[i] == ' ' || field[i] == '\0';
+}
+
+/**
+ * Returns true if the checksum of a header block is right.
+ */
+static bool valid_checksum (const uint8_t *header)
+{
+    uint64_t expected;
+    if (!parse_number(header + 148, 8, &expected)) return false;
+
+    uint64_t sum = 0;
+    for (int i=0; i < BLOCK_SIZE; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : header[i];
+    }
+    return sum == expected;
+}
+
+/**
+ * Read exactly size bytes, false at end of file or on error.
+ */
+static bool read_fully (tar_reader *tar, void *buffer, size_t size)
+{
+    uint8_t *p = buffer;
+    while (size > 0) {
+        unsigned chunk = size > (1u << 30) ? (1u << 30) : (unsigned) size;
+        int n = gzread(tar->gz, p, chunk);
+        if (n <= 0) return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/**
+ * Read the contents of the current member and the padding after it,
+ * false if it is larger than TAR_MEMBER_MAX.
+ */
+static bool read_contents (tar_reader *tar, uint64_t size)
+{
+    if (size > TAR_MEMBER_MAX) return false;
+    uint64_t padded = (size + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+    if (padded + 1 > tar->capacity) {
+        // One more byte so that names and pax records can be terminated
+        uint8_t *data = realloc(tar->data, padded + 1);
+        if (data == NULL) return false;
+        tar->data = data;
+        tar->capacity = padded + 1;
+    }
+    if (!read_fully(tar, tar->data, padded)) return false;
+    tar->data[size] = '\0';
+    return true;
+}
+
+/**
+ * Skip the contents of the current member and the padding after it.
+ */
+static bool skip_contents (tar_reader *tar, uint64_t size)
+{
+    uint8_t blocks[16 * BLOCK_SIZE];
+    uint64_t nbBlocks = size / BLOCK_SIZE + (size % BLOCK_SIZE != 0);
+    while (nbBlocks > 0) {
+        uint64_t chunk = nbBlocks > 16 ? 16 : nbBlocks;
+        if (!read_fully(tar, blocks, chunk * BLOCK_SIZE)) return false;
+        nbBlocks -= chunk;
+    }
+    return true;
+}
+
+/**
+ * Copy the "path" record of pax extended header contents, if any.
+ */
+static void pax_path (const char *records, size_t size, char *name)
+{
+    size_t offset = 0;
+    while (offset < size) {
+        char *end;
+        unsigned long length = strtoul(records + offset, &end, 10);
+        if (length == 0 || offset + length > size || *end != ' ') return;
+
+        const char *key = end + 1;
+        const char *record_end = records + offset + length - 1; // '\n'
+        if (strncmp(key, "path=", 5) == 0) {
+            size_t path_length = record_end - (key + 5);
+            if (path_length < TAR_NAME_SIZE) {
+                memcpy(name, key + 5, path_length);
+                name[path_length] = '\0';
+            }
+        }
+        offset += length;
+    }
+}
+
+tar_reader *tar_open (const char *filename)
+{
+    int fd = strcmp("-", filename) == 0 ? dup(STDIN_FILENO) : open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+
+    tar_reader *tar = calloc(1, sizeof(tar_reader));
+    if (tar == NULL) {
+        close(fd);
+        return NULL;
+    }
+    tar->gz = gzdopen(fd, "rb");
+    if (tar->gz == NULL) {
+        close(fd);
+        free(tar);
+        return NULL;
+    }
+    gzbuffer(tar->gz, 1 << 16);
+    return tar;
+} // end tar_open()
+
+bool tar_next (tar_reader *tar, tar_member *member)
+{
+    // Name given by a previous GNU or pax entry, for the next member
+    char long_name[TAR_NAME_SIZE] = "";
+    uint8_t header[BLOCK_SIZE];
+
+    while (!tar->end && !tar->error) {
+        if (!read_fully(tar, header, BLOCK_SIZE)) {
+            tar->error = true; // the archive ends with zero blocks
+            break;
+        }
+
+        // A zero block marks the end of the archive
+        bool zero = true;
+        for (int i=0; i < BLOCK_SIZE && zero; i++) zero = header[i] == 0;
+        if (zero) {
+            tar->end = true;
+            break;
+        }
+
+        char type = header[156];
+        bool contents = type == 'L' || type == 'x' || type == '0' || type == '\0' || type == '7';
+        uint64_t size;
+        if (!valid_checksum(header) || !parse_number(header + 124, 12, &size) ||
+            !(contents ? read_contents(tar, size) : skip_contents(tar, size))) {
+            tar->error = true;
+            break;
+        }
+
+        switch (type) {
+            case 'L': // GNU long name
+                snprintf(long_name, TAR_NAME_SIZE, "%s", (char *) tar->data);
+                break;
+            case 'x': // pax extended header
+                pax_path((char *) tar->data, size, long_name);
+                break;
+            case '0': case '\0': case '7': // regular file
+                if (long_name[0] != '\0') {
+                    memcpy(member->name, long_name, TAR_NAME_SIZE);
+                } else if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+                    snprintf(member->name, TAR_NAME_SIZE, "%.155s/%.100s",
+                             (char *) header + 345, (char *) header);
+                } else {
+                    snprintf(member->name, TAR_NAME_SIZE, "%.100s", (char *) header);
+                }
+                member->data = tar->data;
+                member->size = size;
+                return true;
+            default: // directories, links, global pax headers...
+                long_name[0] = '\0';
+                break;
+        } // end switch type
+    } // end while
+
+    return false;
+} // end tar_next()
+
+bool tar_error (const tar_reader *tar)
+{
+    return tar->error;
+}
+
+void tar_close (tar_reader *tar)
+{
+    if (tar == NULL) return;
+    gzclose(tar->gz);
+    free(tar->data);
+    free(tar);
+}
+
+/**
+ * Returns true if s ends with suffix.
+ */
+static bool ends_with (const char *s, const char *suffix)
+{
+    size_t length = strlen(s), suffix_length = strlen(suffix);
+    return length >= suffix_length && strcmp(s + length - suffix_length, suffix) == 0;
+}
+
+bool is_tar_file (const char *filename)
+{
+    return ends_with(filename, ".tar") || ends_with(filename, ".tar.gz") ||
+           ends_with(filename, ".tgz");
+}
+
+int sample_sets (const char *name)
+{
+    const char *base = strrchr(name, '/');
+    base = base != NULL ? base + 1 : name;
+
+    // Same as the globs *_[123]* and *_[456789]*
+    int sets = 0;
+    for (const char *p = strchr(base, '_'); p != NULL; p = strchr(p + 1, '_')) {
+        if (p[1] >= '1' && p[1] <= '3') sets |= SAMPLE_TRAIN;
+        if (p[1] >= '4' && p[1] <= '9') sets |= SAMPLE_TEST;
+    }
+    return sets;
+}
+
+bool tar_member_gray (const tar_member *member, uint8_t *gray)
+{
+    return read_gray_image(member->data, member->size, gray);
+}
+
+int tar_member_pixels (const tar_member *member, uint8_t *pixels)
+{
+    uint8_t gray[IMG_WIDTH * IMG_HEIGHT];
+    if (tar_member_gray(member, gray)) return label_pixels(gray, pixels);
+    if (member->size == 0) return -1;
+
+    // Text file of remove_noise, read like segmenter does
+    FILE *f = fmemopen((void *) member->data, member->size, "r");
+    if (f == NULL) return -1;
+    pixels_struct pstruct = convert_txt_to_1dim_array(f);
+    fclose(f);
+
+    memcpy(pixels, pstruct.pixels, IMG_WIDTH * IMG_HEIGHT);
+    free(pstruct.pixels);
+    return pstruct.nbGroups <= CAPTCHA_ARR_SIZE ? pstruct.nbGroups : -1;
+} // end tar_member_pixels()
+
+int sample_answer (const char *name, char *answer)
+{
+    const char *base = strrchr(name, '/');
+    base = base != NULL ? base + 1 : name;
+    size_t length = strcspn(base, "_.");
+    if (length > CAPTCHA_ARR_SIZE) return -1;
+
+    memcpy(answer, base, length);
+    answer[length] = '\0';
+    return length;
+}
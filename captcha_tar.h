@@ -0,0 +1,101 @@
+#pragma once
+#ifndef CAPTCHA_TAR_H
+#define CAPTCHA_TAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Sets of samples, from the name of their file: like
+ * generate_train_file.sh and generate_test_file.sh, a name with "_1",
+ * "_2" or "_3" is a training sample, one with "_4" to "_9" a test sample
+ * (and a name can have both).
+ */
+#define SAMPLE_TRAIN 1
+#define SAMPLE_TEST 2
+
+#define TAR_NAME_SIZE 4096 //!< Longest member name (GNU and pax long names)
+#define TAR_MEMBER_MAX (64u << 20) //!< Largest file (or long name, pax header) read in memory
+
+/**
+ * Regular file of an archive, read in memory.
+ */
+typedef struct {
+    char name[TAR_NAME_SIZE]; //!< path in the archive
+    const uint8_t *data;      //!< contents, valid until the next tar_next()
+    size_t size;              //!< bytes of data
+} tar_member;
+
+typedef struct tar_reader tar_reader;
+
+/**
+ * Open a .tar or .tar.gz file (compression is detected from the data)
+ * to read its members in order, without seeking.
+ *
+ * \param filename archive, "-" for standard input
+ * \return reader, NULL if the file cannot be opened
+ */
+tar_reader *tar_open (const char *filename);
+
+/**
+ * Read the next regular file. Directories, links and other entries are
+ * skipped without being read in memory. A file larger than
+ * TAR_MEMBER_MAX is an error.
+ *
+ * \param member receives the name and contents of the file
+ * \return false at the end of the archive or on error (see tar_error())
+ */
+bool tar_next (tar_reader *tar, tar_member *member);
+
+/**
+ * Returns true if reading stopped because of a corrupt or truncated
+ * archive rather than its end.
+ */
+bool tar_error (const tar_reader *tar);
+
+/**
+ * Close the archive.
+ */
+void tar_close (tar_reader *tar);
+
+/**
+ * Returns true if filename ends with .tar, .tar.gz or .tgz.
+ */
+bool is_tar_file (const char *filename);
+
+/**
+ * Returns the sets (SAMPLE_TRAIN, SAMPLE_TEST) a sample belongs to,
+ * from the base name of its file, 0 if none.
+ */
+int sample_sets (const char *name);
+
+/**
+ * Read a raw (IMG_WIDTH * IMG_HEIGHT bytes) or binary PGM image of
+ * IMG_WIDTH x IMG_HEIGHT 8-bit pixels from a member.
+ *
+ * \param gray receives IMG_WIDTH * IMG_HEIGHT pixels
+ * \return false if the member is not such an image
+ */
+bool tar_member_gray (const tar_member *member, uint8_t *gray);
+
+/**
+ * Group pixels of a sample: an image (see tar_member_gray()) or a text
+ * file written by remove_noise. Needs captcha_features.o.
+ *
+ * \param pixels receives the group of each pixel
+ * \return number of groups, -1 if the member cannot be read or has too
+ *         many groups
+ */
+int tar_member_pixels (const tar_member *member, uint8_t *pixels);
+
+/**
+ * Copy the answer of a sample from its name: the start of its base name
+ * up to the first '_', as in "K3xb7_2.txt".
+ *
+ * \param answer at least CAPTCHA_ARR_SIZE + 1 chars
+ * \return length of the answer, -1 if too long
+ */
+int sample_answer (const char *name, char *answer);
+
+#endif
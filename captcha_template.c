@@ -0,0 +1,247 @@
+/**
+ * \file
+ *
+ * \brief Classification of normalized glyphs by template matching
+ *
+ * A glyph is the same 16 x 16 bit grid the glyph cache uses as key, held
+ * in four 64-bit words, so that its distance to a template is four XOR
+ * and four popcounts. All templates are scanned: 74 classes of 4
+ * templates are about 1200 popcounts per symbol, which compilers
+ * vectorize given the instructions (e.g. -march=native with AVX-512
+ * VPOPCNTDQ, or POPCNT one word at a time).
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "captcha_template.h"
+#include "captcha_common.h"
+#include "captcha_tar.h"
+
+#define KMEANS_ITERATIONS 10
+
+struct template_set {
+    int nbTemplates;
+    glyph_bitmap *bitmaps;
+    char *characters;       //!< class of each template
+};
+
+static int hamming (const glyph_bitmap *a, const glyph_bitmap *b)
+{
+    int distance = 0;
+    for (int w=0; w < TEMPLATE_WORDS; w++) {
+        distance += __builtin_popcountll(a->words[w] ^ b->words[w]);
+    }
+    return distance;
+}
+
+void glyph_bitmap_from_symbol (const uint8_t *pixels, const symbols_struct *symbols,
+                               int symbol, glyph_bitmap *bitmap)
+{
+    glyph_key key;
+    glyph_key_from_symbol(pixels, symbols, symbol, 0, &key);
+    for (int w=0; w < TEMPLATE_WORDS; w++) {
+        bitmap->words[w] = 0;
+        for (int r=0; r < 4; r++) {
+            bitmap->words[w] |= (uint64_t) key.rows[4 * w + r] << (16 * r);
+        }
+    }
+}
+
+/**
+ * Index in members of the center nearest to a glyph.
+ */
+static int nearest_center (const glyph_bitmap *centers, int nbCenters, const glyph_bitmap *glyph)
+{
+    int best = 0, bestDistance = hamming(&centers[0], glyph);
+    for (int c=1; c < nbCenters; c++) {
+        int distance = hamming(&centers[c], glyph);
+        if (distance < bestDistance) {
+            best = c;
+            bestDistance = distance;
+        }
+    }
+    return best;
+}
+
+/**
+ * Cluster the glyphs of one class.
+ *
+ * \param members indices of the glyphs of the class
+ * \param centers receives nbCenters templates
+ * \param cluster work array, one int per member
+ */
+static void cluster_class (const glyph_bitmap *glyphs, const int *members, int nbMembers,
+                           glyph_bitmap *centers, int nbCenters, int *cluster)
+{
+    // Spread the first centers: each one is the glyph farthest from the previous ones
+    centers[0] = glyphs[members[0]];
+    for (int c=1; c < nbCenters; c++) {
+        int farthest = 0, farthestDistance = -1;
+        for (int m=0; m < nbMembers; m++) {
+            const glyph_bitmap *glyph = &glyphs[members[m]];
+            int distance = hamming(&centers[nearest_center(centers, c, glyph)], glyph);
+            if (distance > farthestDistance) {
+                farthest = m;
+                farthestDistance = distance;
+            }
+        }
+        centers[c] = glyphs[members[farthest]];
+    }
+
+    for (int m=0; m < nbMembers; m++) cluster[m] = -1;
+    for (int it=0; it < KMEANS_ITERATIONS; it++) {
+        bool changed = false;
+        for (int m=0; m < nbMembers; m++) {
+            int c = nearest_center(centers, nbCenters, &glyphs[members[m]]);
+            changed = changed || c != cluster[m];
+            cluster[m] = c;
+        }
+        if (!changed) break;
+
+        // Majority of each bit, a cluster left empty keeps its center
+        for (int c=0; c < nbCenters; c++) {
+            int counts[GLYPH_SIZE * GLYPH_SIZE] = { 0 };
+            int size = 0;
+            for (int m=0; m < nbMembers; m++) {
+                if (cluster[m] != c) continue;
+                size++;
+                for (int b=0; b < GLYPH_SIZE * GLYPH_SIZE; b++) {
+                    counts[b] += (glyphs[members[m]].words[b / 64] >> (b % 64)) & 1;
+                }
+            }
+            if (size == 0) continue;
+            for (int w=0; w < TEMPLATE_WORDS; w++) centers[c].words[w] = 0;
+            for (int b=0; b < GLYPH_SIZE * GLYPH_SIZE; b++) {
+                if (2 * counts[b] > size) centers[c].words[b / 64] |= 1ULL << (b % 64);
+            }
+        } // end for c
+    } // end for it
+} // end cluster_class()
+
+template_set *template_build (const glyph_bitmap *glyphs, const char *characters, int nbGlyphs,
+                              int perClass)
+{
+    if (perClass < 1) return NULL;
+    template_set *templates = calloc(1, sizeof(template_set));
+    int *members = malloc(nbGlyphs * sizeof(int) + 1);
+    int *cluster = malloc(nbGlyphs * sizeof(int) + 1);
+    if (templates != NULL) {
+        templates->bitmaps = malloc(TEMPLATE_NB_CLASSES * perClass * sizeof(glyph_bitmap));
+        templates->characters = malloc(TEMPLATE_NB_CLASSES * perClass);
+    }
+    if (templates == NULL || members == NULL || cluster == NULL ||
+        templates->bitmaps == NULL || templates->characters == NULL) {
+        template_free(templates);
+        free(members);
+        free(cluster);
+        return NULL;
+    }
+
+    for (int c=0; c < TEMPLATE_NB_CLASSES; c++) {
+        int nbMembers = 0;
+        for (int g=0; g < nbGlyphs; g++) {
+            if (characters[g] == '0' + c) members[nbMembers++] = g;
+        }
+        if (nbMembers == 0) continue;
+
+        int nbCenters = nbMembers < perClass ? nbMembers : perClass;
+        cluster_class(glyphs, members, nbMembers, templates->bitmaps + templates->nbTemplates,
+                      nbCenters, cluster);
+        memset(templates->characters + templates->nbTemplates, '0' + c, nbCenters);
+        templates->nbTemplates += nbCenters;
+    }
+
+    free(members);
+    free(cluster);
+    if (templates->nbTemplates == 0) {
+        template_free(templates);
+        return NULL;
+    }
+    return templates;
+} // end template_build()
+
+template_set *template_build_from_corpus (const char *filename, int perClass)
+{
+    tar_reader *tar = tar_open(filename);
+    if (tar == NULL) return NULL;
+
+    int capacity = 1024, nbGlyphs = 0;
+    glyph_bitmap *glyphs = malloc(capacity * sizeof(glyph_bitmap));
+    char *characters = malloc(capacity);
+    uint8_t pixels[IMG_WIDTH * IMG_HEIGHT];
+    symbols_struct symbols;
+    char answer[CAPTCHA_ARR_SIZE + 1];
+    bool failed = glyphs == NULL || characters == NULL;
+    tar_member member;
+    while (!failed && tar_next(tar, &member)) {
+        if ((sample_sets(member.name) & SAMPLE_TRAIN) == 0) continue;
+
+        int nbGroups = tar_member_pixels(&member, pixels);
+        int length = sample_answer(member.name, answer);
+        if (nbGroups < 0 || length < 0) continue;
+        segment_symbols(pixels, nbGroups, &symbols);
+        if (symbols.nbSymbols != length) continue;
+
+        if (nbGlyphs + length > capacity) {
+            capacity *= 2;
+            glyph_bitmap *newGlyphs = realloc(glyphs, capacity * sizeof(glyph_bitmap));
+            if (newGlyphs != NULL) glyphs = newGlyphs;
+            char *newCharacters = realloc(characters, capacity);
+            if (newCharacters != NULL) characters = newCharacters;
+            failed = newGlyphs == NULL || newCharacters == NULL;
+            if (failed) break;
+        }
+        for (int i=0; i < length; i++) {
+            glyph_bitmap_from_symbol(pixels, &symbols, symbols.order[i], &glyphs[nbGlyphs]);
+            characters[nbGlyphs++] = answer[i];
+        }
+    } // end while
+
+    template_set *templates = NULL;
+    if (!failed && !tar_error(tar)) {
+        templates = template_build(glyphs, characters, nbGlyphs, perClass);
+    }
+    tar_close(tar);
+    free(glyphs);
+    free(characters);
+    return templates;
+} // end template_build_from_corpus()
+
+void template_free (template_set *templates)
+{
+    if (templates == NULL) return;
+    free(templates->bitmaps);
+    free(templates->characters);
+    free(templates);
+}
+
+int template_count (const template_set *templates)
+{
+    return templates->nbTemplates;
+}
+
+char template_classify (const template_set *templates, const glyph_bitmap *glyph,
+                        int *distance)
+{
+    int best = 0, bestDistance = GLYPH_SIZE * GLYPH_SIZE + 1;
+    for (int t=0; t < templates->nbTemplates; t++) {
+        int d = hamming(&templates->bitmaps[t], glyph);
+        if (d < bestDistance) {
+            best = t;
+            bestDistance = d;
+        }
+    }
+    if (distance != NULL) *distance = bestDistance;
+    return templates->characters[best];
+}
+
+void classify_symbols_template (const template_set *templates, const uint8_t *pixels,
+                                const symbols_struct *symbols, char *answer)
+{
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        glyph_bitmap glyph;
+        glyph_bitmap_from_symbol(pixels, symbols, symbols->order[i], &glyph);
+        answer[i] = template_classify(templates, &glyph, NULL);
+    }
+    answer[symbols->nbSymbols] = '\0';
+}
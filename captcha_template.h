@@ -0,0 +1,81 @@
+#pragma once
+#ifndef CAPTCHA_TEMPLATE_H
+#define CAPTCHA_TEMPLATE_H
+
+#include <stdint.h>
+#include "captcha_features.h"
+#include "captcha_glyph_cache.h"
+
+#define TEMPLATE_WORDS (GLYPH_SIZE * GLYPH_SIZE / 64) //!< 64-bit words per glyph bitmap
+#define TEMPLATE_NB_CLASSES ('z' - '0') //!< Characters from '0', as the outputs of the network
+#define TEMPLATES_PER_CLASS 4           //!< Default number of templates of a class
+
+/**
+ * Normalized glyph (see glyph_key) as GLYPH_SIZE * GLYPH_SIZE bits:
+ * rows 4w to 4w+3 in word w, 16 bits each.
+ */
+typedef struct {
+    uint64_t words[TEMPLATE_WORDS];
+} glyph_bitmap;
+
+/**
+ * Templates of each class, a glyph is classified as the class of the
+ * template at the smallest Hamming distance.
+ */
+typedef struct template_set template_set;
+
+/**
+ * Normalize a symbol.
+ *
+ * \param pixels pixels array, as renumbered by segment_symbols()
+ * \param symbols symbols as filled by segment_symbols()
+ * \param symbol index of the symbol in symbols
+ */
+void glyph_bitmap_from_symbol (const uint8_t *pixels, const symbols_struct *symbols,
+                               int symbol, glyph_bitmap *bitmap);
+
+/**
+ * Build templates from labeled glyphs: the glyphs of each class are split
+ * in perClass clusters (k-means with Hamming distance), and the template
+ * of a cluster is the majority of its glyphs, bit by bit. Clusters pick
+ * up the slants and weights of a class that one template would blur.
+ *
+ * \param characters class of each glyph, from '0' to '0' + TEMPLATE_NB_CLASSES - 1
+ * \param perClass templates per class at most, fewer if the class has fewer glyphs
+ * \return templates, NULL if memory could not be allocated or no glyph has a class
+ */
+template_set *template_build (const glyph_bitmap *glyphs, const char *characters, int nbGlyphs,
+                              int perClass);
+
+/**
+ * Build templates from the training samples (see SAMPLE_TRAIN) of an
+ * archive, as sample_features reads them. Needs captcha_tar.o.
+ *
+ * \param filename .tar or .tar.gz corpus, "-" for standard input
+ * \return templates, NULL if the archive cannot be read or has no sample
+ */
+template_set *template_build_from_corpus (const char *filename, int perClass);
+
+void template_free (template_set *templates);
+
+int template_count (const template_set *templates);
+
+/**
+ * Class of a glyph.
+ *
+ * \param distance receives the Hamming distance to the nearest template, may be NULL
+ * \return character
+ */
+char template_classify (const template_set *templates, const glyph_bitmap *glyph,
+                        int *distance);
+
+/**
+ * Same as classify_symbols() with templates instead of the network.
+ *
+ * \param pixels pixels array, as renumbered by segment_symbols()
+ * \param answer receives symbols->nbSymbols characters and '\0'
+ */
+void classify_symbols_template (const template_set *templates, const uint8_t *pixels,
+                                const symbols_struct *symbols, char *answer);
+
+#endif
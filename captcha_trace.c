@@ -0,0 +1,187 @@
+/**
+ * \file
+ *
+ * \brief Span recording for per-image timelines
+ *
+ * Each thread records its events in its own ring, without locking. The
+ * ring is allocated at the first event of the thread and registered in
+ * a list, so that trace_write() finds all of them. Threads may end before
+ * the trace is written: the ring of an ended thread stays in the list
+ * until trace_write() has written it, then it is free'd (at once if it
+ * holds no event).
+ */
+
+#define _POSIX_C_SOURCE 200809L // clock_gettime()
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "captcha_trace.h"
+
+/**
+ * One begin or end of span.
+ */
+typedef struct {
+    const char *name;  //!< span name, string literal
+    uint64_t    ts;    //!< nanoseconds, monotonic clock
+    int32_t     image; //!< image index, -1 for none
+    char        phase; //!< 'B' or 'E'
+} trace_record;
+
+/**
+ * Events of one thread.
+ */
+typedef struct trace_ring {
+    trace_record records[TRACE_RING_EVENTS];
+    uint64_t head;           //!< number of events recorded since last write
+    int32_t  image;          //!< image of next events
+    int      tid;            //!< thread number in the trace, from 1
+    bool     exited;         //!< thread ended, free'd once written
+    struct trace_ring *next; //!< next ring in the list
+} trace_ring;
+
+volatile bool trace_enabled = false;
+
+static __thread trace_ring *ring = NULL;   //!< ring of the calling thread
+static trace_ring *rings = NULL;           //!< all rings
+static int nbRings = 0;
+static pthread_mutex_t rings_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t ring_key;             //!< calls release_ring() at thread exit
+static pthread_once_t ring_key_once = PTHREAD_ONCE_INIT;
+
+static uint64_t get_time_ns (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/**
+ * Remove a ring from the list and free it. rings_mutex must be held.
+ *
+ * \param link pointer to the ring in the list
+ */
+static void unlink_ring (trace_ring **link)
+{
+    trace_ring *r = *link;
+    *link = r->next;
+    free(r);
+}
+
+/**
+ * Thread exit: the events of the ring are kept for trace_write().
+ */
+static void release_ring (void *arg)
+{
+    trace_ring *r = arg;
+
+    pthread_mutex_lock(&rings_mutex);
+    if (r->head > 0) {
+        r->exited = true;
+    } else {
+        trace_ring **link = &rings;
+        while (*link != r) link = &(*link)->next;
+        unlink_ring(link);
+    }
+    pthread_mutex_unlock(&rings_mutex);
+} // end release_ring()
+
+static void create_ring_key (void)
+{
+    pthread_key_create(&ring_key, release_ring);
+}
+
+/**
+ * Returns the ring of the calling thread, NULL if it cannot be allocated.
+ */
+static trace_ring *get_ring (void)
+{
+    if (ring != NULL) return ring;
+
+    pthread_once(&ring_key_once, create_ring_key);
+    ring = malloc(sizeof(trace_ring));
+    if (ring == NULL) return NULL;
+    ring->head = 0;
+    ring->image = -1;
+    ring->exited = false;
+
+    pthread_mutex_lock(&rings_mutex);
+    ring->tid = ++nbRings;
+    ring->next = rings;
+    rings = ring;
+    pthread_mutex_unlock(&rings_mutex);
+    pthread_setspecific(ring_key, ring);
+
+    return ring;
+} // end get_ring()
+
+void trace_start (void) { trace_enabled = true; }
+
+void trace_stop (void) { trace_enabled = false; }
+
+void trace_set_image (int32_t index)
+{
+    trace_ring *r = get_ring();
+    if (r != NULL) r->image = index;
+}
+
+void trace_event (char phase, const char *name)
+{
+    trace_ring *r = get_ring();
+    if (r == NULL) return;
+
+    trace_record *record = &r->records[r->head % TRACE_RING_EVENTS];
+    record->name = name;
+    record->ts = get_time_ns();
+    record->image = r->image;
+    record->phase = phase;
+    r->head++;
+} // end trace_event()
+
+bool trace_write (FILE *f)
+{
+    int pid = getpid();
+    bool first = true;
+
+    pthread_mutex_lock(&rings_mutex);
+    fprintf(f, "{\"traceEvents\":[");
+    trace_ring **link = &rings;
+    while (*link != NULL) {
+        trace_ring *r = *link;
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"thread %d\"}}", first ? "" : ",", pid, r->tid, r->tid);
+        first = false;
+
+        // Oldest event first. If the ring wrapped, ends of spans whose
+        // beginning was overwritten are skipped.
+        uint64_t start = r->head > TRACE_RING_EVENTS ? r->head - TRACE_RING_EVENTS : 0;
+        int depth = 0;
+        for (uint64_t e = start; e < r->head; e++) {
+            const trace_record *record = &r->records[e % TRACE_RING_EVENTS];
+            if (record->phase == 'B') {
+                depth++;
+            } else if (depth == 0) {
+                continue;
+            } else {
+                depth--;
+            }
+
+            fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d",
+                    record->name, record->phase, record->ts / 1e3, pid, r->tid);
+            if (record->image >= 0) {
+                fprintf(f, ",\"args\":{\"image\":%d}", (int) record->image);
+            }
+            fprintf(f, "}");
+        } // end for each event
+        r->head = 0;
+        if (r->exited) {
+            unlink_ring(link);
+        } else {
+            link = &r->next;
+        }
+    } // end for each ring
+    fprintf(f, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    pthread_mutex_unlock(&rings_mutex);
+
+    return !ferror(f);
+} // end trace_write()
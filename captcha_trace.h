@@ -0,0 +1,77 @@
+#pragma once
+#ifndef CAPTCHA_TRACE_H
+#define CAPTCHA_TRACE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Number of events kept per thread. When a ring is full, the oldest
+ * events are overwritten.
+ */
+#define TRACE_RING_EVENTS 65536
+
+/**
+ * Spans are compiled in when CAPTCHA_TRACE is defined (see Makefile).
+ * They are only recorded between trace_start() and trace_stop(), so when
+ * tracing is off a span costs a test of trace_enabled.
+ *
+ *     TRACE_IMAGE(i);
+ *     TRACE_BEGIN("label");
+ *     ...
+ *     TRACE_END("label");
+ *
+ * Names must be string literals (only the pointer is stored).
+ */
+#ifdef CAPTCHA_TRACE
+#define TRACE_BEGIN(name) do { if (trace_enabled) trace_event('B', name); } while (0)
+#define TRACE_END(name)   do { if (trace_enabled) trace_event('E', name); } while (0)
+#define TRACE_IMAGE(index) do { if (trace_enabled) trace_set_image(index); } while (0)
+#else
+#define TRACE_BEGIN(name) ((void) 0)
+#define TRACE_END(name)   ((void) 0)
+#define TRACE_IMAGE(index) ((void) 0)
+#endif
+
+/**
+ * True between trace_start() and trace_stop().
+ */
+extern volatile bool trace_enabled;
+
+/**
+ * Start recording spans, in all threads.
+ */
+void trace_start (void);
+
+/**
+ * Stop recording spans. Events recorded so far are kept.
+ */
+void trace_stop (void);
+
+/**
+ * Set the image the following spans of the calling thread belong to,
+ * -1 for none (batch work, loading...).
+ */
+void trace_set_image (int32_t index);
+
+/**
+ * Record the beginning ('B') or end ('E') of a span in the ring of the
+ * calling thread.
+ */
+void trace_event (char phase, const char *name);
+
+/**
+ * Write events of all threads as Chrome trace-event JSON, which
+ * Perfetto (ui.perfetto.dev) and chrome://tracing can open, then
+ * empty the rings and free those of threads which have ended.
+ *
+ * Must not be called while other threads record events: call
+ * trace_stop() and wait for the workers first.
+ *
+ * \param f output stream
+ * \return false if an error occurred while writing
+ */
+bool trace_write (FILE *f);
+
+#endif
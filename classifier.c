@@ -0,0 +1,66 @@
+/**
+ * \file
+ *
+ * \brief Main program (Classifier with a mapped model file)
+ *
+ * Same input and output as captcha_cari_test.php: one line of features
+ * per symbol on standard input, in reading order, and the characters
+ * printed without separator. The network is a .cnet file (see
+ * net_to_model.py) mapped in memory instead of a .net file parsed at
+ * each run, so starting a classifier per captcha costs almost nothing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "captcha_model_file.h"
+
+#define LINE_SIZE 4096 //!< Maximum length of a line of features
+
+int main (int argc, char** argv)
+{
+    char usage_str[] = "Usage: %s model.cnet < features\n";
+
+    if (argc != 2) {
+        printf(usage_str, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    mapped_model *model = mapped_model_open(argv[1]);
+    if (model == NULL) {
+        fprintf(stderr, "Cannot map model file %s.\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    uint32_t num_input = model->header->nbInputs;
+    uint32_t num_output = mapped_model_num_output(model);
+
+    float input[MODEL_FILE_MAX_NEURONS];
+    float output[MODEL_FILE_MAX_NEURONS];
+    char line[LINE_SIZE];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        // Like captcha_cari_test.php, skip lines with too few values
+        uint32_t nbValues = 0;
+        char *end;
+        for (char *p = line; nbValues < num_input; p = end) {
+            float value = strtof(p, &end);
+            if (end == p) break;
+            input[nbValues++] = value;
+        }
+        if (nbValues <= 3) continue;
+        if (nbValues != num_input) {
+            fprintf(stderr, "Expected %u features, got %u.\n", num_input, nbValues);
+            exit(EXIT_FAILURE);
+        }
+
+        // First output with the highest value wins
+        mapped_model_run(model, input, output);
+        uint32_t guess = 0;
+        for (uint32_t o=1; o < num_output; o++) {
+            if (output[o] > output[guess]) guess = o;
+        }
+        putchar(label_character(&model->labels, guess));
+    } // end while
+
+    mapped_model_close(model);
+    return EXIT_SUCCESS;
+} // end main()
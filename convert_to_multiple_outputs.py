@@ -1,13 +1,23 @@
 #!/usr/bin/env python3
 # -*- coding: utf-8
 
+"""Usage: convert_to_multiple_outputs.py knn_train.txt knn_train_multiple.txt [labels]
+
+One output per character of the label map file labels (see
+captcha_labels.h), or per character from '0' to 'y' without one.
+"""
+
 __author__ = 'Mathieu Clément'
 __version__ = '0.1'
 
-def char_to_multiple_outputs(char):
-    asInt = ord(char) - ord('0')
+from net_to_c import LEGACY_LABELS, read_label_map
+
+def char_to_multiple_outputs(char, labels=LEGACY_LABELS):
+    asInt = labels.find(char)
+    if asInt < 0:
+        raise ValueError("'%s' is not in the label map" % char)
     buf = ''
-    for i in range(0,ord('z') - ord('0')):
+    for i in range(0,len(labels)):
         if i == asInt:
             buf += '1 '
         else:
@@ -15,7 +25,7 @@ def char_to_multiple_outputs(char):
     buf += '\n'
     return buf
 
-def file_to_multiple_outputs(input_filename, output_filename):
+def file_to_multiple_outputs(input_filename, output_filename, labels=LEGACY_LABELS):
     fh = open(input_filename, 'r')
     oh = open(output_filename, 'w')
 
@@ -23,7 +33,7 @@ def file_to_multiple_outputs(input_filename, output_filename):
     for line in fh:
         count += 1
         if count % 2 == 0:
-            oh.write(char_to_multiple_outputs(line[0]))
+            oh.write(char_to_multiple_outputs(line[0], labels))
         else:
             oh.write(line)
 
@@ -32,4 +42,12 @@ def file_to_multiple_outputs(input_filename, output_filename):
 
 if __name__ == '__main__':
     import sys
-    file_to_multiple_outputs(sys.argv[1], sys.argv[2])
+    if len(sys.argv) not in (3, 4):
+        sys.stderr.write(__doc__)
+        sys.exit(1)
+    try:
+        labels = read_label_map(sys.argv[3]) if len(sys.argv) == 4 else LEGACY_LABELS
+        file_to_multiple_outputs(sys.argv[1], sys.argv[2], labels)
+    except (OSError, ValueError) as e:
+        sys.stderr.write('%s\n' % e)
+        sys.exit(1)
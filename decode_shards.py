@@ -0,0 +1,276 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8
+
+"""Decode a large list of captcha images with several decoder processes.
+
+Usage: decode_shards.py [-n shards] [-j workers] [-w work_dir] [-d decoder]
+                        [-l launcher] [-m memory_mb] [-r retries]
+                        manifest.txt results.txt
+
+The manifest lists image files (raw or PGM, see decoder_static), one path
+per line. Each path goes to shard crc32(path) % shards, and each shard is
+decoded by one "decoder_static -l" worker, at most -j at a time. Results
+are merged into one "path answer" line per manifest line, in manifest
+order.
+
+The work directory holds, for shard K:
+    shard_K.list   paths of the shard, in manifest order
+    shard_K.out    output of its worker, one line per path
+and checkpoint.json, the progress of each shard. Run the same command
+again to resume after a crash: finished shards are not decoded again,
+the others restart after their last complete output line. A worker
+which fails is restarted the same way, at most -r times.
+
+Workers are local processes (-m limits their address space). With -l,
+the worker command is appended to the launcher, e.g. -l 'ssh node{shard}'
+runs shard K on host nodeK: the work directory and images must then be
+on a filesystem shared with these hosts. Output still comes back through
+the standard output of the launcher.
+"""
+
+__author__ = 'Mathieu Clément'
+__version__ = '0.1'
+
+import argparse
+import json
+import os
+import resource
+import shlex
+import subprocess
+import sys
+import time
+import zlib
+
+CHECKPOINT = 'checkpoint.json'
+CHECKPOINT_VERSION = 1
+POLL_SECONDS = 0.5
+SAVE_SECONDS = 5.0  # checkpoint while workers run
+
+
+def shard_of(path, shards):
+    """Shard of a manifest line, stable across runs and hosts."""
+    return zlib.crc32(path.encode()) % shards
+
+
+def read_manifest(filename):
+    """Yields the paths of the manifest, blank lines skipped."""
+    with open(filename) as fh:
+        for line in fh:
+            path = line.rstrip('\n')
+            if path:
+                yield path
+
+
+def shard_file(work_dir, shard, suffix):
+    return os.path.join(work_dir, 'shard_%d.%s' % (shard, suffix))
+
+
+def write_atomic(filename, text):
+    """Replace a file, so that a crash leaves either version."""
+    tmp = filename + '.tmp'
+    with open(tmp, 'w') as fh:
+        fh.write(text)
+        fh.flush()
+        os.fsync(fh.fileno())
+    os.rename(tmp, filename)
+
+
+def manifest_id(filename, shards):
+    """What a checkpoint is valid for."""
+    st = os.stat(filename)
+    return {'manifest': os.path.abspath(filename), 'size': st.st_size,
+            'mtime': st.st_mtime, 'shards': shards}
+
+
+def load_checkpoint(work_dir, run):
+    """Returns the checkpoint of the work directory, None if there is
+    none. Raises ValueError if it belongs to another run."""
+    filename = os.path.join(work_dir, CHECKPOINT)
+    if not os.path.exists(filename):
+        return None
+    with open(filename) as fh:
+        checkpoint = json.load(fh)
+    if checkpoint.get('version') != CHECKPOINT_VERSION or checkpoint.get('run') != run:
+        raise ValueError('%s is for another manifest or number of shards' % filename)
+    return checkpoint
+
+
+def save_checkpoint(work_dir, checkpoint):
+    write_atomic(os.path.join(work_dir, CHECKPOINT), json.dumps(checkpoint, indent=1) + '\n')
+
+
+def split_manifest(manifest, work_dir, shards):
+    """Write the list of each shard, returns the number of paths per shard."""
+    counts = [0] * shards
+    files = [open(shard_file(work_dir, k, 'list.tmp'), 'w') for k in range(shards)]
+    try:
+        for path in read_manifest(manifest):
+            k = shard_of(path, shards)
+            files[k].write(path + '\n')
+            counts[k] += 1
+    finally:
+        for fh in files:
+            fh.close()
+    for k in range(shards):
+        os.rename(shard_file(work_dir, k, 'list.tmp'), shard_file(work_dir, k, 'list'))
+    return counts
+
+
+def complete_lines(work_dir, shard):
+    """Count the complete lines of the output of a shard, and cut a line
+    left incomplete by a crash."""
+    filename = shard_file(work_dir, shard, 'out')
+    if not os.path.exists(filename):
+        return 0
+    with open(filename, 'rb+') as fh:
+        data = fh.read()
+        end = data.rfind(b'\n') + 1
+        if end < len(data):
+            fh.truncate(end)
+    return data.count(b'\n', 0, end)
+
+
+def worker_command(args, shard, skip):
+    command = [args.decoder, '-l', '-k', str(skip), shard_file(args.work_dir, shard, 'list')]
+    if args.launcher:
+        # The remote shell gets one command line
+        return shlex.split(args.launcher.format(shard=shard)) + [shlex.join(command)]
+    return command
+
+
+def start_worker(args, shard, skip):
+    """Start decoding a shard after its first skip paths, appending to
+    its output."""
+    limit = args.memory * 1024 * 1024 if args.memory else None
+
+    def set_limits():
+        if limit:
+            resource.setrlimit(resource.RLIMIT_AS, (limit, limit))
+
+    with open(shard_file(args.work_dir, shard, 'out'), 'ab') as out:
+        return subprocess.Popen(worker_command(args, shard, skip), stdout=out,
+                                preexec_fn=set_limits if not args.launcher else None)
+
+
+def run_shards(args, checkpoint):
+    """Run workers until every shard is done or out of retries. Returns
+    the shards which failed."""
+    shards = checkpoint['shards']
+    pending = [k for k, s in enumerate(shards) if s['done'] < s['total']]
+    running = {}  # shard -> process
+    failed = []
+    last_save = time.monotonic()
+
+    while pending or running:
+        while pending and len(running) < args.workers:
+            k = pending.pop(0)
+            shards[k]['done'] = complete_lines(args.work_dir, k)
+            running[k] = start_worker(args, k, shards[k]['done'])
+
+        time.sleep(POLL_SECONDS)
+        for k, process in list(running.items()):
+            status = process.poll()
+            if status is None:
+                continue
+            del running[k]
+            shards[k]['done'] = complete_lines(args.work_dir, k)
+            if status == 0 and shards[k]['done'] == shards[k]['total']:
+                print('shard %d done, %d images' % (k, shards[k]['total']))
+            elif shards[k]['retries'] < args.retries:
+                shards[k]['retries'] += 1
+                sys.stderr.write('shard %d: worker exited with %d at %d/%d, retrying\n' % (
+                    k, status, shards[k]['done'], shards[k]['total']))
+                pending.append(k)
+            else:
+                sys.stderr.write('shard %d: worker exited with %d at %d/%d, giving up\n' % (
+                    k, status, shards[k]['done'], shards[k]['total']))
+                failed.append(k)
+            save_checkpoint(args.work_dir, checkpoint)
+            last_save = time.monotonic()
+
+        if time.monotonic() - last_save > SAVE_SECONDS:
+            # Output may be buffered: this is a lower bound of progress
+            for k in running:
+                shards[k]['done'] = complete_lines_readonly(args.work_dir, k)
+            save_checkpoint(args.work_dir, checkpoint)
+            last_save = time.monotonic()
+
+    return failed
+
+
+def complete_lines_readonly(work_dir, shard):
+    """Same as complete_lines() for the output of a running worker."""
+    with open(shard_file(work_dir, shard, 'out'), 'rb') as fh:
+        return fh.read().count(b'\n')
+
+
+def merge(args, nb_shards):
+    """Write the outputs of the shards in manifest order. Outputs are opened
+    when their first path comes: shards without paths never had a worker,
+    nor an output."""
+    outputs = {}
+    try:
+        with open(args.results + '.tmp', 'w') as results:
+            for path in read_manifest(args.manifest):
+                shard = shard_of(path, nb_shards)
+                if shard not in outputs:
+                    outputs[shard] = open(shard_file(args.work_dir, shard, 'out'))
+                line = outputs[shard].readline()
+                if not line.startswith(path + ' '):
+                    raise ValueError('output of shard %d does not match its list at %s' % (
+                        shard, path))
+                results.write(line)
+    finally:
+        for fh in outputs.values():
+            fh.close()
+    os.rename(args.results + '.tmp', args.results)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode a list of images with several processes.')
+    parser.add_argument('-n', dest='shards', type=int, default=os.cpu_count(), help='number of shards')
+    parser.add_argument('-j', dest='workers', type=int, default=os.cpu_count(),
+                        help='workers running at the same time')
+    parser.add_argument('-w', dest='work_dir', default='shards', help='work directory')
+    parser.add_argument('-d', dest='decoder', default=os.path.join(os.path.dirname(
+        os.path.abspath(__file__)), 'decoder_static'), help='decoder_static program')
+    parser.add_argument('-l', dest='launcher', help="command running a worker, e.g. 'ssh node{shard}'")
+    parser.add_argument('-m', dest='memory', type=int, help='address space of local workers, MB')
+    parser.add_argument('-r', dest='retries', type=int, default=2, help='restarts of a failed worker')
+    parser.add_argument('manifest')
+    parser.add_argument('results')
+    args = parser.parse_args()
+    if args.shards < 1 or args.workers < 1 or args.retries < 0:
+        parser.error('-n and -j must be positive, -r not negative')
+
+    try:
+        os.makedirs(args.work_dir, exist_ok=True)
+        run = manifest_id(args.manifest, args.shards)
+        checkpoint = load_checkpoint(args.work_dir, run)
+        if checkpoint is None:
+            for k in range(args.shards):
+                if os.path.exists(shard_file(args.work_dir, k, 'out')):
+                    os.remove(shard_file(args.work_dir, k, 'out'))
+            counts = split_manifest(args.manifest, args.work_dir, args.shards)
+            checkpoint = {'version': CHECKPOINT_VERSION, 'run': run,
+                          'shards': [{'total': n, 'done': 0, 'retries': 0} for n in counts]}
+            save_checkpoint(args.work_dir, checkpoint)
+        else:
+            for shard in checkpoint['shards']:
+                shard['retries'] = 0
+            print('resuming: %d/%d images done' % (
+                sum(s['done'] for s in checkpoint['shards']),
+                sum(s['total'] for s in checkpoint['shards'])))
+
+        failed = run_shards(args, checkpoint)
+        if failed:
+            sys.stderr.write('shards %s failed, run again to resume\n' % ' '.join(map(str, failed)))
+            sys.exit(1)
+        merge(args, args.shards)
+    except (OSError, ValueError) as e:
+        sys.stderr.write('%s\n' % e)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
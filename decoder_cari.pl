@@ -14,11 +14,17 @@ my $input_image_basename=basename $input_image;
 my $remove_noise_output_file="/tmp/" . $$ . "_" . $input_image_basename . "_rn.txt";
 my $segmenter_output_file="/tmp/" . $$ . "_" . $input_image_basename . "_sg.txt";
 
-# Noise Removal and Binarization
-`$cari_PATH/remove_noise "$input_image" "$remove_noise_output_file"`;
+# With CARI_RING=/name, groups of pixels go through the shared memory ring
+# of a running "segmenter -r /name" instead of a text file
+if (defined $ENV{CARI_RING}) {
+    `$cari_PATH/remove_noise -r "$ENV{CARI_RING}" "$input_image" "$segmenter_output_file"`;
+} else {
+    # Noise Removal and Binarization
+    `$cari_PATH/remove_noise "$input_image" "$remove_noise_output_file"`;
 
-# Segmentation and Feature Extraction
-`$cari_PATH/segmenter "$remove_noise_output_file" > "$segmenter_output_file"`;
+    # Segmentation and Feature Extraction
+    `$cari_PATH/segmenter "$remove_noise_output_file" > "$segmenter_output_file"`;
+}
 
 # Parse the feature file
 open(my $fh, "<", $segmenter_output_file) or die "Could not open $segmenter_output_file";
@@ -45,7 +51,14 @@ foreach(@reading_order) {
 }
 
 #my $out = `echo "$in" | java -cp $KNN_CLASSPATH captcha.knn.KnnClassifier 1 $cari_PATH/knn_train.txt $nb_features 2>/dev/null`;
-my $out = `echo "$in" | php $cari_PATH/captcha_cari_test.php`;
+# The classifier maps knn_multiple.cnet (make knn_multiple.cnet classifier)
+# instead of parsing knn_multiple.net in each PHP process
+my $out;
+if (-x "$cari_PATH/classifier" && -e "$cari_PATH/knn_multiple.cnet") {
+    $out = `echo "$in" | $cari_PATH/classifier $cari_PATH/knn_multiple.cnet`;
+} else {
+    $out = `echo "$in" | php $cari_PATH/captcha_cari_test.php`;
+}
 print $out;
 print "\n";
 
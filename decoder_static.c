@@ -0,0 +1,287 @@
+/**
+ * \file
+ *
+ * \brief Main program (Decoder with the network compiled in)
+ *
+ * Decodes raw captchas (IMG_WIDTH * IMG_HEIGHT 8-bit pixels per image,
+ * one after the other) and prints one answer per line, "-" for images
+ * with too many groups of pixels. Raw and PGM members of a .tar or .tar.gz
+ * file are decoded in memory, one "name answer" line each. With -s, the
+ * input is one PGM sheet of any size holding many captchas, labeled and
+ * decoded in parallel (see captcha_sheet.h), one "x y answer" line each.
+ * With -l, the input lists image files, one path per line, and each
+ * gets a "path answer" line: this is the worker of decode_shards.py.
+ *
+ * The network is not loaded at run time: captcha_net.h is generated
+ * from a .net file by net_to_c.py (make decoder_static NET=file.net),
+ * so there is no model to load and the compiler knows every dimension.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "captcha_common.h"
+#include "captcha_features.h"
+#include "captcha_net.h"
+#include "captcha_sheet.h"
+#include "captcha_tar.h"
+
+#define IMG_SIZE (IMG_WIDTH * IMG_HEIGHT) //!< Bytes per image
+
+#if NET_NUM_INPUT != NB_FEATURES
+#error "captcha_net.h was not generated from a network taking NB_FEATURES inputs"
+#endif
+
+/**
+ * Classify symbols in reading order, like classify_symbols().
+ */
+static void classify_symbols_static (const symbols_struct *symbols, char *answer)
+{
+    float input[NET_NUM_INPUT] NET_ALIGNED;
+    float output[NET_NUM_OUTPUT];
+
+    for (int i=0; i < symbols->nbSymbols; i++) {
+        const double *features = symbols->features[symbols->order[i]];
+        for (int k=0; k < NET_NUM_INPUT; k++) {
+            input[k] = (float) features[k];
+        }
+
+        // First output with the highest value wins
+        net_run(input, output);
+        int guess = 0;
+        for (int o=1; o < NET_NUM_OUTPUT; o++) {
+            if (output[o] > output[guess]) guess = o;
+        }
+        answer[i] = NET_LABELS[guess];
+    } // end for each symbol
+
+    answer[symbols->nbSymbols] = '\0';
+} // end classify_symbols_static()
+
+/**
+ * Decode one image.
+ *
+ * \param answer receives the answer, "-" if there are too many groups
+ */
+static void decode (const uint8_t *gray, char *answer)
+{
+    uint8_t pixels[IMG_SIZE];
+    component_table components;
+    symbols_struct symbols;
+
+    int nbGroups = label_components(gray, pixels, &components);
+    if (nbGroups < 0) {
+        strcpy(answer, "-");
+        return;
+    }
+    extract_components_features(pixels, &components, &symbols);
+    classify_symbols_static(&symbols, answer);
+}
+
+/**
+ * Decode the images of a tar archive, without extracting it.
+ */
+static void decode_tar (const char *filename)
+{
+    tar_reader *tar = tar_open(filename);
+    if (tar == NULL) {
+        fprintf(stderr, "Error opening input file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t gray[IMG_SIZE];
+    char answer[CAPTCHA_ARR_SIZE + 1];
+    tar_member member;
+    while (tar_next(tar, &member)) {
+        if (!tar_member_gray(&member, gray)) continue;
+        decode(gray, answer);
+        printf("%s %s\n", member.name, answer);
+    }
+    if (tar_error(tar)) {
+        fprintf(stderr, "Corrupt archive %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    tar_close(tar);
+}
+
+/**
+ * Decode the raw or PGM image files of a list, one "path answer" line
+ * per path, so that output lines match list lines even for files which
+ * cannot be read ("-" answer).
+ *
+ * \param skip lines of the list to skip, decoded by a previous run
+ */
+static void decode_list (const char *filename, long skip)
+{
+    FILE *list = strcmp("-", filename) == 0 ? stdin : fopen(filename, "r");
+    if (list == NULL) {
+        fprintf(stderr, "Error opening input file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    // Room for a PGM header, and one more byte to tell larger files
+    uint8_t data[IMG_SIZE + 64];
+    uint8_t gray[IMG_SIZE];
+    char answer[CAPTCHA_ARR_SIZE + 1];
+    char *path = NULL;
+    size_t capacity = 0;
+    ssize_t length;
+    for (long line = 0; (length = getline(&path, &capacity, list)) > 0; line++) {
+        if (line < skip) continue;
+        if (path[length - 1] == '\n') path[--length] = '\0';
+
+        FILE *f = fopen(path, "rb");
+        size_t size = f != NULL ? fread(data, 1, sizeof(data), f) : 0;
+        if (f != NULL) fclose(f);
+        if (read_gray_image(data, size, gray)) {
+            decode(gray, answer);
+        } else {
+            fprintf(stderr, "Cannot read image %s.\n", path);
+            strcpy(answer, "-");
+        }
+        printf("%s %s\n", path, answer);
+    } // end for each line
+
+    free(path);
+    if (list != stdin) fclose(list);
+} // end decode_list()
+
+static void classify_sheet_cell (const symbols_struct *symbols, char *answer, void *arg)
+{
+    (void) arg;
+    classify_symbols_static(symbols, answer);
+}
+
+/**
+ * Decode the captchas of a binary PGM sheet.
+ */
+static void decode_sheet (const char *filename, const sheet_grid *grid, int nbThreads)
+{
+    FILE *f = strcmp("-", filename) == 0 ? stdin : fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error opening input file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    int width, height, maxval;
+    if (fscanf(f, "P5 %d %d %d", &width, &height, &maxval) != 3 || fgetc(f) == EOF ||
+        width < 1 || height < 1 || maxval != 255) {
+        fprintf(stderr, "%s is not an 8-bit binary PGM file.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    uint8_t *gray = malloc((size_t) width * height);
+    if (gray == NULL || fread(gray, (size_t) width * height, 1, f) != 1) {
+        fprintf(stderr, "Error reading input file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    if (f != stdin) fclose(f);
+
+    sheet_labels sheet;
+    sheet_cell *cells;
+    int nbCells;
+    if (!label_sheet(gray, width, height, width, nbThreads, &sheet) ||
+        (nbCells = find_sheet_cells(&sheet, grid, &cells)) < 0) {
+        fprintf(stderr, "Not enough memory for sheet.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    char *answers = malloc((size_t) nbCells * (CAPTCHA_ARR_SIZE + 1) + 1);
+    if (answers == NULL ||
+        !decode_sheet_cells(&sheet, cells, nbCells, nbThreads, classify_sheet_cell, NULL, answers)) {
+        fprintf(stderr, "Cannot decode sheet.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int c = 0; c < nbCells; c++) {
+        printf("%d %d %s\n", cells[c].x, cells[c].y, answers + (size_t) c * (CAPTCHA_ARR_SIZE + 1));
+    }
+
+    free(answers);
+    free(cells);
+    free_sheet_labels(&sheet);
+    free(gray);
+} // end decode_sheet()
+
+int main (int argc, char** argv)
+{
+    char usage_str[] = "Usage: %s [-s [-g x,y,pitch_x,pitch_y] [-j threads]] raw_images_file\n"
+                       "       %s -l [-k skip] list_file\n";
+
+    bool sheet = false;
+    bool list = false;
+    long skip = 0;
+    sheet_grid grid;
+    sheet_grid *gridp = NULL;
+    int nbThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    int opt;
+    while ((opt = getopt(argc, argv, "g:hj:k:ls")) != -1) {
+        switch (opt) {
+            case 's': sheet = true; break;
+            case 'l': list = true; break;
+            case 'k': skip = atol(optarg); break;
+            case 'j': nbThreads = atoi(optarg); break;
+            case 'g':
+                if (sscanf(optarg, "%d,%d,%d,%d", &grid.x, &grid.y, &grid.pitchX, &grid.pitchY) != 4 ||
+                    grid.x < 0 || grid.y < 0 || grid.pitchX < 1 || grid.pitchY < 1) {
+                    fprintf(stderr, "Invalid grid %s.\n", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                gridp = &grid;
+                break;
+            case 'h':
+                printf(usage_str, argv[0], argv[0]);
+                printf("\n"
+                  "Decode raw %dx%d 8-bit images (\"-\" reads standard input) with the\n"
+                  "network compiled in, one answer per line. Images can also be raw\n"
+                  "or PGM members of a .tar or .tar.gz file (\"name answer\" lines).\n"
+                  "-s decodes the captchas of one large binary PGM image instead,\n"
+                  "with -j threads (default: all processors), one \"x y answer\" line\n"
+                  "per captcha, (x, y) being its top left corner. Captchas are found\n"
+                  "from the groups of pixels, or with -g from the corner of the first\n"
+                  "one and the distances between corners (more accurate).\n"
+                  "-l decodes the raw or PGM image files listed one per line in the\n"
+                  "input, one \"path answer\" line each, skipping the first -k lines.\n",
+                  IMG_WIDTH, IMG_HEIGHT);
+                exit(EXIT_SUCCESS);
+            default:
+                printf(usage_str, argv[0], argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || nbThreads < 1 || skip < 0) {
+        printf(usage_str, argv[0], argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    const char *filename = argv[optind];
+
+    if (list) {
+        decode_list(filename, skip);
+        return EXIT_SUCCESS;
+    }
+    if (sheet) {
+        decode_sheet(filename, gridp, nbThreads);
+        return EXIT_SUCCESS;
+    }
+    if (is_tar_file(filename)) {
+        decode_tar(filename);
+        return EXIT_SUCCESS;
+    }
+
+    FILE *f = strcmp("-", filename) == 0 ? stdin : fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Error opening input file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t gray[IMG_SIZE];
+    char answer[CAPTCHA_ARR_SIZE + 1];
+
+    while (fread(gray, IMG_SIZE, 1, f) == 1) {
+        decode(gray, answer);
+        printf("%s\n", answer);
+    }
+
+    if (f != stdin) fclose(f);
+    return EXIT_SUCCESS;
+} // end main()
@@ -1,5 +1,11 @@
 #!/bin/sh
 
+# With an archive of samples, read it as a stream instead of samples/
+if [ -n "$1" ]
+then
+    exec `dirname $0`/sample_features -s test "$1" >> knn_test.txt
+fi
+
 for f in `dirname $0`/samples/segmented/output/*_[456789]* 
 do
     bname=`basename $f`
@@ -0,0 +1,403 @@
+/**
+ * \file
+ *
+ * \brief Main program (Synthetic captcha generator)
+ *
+ * Renders IMG_WIDTH x IMG_HEIGHT captchas of six symbols with skew, stray
+ * pixels and line noise, for load and regression tests. Image i only
+ * depends on the seed and on i, so runs are reproducible.
+ *
+ * Images are written as PGM files named "<answer>_<set>-<index>.pgm", as
+ * the samples of the labeled corpus ("K3xb7_2.txt", see sample_answer()
+ * and sample_sets()), or as raw 8-bit pixels on standard output to feed
+ * the benchmark or the Python module directly. Black pixels are above BLACK_THR, like the blue
+ * channel read by remove_noise.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "captcha_common.h"
+#include "captcha_features.h"
+#include "captcha_tar.h"
+
+#define NB_SYMBOLS 6     //!< Symbols per captcha
+#define GLYPH_WIDTH 5    //!< Glyph width in font pixels
+#define GLYPH_HEIGHT 7   //!< Glyph height in font pixels
+#define GLYPH_SCALE 3    //!< Image pixels per font pixel
+
+#define FIRST_SYMBOL '0' //!< First symbol, output 0 of the network
+#define NB_CLASSES 74    //!< Symbols '0' to 'y', see convert_to_multiple_outputs.py
+#define SEPARATORS "_\\" //!< Symbols never drawn: they split file names
+
+/**
+ * 5x7 font for symbols '0' to 'y'. One byte per column, from the left,
+ * bit 0 is the top row.
+ */
+static const uint8_t font[NB_CLASSES][GLYPH_WIDTH] = {
+    { 0x3E, 0x51, 0x49, 0x45, 0x3E }, // 0
+    { 0x00, 0x42, 0x7F, 0x40, 0x00 }, // 1
+    { 0x42, 0x61, 0x51, 0x49, 0x46 }, // 2
+    { 0x21, 0x41, 0x45, 0x4B, 0x31 }, // 3
+    { 0x18, 0x14, 0x12, 0x7F, 0x10 }, // 4
+    { 0x27, 0x45, 0x45, 0x45, 0x39 }, // 5
+    { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, // 6
+    { 0x01, 0x71, 0x09, 0x05, 0x03 }, // 7
+    { 0x36, 0x49, 0x49, 0x49, 0x36 }, // 8
+    { 0x06, 0x49, 0x49, 0x29, 0x1E }, // 9
+    { 0x00, 0x36, 0x36, 0x00, 0x00 }, // :
+    { 0x00, 0x56, 0x36, 0x00, 0x00 }, // ;
+    { 0x08, 0x14, 0x22, 0x41, 0x00 }, // <
+    { 0x14, 0x14, 0x14, 0x14, 0x14 }, // =
+    { 0x00, 0x41, 0x22, 0x14, 0x08 }, // >
+    { 0x02, 0x01, 0x51, 0x09, 0x06 }, // ?
+    { 0x32, 0x49, 0x79, 0x41, 0x3E }, // @
+    { 0x7E, 0x11, 0x11, 0x11, 0x7E }, // A
+    { 0x7F, 0x49, 0x49, 0x49, 0x36 }, // B
+    { 0x3E, 0x41, 0x41, 0x41, 0x22 }, // C
+    { 0x7F, 0x41, 0x41, 0x22, 0x1C }, // D
+    { 0x7F, 0x49, 0x49, 0x49, 0x41 }, // E
+    { 0x7F, 0x09, 0x09, 0x09, 0x01 }, // F
+    { 0x3E, 0x41, 0x49, 0x49, 0x7A }, // G
+    { 0x7F, 0x08, 0x08, 0x08, 0x7F }, // H
+    { 0x00, 0x41, 0x7F, 0x41, 0x00 }, // I
+    { 0x20, 0x40, 0x41, 0x3F, 0x01 }, // J
+    { 0x7F, 0x08, 0x14, 0x22, 0x41 }, // K
+    { 0x7F, 0x40, 0x40, 0x40, 0x40 }, // L
+    { 0x7F, 0x02, 0x0C, 0x02, 0x7F }, // M
+    { 0x7F, 0x04, 0x08, 0x10, 0x7F }, // N
+    { 0x3E, 0x41, 0x41, 0x41, 0x3E }, // O
+    { 0x7F, 0x09, 0x09, 0x09, 0x06 }, // P
+    { 0x3E, 0x41, 0x51, 0x21, 0x5E }, // Q
+    { 0x7F, 0x09, 0x19, 0x29, 0x46 }, // R
+    { 0x46, 0x49, 0x49, 0x49, 0x31 }, // S
+    { 0x01, 0x01, 0x7F, 0x01, 0x01 }, // T
+    { 0x3F, 0x40, 0x40, 0x40, 0x3F }, // U
+    { 0x1F, 0x20, 0x40, 0x20, 0x1F }, // V
+    { 0x3F, 0x40, 0x38, 0x40, 0x3F }, // W
+    { 0x63, 0x14, 0x08, 0x14, 0x63 }, // X
+    { 0x07, 0x08, 0x70, 0x08, 0x07 }, // Y
+    { 0x61, 0x51, 0x49, 0x45, 0x43 }, // Z
+    { 0x00, 0x7F, 0x41, 0x41, 0x00 }, // [
+    { 0x02, 0x04, 0x08, 0x10, 0x20 }, // backslash
+    { 0x00, 0x41, 0x41, 0x7F, 0x00 }, // ]
+    { 0x04, 0x02, 0x01, 0x02, 0x04 }, // ^
+    { 0x40, 0x40, 0x40, 0x40, 0x40 }, // _
+    { 0x00, 0x01, 0x02, 0x04, 0x00 }, // `
+    { 0x20, 0x54, 0x54, 0x54, 0x78 }, // a
+    { 0x7F, 0x48, 0x44, 0x44, 0x38 }, // b
+    { 0x38, 0x44, 0x44, 0x44, 0x20 }, // c
+    { 0x38, 0x44, 0x44, 0x48, 0x7F }, // d
+    { 0x38, 0x54, 0x54, 0x54, 0x18 }, // e
+    { 0x08, 0x7E, 0x09, 0x01, 0x02 }, // f
+    { 0x0C, 0x52, 0x52, 0x52, 0x3E }, // g
+    { 0x7F, 0x08, 0x04, 0x04, 0x78 }, // h
+    { 0x00, 0x44, 0x7D, 0x40, 0x00 }, // i
+    { 0x20, 0x40, 0x44, 0x3D, 0x00 }, // j
+    { 0x7F, 0x10, 0x28, 0x44, 0x00 }, // k
+    { 0x00, 0x41, 0x7F, 0x40, 0x00 }, // l
+    { 0x7C, 0x04, 0x18, 0x04, 0x78 }, // m
+    { 0x7C, 0x08, 0x04, 0x04, 0x78 }, // n
+    { 0x38, 0x44, 0x44, 0x44, 0x38 }, // o
+    { 0x7C, 0x14, 0x14, 0x14, 0x08 }, // p
+    { 0x08, 0x14, 0x14, 0x18, 0x7C }, // q
+    { 0x7C, 0x08, 0x04, 0x04, 0x08 }, // r
+    { 0x48, 0x54, 0x54, 0x54, 0x20 }, // s
+    { 0x04, 0x3F, 0x44, 0x40, 0x20 }, // t
+    { 0x3C, 0x40, 0x40, 0x20, 0x7C }, // u
+    { 0x1C, 0x20, 0x40, 0x20, 0x1C }, // v
+    { 0x3C, 0x40, 0x30, 0x40, 0x3C }, // w
+    { 0x44, 0x28, 0x10, 0x28, 0x44 }, // x
+    { 0x0C, 0x50, 0x50, 0x50, 0x3C }, // y
+};
+
+/**
+ * Generation parameters
+ */
+typedef struct {
+    uint64_t seed;        //!< base seed
+    const char *alphabet; //!< symbols to draw from
+    float skew;           //!< maximum shear (horizontal pixels per row)
+    int strayPixels;      //!< stray pixels per image
+    int lines;            //!< noise lines per image
+} generator_params;
+
+/**
+ * Random number generator (xorshift64*), one per image.
+ */
+typedef struct { uint64_t state; } rng_struct;
+
+/**
+ * Seed generator for image index, so that each image can be generated
+ * alone (splitmix64 of seed and index).
+ */
+rng_struct rng_for_image (uint64_t seed, uint64_t index)
+{
+    uint64_t z = seed + (index + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    return (rng_struct) { z ? z : 1 };
+}
+
+uint64_t rng_next (rng_struct *rng)
+{
+    rng->state ^= rng->state >> 12;
+    rng->state ^= rng->state << 25;
+    rng->state ^= rng->state >> 27;
+    return rng->state * 0x2545F4914F6CDD1DULL;
+}
+
+/**
+ * Random integer in [low, high]
+ */
+int rng_range (rng_struct *rng, int low, int high)
+{
+    return low + (int) ((rng_next(rng) >> 33) % (uint64_t) (high - low + 1));
+}
+
+/**
+ * Random float in [-1, 1]
+ */
+float rng_unit (rng_struct *rng)
+{
+    return (float) ((rng_next(rng) >> 40) / (double) (1 << 23)) - 1;
+}
+
+/**
+ * Set a pixel black, if within image.
+ */
+void set_black (uint8_t *gray, int x, int y, rng_struct *rng)
+{
+    if (is_out_coord((Coord) {x, y})) return;
+    gray[get_index(x, y)] = BLACK_THR + 1 + rng_range(rng, 0, 255 - BLACK_THR - 1);
+}
+
+/**
+ * Draw a glyph, sheared around its middle row.
+ */
+void draw_glyph (uint8_t *gray, int symbol, int left, int top, float shear, rng_struct *rng)
+{
+    const uint8_t *columns = font[symbol - FIRST_SYMBOL];
+    int height = GLYPH_HEIGHT * GLYPH_SCALE;
+
+    for (int y = 0; y < height; y++) {
+        int offset = (int) (shear * (height / 2 - y));
+        int row = y / GLYPH_SCALE;
+
+        for (int x = 0; x < GLYPH_WIDTH * GLYPH_SCALE; x++) {
+            if (columns[x / GLYPH_SCALE] & (1 << row)) {
+                set_black(gray, left + x + offset, top + y, rng);
+            }
+        }
+    } // end for y
+} // end draw_glyph()
+
+/**
+ * Draw a 1 pixel wide line (Bresenham).
+ */
+void draw_line (uint8_t *gray, int x0, int y0, int x1, int y1, rng_struct *rng)
+{
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int err = dx + dy;
+
+    while (true) {
+        set_black(gray, x0, y0, rng);
+        if (x0 == x1 && y0 == y1) break;
+        int e2 = 2 * err;
+        if (e2 >= dy) { err += dy; x0 += sx; }
+        if (e2 <= dx) { err += dx; y0 += sy; }
+    }
+} // end draw_line()
+
+/**
+ * Render one captcha.
+ *
+ * \param params generation parameters
+ * \param index image index
+ * \param gray receives IMG_WIDTH * IMG_HEIGHT pixels
+ * \param answer receives the NB_SYMBOLS symbols, '\0' terminated
+ */
+void generate_captcha (const generator_params *params, uint64_t index,
+                       uint8_t *gray, char *answer)
+{
+    rng_struct rng = rng_for_image(params->seed, index);
+    int alphabet_len = strlen(params->alphabet);
+
+    // Light background, 8 random pixels per random number
+    for (int i = 0; i < IMG_WIDTH * IMG_HEIGHT; i += 8) {
+        uint64_t r = rng_next(&rng);
+        for (int b = 0; b < 8 && i + b < IMG_WIDTH * IMG_HEIGHT; b++) {
+            gray[i + b] = (r >> (8 * b)) & 0x7F;
+        }
+    }
+
+    int step = (IMG_WIDTH - 10) / NB_SYMBOLS;
+    for (int s = 0; s < NB_SYMBOLS; s++) {
+        answer[s] = params->alphabet[rng_range(&rng, 0, alphabet_len - 1)];
+
+        int left = 8 + s * step + rng_range(&rng, -2, 2);
+        int top = rng_range(&rng, 12, IMG_HEIGHT - GLYPH_HEIGHT * GLYPH_SCALE - 12);
+        draw_glyph(gray, answer[s], left, top, params->skew * rng_unit(&rng), &rng);
+    }
+    answer[NB_SYMBOLS] = '\0';
+
+    for (int l = 0; l < params->lines; l++) {
+        draw_line(gray,
+                  rng_range(&rng, 0, IMG_WIDTH - 1), rng_range(&rng, 0, IMG_HEIGHT - 1),
+                  rng_range(&rng, 0, IMG_WIDTH - 1), rng_range(&rng, 0, IMG_HEIGHT - 1),
+                  &rng);
+    }
+
+    for (int p = 0; p < params->strayPixels; p++) {
+        set_black(gray, rng_range(&rng, 0, IMG_WIDTH - 1), rng_range(&rng, 0, IMG_HEIGHT - 1), &rng);
+    }
+} // end generate_captcha()
+
+/**
+ * Write image as binary PGM.
+ */
+void write_pgm (const char *filename, const uint8_t *gray)
+{
+    FILE *f = fopen(filename, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error opening output file %s.\n", filename);
+        exit(EXIT_FAILURE);
+    }
+    fprintf(f, "P5\n%d %d\n255\n", IMG_WIDTH, IMG_HEIGHT);
+    fwrite(gray, 1, IMG_WIDTH * IMG_HEIGHT, f);
+    fclose(f);
+}
+
+/**
+ * Name of the PGM file of an image. Set digits 1 to 9 take turns, so
+ * that a third of the images are training samples (_1 to _3) and the
+ * others test samples, as in the labeled corpus. The name is read back
+ * as the tar tools do, to make sure they get the answer and set.
+ *
+ * \return file name, to free
+ */
+static char *pgm_filename (const char *output_dir, uint64_t index, const char *answer)
+{
+    int set = 1 + index % 9;
+    char *filename;
+    if (asprintf(&filename, "%s/%s_%d-%llu.pgm", output_dir, answer, set,
+                 (unsigned long long) index) < 0) {
+        exit(EXIT_FAILURE);
+    }
+
+    char parsed[CAPTCHA_ARR_SIZE + 1];
+    if (sample_answer(filename, parsed) < 0 || strcmp(parsed, answer) != 0 ||
+        sample_sets(filename) != (set <= 3 ? SAMPLE_TRAIN : SAMPLE_TEST)) {
+        fprintf(stderr, "File name %s does not give back answer %s.\n", filename, answer);
+        exit(EXIT_FAILURE);
+    }
+    return filename;
+} // end pgm_filename()
+
+int main (int argc, char** argv)
+{
+    char usage_str[] = "Usage: %s [-h] [-n count] [-s seed] [-a alphabet] [-k skew]\n"
+                       "       [-p stray_pixels] [-l lines] [-m manifest] [-o output_dir]\n";
+
+    char default_alphabet[NB_CLASSES + 1];
+    int nbDefault = 0;
+    for (int i = 0; i < NB_CLASSES; i++) {
+        if (strchr(SEPARATORS, FIRST_SYMBOL + i) == NULL) {
+            default_alphabet[nbDefault++] = FIRST_SYMBOL + i;
+        }
+    }
+    default_alphabet[nbDefault] = '\0';
+
+    generator_params params = { .seed = 1, .alphabet = default_alphabet,
+                                .skew = 0.3, .strayPixels = 4, .lines = 1 };
+    uint64_t count = 1;
+    char *manifest_filename = NULL;
+    char *output_dir = NULL;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "hn:s:a:k:p:l:m:o:")) != -1) {
+        switch (opt) {
+            case 'n': count = strtoull(optarg, NULL, 10); break;
+            case 's': params.seed = strtoull(optarg, NULL, 10); break;
+            case 'a': params.alphabet = optarg; break;
+            case 'k': params.skew = atof(optarg); break;
+            case 'p': params.strayPixels = atoi(optarg); break;
+            case 'l': params.lines = atoi(optarg); break;
+            case 'm': manifest_filename = optarg; break;
+            case 'o': output_dir = optarg; break;
+            case 'h':
+                printf(usage_str, argv[0]);
+                printf("\n"
+                  "Generate %dx%d captchas of %d symbols.\n"
+                  "\n"
+                  "Parameters\n"
+                  "==========\n"
+                  "-n count:        number of captchas (default 1)\n"
+                  "-s seed:         seed, same seed gives same captchas (default 1)\n"
+                  "-a alphabet:     symbols to use, between '0' and 'y' except '_' and\n"
+                  "                 '\\' (default all)\n"
+                  "-k skew:         maximum shear, in pixels per row (default 0.3)\n"
+                  "-p stray_pixels: stray pixels per captcha (default 4)\n"
+                  "-l lines:        noise lines per captcha (default 1)\n"
+                  "-m manifest:     write \"<index> <answer>\" lines to this file\n"
+                  "-o output_dir:   write <answer>_<set>-<index>.pgm files in this\n"
+                  "                 directory, set 1 to 3 (training) or 4 to 9 (test).\n"
+                  "                 Without it, raw 8-bit pixels are written to standard\n"
+                  "                 output, one captcha after the other.\n",
+                  IMG_WIDTH, IMG_HEIGHT, NB_SYMBOLS);
+                exit(EXIT_SUCCESS);
+            default:
+                printf(usage_str, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (strlen(params.alphabet) == 0) {
+        fprintf(stderr, "Alphabet is empty.\n");
+        exit(EXIT_FAILURE);
+    }
+    for (const char *c = params.alphabet; *c; c++) {
+        if (*c < FIRST_SYMBOL || *c >= FIRST_SYMBOL + NB_CLASSES) {
+            fprintf(stderr, "Symbol '%c' is not between '0' and 'y'.\n", *c);
+            exit(EXIT_FAILURE);
+        }
+        if (strchr(SEPARATORS, *c) != NULL) {
+            fprintf(stderr, "Symbol '%c' cannot be used, it splits file names.\n",
+                    *c);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    FILE *manifest = NULL;
+    if (manifest_filename != NULL) {
+        manifest = fopen(manifest_filename, "w");
+        if (manifest == NULL) {
+            fprintf(stderr, "Error opening manifest file %s.\n", manifest_filename);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    uint8_t gray[IMG_WIDTH * IMG_HEIGHT];
+    char answer[NB_SYMBOLS + 1];
+    for (uint64_t i = 0; i < count; i++) {
+        generate_captcha(&params, i, gray, answer);
+
+        if (output_dir != NULL) {
+            char *filename = pgm_filename(output_dir, i, answer);
+            write_pgm(filename, gray);
+            free(filename);
+        } else if (fwrite(gray, 1, sizeof(gray), stdout) != sizeof(gray)) {
+            exit(EXIT_FAILURE); // reader went away
+        }
+
+        if (manifest != NULL) fprintf(manifest, "%llu %s\n", (unsigned long long) i, answer);
+    } // end for each captcha
+
+    if (manifest != NULL) fclose(manifest);
+} // end main()
@@ -0,0 +1,267 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8
+
+"""Reduce a k-NN reference set to a few prototypes.
+
+Usage: knn_reduce.py [-m method] [-p prototypes] [-t knn_test.txt]
+                     [-q reduced.knn8] [-l labels] knn_train.txt reduced.txt
+
+Methods:
+    cnn      (default) Hart condensing: keep only the samples needed for
+             1-NN to classify all others correctly
+    enn      Wilson editing: drop samples misclassified by their 3 nearest
+             neighbours
+    enn+cnn  Wilson editing then Hart condensing
+    kmeans   -p k-means centroids per class (default 4)
+
+Input files are either in the knn_train.txt format (a line of features,
+then a line with the character) or in the FANN format of
+knn_train_multiple.txt (outputs converted back to characters with the
+label map file -l, see captcha_labels.h, '0' + output without). The reduced
+set is written in the knn_train.txt format, so that it replaces the
+reference set of the k-NN classifier.
+
+1-NN accuracy of the full and reduced sets is measured on the -t file, or
+if there is none, on 20% of the samples held out from a reduction of the
+other 80%.
+
+With -q, the reduced set is also written with features quantized to int8
+(see write_knn8()), and the accuracy with quantized features is reported.
+"""
+
+__author__ = 'Mathieu Clément'
+__version__ = '0.1'
+
+import argparse
+import os
+import struct
+import sys
+
+import numpy as np
+
+from net_to_c import LEGACY_LABELS, read_label_map
+
+KNN8_MAGIC = 0x384E4E4B  # "KNN8"
+KNN8_VERSION = 1
+KNN8_HEADER = struct.Struct('<4If')  # magic, version, samples, features, scale
+ALIGN = 64
+
+SEED = 0
+CHUNK = 1024  # queries per block of distances
+
+
+def read_samples(filename, characters=LEGACY_LABELS):
+    """Returns (features, labels): float array [n][features], labels as
+    character codes. characters maps the outputs of the FANN format."""
+    with open(filename) as fh:
+        lines = [line.split() for line in fh if line.strip()]
+
+    first = lines[0]
+    if len(first) == 3 and all(v.isdigit() for v in first):
+        # FANN format: header, then features and outputs lines
+        count = int(first[0])
+        lines = lines[1:1 + 2 * count]
+        if int(first[2]) != len(characters):
+            raise ValueError('%s: %s outputs, the label map has %d characters'
+                             % (filename, first[2], len(characters)))
+        labels = [ord(characters[int(np.argmax([float(v) for v in outputs]))])
+                  for outputs in lines[1::2]]
+    else:
+        labels = [ord(outputs[0]) for outputs in lines[1::2]]
+
+    features = np.array([[float(v) for v in values] for values in lines[0::2]], dtype=np.float32)
+    if len(features) != len(labels):
+        raise ValueError('odd number of lines')
+    return features, np.array(labels, dtype=np.int32)
+
+
+def write_samples(filename, features, labels):
+    with open(filename, 'w') as fh:
+        for values, label in zip(features, labels):
+            fh.write(' '.join('%.4f' % v for v in values) + '\n' + chr(label) + '\n')
+
+
+def nearest(queries, references, k, exclude_self=False):
+    """Indices [n][k] of the k nearest references of each query (squared
+    Euclidean distance), computed by blocks of CHUNK queries."""
+    ref_norms = (references.astype(np.float64) ** 2).sum(axis=1)
+    result = np.empty((len(queries), k), dtype=np.int64)
+    for start in range(0, len(queries), CHUNK):
+        block = queries[start:start + CHUNK].astype(np.float64)
+        distances = ref_norms[None, :] - 2 * block @ references.T.astype(np.float64)
+        if exclude_self:
+            distances[np.arange(len(block)), np.arange(start, start + len(block))] = np.inf
+        if k == 1:
+            result[start:start + len(block), 0] = distances.argmin(axis=1)
+        else:
+            part = np.argpartition(distances, k, axis=1)[:, :k]
+            order = np.take_along_axis(distances, part, axis=1).argsort(axis=1)
+            result[start:start + len(block)] = np.take_along_axis(part, order, axis=1)
+    return result
+
+
+def classify(queries, features, labels, k=1, exclude_self=False):
+    """k-NN majority vote, ties won by the nearest neighbour."""
+    neighbours = labels[nearest(queries, features, k, exclude_self)]
+    if k == 1:
+        return neighbours[:, 0]
+    result = neighbours[:, 0].copy()
+    for i, votes in enumerate(neighbours):
+        values, counts = np.unique(votes, return_counts=True)
+        if counts.max() > 1 and (counts == counts.max()).sum() == 1:
+            result[i] = values[counts.argmax()]
+    return result
+
+
+def edit(features, labels, k=3):
+    """Wilson editing: indices of the samples classified correctly by their
+    k nearest other samples."""
+    return np.flatnonzero(classify(features, features, labels, k, exclude_self=True) == labels)
+
+
+def condense(features, labels, indices):
+    """Hart condensing of the samples at indices: indices of a subset with
+    which 1-NN classifies all of them correctly."""
+    rng = np.random.RandomState(SEED)
+    indices = indices[rng.permutation(len(indices))]
+
+    # One sample per class to start with
+    _, first = np.unique(labels[indices], return_index=True)
+    kept = list(indices[first])
+
+    # Add each sample 1-NN gets wrong with the prototypes kept so far,
+    # until a pass over all samples adds none
+    prototypes = list(features[kept])
+    changed = True
+    while changed:
+        changed = False
+        references = np.array(prototypes)
+        for i in indices:
+            distances = ((references - features[i]) ** 2).sum(axis=1)
+            if labels[kept[int(distances.argmin())]] != labels[i]:
+                kept.append(i)
+                prototypes.append(features[i])
+                references = np.array(prototypes)
+                changed = True
+    return np.array(sorted(kept))
+
+
+def kmeans(features, labels, per_class, iterations=20):
+    """Returns (features, labels) of per_class centroids per class."""
+    rng = np.random.RandomState(SEED)
+    centroids = []
+    centroid_labels = []
+    for label in np.unique(labels):
+        samples = features[labels == label]
+        k = min(per_class, len(samples))
+        centers = samples[rng.choice(len(samples), k, replace=False)].astype(np.float64)
+        for _ in range(iterations):
+            assignment = nearest(samples, centers, 1)[:, 0]
+            for c in range(k):
+                members = samples[assignment == c]
+                if len(members):
+                    centers[c] = members.mean(axis=0)
+        centroids.append(centers)
+        centroid_labels += [label] * k
+    return np.concatenate(centroids).astype(np.float32), np.array(centroid_labels, dtype=np.int32)
+
+
+def reduce(features, labels, method, per_class):
+    if method == 'kmeans':
+        return kmeans(features, labels, per_class)
+    indices = np.arange(len(labels))
+    if method in ('enn', 'enn+cnn'):
+        indices = edit(features, labels)
+    if method in ('cnn', 'enn+cnn'):
+        indices = condense(features, labels, indices)
+    return features[indices], labels[indices]
+
+
+def quantize(features):
+    """Returns (int8 features, scale): one scale for all features, so that
+    squared distances can be computed on the integers."""
+    scale = float(np.abs(features).max()) / 127 or 1.0
+    return np.clip(np.rint(features / scale), -127, 127).astype(np.int8), scale
+
+
+def write_knn8(filename, features, labels):
+    """Header (KNN8_HEADER), labels (1 byte per sample), then from the next
+    multiple of 64 bytes, the int8 features of each sample. A query is
+    quantized with the same scale before computing distances."""
+    quantized, scale = quantize(features)
+    header = KNN8_HEADER.pack(KNN8_MAGIC, KNN8_VERSION, len(labels), features.shape[1], scale)
+    offset = (len(header) + len(labels) + ALIGN - 1) // ALIGN * ALIGN
+
+    data = bytearray(offset + quantized.size)
+    data[0:len(header)] = header
+    data[len(header):len(header) + len(labels)] = labels.astype(np.uint8).tobytes()
+    data[offset:] = quantized.tobytes()
+
+    tmp = filename + '.tmp'
+    with open(tmp, 'wb') as fh:
+        fh.write(data)
+    os.replace(tmp, filename)
+    return quantized, scale
+
+
+def accuracy(test_features, test_labels, features, labels):
+    return float((classify(test_features, features, labels) == test_labels).mean())
+
+
+def quantized_accuracy(test_features, test_labels, features, labels):
+    quantized, scale = quantize(features)
+    queries = np.clip(np.rint(test_features / scale), -127, 127)
+    return accuracy(queries, test_labels, quantized.astype(np.float32), labels)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Reduce a k-NN reference set to a few prototypes.')
+    parser.add_argument('-m', dest='method', default='cnn', choices=['enn+cnn', 'cnn', 'enn', 'kmeans'])
+    parser.add_argument('-p', dest='per_class', type=int, default=4, help='k-means prototypes per class')
+    parser.add_argument('-t', dest='test', help='test file to measure accuracy')
+    parser.add_argument('-q', dest='quantized', help='also write the reduced set with int8 features')
+    parser.add_argument('-l', dest='labels', help='label map file of FANN format outputs')
+    parser.add_argument('train')
+    parser.add_argument('output')
+    args = parser.parse_args()
+
+    try:
+        characters = read_label_map(args.labels) if args.labels else LEGACY_LABELS
+        features, labels = read_samples(args.train, characters)
+        if args.test:
+            test_features, test_labels = read_samples(args.test, characters)
+            reference_features, reference_labels = features, labels
+        else:
+            order = np.random.RandomState(SEED).permutation(len(labels))
+            held_out = order[:len(order) // 5]
+            kept = order[len(order) // 5:]
+            test_features, test_labels = features[held_out], labels[held_out]
+            reference_features, reference_labels = features[kept], labels[kept]
+
+        reduced_features, reduced_labels = reduce(reference_features, reference_labels,
+                                                  args.method, args.per_class)
+        full = accuracy(test_features, test_labels, reference_features, reference_labels)
+        reduced = accuracy(test_features, test_labels, reduced_features, reduced_labels)
+        print('%-12s %6d samples  %8d bytes  accuracy %.4f' % (
+            'full', len(reference_labels), reference_features.nbytes, full))
+        print('%-12s %6d samples  %8d bytes  accuracy %.4f (%+.4f)' % (
+            args.method, len(reduced_labels), reduced_features.nbytes, reduced, reduced - full))
+        if args.quantized:
+            quantized = quantized_accuracy(test_features, test_labels, reduced_features, reduced_labels)
+            print('%-12s %6d samples  %8d bytes  accuracy %.4f (%+.4f)' % (
+                'int8', len(reduced_labels), len(reduced_labels) * features.shape[1], quantized,
+                quantized - full))
+
+        if not args.test:
+            # Measured on a split, the output is the reduction of all samples
+            reduced_features, reduced_labels = reduce(features, labels, args.method, args.per_class)
+        write_samples(args.output, reduced_features, reduced_labels)
+        if args.quantized:
+            write_knn8(args.quantized, reduced_features, reduced_labels)
+    except (OSError, ValueError, IndexError) as e:
+        sys.stderr.write('%s\n' % e)
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
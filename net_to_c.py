@@ -0,0 +1,224 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8
+
+"""Compile a network saved by captcha_cari_train (FANN .net file) into a
+C header: weights as static const aligned arrays, and one function per
+layer whose loop bounds are constants, so that the compiler unrolls and
+vectorizes them for exactly this shape. See decoder_static.c.
+
+Usage: net_to_c.py knn_multiple.net > captcha_net.h
+
+The characters of the outputs come from the label map file of the
+network (knn_multiple.labels), or are '0' + i without one.
+
+Only fully connected networks without input scaling are supported, with
+linear, sigmoid or symmetric sigmoid activations (one per layer).
+Results match fann_run() up to float rounding (sums are not added in
+the same order).
+"""
+
+__author__ = 'Mathieu Clément'
+__version__ = '0.1'
+
+import os
+import re
+import sys
+
+# Activation functions, values of enum fann_activationfunc_enum
+FANN_LINEAR = 0
+FANN_SIGMOID = 3
+FANN_SIGMOID_SYMMETRIC = 5
+
+# Outputs of networks without a label map file: '0' + i (captcha_labels.h)
+LEGACY_LABELS = ''.join(chr(ord('0') + i) for i in range(74))
+
+# Floats per 64-byte line: neuron counts are padded to a multiple of it
+PAD = 16
+
+NEURON_RE = re.compile(r'\((\d+), (\d+), ([-+0-9.eE]+)\)')
+CONNECTION_RE = re.compile(r'\((\d+), ([-+0-9.eE]+)\)')
+
+
+def read_net(filename):
+    """Returns layers as a list of (weights, biases, activation, steepness),
+    weights[i][j] being the weight from input i to neuron j, and the
+    number of inputs."""
+    values = {}
+    with open(filename, 'r') as fh:
+        header = fh.readline().strip()
+        if not header.startswith('FANN_FLO'):
+            raise ValueError('%s: not a floating point FANN network (%s)' % (filename, header))
+        for line in fh:
+            key, _, value = line.rstrip('\n').partition('=')
+            values[key] = value
+
+    if values.get('scale_included', '0') != '0':
+        raise ValueError('networks with input scaling are not supported')
+    if float(values.get('connection_rate', '1')) < 1:
+        raise ValueError('only fully connected networks are supported')
+
+    # Sizes include the bias neuron of each layer
+    sizes = [int(s) for s in values['layer_sizes'].split()]
+    neurons = [(int(n), int(a), float(s)) for n, a, s in NEURON_RE.findall(
+        values['neurons (num_inputs, activation_function, activation_steepness)'])]
+    connections = [(int(n), float(w)) for n, w in CONNECTION_RE.findall(
+        values['connections (connected_to_neuron, weight)'])]
+    if len(neurons) != sum(sizes):
+        raise ValueError('expected %d neurons, found %d' % (sum(sizes), len(neurons)))
+
+    layers = []
+    first = sizes[0]         # first neuron of current layer
+    previous_first = 0       # first neuron of previous layer
+    con = 0
+    for l in range(1, len(sizes)):
+        nb_inputs = sizes[l - 1] - 1
+        nb_neurons = sizes[l] - 1
+        weights = [[0.0] * nb_neurons for _ in range(nb_inputs)]
+        biases = [0.0] * nb_neurons
+        activation, steepness = neurons[first][1], neurons[first][2]
+
+        for j in range(nb_neurons):
+            num_inputs, a, s = neurons[first + j]
+            if (a, s) != (activation, steepness):
+                raise ValueError('layer %d: neurons have different activations' % l)
+            if num_inputs != nb_inputs + 1:
+                raise ValueError('layer %d: neuron %d is not fully connected' % (l, j))
+            for _ in range(num_inputs):
+                neuron, weight = connections[con]
+                con += 1
+                if neuron == previous_first + nb_inputs:
+                    biases[j] = weight
+                else:
+                    weights[neuron - previous_first][j] = weight
+        con += neurons[first + nb_neurons][0] # bias neuron, no connection normally
+
+        if activation not in (FANN_LINEAR, FANN_SIGMOID, FANN_SIGMOID_SYMMETRIC):
+            raise ValueError('layer %d: unsupported activation function %d' % (l, activation))
+        layers.append((weights, biases, activation, steepness))
+        previous_first = first
+        first += sizes[l]
+
+    return layers, sizes[0] - 1
+
+
+def read_label_map(filename):
+    """Returns the alphabet of a label map file: its first line which is
+    not a '#' comment."""
+    with open(filename, 'r') as fh:
+        for line in fh:
+            line = line.rstrip('\r\n')
+            if line and not line.startswith('#'):
+                if len(set(line)) != len(line) or not all('!' <= c <= '~' for c in line):
+                    raise ValueError('%s: invalid alphabet' % filename)
+                return line
+    raise ValueError('%s: no alphabet' % filename)
+
+
+def read_labels(net_filename, nb_outputs):
+    """Returns the character of each output of a network, from the label
+    map file next to it (x.labels for x.net) or the legacy map."""
+    root, ext = os.path.splitext(net_filename)
+    labels_filename = (root if ext == '.net' else net_filename) + '.labels'
+    labels = read_label_map(labels_filename) if os.path.exists(labels_filename) else LEGACY_LABELS
+    if len(labels) != nb_outputs:
+        raise ValueError('%d characters for %d outputs' % (len(labels), nb_outputs))
+    return labels
+
+
+def c_string(text):
+    return '"%s"' % text.replace('\\', '\\\\').replace('"', '\\"')
+
+
+def padded(n):
+    return (n + PAD - 1) // PAD * PAD
+
+
+def float_literal(value):
+    return '%.9ef' % value
+
+
+def write_array(out, declaration, rows):
+    out.write('%s = {\n' % declaration)
+    for row in rows:
+        out.write('    { %s },\n' % ', '.join(float_literal(v) for v in row))
+    out.write('};\n\n')
+
+
+def write_layer(out, l, layer, nb_inputs):
+    weights, biases, activation, steepness = layer
+    nb_neurons = len(biases)
+    pad = padded(nb_neurons)
+
+    out.write('#define NET_LAYER_%d_NEURONS %d\n' % (l, nb_neurons))
+    out.write('#define NET_LAYER_%d_PAD %d\n\n' % (l, pad))
+    write_array(out, 'static const float net_weights_%d[%d][NET_LAYER_%d_PAD] '
+                     'NET_ALIGNED' % (l, nb_inputs, l),
+                [row + [0.0] * (pad - nb_neurons) for row in weights])
+    out.write('static const float net_biases_%d[NET_LAYER_%d_PAD] NET_ALIGNED = {\n    %s\n};\n\n'
+              % (l, l, ', '.join(float_literal(v) for v in biases + [0.0] * (pad - nb_neurons))))
+
+    out.write('static inline void net_layer_%d (const float *restrict in, float *restrict out)\n' % l)
+    out.write('{\n')
+    out.write('    float sum[NET_LAYER_%d_PAD] NET_ALIGNED;\n' % l)
+    out.write('    for (int j=0; j < NET_LAYER_%d_PAD; j++) sum[j] = net_biases_%d[j];\n' % (l, l))
+    out.write('    for (int i=0; i < %d; i++) {\n' % nb_inputs)
+    out.write('        for (int j=0; j < NET_LAYER_%d_PAD; j++) sum[j] += in[i] * net_weights_%d[i][j];\n'
+              % (l, l))
+    out.write('    }\n')
+    out.write('    for (int j=0; j < NET_LAYER_%d_NEURONS; j++) {\n' % l)
+    # Same steepness and clamping as fann_run()
+    out.write('        float s = %s * sum[j];\n' % float_literal(steepness))
+    max_sum = 150 / steepness
+    out.write('        if (s > %s) s = %s; else if (s < %s) s = %s;\n'
+              % (float_literal(max_sum), float_literal(max_sum),
+                 float_literal(-max_sum), float_literal(-max_sum)))
+    if activation == FANN_SIGMOID_SYMMETRIC:
+        out.write('        out[j] = 2.0f / (1.0f + expf(-2.0f * s)) - 1.0f;\n')
+    elif activation == FANN_SIGMOID:
+        out.write('        out[j] = 1.0f / (1.0f + expf(-2.0f * s));\n')
+    else:
+        out.write('        out[j] = s;\n')
+    out.write('    }\n')
+    out.write('} // end net_layer_%d()\n\n' % l)
+
+
+def write_header(out, layers, nb_inputs, labels, filename):
+    nb_outputs = len(layers[-1][1])
+    out.write('/**\n * \\file\n *\n * \\brief Network compiled from %s\n *\n' % filename)
+    out.write(' * Generated by net_to_c.py, do not edit.\n */\n\n')
+    out.write('#pragma once\n#ifndef CAPTCHA_NET_H\n#define CAPTCHA_NET_H\n\n')
+    out.write('#include <math.h>\n\n')
+    out.write('#define NET_ALIGNED __attribute__ ((aligned (64)))\n\n')
+    out.write('#define NET_NUM_INPUT %d\n' % nb_inputs)
+    out.write('#define NET_NUM_OUTPUT %d\n' % nb_outputs)
+    out.write('#define NET_LABELS %s //!< character of each output\n\n' % c_string(labels))
+
+    sizes = [nb_inputs]
+    for l, layer in enumerate(layers, 1):
+        write_layer(out, l, layer, sizes[-1])
+        sizes.append(len(layer[1]))
+
+    out.write('/**\n * Same as fann_run().\n *\n')
+    out.write(' * \\param input NET_NUM_INPUT values\n')
+    out.write(' * \\param output receives NET_NUM_OUTPUT values\n */\n')
+    out.write('static inline void net_run (const float *restrict input, float *restrict output)\n{\n')
+    for l in range(1, len(layers)):
+        out.write('    float layer_%d[NET_LAYER_%d_PAD] NET_ALIGNED;\n' % (l, l))
+    for l in range(1, len(layers) + 1):
+        src = 'input' if l == 1 else 'layer_%d' % (l - 1)
+        dst = 'output' if l == len(layers) else 'layer_%d' % l
+        out.write('    net_layer_%d(%s, %s);\n' % (l, src, dst))
+    out.write('}\n\n#endif\n')
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.stderr.write('Usage: %s network.net > captcha_net.h\n' % sys.argv[0])
+        sys.exit(1)
+    try:
+        layers, nb_inputs = read_net(sys.argv[1])
+        labels = read_labels(sys.argv[1], len(layers[-1][1]))
+    except (OSError, KeyError, ValueError) as e:
+        sys.stderr.write('%s: %s\n' % (sys.argv[1], e))
+        sys.exit(1)
+    write_header(sys.stdout, layers, nb_inputs, labels, sys.argv[1])
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8
+
+"""Convert a network saved by captcha_cari_train (FANN .net file) into a
+binary model file (.cnet) which captcha_model_file.c maps in memory.
+
+Usage: net_to_model.py knn_multiple.net knn_multiple.cnet
+
+The layout is described in captcha_model_file.h: a header, then the
+weights and biases of each layer as little-endian float blocks aligned
+on 64 bytes, neurons padded to a multiple of 16, then the characters of
+the outputs, from the label map file of the network (knn_multiple.labels).
+"""
+
+__author__ = 'Mathieu Clément'
+__version__ = '0.1'
+
+import os
+import struct
+import sys
+
+from net_to_c import read_net, read_labels, padded
+
+MAGIC = 0x54454E43         # "CNET"
+FORMAT_VERSION = 2
+ALIGN = 64
+MAX_LAYERS = 8
+FLOAT32 = 0
+
+HEADER = struct.Struct('<6IQ')  # magic, version, inputs, layers, weight type, labels, offset
+LAYER = struct.Struct('<3If2Q') # neurons, stride, activation, steepness, offsets
+
+
+def aligned(offset):
+    return (offset + ALIGN - 1) // ALIGN * ALIGN
+
+
+def write_model(filename, layers, nb_inputs, labels):
+    if len(layers) > MAX_LAYERS:
+        raise ValueError('at most %d layers are supported' % MAX_LAYERS)
+
+    # Place blocks after the header
+    offset = aligned(HEADER.size + MAX_LAYERS * LAYER.size)
+    descriptions = []
+    blocks = []
+    inputs = nb_inputs
+    for weights, biases, activation, steepness in layers:
+        stride = padded(len(biases))
+        weights_block = b''.join(struct.pack('<%df' % stride, *(row + [0.0] * (stride - len(row))))
+                                 for row in weights)
+        biases_block = struct.pack('<%df' % stride, *(biases + [0.0] * (stride - len(biases))))
+        assert len(weights_block) == inputs * stride * 4
+
+        weights_offset = offset
+        offset = aligned(offset + len(weights_block))
+        biases_offset = offset
+        offset = aligned(offset + len(biases_block))
+
+        descriptions.append(LAYER.pack(len(biases), stride, activation, steepness,
+                                       weights_offset, biases_offset))
+        blocks += [(weights_offset, weights_block), (biases_offset, biases_block)]
+        inputs = len(biases)
+
+    labels_block = labels.encode('ascii')
+    labels_offset = offset
+    offset = aligned(offset + len(labels_block))
+    blocks.append((labels_offset, labels_block))
+
+    data = bytearray(offset)
+    header = HEADER.pack(MAGIC, FORMAT_VERSION, nb_inputs, len(layers), FLOAT32,
+                         len(labels_block), labels_offset)
+    header += b''.join(descriptions) + bytes(LAYER.size * (MAX_LAYERS - len(layers)))
+    data[0:len(header)] = header
+    for block_offset, block in blocks:
+        data[block_offset:block_offset + len(block)] = block
+
+    # Replace the file in one step: processes which mapped the old one
+    # keep it, new ones get the new one
+    tmp = filename + '.tmp'
+    with open(tmp, 'wb') as fh:
+        fh.write(data)
+    os.replace(tmp, filename)
+
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.stderr.write('Usage: %s network.net model.cnet\n' % sys.argv[0])
+        sys.exit(1)
+    try:
+        layers, nb_inputs = read_net(sys.argv[1])
+        labels = read_labels(sys.argv[1], len(layers[-1][1]))
+        write_model(sys.argv[2], layers, nb_inputs, labels)
+    except (OSError, KeyError, ValueError) as e:
+        sys.stderr.write('%s: %s\n' % (sys.argv[1], e))
+        sys.exit(1)
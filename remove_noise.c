@@ -2,6 +2,10 @@
  * \file
  *
  * \brief Main program
+ *
+ * With -r, the groups of pixels are put in the shared memory ring of a
+ * running segmenter -r instead of a text file, and remove_noise exits
+ * once segmenter has written its report.
  */
 
 #define _GNU_SOURCE
@@ -13,10 +17,17 @@
 #include <getopt.h>
 #include <magick/MagickCore.h>
 #include <math.h>
+#include <unistd.h>
 #include "captcha_common.h"
+#include "captcha_ring.h"
 
 #define ERR_PACKET 2  // TODO: Make other constants for errors
 
+/**
+ * Time to wait for segmenter to take a record and to write its report.
+ */
+#define RING_TIMEOUT_MS 30000
+
 /**
  * Artifact size threshold.
  * Measure the height and width of black areas. If h or w > ths
@@ -41,6 +52,21 @@ bool is_black (PixelPacket* packet) { return packet->blue > 60000; }
 // TODO Make local
 uint16_t pixel_groups_index = 1;
 
+/**
+ * Most groups an image can have: isolated pixels, one every other
+ * column and row.
+ */
+#define MAX_PIXEL_GROUPS (((IMG_WIDTH + 1) / 2) * ((IMG_HEIGHT + 1) / 2))
+
+/**
+ * A group of adjacent black pixels, filled while the group is marked.
+ */
+typedef struct {
+    uint16_t count;  //!< number of pixels
+    uint16_t left;   //!< most left column
+    uint16_t right;  //!< most right column
+} pixel_group;
+
 /**
  * Read pixels from array and find adjacent black pixels (pixel groups) 
  * to the specified coordinate,
@@ -51,6 +77,7 @@ uint16_t pixel_groups_index = 1;
  * \param pixel_groups array whose values are the IDs of the pixel groups.
  *                     Single pixels have a value of 0.
  *                     Noise artifacts are also given an ID.
+ * \param group the group being marked, receives its size and bounds
  *
  * \return true if pixel at the starting coordinate is black.
  */
@@ -58,7 +85,8 @@ bool mark_noise_rec (
     Coord coord,
     PixelPacket *packets, 
     int16_t *visited_pixels,
-    uint16_t *pixel_groups)
+    uint16_t *pixel_groups,
+    pixel_group *group)
 {
     if (is_out_coord(coord)) return false;
     int index = get_coord_index(coord);
@@ -68,14 +96,16 @@ bool mark_noise_rec (
 
     if (is_black(&packets[index])) {
         pixel_groups[index] = pixel_groups_index;
-        mark_noise_rec(get_north_coord(coord), packets, visited_pixels, pixel_groups);
-        mark_noise_rec(get_south_coord(coord), packets, visited_pixels, pixel_groups);
-        mark_noise_rec(get_east_coord(coord), packets, visited_pixels, pixel_groups);
-        mark_noise_rec(get_west_coord (coord), packets, visited_pixels, pixel_groups);
-        mark_noise_rec(get_north_east_coord(coord), packets, visited_pixels, pixel_groups);
-        mark_noise_rec(get_south_east_coord(coord), packets, visited_pixels, pixel_groups);
-        mark_noise_rec(get_north_west_coord(coord), packets, visited_pixels, pixel_groups);
-        mark_noise_rec(get_south_west_coord(coord), packets, visited_pixels, pixel_groups);
+        if (group->count++ == 0 || coord.x < group->left) group->left = coord.x;
+        if (coord.x > group->right) group->right = coord.x;
+        mark_noise_rec(get_north_coord(coord), packets, visited_pixels, pixel_groups, group);
+        mark_noise_rec(get_south_coord(coord), packets, visited_pixels, pixel_groups, group);
+        mark_noise_rec(get_east_coord(coord), packets, visited_pixels, pixel_groups, group);
+        mark_noise_rec(get_west_coord (coord), packets, visited_pixels, pixel_groups, group);
+        mark_noise_rec(get_north_east_coord(coord), packets, visited_pixels, pixel_groups, group);
+        mark_noise_rec(get_south_east_coord(coord), packets, visited_pixels, pixel_groups, group);
+        mark_noise_rec(get_north_west_coord(coord), packets, visited_pixels, pixel_groups, group);
+        mark_noise_rec(get_south_west_coord(coord), packets, visited_pixels, pixel_groups, group);
         return true;
     } else {
         return false;
@@ -85,101 +115,47 @@ bool mark_noise_rec (
 /**
  * Identifies pixel groups.
  *
- * \param counters uninitialized pointer to a pointer of an array, whose index
- *                 is the ID of a pixel group and the value is the number of
- *                 pixels within that group.
+ * \param groups uninitialized pointer to a pointer of an array, whose index
+ *               is the ID of a pixel group and the value is the number of
+ *               pixels and the bounds of that group. Index 0 is empty.
  * \see mark_noise_rec
  */
-void mark_noise(PixelPacket *packets, uint16_t *pixel_groups, uint16_t **counters)
+void mark_noise(PixelPacket *packets, uint16_t *pixel_groups, pixel_group **groups)
 {
     int16_t *visited_pixels = calloc(IMG_HEIGHT * IMG_WIDTH, 2);
+    pixel_group *my_groups = calloc(MAX_PIXEL_GROUPS + 1, sizeof(pixel_group));
+    if (visited_pixels == NULL || my_groups == NULL) {
+        fprintf(stderr, "Not enough memory for pixel groups.\n");
+        exit(EXIT_FAILURE);
+    }
 
     for (int row=0; row < IMG_HEIGHT; row++) {
         for (int col = 0; col < IMG_WIDTH; col++) {
-            if (mark_noise_rec((Coord) {col, row}, packets, visited_pixels, pixel_groups)) {
+            if (mark_noise_rec((Coord) {col, row}, packets, visited_pixels, pixel_groups,
+                               &my_groups[pixel_groups_index])) {
                 pixel_groups_index++;
             }
         } // end for col
     } // end for row
 
-    // Count pixels per group
-    uint16_t *my_counters = calloc(pixel_groups_index+1, 2);
-    for (int j=0; j < IMG_WIDTH * IMG_HEIGHT; j++) {
-        if (pixel_groups[j] > 0) {
-            my_counters[pixel_groups[j]]++;
-        }
-    } // end for j
-    *counters = my_counters;
+    free(visited_pixels);
+    *groups = my_groups;
 
 } // end mark_noise()
 
 /**
- * Sort the left array and report the changes in the second.
- * In other words sort two arrays based on the values of only one.
- * If several elements have the same left value, sort by the right value
- * as well.
- * Arrays are said to be "parallel".
- *
- * \param lefts Left array
- * \param rights Right array
- * \param array_length Number of elements in array
+ * Bounds of a symbol, compared by left then right coordinate.
  */
-void sort_two_arrays_based_on_first(uint16_t *lefts, uint16_t *rights, int array_length)
-{
-    // Selection sort on left array. Right array is updated in the very same way.
-    uint16_t min;
-    uint16_t tmp_left, tmp_right;
-    int min_index;
-    for (int i=0; i < array_length; i++) {
-        min_index = i;
-        min = lefts[i];
-
-        for (int j=i+1; j < array_length; j++) {
-            if (lefts[j] < min) {
-                min_index = j;
-                min = lefts[j];
-            } // end if
-        }
+typedef struct {
+    uint16_t left;
+    uint16_t right;
+} symbol_bounds;
 
-        tmp_left = lefts[i];                tmp_right = rights[i];
-        lefts[i] = min;                     rights[i] = rights[min_index];
-        lefts[min_index] = tmp_left;        rights[min_index] = tmp_right;
-
-    } // end for
-
-    // Arrays are sorted based on the left.
-    // We have to consider the case where left coord is the same but right isn't.
-    
-    // Find zones with same left indice
-    uint16_t *ends   = malloc(sizeof(int) * array_length); // index: beginning, value: end
-                                                           // of portion with same left indice.
-    for (int i=0; i < array_length; i++) {
-        ends[i] = i;
-        for (int j=i+1; j < array_length; j++) {
-            if (lefts[i] == lefts[j]) ends[i] = j;
-        } // end for j
-    } // end for i
-
-    // Selection sort on right array
-    for (int e=0; e < array_length; e++) {
-        for (int i=e; i <= ends[e]; i++) {
-            min_index = i;
-            min = rights[i];
-
-            for (int j=i+1; j < array_length; j++) {
-                if (rights[j] < min) {
-                    min_index = j;
-                    min = rights[j];
-                } // end if
-
-                tmp_right = rights[i];
-                rights[i] = rights[min_index];
-                rights[min_index] = tmp_right;
-            } // end for j
-        } // end for i
-    } // end for e
-
-    free(ends);
+static int compare_bounds (const void *a, const void *b)
+{
+    const symbol_bounds *boundsA = a, *boundsB = b;
+    if (boundsA->left != boundsB->left) return boundsA->left - boundsB->left;
+    return boundsA->right - boundsB->right;
 }
 
 /**
@@ -193,14 +169,17 @@ void sort_two_arrays_based_on_first(uint16_t *lefts, uint16_t *rights, int array
  * \param inputf the input image in any format supported by ImageMagick
  * \param outputf the output image in any format supported by ImageMagick,
  *                with noise artifacts removed. Set to NULL to not create
- *                the image.
+ *                the image: it is then neither allocated nor drawn.
  * \param txt_filename a text file containing the mapping between particular
  *                     pixels and the groups they are in.
  *                     Each line is in the format 
  *                      "%d %d %d", group_id, pixel_row, pixel_column.
  *                     Lines are terminated by "\n".
+ * \param record if not NULL, receives the groups as segmenter reads them
+ *               from the text file. nbGroups must be 0 and pixels 0.
  */
-void remove_noise (char* pgm, char* inputf, char* outputf, char* txt_filename)
+void remove_noise (char* pgm, char* inputf, char* outputf, char* txt_filename,
+                   ring_record *record)
 {
     // Init
     ExceptionInfo* exception;
@@ -248,18 +227,73 @@ void remove_noise (char* pgm, char* inputf, char* outputf, char* txt_filename)
 
     // Look for adjacent black pixels
     uint16_t *pixel_groups = calloc(IMG_WIDTH * IMG_HEIGHT, 2);
-    uint16_t *counters;
-    mark_noise(packets, pixel_groups, &counters);
+    pixel_group *groups;
+    mark_noise(packets, pixel_groups, &groups);
+
+    // Groups of the record, numbered from 1 in the order of the lines of
+    // the text file, like convert_txt_to_1dim_array() does
+    uint8_t *record_ids = record != NULL ? calloc(pixel_groups_index + 1, 1) : NULL;
 
-    // Debug display
-    for (int j=0; j < IMG_HEIGHT; j++) {
+    // Match zones of captcha (6 letters) with the groups found. IDs are given
+    // row by row, so in ID order groups come as the lines of the text file.
+    symbol_bounds captcha_bounds[CAPTCHA_ARR_SIZE];
+    int captcha_groups_ind = 0;
+    for (int n=1; n < pixel_groups_index; n++) {
+        if (groups[n].count <= ARTIFACT_THR) continue;
+        if (captcha_groups_ind == CAPTCHA_ARR_SIZE) {
+            fprintf(stderr, "Too many captcha groups.\n");
+            exit(EXIT_FAILURE);
+        }
+        captcha_bounds[captcha_groups_ind++] = (symbol_bounds) { groups[n].left, groups[n].right };
+        if (record != NULL) record_ids[n] = ++record->nbGroups;
+    }
+
+    // Create a new image with the extracted letters from captcha (still skewed),
+    // only if it is written
+    Image *output_image = NULL;
+    packets = NULL;
+    if (has_output_img_file) {
+        MagickPixelPacket background = { .storage_class = DirectClass,
+                                         //.colorspace = GRAYColorspace,
+                                         .colorspace = RGBColorspace,
+                                         .matte = MagickTrue,
+                                         .fuzz = 0,
+                                         .depth = 0,
+                                         .red = 65535,
+                                         .green = 65535,
+                                         .blue = 65535,
+                                         .opacity = 0, // 65535 for transparency
+                                         .index = 0 };
+
+        output_image = NewMagickImage(image_info, IMG_WIDTH, IMG_HEIGHT, &background);
+        packets = GetAuthenticPixels (
+            output_image, 0, 0, IMG_WIDTH, IMG_HEIGHT, exception);
+
+        if (exception->severity != UndefinedException) CatchException(exception);
+        if (packets == NULL) exit(3);
+    }
+
+    // Debug display, text file, record and output image in one pass. Without
+    // any of them, the pass is skipped.
+    bool has_pass = verbose_flag || has_txt_file || record != NULL || has_output_img_file;
+    for (int j=0; has_pass && j < IMG_HEIGHT; j++) {
         for (int i=0; i < IMG_WIDTH; i++) {
-            int n = pixel_groups[get_index(i, j)];
-            if (counters[n] > ARTIFACT_THR && n != 0) {
+            int index = get_index(i, j);
+            int n = pixel_groups[index];
+            if (groups[n].count > ARTIFACT_THR && n != 0) {
                 if (verbose_flag) printf("%1d", n % 10);
                 if (has_txt_file) fprintf(txt_file, "%d %d %d\n", n, i, j);
+                if (record != NULL) record->pixels[index] = record_ids[n];
+
+                if (packets != NULL) {
+                    PixelPacket *packet = &packets[index];
+                    packet->blue = 0;
+                    packet->green = 0;
+                    packet->red = 0;
+                    packet->opacity = 0;
+                }
             }
-            //else if (counters[n] != 0) printf("x");
+            //else if (groups[n].count != 0) printf("x");
             else {
                 if (verbose_flag) printf(" ");
             }
@@ -267,91 +301,32 @@ void remove_noise (char* pgm, char* inputf, char* outputf, char* txt_filename)
         if (verbose_flag) printf("\n");
     }
 
-    // Create a new image with the extracted letters from captcha (still skewed)
-    MagickPixelPacket background = { .storage_class = DirectClass,
-                                     //.colorspace = GRAYColorspace,
-                                     .colorspace = RGBColorspace,
-                                     .matte = MagickTrue,
-                                     .fuzz = 0,
-                                     .depth = 0,
-                                     .red = 65535,
-                                     .green = 65535,
-                                     .blue = 65535,
-                                     .opacity = 0, // 65535 for transparency
-                                     .index = 0 };
-                                    
-    Image *output_image = NewMagickImage(image_info, IMG_WIDTH, IMG_HEIGHT, &background);
-    packets = GetAuthenticPixels (
-        output_image, 0, 0, IMG_WIDTH, IMG_HEIGHT, exception);
-    
-    if (exception->severity != UndefinedException) CatchException(exception);
-    if (packets == NULL) exit(3);
-
-    // Match zones of captcha (6 letters) with ajacent pixel zones found earlier
-    uint16_t *captcha_groups_matching = calloc(CAPTCHA_ARR_SIZE, 2); // captchas contain captcha_groups_ind letters
-    int captcha_groups_ind = 0;
-    uint16_t *captcha_lefts  = malloc(CAPTCHA_ARR_SIZE * 2); // most  left coordinate of a symbol
-    for (int i=0; i < captcha_groups_ind; i++) captcha_lefts[i] = IMG_WIDTH - 1;
-    uint16_t *captcha_rights = calloc(CAPTCHA_ARR_SIZE, 2); // most right coordinate of a symbol
-
-    for (int j=0; j < IMG_HEIGHT; j++) {
-        for (int i=0; i < IMG_WIDTH; i++) {
-            int index = get_index(i, j);
-            int n = pixel_groups[index];
-            if (counters[n] > ARTIFACT_THR && n != 0) {
-
-                // Test if symbol already added
-                int captcha_index = -1;
-                for (int k=0; k < captcha_groups_ind; k++) {
-                    if (captcha_groups_matching[k] == n) {
-                        captcha_index = k;
-                        break;
-                    }
-                }
-                // Add if not existent
-                if(captcha_index == -1) {
-                    captcha_groups_matching[captcha_groups_ind++] = n;
-                    if (captcha_groups_ind == CAPTCHA_ARR_SIZE + 1) {
-                        fprintf(stderr, "Too many captcha groups.\n");
-                        exit(EXIT_FAILURE);
-                    }
-                    captcha_index = captcha_groups_ind-1;
-                }
-
-                // Adjust left and right bounds
-                if (i < captcha_lefts[captcha_index])  captcha_lefts[captcha_index]  = i;
-                if (i > captcha_rights[captcha_index]) captcha_rights[captcha_index] = i;
-
-                PixelPacket *packet = &packets[index];
-                packet->blue = 0;
-                packet->green = 0;
-                packet->red = 0;
-                packet->opacity = 0;
-            } // end if
-        } // end for column
-    } // end for row
-
-    // Sort arrays
-    sort_two_arrays_based_on_first(captcha_lefts, captcha_rights, captcha_groups_ind);
+    // Sort bounds
+    qsort(captcha_bounds, captcha_groups_ind, sizeof(symbol_bounds), compare_bounds);
 
     // Display bounds of each symbol in captcha
     if (verbose_flag) {
         for (int i=0; i < captcha_groups_ind; i++) {
-            printf("%d %d\n", captcha_lefts[i], captcha_rights[i]);
+            printf("%d %d\n", captcha_bounds[i].left, captcha_bounds[i].right);
         }
     }
 
-    if (SyncAuthenticPixels(output_image, exception) == MagickFalse) exit(3);
-    if (exception->severity != UndefinedException) CatchException(exception);
-
-
     // Write output image
     if (has_output_img_file) {
+        if (SyncAuthenticPixels(output_image, exception) == MagickFalse) exit(3);
+        if (exception->severity != UndefinedException) CatchException(exception);
+
         strcpy(image_info->filename, outputf);
         WriteImages(image_info, output_image, outputf, exception);
         if (exception->severity != UndefinedException) CatchException(exception);
     }
 
+    if (verbose_flag) {
+        printf("Stages: ");
+        print_stages(stdout, STAGE_LABEL | (has_output_img_file ? STAGE_DEBUG_IMAGE : 0));
+        printf("\n");
+    }
+
     /*************************************************************************/
 
     // Dealloc
@@ -359,23 +334,80 @@ void remove_noise (char* pgm, char* inputf, char* outputf, char* txt_filename)
     exception = DestroyExceptionInfo(exception);
     MagickCoreTerminus();
 
-    free(captcha_lefts);
-    free(captcha_rights);
+    free(pixel_groups);
+    free(groups);
+    free(record_ids);
 
     // Close txt file
     if (has_txt_file) fclose(txt_file);
 }
 
+/**
+ * Put the groups of an image in the ring of segmenter and wait for its
+ * report.
+ *
+ * \param report_filename file segmenter writes its report to, NULL for
+ *                        the standard output of segmenter
+ */
+void put_in_ring (char* pgm, char* ring_name, char* inputf, char* outputf,
+                  char* report_filename)
+{
+    label_ring *ring = ring_open(ring_name);
+    if (ring == NULL) {
+        fprintf(stderr, "Error opening ring %s. Is segmenter -r running?\n", ring_name);
+        exit(EXIT_FAILURE);
+    }
+
+    ring_record *record = calloc(1, sizeof(ring_record));
+    if (record == NULL) exit(EXIT_FAILURE);
+
+    // segmenter runs in another directory
+    int length;
+    if (report_filename == NULL) {
+        length = 0;
+    } else if (report_filename[0] == '/' || strcmp("-", report_filename) == 0) {
+        length = snprintf(record->output, RING_PATH_SIZE, "%s", report_filename);
+    } else {
+        char cwd[RING_PATH_SIZE];
+        length = getcwd(cwd, sizeof(cwd)) != NULL ?
+            snprintf(record->output, RING_PATH_SIZE, "%s/%s", cwd, report_filename) :
+            RING_PATH_SIZE;
+    }
+    if (length >= RING_PATH_SIZE) {
+        fprintf(stderr, "Path too long: %s.\n", report_filename);
+        exit(EXIT_FAILURE);
+    }
+
+    remove_noise(pgm, inputf, outputf, NULL, record);
+
+    uint32_t ticket;
+    if (!ring_put(ring, record, RING_TIMEOUT_MS, &ticket) ||
+        !ring_wait_read(ring, ticket, RING_TIMEOUT_MS)) {
+        fprintf(stderr, "Timeout: segmenter is not reading ring %s.\n", ring_name);
+        exit(EXIT_FAILURE);
+    }
+
+    free(record);
+    ring_close(ring);
+} // end put_in_ring()
+
 /**
  * See help and usage.
  */
 int main (int argc, char** argv)
 {
-    char usage_str[] = "Usage: %s [-h] [-v] input_image [output_txt_file] [output_image]\n";
-
-    if ( (argc > 1 && strcmp("-h", argv[1]) == 0) ||
-         (argc > 2 && strcmp("-h", argv[2]) == 0) ) {
-        printf("%s"
+    char usage_str[] = "Usage: %s [-h] [-v] input_image [output_txt_file] [output_image]\n"
+                       "       %s [-v] -r /ring_name input_image [report_file] [output_image]\n";
+
+    char *ring_name = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "hr:v")) != -1) {
+        switch (opt) {
+            case 'v': verbose_flag = true; break;
+            case 'r': ring_name = optarg; break;
+            case 'h':
+                printf(usage_str, argv[0], argv[0]);
+                printf("\n"
           "Remove noise artifacts from an image and detect groups of pixels.\n"
           "\n"
           "By default, an artifact is any group of pixels counting less than 15 pixels.\n"
@@ -392,38 +424,41 @@ int main (int argc, char** argv)
           "                    You can easily sort them out with 'sort -n' or similar methods.\n"
           "Output image:       195x50 pixels image, RGB color space. PNG is recommended but you\n"
           "                    can use any format supported by ImageMagick.\n"
+          "Ring (-r):          Shared memory ring of a running 'segmenter -r /ring_name'.\n"
+          "                    Groups are put in it instead of a text file, and segmenter\n"
+          "                    writes its report to the report file (its standard output\n"
+          "                    if none). Exits once the report is written.\n"
           "\n"
           "\n"
           "Mathieu Clément <mathieu.clement@freebourg.org>\n"
-          "\n", usage_str);
-        exit(EXIT_SUCCESS);
-    } 
+          "\n");
+                exit(EXIT_SUCCESS);
+            default:
+                printf(usage_str, argv[0], argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
 
     // At least input_image should be provided
-    if (argc < 2) {
-        printf(usage_str, argv[0]);
+    if (optind >= argc || argc - optind > 3) {
+        printf(usage_str, argv[0], argv[0]);
         exit(EXIT_FAILURE);
     }
-    
-    verbose_flag = strcmp(argv[1], "-v") == 0;
-
-    // Offset in case of "-v" in front of positional arguments
-    int arg_offset = verbose_flag ? 1 : 0;
 
     // Input image
-    char *inputf = argv[1+arg_offset];
+    char *inputf = argv[optind];
     
-    // Output txt file
+    // Output txt file, or report file with a ring
     char *txt_filename = NULL;
-    if (argc == 3+arg_offset) { // with output text file
-        txt_filename = argv[2+arg_offset];
-    }
+    if (argc - optind >= 2) txt_filename = argv[optind + 1];
 
     // Output image
     char *outputf = NULL;
-    if (argc == 4+arg_offset) {
-        outputf = argv[3+arg_offset];
-    }
+    if (argc - optind == 3) outputf = argv[optind + 2];
 
-    remove_noise (argv[0], inputf, outputf, txt_filename);
+    if (ring_name != NULL) {
+        put_in_ring(argv[0], ring_name, inputf, outputf, txt_filename);
+    } else {
+        remove_noise(argv[0], inputf, outputf, txt_filename, NULL);
+    }
 } // end main
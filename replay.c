@@ -0,0 +1,313 @@
+/**
+ * \file
+ *
+ * \brief Main program (Replay of a capture file)
+ *
+ * Feeds the images of a capture file (see captcha_capture.h) to an
+ * asynchronous decoder, in their lanes, at the pace they were captured
+ * at or faster, and compares the answers with the captured ones: a
+ * capture taken with one build or network and replayed with another
+ * shows which images they disagree on. Latencies are measured from
+ * submission to harvest, and reported next to the captured ones.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <poll.h>
+#include "captcha_async.h"
+#include "captcha_capture.h"
+#include "captcha_common.h"
+#include "captcha_model.h"
+
+#define IMG_SIZE (IMG_WIDTH * IMG_HEIGHT) //!< Bytes per image
+
+/**
+ * Images in flight at most, tags are indices modulo this. More than the
+ * default queues of both lanes.
+ */
+#define MAX_PENDING 4096
+
+/**
+ * Captured result of an image in flight.
+ */
+typedef struct {
+    bool used;
+    double submitted;           //!< replay time of submission
+    uint8_t status;
+    char answer[ANSWER_SIZE];
+} pending_image;
+
+/**
+ * An image whose replayed result differs from the captured one.
+ */
+typedef struct {
+    uint64_t index;             //!< record in the capture file
+    uint64_t tag;               //!< captured tag
+    uint8_t capturedStatus, replayedStatus;
+    char captured[ANSWER_SIZE], replayed[ANSWER_SIZE];
+} difference;
+
+/**
+ * Growable array of latencies, in seconds.
+ */
+typedef struct {
+    double *values;
+    size_t count, capacity;
+} latencies;
+
+static void add_latency (latencies *l, double value)
+{
+    if (l->count == l->capacity) {
+        l->capacity = l->capacity ? 2 * l->capacity : 1024;
+        l->values = realloc(l->values, l->capacity * sizeof(double));
+        if (l->values == NULL) {
+            fprintf(stderr, "Not enough memory for latencies.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    l->values[l->count++] = value;
+}
+
+static int compare_doubles (const void *a, const void *b)
+{
+    double x = *(const double *) a, y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Print percentiles of latencies, in microseconds.
+ */
+static void print_latencies (const char *lane, const char *source, latencies *l)
+{
+    printf("%-12s %-8s %8zu", lane, source, l->count);
+    if (l->count == 0) {
+        printf("\n");
+        return;
+    }
+    qsort(l->values, l->count, sizeof(double), compare_doubles);
+    const double fractions[] = { 0.5, 0.9, 0.99, 0.999 };
+    for (int f=0; f < 4; f++) {
+        size_t rank = (size_t) ceil(fractions[f] * l->count);
+        printf(" %9.0f", l->values[rank > 0 ? rank - 1 : 0] * 1e6);
+    }
+    printf(" %9.0f\n", l->values[l->count - 1] * 1e6);
+}
+
+/**
+ * Returns a monotonic time in seconds.
+ */
+static double get_time (void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * State of a replay.
+ */
+typedef struct {
+    captcha_async *ctx;
+    pending_image pending[MAX_PENDING];
+    latencies replayed[ASYNC_NB_LANES];
+    difference *differences;
+    int maxDifferences;         //!< kept to be printed
+    uint64_t nbDifferences;
+    uint64_t harvested;
+} replay_state;
+
+/**
+ * Wait for results until a deadline, and compare them to the captured
+ * ones.
+ *
+ * \param deadline monotonic time, 0 to return after the first results
+ * \param indices record of each tag, modulo MAX_PENDING
+ */
+static void harvest_until (replay_state *state, double deadline, const uint64_t *indices)
+{
+    struct pollfd pfd = { .fd = captcha_async_fd(state->ctx), .events = POLLIN };
+    async_result results[64];
+
+    do {
+        double now = get_time();
+        int timeout = deadline == 0 ? -1 :
+                      deadline > now ? (int) ceil((deadline - now) * 1e3) : 0;
+        if (poll(&pfd, 1, timeout) <= 0) continue; // timeout or EINTR
+
+        int n = captcha_async_harvest(state->ctx, results, 64);
+        now = get_time();
+        for (int k=0; k < n; k++) {
+            async_result *result = &results[k];
+            pending_image *image = &state->pending[result->tag % MAX_PENDING];
+            add_latency(&state->replayed[result->lane], now - image->submitted);
+
+            if (result->status != image->status ||
+                (result->status == ASYNC_OK && strcmp(result->answer, image->answer) != 0)) {
+                if (state->nbDifferences < (uint64_t) state->maxDifferences) {
+                    difference *d = &state->differences[state->nbDifferences];
+                    d->index = result->tag;
+                    d->tag = indices[result->tag % MAX_PENDING];
+                    d->capturedStatus = image->status;
+                    d->replayedStatus = result->status;
+                    memcpy(d->captured, image->answer, ANSWER_SIZE);
+                    memcpy(d->replayed, result->answer, ANSWER_SIZE);
+                }
+                state->nbDifferences++;
+            }
+            image->used = false;
+        }
+        state->harvested += n;
+        if (deadline == 0 && n > 0) return;
+    } while (deadline == 0 || get_time() < deadline);
+} // end harvest_until()
+
+static int compare_differences (const void *a, const void *b)
+{
+    const difference *x = a, *y = b;
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+int main (int argc, char** argv)
+{
+    char usage_str[] = "Usage: %s [-s speed] [-a threads] [-d differences] model.net capture_file\n";
+
+    double speed = 1;
+    int nbThreads = 1;
+    int maxDifferences = 20;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:d:hs:")) != -1) {
+        switch (opt) {
+            case 's': speed = atof(optarg); break;
+            case 'a': nbThreads = atoi(optarg); break;
+            case 'd': maxDifferences = atoi(optarg); break;
+            case 'h':
+                printf(usage_str, argv[0]);
+                printf("\n"
+                  "Decode the images of a capture file again with a network, through\n"
+                  "the asynchronous decoder, and compare with the captured answers.\n"
+                  "-s replays at that many times the captured pace (default 1), 0 as\n"
+                  "fast as the decoder takes images.\n"
+                  "-a sets the decoding threads (default 1).\n"
+                  "-d prints that many differences at most (default 20).\n"
+                  "Latencies (microseconds) are from submission to harvest when\n"
+                  "replayed, from submission to result when captured.\n"
+                  "Exits with status 1 if any answer differs.\n");
+                exit(EXIT_SUCCESS);
+            default:
+                printf(usage_str, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 2 || speed < 0 || nbThreads < 1 || maxDifferences < 0) {
+        printf(usage_str, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *file = capture_read_open(argv[optind + 1]);
+    if (file == NULL) {
+        fprintf(stderr, "Cannot read capture file %s: %s.\n", argv[optind + 1],
+                errno == EINVAL ? "not a capture file of this build" : strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    model_holder *holder = model_holder_create(argv[optind]);
+    if (holder == NULL) {
+        fprintf(stderr, "Cannot create network from %s.\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    replay_state *state = calloc(1, sizeof(replay_state));
+    if (state == NULL) exit(EXIT_FAILURE);
+    state->ctx = captcha_async_create(holder, NULL, nbThreads, NULL);
+    state->maxDifferences = maxDifferences;
+    state->differences = malloc((maxDifferences + 1) * sizeof(difference));
+    if (state->ctx == NULL || state->differences == NULL) {
+        fprintf(stderr, "Cannot start asynchronous decoder.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    latencies captured[ASYNC_NB_LANES] = { { NULL, 0, 0 } };
+    uint64_t indices[MAX_PENDING];
+    capture_record record;
+    uint64_t nbRecords = 0, firstTime = 0, stalls = 0, invalid = 0;
+    double start = get_time();
+    while (fread(&record, sizeof(record), 1, file) == 1) {
+        if (record.lane >= ASYNC_NB_LANES ||
+            memchr(record.answer, '\0', ANSWER_SIZE) == NULL) {
+            invalid++;
+            continue;
+        }
+        uint64_t index = nbRecords++;
+        if (index == 0) firstTime = record.time;
+        add_latency(&captured[record.lane], record.latency / 1e6);
+
+        // Original pace: the offset from the first image, divided by speed
+        if (speed > 0 && record.time > firstTime) {
+            double due = start + (record.time - firstTime) / 1e6 / speed;
+            if (due > get_time()) harvest_until(state, due, indices);
+        }
+
+        pending_image *image = &state->pending[index % MAX_PENDING];
+        while (image->used) harvest_until(state, 0, indices);
+        image->used = true;
+        image->status = record.status;
+        memcpy(image->answer, record.answer, ANSWER_SIZE);
+        indices[index % MAX_PENDING] = record.tag;
+
+        image->submitted = get_time();
+        while (captcha_async_submit(state->ctx, record.lane, record.gray, IMG_SIZE, index) < 0) {
+            if (errno != EAGAIN) {
+                fprintf(stderr, "Cannot submit record %llu.\n", (unsigned long long) index);
+                exit(EXIT_FAILURE);
+            }
+            // The lane is full, as it would have been for the service
+            stalls++;
+            harvest_until(state, 0, indices);
+        }
+    } // end while
+    if (ferror(file)) {
+        fprintf(stderr, "Error reading capture file %s.\n", argv[optind + 1]);
+        exit(EXIT_FAILURE);
+    }
+    fclose(file);
+    while (state->harvested < nbRecords) harvest_until(state, 0, indices);
+    double elapsed = get_time() - start;
+
+    printf("%llu images replayed in %.2f s, %llu stalls on full lanes, %llu invalid records\n",
+           (unsigned long long) nbRecords, elapsed, (unsigned long long) stalls,
+           (unsigned long long) invalid);
+    printf("%-12s %-8s %8s %9s %9s %9s %9s %9s\n",
+           "lane", "", "images", "p50 us", "p90 us", "p99 us", "p99.9 us", "max us");
+    const char *lane_names[ASYNC_NB_LANES] = { "interactive", "bulk" };
+    for (int l=0; l < ASYNC_NB_LANES; l++) {
+        print_latencies(lane_names[l], "captured", &captured[l]);
+        print_latencies("", "replayed", &state->replayed[l]);
+        free(captured[l].values);
+        free(state->replayed[l].values);
+    }
+
+    int kept = state->nbDifferences < (uint64_t) maxDifferences ? state->nbDifferences : maxDifferences;
+    qsort(state->differences, kept, sizeof(difference), compare_differences);
+    for (int i=0; i < kept; i++) {
+        difference *d = &state->differences[i];
+        printf("differs: record %llu tag %llu captured %s \"%s\" replayed %s \"%s\"\n",
+               (unsigned long long) d->index, (unsigned long long) d->tag,
+               d->capturedStatus == ASYNC_OK ? "ok" : "failed", d->captured,
+               d->replayedStatus == ASYNC_OK ? "ok" : "failed", d->replayed);
+    }
+    printf("%llu differences\n", (unsigned long long) state->nbDifferences);
+
+    bool same = state->nbDifferences == 0;
+    captcha_async_destroy(state->ctx);
+    model_holder_destroy(holder);
+    free(state->differences);
+    free(state);
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+} // end main()
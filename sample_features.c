@@ -0,0 +1,102 @@
+/**
+ * \file
+ *
+ * \brief Main program (Training and test files from an archive)
+ *
+ * Reads the samples of a .tar or .tar.gz corpus as a stream, without
+ * extracting it, and prints the lines generate_train_file.sh and
+ * generate_test_file.sh append to knn_train.txt and knn_test.txt: for
+ * each symbol in reading order, a line with the values the segmenter
+ * prints after "CODED FEATURES" (without that prefix), then a line with
+ * the character.
+ *
+ * Members are text files written by remove_noise (as in
+ * samples/segmented/output/), or raw or PGM images. The answer of a
+ * sample is the start of its base name up to the first '_', as in
+ * "K3xb7_2.txt". Samples whose number of symbols differs from the length
+ * of their answer are skipped.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "captcha_common.h"
+#include "captcha_features.h"
+#include "captcha_tar.h"
+
+#define IMG_SIZE (IMG_WIDTH * IMG_HEIGHT) //!< Bytes per image
+
+int main (int argc, char** argv)
+{
+    char usage_str[] = "Usage: %s [-s train|test] corpus.tar[.gz]\n";
+
+    int sets = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "hs:")) != -1) {
+        switch (opt) {
+            case 's':
+                sets = strcmp(optarg, "train") == 0 ? SAMPLE_TRAIN :
+                       strcmp(optarg, "test") == 0 ? SAMPLE_TEST : -1;
+                break;
+            case 'h':
+                printf(usage_str, argv[0]);
+                printf("\n"
+                  "Print features and characters of the samples of an archive (\"-\"\n"
+                  "reads standard input). -s keeps training (_1 to _3) or test (_4 to\n"
+                  "_9) samples only, like generate_train_file.sh and\n"
+                  "generate_test_file.sh.\n");
+                exit(EXIT_SUCCESS);
+            default:
+                printf(usage_str, argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+    if (optind != argc - 1 || sets < 0) {
+        printf(usage_str, argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    tar_reader *tar = tar_open(argv[optind]);
+    if (tar == NULL) {
+        fprintf(stderr, "Error opening input file %s.\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+
+    uint8_t pixels[IMG_SIZE];
+    symbols_struct symbols;
+    char answer[CAPTCHA_ARR_SIZE + 1];
+    int nbSamples = 0, nbSkipped = 0;
+    tar_member member;
+    while (tar_next(tar, &member)) {
+        if (sets != 0 && (sample_sets(member.name) & sets) == 0) continue;
+
+        int nbGroups = tar_member_pixels(&member, pixels);
+        int length = sample_answer(member.name, answer);
+        if (nbGroups < 0 || length < 0) {
+            nbSkipped++;
+            continue;
+        }
+        extract_features(pixels, nbGroups, &symbols);
+        if (symbols.nbSymbols != length) {
+            nbSkipped++;
+            continue;
+        }
+
+        for (int i=0; i < symbols.nbSymbols; i++) {
+            print_features(stdout, symbols.features[symbols.order[i]]);
+            printf("\n%c\n", answer[i]);
+        }
+        nbSamples++;
+    } // end while
+
+    if (tar_error(tar)) {
+        fprintf(stderr, "Corrupt archive %s.\n", argv[optind]);
+        exit(EXIT_FAILURE);
+    }
+    tar_close(tar);
+
+    fprintf(stderr, "%d samples, %d skipped\n", nbSamples, nbSkipped);
+    return EXIT_SUCCESS;
+} // end main()
@@ -0,0 +1,32 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8
+
+"""Build the captcha_cari Python extension (make python_module)."""
+
+__author__ = 'Mathieu Clément'
+__version__ = '0.1'
+
+from setuptools import setup, Extension
+import numpy
+
+captcha_cari = Extension(
+    'captcha_cari',
+    sources=['captcha_cari_module.c',
+             'captcha_common.c',
+             'captcha_features.c',
+             'captcha_batch.c',
+             'captcha_decode.c',
+             'captcha_trace.c',
+             'captcha_glyph_cache.c',
+             'captcha_model.c',
+             'captcha_labels.c'],
+    define_macros=[('CAPTCHA_TRACE', None)],
+    include_dirs=[numpy.get_include()],
+    libraries=['fann', 'm', 'pthread'],
+    extra_compile_args=['-std=c99', '-O3'],
+)
+
+setup(name='captcha_cari',
+      version=__version__,
+      description='Captcha decoding and feature extraction',
+      ext_modules=[captcha_cari])